@@ -23,12 +23,17 @@ d := bin
 # Targets and intermediates in this directory
 objs_tuna := $(d)/tuna.o
 objs_tuna_fft_test := $(d)/tuna_fft_test.o
+objs_tuna_bufq_bench := $(d)/tuna_bufq_bench.o
+objs_tuna_simd_bench := $(d)/tuna_simd_bench.o
+objs_tuna_wisdom := $(d)/tuna_wisdom.o
 
-objs := $(objs_tuna) $(objs_tuna_fft_test)
+objs := $(objs_tuna) $(objs_tuna_fft_test) $(objs_tuna_bufq_bench) \
+	$(objs_tuna_simd_bench) $(objs_tuna_wisdom)
 
 deps := $(objs:%.o=%.d)
 
-tgts := $(d)/tuna $(d)/tuna_fft_test
+tgts := $(d)/tuna $(d)/tuna_fft_test $(d)/tuna_bufq_bench \
+	$(d)/tuna_simd_bench $(d)/tuna_wisdom
 
 TARGETS_BIN += $(tgts)
 
@@ -53,6 +58,20 @@ $(d)/tuna: $(objs_tuna)
 
 $(d)/tuna_fft_test: $(objs_tuna_fft_test)
 
+$(d)/tuna_bufq_bench: $(objs_tuna_bufq_bench)
+
+$(d)/tuna_simd_bench: $(objs_tuna_simd_bench)
+
+$(d)/tuna_wisdom: $(objs_tuna_wisdom)
+
+# Pre-plan all FFT lengths used at common sample rates and save the results to
+# fftw.wisdom in the build directory.
+.PHONY: wisdom
+wisdom: export LD_LIBRARY_PATH := libtuna
+wisdom: $(d)/tuna_wisdom
+	@echo WISDOM fftw.wisdom
+	$(Q)./$< fftw.wisdom
+
 .PHONY: install-bin
 install-bin: $(tgts)
 	@echo INSTALL $^
@@ -20,34 +20,79 @@
 
 #include <argp.h>
 #include <assert.h>
+#include <glob.h>
+#include <pthread.h>
 #include <signal.h>
 #include <sndfile.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "analysis.h"
+#include "buffer.h"
 #include "bufq.h"
 #include "consumer.h"
 #include "counter.h"
+#include "fft.h"
 #include "input_alsa.h"
 #include "input_sndfile.h"
+#include "input_wavmap.h"
 #include "input_zero.h"
 #include "log.h"
 #include "output_null.h"
 #include "output_sndfile.h"
 #include "producer.h"
 #include "pulse.h"
+#include "rt.h"
+#include "tee.h"
 #include "time_slice.h"
 
 #ifdef ENABLE_ADS1672
 #include "input_ads1672.h"
 #endif
 
+/* A complete chain of modules from one input to all outputs. A single run
+ * uses one pipeline, batch mode builds one for each input file.
+ */
+struct pipeline {
+	struct producer *	in;
+	struct consumer *	counter;
+	struct consumer *	bufq;
+	struct consumer *	out;
+	struct consumer *	tee;
+
+	/* If stem is set, it is prefixed to the name of every output file so
+	 * that each file in a batch gets its own results. Memory which must
+	 * live as long as the modules, such as the copies of the output
+	 * specifiers, output file names and pulse parameters, is listed in
+	 * allocs and freed by pipeline_exit().
+	 */
+	const char *		stem;
+	void **			allocs;
+	uint			n_allocs;
+
+	/* Files read in sequence by the sndfile input. */
+	glob_t			sequence;
+	const char *		source;
+
+	/* When every channel of the input is processed, each channel has a
+	 * pipeline of its own holding its outputs behind a queue, so that the
+	 * channels are processed in parallel.
+	 */
+	struct pipeline *	channels;
+	uint			n_channels;
+};
+
 /* Globals. */
-struct producer * in = NULL;
-struct consumer * counter = NULL;
-struct consumer * bufq = NULL;
-struct consumer * out = NULL;
+struct pipeline pl;
+
+/* Queue threads created so far and how many of them have been pinned to a CPU,
+ * for the real-time report.
+ */
+uint n_queue_threads;
+uint n_queue_pinned;
 
 /* Defaults. */
 const char * default_input = "alsa:hw:0";
@@ -62,21 +107,71 @@ const char * argp_program_bug_address = "https://bitbucket.org/underwater-acoust
 static char docstring[] = "Toolkit for Underwater Noise Analysis (TUNA)";
 
 static const struct argp_option options[] = {
-	{"input", 'i', "SOURCE", 0, "Configure input module", 0},
-	{"output", 'o', "SINK", 0, "Configure output module", 0},
+	{"input", 'i', "SOURCE", 0, "Configure input module. For sndfile input, SOURCE may be a directory, "
+		"a glob pattern or an '@'-prefixed manifest to read a sequence of files as one stream", 0},
+	{"output", 'o', "SINK", 0, "Configure output module, may be given more than once. "
+		"Prefix SINK with 'queue:' to run it on its own thread and drop data if it falls behind", 0},
 	{"sample-rate", 'r', "RATE", 0, "Set sample rate for input module if supported", 0},
-	{"bufq", 'q', "BOOL", OPTION_ARG_OPTIONAL, "Enable (BOOL=1) or disable (BOOL=0) buffer queueing", 0},
+	{"bufq", 'q', "MODE", OPTION_ARG_OPTIONAL, "Enable (MODE=1) or disable (MODE=0) buffer queueing, "
+		"or select the queue type (MODE=list or MODE=ring[:DEPTH])", 0},
 	{"count", 'c', "COUNT", 0, "Process only COUNT samples before exiting", 0},
+	{"arena", 'a', 0, 0, "Preallocate all sample buffers in locked memory", 0},
+	{"parallel", 'p', 0, 0, "Run each part of the analysis output on its own thread", 0},
+	{"jobs", 'j', "N", 0, "Process time slices on N worker threads", 0},
+	{"read-ahead", 'R', "DEPTH", 0, "Decode up to DEPTH buffers ahead of the analysis on a separate thread (sndfile input only)", 0},
+	{"sndfile-queue", 'Q', "DEPTH", 0, "Write sndfile output on a separate thread, queueing up to DEPTH buffers", 0},
+	{"mmap", 'm', 0, 0, "Convert samples straight from the capture device's buffer rather than reading them (alsa input only)", 0},
+	{"alsa-format", 'F', "FORMAT", 0, "Set capture format (auto, s32_le, s24_le, s24_3le, float_le or s16_le). "
+		"The default is auto, which uses the widest format the device supports (alsa input only)", 0},
+	{"alsa-channels", 'N', "N", 0, "Capture N channels, of which the first is analysed "
+		"unless every channel is processed (default 2, alsa input only)", 0},
+	{"alsa-period", 'P', "FRAMES", 0, "Set capture period size (default 4096, alsa input only)", 0},
+	{"alsa-stats", 'S', "FILE", 0, "Append capture statistics to FILE periodically and when capture stops (alsa input only)", 0},
+	{"alsa-stats-interval", 'T', "SECONDS", 0, "Set the interval between capture statistics, "
+		"or 0 to only write them when capture stops (default 60, alsa input only)", 0},
+	{"all-channels", 'C', 0, 0, "Process every channel of the input in parallel, each with its own outputs. "
+		"Output file names are prefixed with 'chN' for channel N (sndfile and alsa input only)", 0},
+	{"batch", 'b', "FILES", 0, "Process each file in a directory, a glob pattern or an '@'-prefixed manifest "
+		"with one path per line. Output file names are prefixed with the name of each input file", 0},
+	{"workers", 'W', "N", 0, "Process N files of a batch at once (default 1)", 0},
+	{"rt-priority", 'X', "PRIO", 0, "Run the producer thread under SCHED_FIFO at priority PRIO (1 to 99, not in batch mode)", 0},
+	{"cpus", 'A', "LIST", 0, "Pin the producer thread to the first CPU in the comma separated LIST and "
+		"each queue thread to the remaining CPUs in turn (not in batch mode)", 0},
+	{"mlock", 'L', 0, 0, "Lock all memory of the process into RAM once set up (not in batch mode)", 0},
+	{"fft-effort", 'e', "EFFORT", 0, "Set FFT planning effort (estimate, measure, patient or exhaustive)", 0},
+	{"wisdom", 'w', "FILE", 0, "Load and save FFTW wisdom in FILE, or disable wisdom if FILE is empty", 0},
 	{0, 0, 0, 0, 0, 0}
 };
 
 struct arguments {
 	char * input;
-	char * output;
+	char ** outputs;
+	uint n_outputs;
 	uint sample_rate;
 	int use_bufq;
+	enum bufq_modes bufq_mode;
+	uint bufq_depth;
 	uint count;
 	int use_count;
+	int use_arena;
+	int parallel;
+	uint jobs;
+	uint read_ahead;
+	uint sndfile_queue;
+	int alsa_mmap;
+	enum input_alsa_formats alsa_format;
+	uint alsa_channels;
+	uint alsa_period;
+	char * alsa_stats;
+	uint alsa_stats_interval;
+	int all_channels;
+	int rt_priority;
+	int * cpus;
+	uint n_cpus;
+	int mlock;
+	char * batch;
+	uint workers;
+	int input_given;
 };
 
 struct arguments * args_init()
@@ -98,26 +193,114 @@ struct arguments * args_init()
 		return NULL;
 	}
 
-	args->output = strdup(default_output);
-	if (!args->output) {
-		error("tuna: Failed to allocate memory for default output specifier");
-		return NULL;
-	}
+	/* The default output is only used if no '-o' arguments are given. */
+	args->outputs = NULL;
+	args->n_outputs = 0;
 
 	args->sample_rate = 44100;
 	args->use_bufq = 0;
+	args->bufq_mode = BUFQ_MODE_LIST;
+	args->bufq_depth = 0;
 	args->use_count = 0;
+	args->use_arena = 0;
+	args->parallel = 0;
+	args->jobs = 0;
+	args->read_ahead = 0;
+	args->sndfile_queue = 0;
+	args->alsa_mmap = 0;
+	args->alsa_format = INPUT_ALSA_FORMAT_AUTO;
+	args->alsa_channels = 2;
+	args->alsa_period = 4096;
+	args->alsa_stats = NULL;
+	args->alsa_stats_interval = 60;
+	args->all_channels = 0;
+	args->rt_priority = 0;
+	args->cpus = NULL;
+	args->n_cpus = 0;
+	args->mlock = 0;
+	args->batch = NULL;
+	args->workers = 1;
+	args->input_given = 0;
 
 	return args;
 }
 
 void args_exit(struct arguments * args)
 {
+	uint i;
+
 	free(args->input);
-	free(args->output);
+	free(args->batch);
+	free(args->cpus);
+	free(args->alsa_stats);
+	for (i = 0; i < args->n_outputs; i++)
+		free(args->outputs[i]);
+	free(args->outputs);
 	free(args);
 }
 
+int args_add_output(struct arguments * args, const char * spec)
+{
+	assert(args);
+	assert(spec);
+
+	char ** outputs;
+
+	outputs = (char **) realloc(args->outputs,
+			(args->n_outputs + 1) * sizeof(char *));
+	if (!outputs)
+		return -ENOMEM;
+	args->outputs = outputs;
+
+	args->outputs[args->n_outputs] = strdup(spec);
+	if (!args->outputs[args->n_outputs])
+		return -ENOMEM;
+	args->n_outputs++;
+
+	return 0;
+}
+
+/* Parse a comma separated list of CPU numbers. */
+int args_parse_cpus(struct arguments * args, const char * list)
+{
+	assert(args);
+	assert(list);
+
+	int * cpus;
+	uint n;
+	const char * p;
+	char * end;
+
+	/* One more CPU than there are commas. */
+	n = 1;
+	for (p = list; *p; p++)
+		if (*p == ',')
+			n++;
+
+	cpus = (int *) malloc(n * sizeof(int));
+	if (!cpus)
+		return -ENOMEM;
+
+	p = list;
+	for (n = 0; ; n++) {
+		cpus[n] = (int) strtol(p, &end, 10);
+		if (end == p || cpus[n] < 0 || (*end && *end != ',')) {
+			free(cpus);
+			return -EINVAL;
+		}
+
+		if (!*end)
+			break;
+		p = end + 1;
+	}
+
+	free(args->cpus);
+	args->cpus = cpus;
+	args->n_cpus = n + 1;
+
+	return 0;
+}
+
 /* Split a string of the form "a:b" so that param just contains "a" and "b" is
  * returned.
  */
@@ -141,6 +324,9 @@ static error_t parse(int key, char * param, struct argp_state * state)
 	assert(state);
 
 	struct arguments * args = (struct arguments *)state->input;
+	char * depth;
+	char * end;
+	enum fft_efforts effort;
 
 	switch (key) {
 	    case 'i':
@@ -151,13 +337,12 @@ static error_t parse(int key, char * param, struct argp_state * state)
 			error("tuna: Failed to allocate memory to handle input argument");
 			return -ENOMEM;
 		}
+		args->input_given = 1;
 		break;
 
 	    case 'o':
-		/* Replace default/previous output specifier. */
-		free(args->output);
-		args->output = strdup(param);
-		if (!args->output) {
+		/* Add to the list of output specifiers. */
+		if (args_add_output(args, param) < 0) {
 			error("tuna: Failed to allocate memory to handle output argument");
 			return -ENOMEM;
 		}
@@ -168,10 +353,25 @@ static error_t parse(int key, char * param, struct argp_state * state)
 		break;
 
 	    case 'q':
-		if (param)
-			args->use_bufq = (int) strtol(param, NULL, 10);
-		else
+		if (!param) {
+			args->use_bufq = 1;
+		} else if (strcmp(param, "ring") == 0 ||
+				strncmp(param, "ring:", 5) == 0) {
+			args->use_bufq = 1;
+			args->bufq_mode = BUFQ_MODE_RING;
+			depth = split_param(param);
+			if (depth)
+				args->bufq_depth = (uint) strtoul(depth, NULL, 10);
+		} else if (strcmp(param, "list") == 0) {
 			args->use_bufq = 1;
+			args->bufq_mode = BUFQ_MODE_LIST;
+		} else {
+			args->use_bufq = (int) strtol(param, &end, 10);
+			if (end == param || *end) {
+				error("tuna: Unknown queue mode %s", param);
+				return -EINVAL;
+			}
+		}
 		break;
 
 	    case 'c':
@@ -179,6 +379,105 @@ static error_t parse(int key, char * param, struct argp_state * state)
 		args->use_count = 1;
 		break;
 
+	    case 'a':
+		args->use_arena = 1;
+		break;
+
+	    case 'p':
+		args->parallel = 1;
+		break;
+
+	    case 'j':
+		args->jobs = (uint) strtoul(param, NULL, 10);
+		break;
+
+	    case 'R':
+		args->read_ahead = (uint) strtoul(param, NULL, 10);
+		break;
+
+	    case 'Q':
+		args->sndfile_queue = (uint) strtoul(param, NULL, 10);
+		break;
+
+	    case 'm':
+		args->alsa_mmap = 1;
+		break;
+
+	    case 'F':
+		if (input_alsa_parse_format(param, &args->alsa_format) < 0) {
+			error("tuna: Unknown capture format %s", param);
+			return -EINVAL;
+		}
+		break;
+
+	    case 'N':
+		args->alsa_channels = (uint) strtoul(param, NULL, 10);
+		break;
+
+	    case 'P':
+		args->alsa_period = (uint) strtoul(param, NULL, 10);
+		break;
+
+	    case 'S':
+		free(args->alsa_stats);
+		args->alsa_stats = strdup(param);
+		if (!args->alsa_stats) {
+			error("tuna: Failed to allocate memory to handle statistics argument");
+			return -ENOMEM;
+		}
+		break;
+
+	    case 'T':
+		args->alsa_stats_interval = (uint) strtoul(param, NULL, 10);
+		break;
+
+	    case 'C':
+		args->all_channels = 1;
+		break;
+
+	    case 'X':
+		args->rt_priority = (int) strtol(param, NULL, 10);
+		break;
+
+	    case 'A':
+		if (args_parse_cpus(args, param) < 0) {
+			error("tuna: Invalid CPU list %s", param);
+			return -EINVAL;
+		}
+		break;
+
+	    case 'L':
+		args->mlock = 1;
+		break;
+
+	    case 'b':
+		free(args->batch);
+		args->batch = strdup(param);
+		if (!args->batch) {
+			error("tuna: Failed to allocate memory to handle batch argument");
+			return -ENOMEM;
+		}
+		break;
+
+	    case 'W':
+		args->workers = (uint) strtoul(param, NULL, 10);
+		if (!args->workers)
+			args->workers = 1;
+		break;
+
+	    case 'e':
+		if (fft_parse_effort(param, &effort) < 0) {
+			error("tuna: Unknown FFT planning effort %s", param);
+			return -EINVAL;
+		}
+		fft_set_effort(effort);
+		break;
+
+	    case 'w':
+		if (fft_set_wisdom_path(param[0] ? param : NULL) < 0)
+			return -ENOMEM;
+		break;
+
 	    default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -189,17 +488,16 @@ static error_t parse(int key, char * param, struct argp_state * state)
 static struct argp argp = {options, parse, NULL, docstring, NULL, NULL, NULL};
 
 /* Callback function for '-c' argument: called when the given number of samples
- * have passed through the counter module.
+ * have passed through the counter module of the pipeline given in arg.
  */
 int count_callback(void * arg)
 {
-	__unused(arg);
-
+	struct pipeline * p = (struct pipeline *) arg;
 	int r;
 
 	msg("tuna: Terminating as requested sample count has been reached");
 
-	r = producer_stop(in, 0);
+	r = producer_stop(p->in, 0);
 	if (r < 0)
 		fatal("tuna: Failed to stop input module");
 
@@ -229,125 +527,568 @@ struct pulse_params * pulse_params_init()
 	return params;
 }
 
-int output_init(struct arguments * args)
+/* Keep an allocation until pipeline_exit(). Returns ptr, or NULL if ptr is NULL
+ * or can't be kept, in which case it is freed.
+ */
+void * pipeline_keep(struct pipeline * p, void * ptr)
+{
+	assert(p);
+
+	void ** allocs;
+
+	if (!ptr)
+		return NULL;
+
+	allocs = (void **) realloc(p->allocs,
+			(p->n_allocs + 1) * sizeof(void *));
+	if (!allocs) {
+		free(ptr);
+		return NULL;
+	}
+	p->allocs = allocs;
+	p->allocs[p->n_allocs++] = ptr;
+
+	return ptr;
+}
+
+/* Get the name to use for an output file of the pipeline. Without a stem this
+ * is just the sink given by the user. With a stem, the stem is inserted in
+ * front of the last path component of the sink so "out/results.csv" becomes
+ * "out/STEM-results.csv".
+ */
+char * pipeline_sink_name(struct pipeline * p, char * sink)
+{
+	assert(p);
+
+	char * name;
+	const char * base;
+	size_t len, dir_len;
+
+	if (!p->stem || !sink)
+		return sink;
+
+	base = strrchr(sink, '/');
+	base = base ? base + 1 : sink;
+	dir_len = (size_t)(base - sink);
+
+	len = strlen(sink) + strlen(p->stem) + 2;
+	name = (char *) malloc(len);
+	if (!name) {
+		error("tuna: Failed to allocate memory for output file name");
+		return NULL;
+	}
+	snprintf(name, len, "%.*s%s-%s", (int) dir_len, sink, p->stem, base);
+
+	return (char *) pipeline_keep(p, name);
+}
+
+/* Pick the CPU for the next queue thread from those following the producer's
+ * CPU in '-A', taking each in turn. Returns -1 if the thread shouldn't be
+ * pinned.
+ */
+int next_queue_cpu(struct arguments * args)
 {
 	assert(args);
 
-	char * sink = split_param(args->output);
+	uint n;
+
+	/* Batch mode ignores the real-time options. */
+	if (args->batch)
+		return -1;
+
+	n = n_queue_threads++;
+	if (args->n_cpus < 2)
+		return -1;
+
+	return args->cpus[1 + n % (args->n_cpus - 1)];
+}
+
+void pin_queue(struct arguments * args, struct consumer * bufq)
+{
+	int cpu = next_queue_cpu(args);
+
+	if (cpu >= 0 && bufq_set_cpu(bufq, cpu) >= 0)
+		n_queue_pinned++;
+}
+
+void pin_branch(struct arguments * args, struct consumer * tee, uint index)
+{
+	int cpu = next_queue_cpu(args);
+
+	if (cpu >= 0 && tee_set_branch_cpu(tee, index, cpu) >= 0)
+		n_queue_pinned++;
+}
+
+/* Create a single output consumer from a specifier of the form
+ * "module:params". A copy of the specifier is kept by the pipeline and
+ * modified during parsing.
+ */
+struct consumer * output_create(struct pipeline * p, struct arguments * args,
+		const char * output)
+{
+	assert(p);
+	assert(args);
+	assert(output);
+
+	struct consumer * c;
+	char * spec;
+	char * sink;
 	int format;
 	uint max_samples_per_file;
 	int r;
 
-	out = consumer_new();
-	if (!out) {
+	spec = (char *) pipeline_keep(p, strdup(output));
+	if (!spec) {
+		error("tuna: Failed to allocate memory for output specifier");
+		return NULL;
+	}
+	sink = split_param(spec);
+
+	c = consumer_new();
+	if (!c) {
 		error("tune: Failed to create consumer object");
-		return -1;
+		return NULL;
 	}
 
-	if (strcmp(args->output, "time_slice") == 0) {
-		r = time_slice_init(out, sink, TUNA_OUT_MODE_CSV);
-	} else if (strcmp(args->output, "pulse") == 0) {
+	if (strcmp(spec, "time_slice") == 0) {
+		sink = pipeline_sink_name(p, sink);
+		if (!sink)
+			return NULL;
+
+		if (args->jobs)
+			r = time_slice_init_parallel(c, sink, TUNA_OUT_MODE_CSV,
+					args->jobs);
+		else
+			r = time_slice_init(c, sink, TUNA_OUT_MODE_CSV);
+	} else if (strcmp(spec, "pulse") == 0) {
 		struct pulse_params * params;
 
-		params = pulse_params_init();
+		sink = pipeline_sink_name(p, sink);
+		if (!sink)
+			return NULL;
+
+		params = (struct pulse_params *)
+			pipeline_keep(p, pulse_params_init());
 		if (!params)
-			return -1;
+			return NULL;
 
-		r = pulse_init(out, sink, params);
-	} else if (strcmp(args->output, "analysis") == 0) {
+		r = pulse_init(c, sink, params);
+	} else if (strcmp(spec, "analysis") == 0) {
 		struct pulse_params * params;
 		char * pulse_sink, * time_slice_sink;
 
-		params = pulse_params_init();
-		if (!params)
-			return -1;
-
-
 		/* Split parameter again to get two sink files. */
 		pulse_sink = sink;
 		time_slice_sink = split_param(sink);
 
-		r = analysis_init(out, pulse_sink, time_slice_sink, params);
-	} else if (strcmp(args->output, "sndfile") == 0) {
+		pulse_sink = pipeline_sink_name(p, pulse_sink);
+		time_slice_sink = pipeline_sink_name(p, time_slice_sink);
+		if (!pulse_sink || !time_slice_sink)
+			return NULL;
+
+		params = (struct pulse_params *)
+			pipeline_keep(p, pulse_params_init());
+		if (!params)
+			return NULL;
+
+		if (args->parallel)
+			r = analysis_init_parallel(c, pulse_sink,
+					time_slice_sink, params);
+		else
+			r = analysis_init(c, pulse_sink, time_slice_sink,
+					params);
+	} else if (strcmp(spec, "sndfile") == 0) {
+		sink = pipeline_sink_name(p, sink);
+		if (!sink)
+			return NULL;
+
 		/* TODO: These should be configurable. */
 		format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
 		max_samples_per_file = 60 * 60 * args->sample_rate; /* One hour. */
 
-		r = output_sndfile_init(out, sink, ".wav", format,
-				max_samples_per_file);
-	} else if (strcmp(args->output, "null") == 0) {
-		r = output_null_init(out);
+		r = output_sndfile_init_async(c, sink, ".wav", format,
+				max_samples_per_file, args->sndfile_queue);
+	} else if (strcmp(spec, "null") == 0) {
+		r = output_null_init(c);
 	} else {
-		error("tuna: Unknown output module %s", args->output);
-		return -EINVAL;
+		error("tuna: Unknown output module %s", spec);
+		return NULL;
+	}
+
+	if (r < 0) {
+		error("tuna: Failed to initialise %s output", spec);
+		return NULL;
+	}
+
+	return c;
+}
+
+int output_init(struct pipeline * p, struct arguments * args)
+{
+	assert(p);
+	assert(args);
+
+	struct consumer * c;
+	const char * spec;
+	uint i;
+	int queued;
+	int r;
+
+	/* A single unqueued output is used directly, anything else needs a tee
+	 * to fan out the data.
+	 */
+	if (args->n_outputs == 1 && strncmp(args->outputs[0], "queue:", 6)) {
+		p->out = output_create(p, args, args->outputs[0]);
+		return p->out ? 0 : -1;
 	}
 
+	p->tee = consumer_new();
+	if (!p->tee) {
+		error("tuna: Failed to create consumer object for tee");
+		return -1;
+	}
+
+	r = tee_init(p->tee);
 	if (r < 0) {
-		error("tuna: Failed to initialise %s output", args->output);
+		error("tuna: Failed to initialise tee module");
 		return r;
 	}
+	p->out = p->tee;
+
+	for (i = 0; i < args->n_outputs; i++) {
+		spec = args->outputs[i];
+		queued = (strncmp(spec, "queue:", 6) == 0);
+		if (queued)
+			spec += 6;
+
+		c = output_create(p, args, spec);
+		if (!c)
+			return -1;
+
+		r = tee_add_branch(p->tee, c, queued, 0);
+		if (r < 0) {
+			error("tuna: Failed to add %s output to tee", spec);
+			return r;
+		}
+
+		if (queued)
+			pin_branch(args, p->tee, (uint) r);
+	}
+
+	return 0;
+}
+
+/* Read a list of files into gl. The spec may name a directory, a manifest file
+ * if prefixed with '@' or be a glob pattern. Returns the number of files found
+ * or <0 on error.
+ */
+int find_files(const char * spec, glob_t * gl)
+{
+	assert(spec);
+	assert(gl);
+
+	FILE * f;
+	char line[4096];
+	char * pattern;
+	size_t len;
+	struct stat st;
+	int flags = 0;
+	int r;
+
+	memset(gl, 0, sizeof(glob_t));
+
+	if (spec[0] == '@') {
+		/* Add each line of the manifest literally, skipping blank lines
+		 * and comments. GLOB_NOCHECK returns the pattern itself when
+		 * nothing matches and GLOB_NOESCAPE stops backslashes being
+		 * interpreted, so this also works for paths which contain
+		 * glob metacharacters.
+		 */
+		f = fopen(spec + 1, "r");
+		if (!f) {
+			error("tuna: Failed to open manifest %s", spec + 1);
+			return -errno;
+		}
+
+		while (fgets(line, sizeof(line), f)) {
+			len = strcspn(line, "\r\n");
+			line[len] = '\0';
+			if (len == 0 || line[0] == '#')
+				continue;
+
+			r = glob(line, flags | GLOB_NOCHECK | GLOB_NOESCAPE
+					| GLOB_NOSORT, NULL, gl);
+			if (r != 0) {
+				error("tuna: Failed to add %s to file list", line);
+				fclose(f);
+				globfree(gl);
+				return -ENOMEM;
+			}
+			flags = GLOB_APPEND;
+		}
+
+		fclose(f);
+		return (int) gl->gl_pathc;
+	}
+
+	if (stat(spec, &st) == 0 && S_ISDIR(st.st_mode)) {
+		len = strlen(spec) + 3;
+		pattern = (char *) malloc(len);
+		if (!pattern) {
+			error("tuna: Failed to allocate memory for file pattern");
+			return -ENOMEM;
+		}
+		snprintf(pattern, len, "%s/*", spec);
+		r = glob(pattern, 0, NULL, gl);
+		free(pattern);
+	} else {
+		r = glob(spec, 0, NULL, gl);
+	}
+
+	if (r == GLOB_NOMATCH)
+		return 0;
+	if (r != 0) {
+		error("tuna: Failed to find files matching %s", spec);
+		return -EIO;
+	}
+
+	return (int) gl->gl_pathc;
+}
+
+/* Check whether an input source names a list of files rather than one file. */
+int is_file_list(const char * source)
+{
+	assert(source);
+
+	struct stat st;
+
+	if (source[0] == '@')
+		return 1;
+
+	if (stat(source, &st) == 0)
+		return S_ISDIR(st.st_mode);
+
+	return strpbrk(source, "*?[") != NULL;
+}
+
+/* Returns the number of channels in the named sound file or <0 on error. */
+int file_channels(const char * path)
+{
+	assert(path);
+
+	SNDFILE * sf;
+	SF_INFO sf_info;
+
+	memset(&sf_info, 0, sizeof(sf_info));
+	sf = sf_open(path, SFM_READ, &sf_info);
+	if (!sf) {
+		error("tuna: Failed to open %s: %s", path, sf_strerror(NULL));
+		return -EIO;
+	}
+	sf_close(sf);
+
+	return sf_info.channels;
+}
+
+/* Build a chain of outputs behind a queue for each of n channels of the named
+ * input. The output files of channel N are prefixed with "chN".
+ */
+int channels_init(struct pipeline * p, struct arguments * args,
+		const char * name, uint n)
+{
+	assert(p);
+	assert(args);
+	assert(name);
+
+	struct pipeline * ch;
+	char * stem;
+	size_t len;
+	uint i;
+	int r;
+
+	p->channels = (struct pipeline *) calloc(n, sizeof(struct pipeline));
+	if (!p->channels) {
+		error("tuna: Failed to allocate memory for channels");
+		return -ENOMEM;
+	}
+	p->n_channels = n;
+
+	for (i = 0; i < n; i++) {
+		ch = &p->channels[i];
+
+		len = (p->stem ? strlen(p->stem) + 1 : 0) + 16;
+		stem = (char *) malloc(len);
+		if (!stem) {
+			error("tuna: Failed to allocate memory for output file stem");
+			return -ENOMEM;
+		}
+		if (p->stem)
+			snprintf(stem, len, "%s-ch%u", p->stem, i);
+		else
+			snprintf(stem, len, "ch%u", i);
+		ch->stem = (const char *) pipeline_keep(ch, stem);
+		if (!ch->stem)
+			return -ENOMEM;
+
+		r = output_init(ch, args);
+		if (r < 0)
+			return r;
+
+		ch->bufq = consumer_new();
+		if (!ch->bufq) {
+			error("tuna: Failed to create consumer object for bufq");
+			return -1;
+		}
+
+		r = bufq_init_mode(ch->bufq, ch->out, args->bufq_mode,
+				args->bufq_depth);
+		if (r < 0) {
+			error("tuna: Failed to initialise bufq module");
+			return r;
+		}
+		pin_queue(args, ch->bufq);
+	}
 
+	msg("tuna: Processing %u channels of %s", n, name);
 	return 0;
 }
 
-int input_init(struct arguments * args)
+/* The input module name in args->input has already been split from its
+ * source.
+ */
+int input_init(struct pipeline * p, struct arguments * args,
+		const char * source)
 {
+	assert(p);
 	assert(args);
 
-	char * source = split_param(args->input);
 	int r;
+	uint i, n_targets;
+	struct input_alsa_params alsa_params;
+	const char * const * sources = NULL;
+	uint n_sources = 0;
 	struct consumer * target;
+	struct consumer ** targets;
 
-	target = out;
+	target = p->out;
+	targets = &target;
+	n_targets = 1;
 
-	if (args->use_bufq) {
-		bufq = consumer_new();
-		if (!bufq) {
+	/* The sndfile input reads either one file or a list of files. */
+	if (strcmp(args->input, "sndfile") == 0) {
+		if (!source) {
+			error("tuna: No file given for sndfile input");
+			return -EINVAL;
+		}
+
+		if (is_file_list(source)) {
+			r = find_files(source, &p->sequence);
+			if (r < 0)
+				return r;
+			if (r == 0) {
+				error("tuna: No files found for input %s",
+						source);
+				return -ENOENT;
+			}
+			sources = (const char * const *) p->sequence.gl_pathv;
+			n_sources = (uint) r;
+		} else {
+			p->source = source;
+			sources = &p->source;
+			n_sources = 1;
+		}
+	}
+
+	if (args->all_channels) {
+		if (sources) {
+			r = file_channels(sources[0]);
+			if (r < 0)
+				return r;
+			n_targets = (uint) r;
+		} else if (strcmp(args->input, "alsa") == 0) {
+			n_targets = args->alsa_channels;
+		} else {
+			error("tuna: Processing all channels requires sndfile or alsa input");
+			return -EINVAL;
+		}
+
+		r = channels_init(p, args, sources ? sources[0] : source,
+				n_targets);
+		if (r < 0)
+			return r;
+
+		targets = (struct consumer **) pipeline_keep(p,
+				malloc(n_targets * sizeof(struct consumer *)));
+		if (!targets) {
+			error("tuna: Failed to allocate memory for channels");
+			return -ENOMEM;
+		}
+		for (i = 0; i < n_targets; i++)
+			targets[i] = p->channels[i].bufq;
+	} else if (args->use_bufq) {
+		p->bufq = consumer_new();
+		if (!p->bufq) {
 			error("tuna: Failed to create consumer object for bufq");
 			return -1;
 		}
 
-		r = bufq_init(bufq, target);
+		r = bufq_init_mode(p->bufq, target, args->bufq_mode,
+				args->bufq_depth);
 		if (r < 0) {
 			error("tuna: Failed to initialise bufq module");
 			return r;
 		}
+		pin_queue(args, p->bufq);
 
-		target = bufq;
+		target = p->bufq;
 	}
 
+	/* When every channel is processed, samples are counted on the first.
+	 */
 	if (args->use_count) {
-		counter = consumer_new();
-		if (!counter) {
+		p->counter = consumer_new();
+		if (!p->counter) {
 			error("tuna: Failed to create consumer object for counter");
 			return -1;
 		}
 
-		r = counter_init(counter, target, args->count, count_callback,
-				NULL);
+		r = counter_init(p->counter, targets[0], args->count,
+				count_callback, p);
 		if (r < 0) {
 			error("tuna: Failed to initialise counter module");
 			return r;
 		}
 
-		target = counter;
+		targets[0] = p->counter;
 	}
 
-	in = producer_new();
-	if (!in) {
+	p->in = producer_new();
+	if (!p->in) {
 		error("tuna: Failed to create producer object");
 		return -1;
 	}
 
-	if (strcmp(args->input, "sndfile") == 0)
-		r = input_sndfile_init(in, target, source);
-	else if (strcmp(args->input, "alsa") == 0)
-		r = input_alsa_init(in, target, source, args->sample_rate);
+	if (sources)
+		r = input_sndfile_init_channels(p->in, targets, n_targets,
+				sources, n_sources, args->read_ahead);
+	else if (strcmp(args->input, "wavmap") == 0)
+		r = input_wavmap_init(p->in, target, source);
+	else if (strcmp(args->input, "alsa") == 0) {
+		alsa_params.sample_rate = args->sample_rate;
+		alsa_params.use_mmap = args->alsa_mmap;
+		alsa_params.format = args->alsa_format;
+		alsa_params.channels = args->alsa_channels;
+		alsa_params.period_size = args->alsa_period;
+		alsa_params.stats_path = args->alsa_stats;
+		alsa_params.stats_interval = args->alsa_stats_interval;
+		r = input_alsa_init_channels(p->in, targets, n_targets,
+				source, &alsa_params);
+	}
 	else if (strcmp(args->input, "zero") == 0)
-		r = input_zero_init(in, target, args->sample_rate);
+		r = input_zero_init(p->in, target, args->sample_rate);
 #ifdef ENABLE_ADS1672
 	else if (strcmp(args->input, "ads1672") == 0)
-		r = input_ads1672_init(in, target, args->sample_rate);
+		r = input_ads1672_init(p->in, target, args->sample_rate);
 #endif
 	else {
 		error("tuna: Unknown input module %s", args->input);
@@ -362,20 +1103,435 @@ int input_init(struct arguments * args)
 	return 0;
 }
 
-void input_exit()
+void input_exit(struct pipeline * p)
+{
+	assert(p);
+
+	if (p->in)
+		producer_exit(p->in);
+	if (p->bufq)
+		consumer_exit(p->bufq);
+	if (p->counter)
+		consumer_exit(p->counter);
+	p->in = NULL;
+	p->bufq = NULL;
+	p->counter = NULL;
+}
+
+/* Report any data dropped by queued outputs. */
+void output_stats(struct pipeline * p)
+{
+	assert(p);
+
+	uint i, n;
+	struct bufq_stats stats;
+
+	for (i = 0; i < p->n_channels; i++)
+		output_stats(&p->channels[i]);
+
+	if (!p->tee)
+		return;
+
+	n = tee_get_branch_count(p->tee);
+	for (i = 0; i < n; i++) {
+		tee_get_branch_stats(p->tee, i, &stats);
+		msg("tuna: Output %u: max backlog %u, dropped %llu buffers "
+				"(%llu samples)", i, stats.max_backlog,
+				stats.dropped_buffers, stats.dropped_samples);
+	}
+}
+
+void output_exit(struct pipeline * p)
 {
-	if (in)
-		producer_exit(in);
-	if (bufq)
-		consumer_exit(bufq);
-	if (counter)
-		consumer_exit(counter);
+	assert(p);
+
+	if (p->out)
+		consumer_exit(p->out);
+	p->out = NULL;
+	p->tee = NULL;
 }
 
-void output_exit()
+void pipeline_exit(struct pipeline * p)
 {
-	if (out)
-		consumer_exit(out);
+	assert(p);
+
+	uint i;
+
+	input_exit(p);
+
+	for (i = 0; i < p->n_channels; i++)
+		pipeline_exit(&p->channels[i]);
+	free(p->channels);
+	p->channels = NULL;
+	p->n_channels = 0;
+
+	output_exit(p);
+
+	for (i = 0; i < p->n_allocs; i++)
+		free(p->allocs[i]);
+	free(p->allocs);
+	p->allocs = NULL;
+	p->n_allocs = 0;
+
+	globfree(&p->sequence);
+	memset(&p->sequence, 0, sizeof(p->sequence));
+}
+
+/*******************************************************************************
+	Batch processing
+*******************************************************************************/
+
+/* Result of processing one file of a batch. */
+struct batch_file {
+	const char *		path;
+	int			r;
+	int			stopped;
+	double			duration;
+	double			elapsed;
+};
+
+/* Shared state of a batch. Each worker takes the next unprocessed file until
+ * none remain. The producers of the pipelines currently running are kept in
+ * running[] so that they can all be stopped on SIGTERM. The mutex protects
+ * next, running[] and stop.
+ */
+struct batch {
+	struct arguments *	args;
+	struct batch_file *	files;
+	uint			n_files;
+	uint			next;
+	struct producer **	running;
+	int			stop;
+	int			done;
+	pthread_mutex_t		mutex;
+};
+
+/* Arguments for one worker thread. */
+struct batch_worker {
+	struct batch *		batch;
+	uint			index;
+	pthread_t		thread;
+};
+
+static double elapsed(struct timespec * start, struct timespec * end)
+{
+	return (double)(end->tv_sec - start->tv_sec) +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Get the name of a file without its directory or extension, which is used as
+ * the stem of its output files.
+ */
+char * batch_stem(const char * path)
+{
+	assert(path);
+
+	const char * base;
+	char * stem, * ext;
+
+	base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+
+	stem = strdup(base);
+	if (!stem)
+		return NULL;
+
+	ext = strrchr(stem, '.');
+	if (ext && ext != stem)
+		*ext = '\0';
+
+	return stem;
+}
+
+/* Process one file of a batch on a pipeline of its own. */
+int batch_process(struct batch * b, uint worker, struct batch_file * bf)
+{
+	assert(b);
+	assert(bf);
+
+	struct pipeline p;
+	struct timespec start, end;
+	SNDFILE * sf;
+	SF_INFO sf_info;
+	int r;
+
+	/* Find the length of the recording so that we can give a realtime
+	 * factor. Both input modules used in batch mode handle files which
+	 * libsndfile can open.
+	 */
+	memset(&sf_info, 0, sizeof(sf_info));
+	sf = sf_open(bf->path, SFM_READ, &sf_info);
+	if (!sf) {
+		error("tuna: Failed to open %s: %s", bf->path, sf_strerror(NULL));
+		return -EIO;
+	}
+	bf->duration = (double) sf_info.frames / sf_info.samplerate;
+	if (b->args->use_count && b->args->count < sf_info.frames)
+		bf->duration = (double) b->args->count / sf_info.samplerate;
+	sf_close(sf);
+
+	memset(&p, 0, sizeof(p));
+	p.stem = (const char *) pipeline_keep(&p, batch_stem(bf->path));
+	if (!p.stem) {
+		error("tuna: Failed to allocate memory for output file stem");
+		return -ENOMEM;
+	}
+
+	/* Outputs are built for each channel by input_init() if every channel
+	 * is processed.
+	 */
+	if (!b->args->all_channels) {
+		r = output_init(&p, b->args);
+		if (r < 0)
+			goto out;
+	}
+
+	r = input_init(&p, b->args, bf->path);
+	if (r < 0)
+		goto out;
+
+	pthread_mutex_lock(&b->mutex);
+	if (b->stop) {
+		pthread_mutex_unlock(&b->mutex);
+		r = -EINTR;
+		goto out;
+	}
+	b->running[worker] = p.in;
+	pthread_mutex_unlock(&b->mutex);
+
+	msg("tuna: Worker %u processing %s", worker, bf->path);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	r = producer_run(p.in);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	bf->elapsed = elapsed(&start, &end);
+
+	/* Once the producer is removed from running[] it can't be stopped by
+	 * the signal thread, so it is then safe to destroy.
+	 */
+	pthread_mutex_lock(&b->mutex);
+	b->running[worker] = NULL;
+	bf->stopped = b->stop;
+	pthread_mutex_unlock(&b->mutex);
+
+	output_stats(&p);
+
+out:
+	pipeline_exit(&p);
+	return r;
+}
+
+void * batch_worker_thread(void * arg)
+{
+	struct batch_worker * w = (struct batch_worker *) arg;
+	struct batch * b = w->batch;
+	struct batch_file * bf;
+	uint i;
+
+	while (1) {
+		pthread_mutex_lock(&b->mutex);
+		if (b->stop || b->next == b->n_files) {
+			pthread_mutex_unlock(&b->mutex);
+			break;
+		}
+		i = b->next++;
+		pthread_mutex_unlock(&b->mutex);
+
+		bf = &b->files[i];
+		bf->r = batch_process(b, w->index, bf);
+		if (bf->r < 0)
+			error("tuna: Failed to process %s", bf->path);
+		else if (bf->stopped)
+			msg("tuna: Stopped %s after %.3f s", bf->path,
+					bf->elapsed);
+		else if (bf->elapsed > 0)
+			msg("tuna: Finished %s: %.3f s of audio in %.3f s, "
+					"%.2fx realtime", bf->path,
+					bf->duration, bf->elapsed,
+					bf->duration / bf->elapsed);
+	}
+
+	return NULL;
+}
+
+/* SIGTERM is blocked in every thread during a batch and collected here, where
+ * it is safe to take the batch mutex. The thread is woken with SIGTERM at the
+ * end of the batch, when done has been set.
+ */
+void * batch_signal_thread(void * arg)
+{
+	struct batch * b = (struct batch *) arg;
+	sigset_t set;
+	int sig;
+	uint i;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigwait(&set, &sig);
+
+	pthread_mutex_lock(&b->mutex);
+	if (!b->done) {
+		msg("tuna: Terminating batch due to SIGTERM");
+		b->stop = 1;
+		for (i = 0; i < b->args->workers; i++)
+			if (b->running[i] &&
+					producer_stop(b->running[i], sig) < 0)
+				fatal("tuna: Failed to stop input module");
+	}
+	pthread_mutex_unlock(&b->mutex);
+
+	return NULL;
+}
+
+/* Log the throughput of each file and of the batch as a whole. The overall
+ * realtime factor is the audio processed over the wall clock time of the batch
+ * so that it includes the benefit of running several workers.
+ */
+void batch_summary(struct batch * b, double wall)
+{
+	assert(b);
+
+	uint i, n_done = 0, n_failed = 0, n_stopped = 0;
+	double duration = 0, busy = 0;
+	struct batch_file * bf;
+
+	msg("tuna: Batch summary:");
+	for (i = 0; i < b->n_files; i++) {
+		bf = &b->files[i];
+		if (bf->r < 0) {
+			n_failed++;
+			msg("tuna:   %s: failed (%d)", bf->path, bf->r);
+		} else if (bf->stopped) {
+			n_stopped++;
+			msg("tuna:   %s: stopped", bf->path);
+		} else if (bf->elapsed > 0) {
+			n_done++;
+			duration += bf->duration;
+			busy += bf->elapsed;
+			msg("tuna:   %s: %.3f s in %.3f s, %.2fx realtime",
+					bf->path, bf->duration, bf->elapsed,
+					bf->duration / bf->elapsed);
+		}
+	}
+
+	msg("tuna: Processed %u of %u files (%u failed, %u stopped) on %u "
+			"workers", n_done, b->n_files, n_failed, n_stopped,
+			b->args->workers);
+	if (busy > 0 && wall > 0)
+		msg("tuna: %.3f s of audio in %.3f s, %.2fx realtime overall, "
+				"%.2fx realtime per worker", duration, wall,
+				duration / wall, duration / busy);
+}
+
+int batch_run(struct arguments * args)
+{
+	assert(args);
+
+	struct batch b;
+	struct batch_worker * workers;
+	glob_t gl;
+	sigset_t set, old_set;
+	pthread_t sig_thread;
+	struct timespec start, end;
+	uint i, n_workers;
+	int r;
+
+	if (strcmp(args->input, "sndfile") && strcmp(args->input, "wavmap")) {
+		error("tuna: Batch mode requires sndfile or wavmap input");
+		return -EINVAL;
+	}
+
+	if (args->rt_priority || args->n_cpus || args->mlock) {
+		error("tuna: Real-time options can't be used in batch mode");
+		return -EINVAL;
+	}
+
+	r = find_files(args->batch, &gl);
+	if (r < 0)
+		return r;
+	if (r == 0) {
+		error("tuna: No files found for batch %s", args->batch);
+		return -ENOENT;
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.args = args;
+	b.n_files = (uint) gl.gl_pathc;
+	n_workers = args->workers;
+
+	b.files = (struct batch_file *)
+		calloc(b.n_files, sizeof(struct batch_file));
+	b.running = (struct producer **)
+		calloc(n_workers, sizeof(struct producer *));
+	workers = (struct batch_worker *)
+		calloc(n_workers, sizeof(struct batch_worker));
+	if (!b.files || !b.running || !workers) {
+		error("tuna: Failed to allocate memory for batch");
+		r = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < b.n_files; i++)
+		b.files[i].path = gl.gl_pathv[i];
+
+	pthread_mutex_init(&b.mutex, NULL);
+
+	/* Block SIGTERM before starting any threads so that it is only ever
+	 * handled by the signal thread.
+	 */
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+
+	r = pthread_create(&sig_thread, NULL, batch_signal_thread, &b);
+	if (r != 0) {
+		error("tuna: Failed to start signal thread");
+		r = -r;
+		goto out_mask;
+	}
+
+	msg("tuna: Processing %u files on %u workers", b.n_files, n_workers);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < n_workers; i++) {
+		workers[i].batch = &b;
+		workers[i].index = i;
+		r = pthread_create(&workers[i].thread, NULL,
+				batch_worker_thread, &workers[i]);
+		if (r != 0) {
+			error("tuna: Failed to start worker %u", i);
+			n_workers = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < n_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	pthread_mutex_lock(&b.mutex);
+	b.done = 1;
+	pthread_mutex_unlock(&b.mutex);
+	pthread_kill(sig_thread, SIGTERM);
+	pthread_join(sig_thread, NULL);
+
+	batch_summary(&b, elapsed(&start, &end));
+
+	/* Fail if any file failed or the pool couldn't be started. */
+	r = n_workers ? 0 : -1;
+	for (i = 0; i < b.n_files; i++)
+		if (b.files[i].r < 0)
+			r = b.files[i].r;
+
+out_mask:
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	pthread_mutex_destroy(&b.mutex);
+out:
+	free(workers);
+	free(b.running);
+	free(b.files);
+	globfree(&gl);
+	return r;
 }
 
 void sigterm_handler(int sig)
@@ -384,15 +1540,201 @@ void sigterm_handler(int sig)
 
 	msg("tuna: Terminating due to SIGTERM");
 
-	r = producer_stop(in, sig);
+	r = producer_stop(pl.in, sig);
 	if (r < 0)
 		fatal("tuna: Failed to stop input module");
 }
 
+/* Apply the real-time options to the producer, which runs on this thread, and
+ * report what was done. None of these are essential, so if they aren't
+ * permitted we carry on without.
+ */
+void rt_setup(struct arguments * args)
+{
+	assert(args);
+
+	char sched[64];
+	char cpu[64];
+	const char * mem;
+	int r;
+
+	if (!args->rt_priority && !args->n_cpus && !args->mlock)
+		return;
+
+	snprintf(sched, sizeof(sched), "normal scheduling");
+	if (args->rt_priority) {
+		r = rt_set_priority(pthread_self(), args->rt_priority);
+		if (r < 0)
+			snprintf(sched, sizeof(sched),
+					"normal scheduling (SCHED_FIFO %s)",
+					(r == -EPERM) ? "not permitted" :
+					"failed");
+		else
+			snprintf(sched, sizeof(sched),
+					"SCHED_FIFO priority %d",
+					args->rt_priority);
+	}
+
+	snprintf(cpu, sizeof(cpu), "producer on any CPU");
+	if (args->n_cpus) {
+		r = rt_set_cpu(pthread_self(), args->cpus[0]);
+		if (r < 0)
+			snprintf(cpu, sizeof(cpu),
+					"producer on any CPU (pinning failed)");
+		else
+			snprintf(cpu, sizeof(cpu), "producer on CPU %d",
+					args->cpus[0]);
+	}
+
+	/* Lock memory last so that everything set up above is covered. */
+	mem = "memory not locked";
+	if (args->mlock) {
+		r = rt_lock_memory();
+		if (r == 1)
+			mem = "all memory locked";
+		else if (r == 0)
+			mem = "current memory locked";
+		else if (r == -EPERM)
+			mem = "memory not locked (not permitted)";
+		else
+			mem = "memory not locked (failed)";
+	}
+
+	msg("tuna: Real-time setup: %s, %s, %u of %u queue threads pinned, %s",
+			sched, cpu, n_queue_pinned, n_queue_threads, mem);
+}
+
+int run(struct arguments * args, const char * source)
+{
+	assert(args);
+
+	int r;
+
+	if (!args->all_channels) {
+		r = output_init(&pl, args);
+		if (r < 0)
+			return r;
+	}
+
+	r = input_init(&pl, args, source);
+	if (r < 0)
+		return r;
+
+	rt_setup(args);
+
+	/* Setup signal handler now that 'pl.in' is valid (as the handler calls
+	 * in->stop() ).
+	 */
+	signal(SIGTERM, sigterm_handler);
+
+	r = producer_run(pl.in);
+
+	/* Don't try to stop the producer once it's gone. */
+	signal(SIGTERM, SIG_DFL);
+
+	return r;
+}
+
+/* Size of the buffers acquired by the input module. The file inputs read up to
+ * 65536 frames at a time, ALSA delivers about a period per wakeup.
+ */
+uint input_buffer_frames(struct arguments * args)
+{
+	assert(args);
+
+	if (strcmp(args->input, "alsa") == 0)
+		return args->alsa_period;
+
+	return 1U << 16;
+}
+
+/* Number of streams processed separately for one input, which is the channel
+ * count of the input if every channel is processed. Only the first file of a
+ * batch or sequence is checked, buffers for any extra channels of later files
+ * come from the pool. Returns 1 if the count can't be found.
+ */
+uint input_streams(struct arguments * args, const char * source)
+{
+	assert(args);
+
+	SNDFILE * sf;
+	SF_INFO sf_info;
+	glob_t gl;
+	const char * path;
+	uint n = 1;
+
+	if (!args->all_channels)
+		return 1;
+
+	if (strcmp(args->input, "alsa") == 0)
+		return args->alsa_channels;
+
+	path = args->batch ? args->batch : source;
+	if (!path)
+		return 1;
+
+	memset(&gl, 0, sizeof(gl));
+	if (args->batch || is_file_list(path)) {
+		if (find_files(path, &gl) <= 0) {
+			globfree(&gl);
+			return 1;
+		}
+		path = gl.gl_pathv[0];
+	}
+
+	memset(&sf_info, 0, sizeof(sf_info));
+	sf = sf_open(path, SFM_READ, &sf_info);
+	if (sf) {
+		n = (uint) sf_info.channels;
+		sf_close(sf);
+	}
+
+	globfree(&gl);
+	return n;
+}
+
+/* Sum of the depths of the queues which may hold buffers for one stream: the
+ * input queue, read ahead in the sndfile input, queued outputs, the two
+ * queues inside parallel analysis and the writer queue of sndfile outputs.
+ */
+uint stream_queue_depth(struct arguments * args)
+{
+	assert(args);
+
+	uint i, depth = 0;
+	const char * spec;
+
+	if (args->use_bufq || args->all_channels)
+		depth += args->bufq_depth ? args->bufq_depth :
+			BUFQ_DEFAULT_DEPTH;
+
+	depth += args->read_ahead;
+
+	for (i = 0; i < args->n_outputs; i++) {
+		spec = args->outputs[i];
+		if (strncmp(spec, "queue:", 6) == 0) {
+			depth += BUFQ_DEFAULT_DEPTH;
+			spec += 6;
+		}
+
+		if (args->parallel && strncmp(spec, "analysis", 8) == 0 &&
+				(spec[8] == ':' || spec[8] == '\0'))
+			depth += 2 * BUFQ_DEFAULT_DEPTH;
+		if (strncmp(spec, "sndfile", 7) == 0 &&
+				(spec[7] == ':' || spec[7] == '\0'))
+			depth += args->sndfile_queue;
+	}
+
+	return depth;
+}
+
 int main(int argc, char * argv[])
 {
 	int r;
+	uint depth, n_streams;
+	char * source;
 	struct arguments * args;
+	struct buffer_stats stats;
 	const char * log_file = "tuna.log";
 	const char * app_name = "tuna";
 
@@ -405,25 +1747,60 @@ int main(int argc, char * argv[])
 	if (!args)
 		return -ENOMEM;
 
-	argp_parse(&argp, argc, argv, 0, 0, args);
+	/* The parser returns negative error values but argp itself returns
+	 * positive ones.
+	 */
+	r = argp_parse(&argp, argc, argv, 0, 0, args);
+	if (r) {
+		error("tuna: Invalid arguments");
+		args_exit(args);
+		log_exit();
+		return r < 0 ? r : -r;
+	}
 
-	r = output_init(args);
-	if (r < 0)
-		return r;
+	/* Batch mode reads files, so don't default to capturing from ALSA. */
+	if (args->batch && !args->input_given) {
+		free(args->input);
+		args->input = strdup("sndfile");
+		if (!args->input)
+			return -ENOMEM;
+	}
 
-	r = input_init(args);
-	if (r < 0)
-		return r;
+	source = split_param(args->input);
 
-	/* Setup signal handler now that 'in' is valid (as the handler calls
-	 * in->stop() ).
-	 */
-	signal(SIGTERM, sigterm_handler);
+	if (args->n_outputs == 0) {
+		r = args_add_output(args, default_output);
+		if (r < 0) {
+			error("tuna: Failed to allocate memory for default output specifier");
+			return r;
+		}
+	}
+
+	if (args->use_arena) {
+		n_streams = input_streams(args, source);
+		if (args->batch)
+			n_streams *= args->workers;
+		depth = n_streams * stream_queue_depth(args);
+		r = buffer_arena_init(args->sample_rate,
+				input_buffer_frames(args), n_streams, depth);
+		if (r < 0)
+			return r;
+	}
+
+	if (args->batch)
+		r = batch_run(args);
+	else
+		r = run(args, source);
 
-	r = producer_run(in);
+	buffer_get_stats(&stats);
+	msg("tuna: Buffer pool: %llu hits, %llu misses, high water %llu buffers, "
+			"%llu arena failures", stats.hits, stats.misses,
+			stats.high_water, stats.arena_failures);
 
-	input_exit();
-	output_exit();
+	output_stats(&pl);
+	pipeline_exit(&pl);
+	fft_cleanup();
+	buffer_arena_exit();
 	log_exit();
 	args_exit(args);
 
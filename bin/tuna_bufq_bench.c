@@ -0,0 +1,149 @@
+/*******************************************************************************
+	tuna_bufq_bench.c: Compare the throughput of the bufq implementations.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+/* Push a fixed number of buffers through a bufq into a null consumer and
+ * report how long it took. The null consumer does no work so this measures the
+ * cost of the queue itself: locking, signalling and waking the consumer
+ * thread.
+ *
+ * Usage: tuna_bufq_bench [BUFFERS [FRAMES [DEPTH]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "bufq.h"
+#include "consumer.h"
+#include "log.h"
+#include "output_null.h"
+
+static double elapsed(struct timespec * start, struct timespec * end)
+{
+	return (double)(end->tv_sec - start->tv_sec) +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int bench(const char * name, enum bufq_modes mode, uint n_buffers,
+		uint frames_per_buffer, uint depth)
+{
+	int r;
+	uint i, frames;
+	sample_t * buf;
+	struct consumer * out, * q;
+	struct timespec ts, start, end;
+	struct buffer_stats stats;
+	double t;
+
+	out = consumer_new();
+	if (!out)
+		return -1;
+
+	r = output_null_init(out);
+	if (r < 0) {
+		error("bench: Failed to init output_null");
+		return r;
+	}
+
+	q = consumer_new();
+	if (!q)
+		return -1;
+
+	r = bufq_init_mode(q, out, mode, depth);
+	if (r < 0) {
+		error("bench: Failed to init bufq");
+		return r;
+	}
+
+	memset(&ts, 0, sizeof(struct timespec));
+	r = consumer_start(q, 44100, &ts);
+	if (r < 0) {
+		error("bench: Failed to start bufq");
+		return r;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < n_buffers; i++) {
+		frames = frames_per_buffer;
+		buf = buffer_acquire(&frames);
+		if (!buf) {
+			error("bench: Failed to acquire buffer");
+			return -1;
+		}
+
+		r = consumer_write(q, buf, frames_per_buffer);
+		if (r < 0) {
+			error("bench: Failed to write to bufq");
+			return r;
+		}
+
+		buffer_release(buf);
+	}
+
+	/* Exiting the bufq waits for the queue to drain. */
+	consumer_exit(q);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	consumer_exit(out);
+
+	t = elapsed(&start, &end);
+	printf("%-6s %10u buffers %8u frames %10.3f s %12.0f buffers/s %10.1f ns/buffer\n",
+			name, n_buffers, frames_per_buffer, t, n_buffers / t,
+			t * 1e9 / n_buffers);
+
+	buffer_get_stats(&stats);
+	printf("%-6s pool: %llu hits, %llu misses, high water %llu buffers\n",
+			name, stats.hits, stats.misses, stats.high_water);
+
+	return 0;
+}
+
+int main(int argc, char * argv[])
+{
+	int r;
+	uint n_buffers = 1000000;
+	uint frames_per_buffer = 64;
+	uint depth = 0;
+	const char * app_name = "tuna_bufq_bench";
+
+	if (argc > 1)
+		n_buffers = (uint) strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		frames_per_buffer = (uint) strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		depth = (uint) strtoul(argv[3], NULL, 10);
+
+	r = log_init(NULL, app_name);
+	if (r < 0)
+		return r;
+
+	r = bench("list", BUFQ_MODE_LIST, n_buffers, frames_per_buffer, depth);
+	if (r < 0)
+		goto out;
+
+	r = bench("ring", BUFQ_MODE_RING, n_buffers, frames_per_buffer, depth);
+
+out:
+	log_exit();
+
+	return r;
+}
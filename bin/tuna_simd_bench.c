@@ -0,0 +1,219 @@
+/*******************************************************************************
+	tuna_simd_bench.c: Compare the throughput of the SIMD kernel widths.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+/* Time the SIMD kernels once for each level supported by this machine and
+ * report the throughput of each in samples per second.
+ *
+ * Each kernel is called directly on a block of random data. The psum and
+ * wpsum2 kernels of the third octave level calculation work on frequency
+ * domain data. The window kernel converts time domain samples to floating
+ * point and windows them, the window_stats kernel also finds the peaks and
+ * accumulates the moments in the same pass. These are the kernels which
+ * time_slice uses for the outer and middle quarters of each slice.
+ *
+ * Usage: tuna_simd_bench [SECONDS [RATE]]
+ */
+
+#include <complex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "simd.h"
+#include "time_slice.h"
+#include "tol.h"
+#include "types.h"
+
+/* Length of the block of data passed to each kernel call. */
+#define KERNEL_LENGTH 4096
+
+/* Number of blocks of random samples, cycled through by the time_slice
+ * kernels.
+ */
+#define N_BLOCKS 16
+
+static double elapsed(struct timespec * start, struct timespec * end)
+{
+	return (double)(end->tv_sec - start->tv_sec) +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void report(enum simd_levels level, const char * kernel,
+		uint64 samples, double t)
+{
+	printf("%-7s %-12s %12llu samples %10.6f s %10.2f Msamples/s\n",
+			simd_level_name(level), kernel, samples, t,
+			samples / t / 1e6);
+}
+
+/* Results of the kernels are stored here so that the calls can't be optimised
+ * away.
+ */
+static volatile float sink;
+
+/* Call each tol kernel on KERNEL_LENGTH samples n_calls times. */
+int bench_tol(enum simd_levels level, float complex * x, float * w,
+		uint n_calls, uint rate)
+{
+	uint i;
+	struct tol * t;
+	struct timespec start, end;
+	float sum = 0;
+	float e[2] = {0, 0};
+
+	/* The kernels are chosen when the context is created. */
+	t = tol_init(rate, 2 * KERNEL_LENGTH, 0.4, 3);
+	if (!t) {
+		error("bench: Failed to init tol");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n_calls; i++)
+		sum += tol_psum(t, x, KERNEL_LENGTH);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report(level, "psum", (uint64) n_calls * KERNEL_LENGTH,
+			elapsed(&start, &end));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n_calls; i++)
+		tol_wpsum2(t, x, w, KERNEL_LENGTH, e);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report(level, "wpsum2", (uint64) n_calls * KERNEL_LENGTH,
+			elapsed(&start, &end));
+
+	tol_exit(t);
+
+	sink = sum + e[0] + e[1];
+	return 0;
+}
+
+/* Call each time_slice kernel on KERNEL_LENGTH samples n_calls times. */
+int bench_time_slice(enum simd_levels level, sample_t * data, float * w,
+		float * out, uint n_calls)
+{
+	uint i;
+	struct timespec start, end;
+	sample_t peaks[2] = {0, 0};
+	float moments[4] = {0, 0, 0, 0};
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n_calls; i++)
+		time_slice_window(&data[(i % N_BLOCKS) * KERNEL_LENGTH], w,
+				out, KERNEL_LENGTH);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report(level, "window", (uint64) n_calls * KERNEL_LENGTH,
+			elapsed(&start, &end));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n_calls; i++)
+		time_slice_window_stats(&data[(i % N_BLOCKS) * KERNEL_LENGTH],
+				w, out, KERNEL_LENGTH, peaks, moments);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report(level, "window_stats", (uint64) n_calls * KERNEL_LENGTH,
+			elapsed(&start, &end));
+
+	sink = out[0] + moments[0] + peaks[0];
+	return 0;
+}
+
+int bench(enum simd_levels level, sample_t * data, float complex * x,
+		float * w, float * out, uint n_calls, uint rate)
+{
+	int r;
+
+	r = simd_set_level(level);
+	if (r < 0)
+		return r;
+
+	r = bench_tol(level, x, w, n_calls, rate);
+	if (r < 0)
+		return r;
+
+	return bench_time_slice(level, data, w, out, n_calls);
+}
+
+int main(int argc, char * argv[])
+{
+	int r = 0;
+	uint i, n_calls;
+	uint seconds = 60;
+	uint rate = 44100;
+	sample_t * data;
+	float complex * x;
+	float * w;
+	float * out;
+	enum simd_levels level, max_level;
+	const char * app_name = "tuna_simd_bench";
+
+	if (argc > 1)
+		seconds = (uint) strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		rate = (uint) strtoul(argv[2], NULL, 10);
+
+	r = log_init(NULL, app_name);
+	if (r < 0)
+		return r;
+
+	/* Use a few blocks of random data, cycled through, so that the cost of
+	 * generating it isn't measured.
+	 */
+	data = (sample_t *) malloc(N_BLOCKS * KERNEL_LENGTH * sizeof(sample_t));
+	x = (float complex *) malloc(KERNEL_LENGTH * sizeof(float complex));
+	w = (float *) malloc(2 * KERNEL_LENGTH * sizeof(float));
+	out = (float *) malloc(KERNEL_LENGTH * sizeof(float));
+	if (!data || !x || !w || !out) {
+		error("bench: Failed to allocate memory");
+		r = -1;
+		goto out;
+	}
+
+	srand(1);
+	for (i = 0; i < N_BLOCKS * KERNEL_LENGTH; i++)
+		data[i] = rand() - RAND_MAX / 2;
+	for (i = 0; i < KERNEL_LENGTH; i++)
+		x[i] = (float) rand() / RAND_MAX - 0.5f +
+			((float) rand() / RAND_MAX - 0.5f) * I;
+	for (i = 0; i < 2 * KERNEL_LENGTH; i++)
+		w[i] = (float) rand() / RAND_MAX;
+
+	/* Each kernel processes as many samples as a stream of the given
+	 * rate and duration.
+	 */
+	n_calls = (uint64) seconds * rate / KERNEL_LENGTH;
+	max_level = simd_detect();
+
+	for (level = SIMD_LEVEL_NONE; level <= max_level; level++) {
+		r = bench(level, data, x, w, out, n_calls, rate);
+		if (r < 0)
+			break;
+	}
+
+out:
+	free(out);
+	free(w);
+	free(x);
+	free(data);
+	log_exit();
+
+	return r;
+}
@@ -0,0 +1,130 @@
+/*******************************************************************************
+	tuna_wisdom.c: Generate FFTW wisdom ahead of time.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+/* Planning a large FFT with a high effort level can take many seconds, which is
+ * too long to wait when starting a capture. This program plans every FFT length
+ * which time_slice and pulse may use at the given sample rates so that the
+ * resulting wisdom file can be shipped with tuna and later runs only need to
+ * load it.
+ *
+ * Usage: tuna_wisdom [FILE [EFFORT [RATE...]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fft.h"
+#include "log.h"
+
+static const uint default_rates[] = {
+	8000, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 176400, 192000,
+	400000
+};
+
+static const uint min_length = 256;
+
+static double elapsed(struct timespec * start, struct timespec * end)
+{
+	return (double)(end->tv_sec - start->tv_sec) +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Plan every power of two length from min_length up to the first power of two
+ * which is not less than the sample rate. Lengths which are already planned are
+ * found in the plan cache so cost nothing.
+ */
+int plan_rate(uint sample_rate)
+{
+	uint length;
+	struct fft * fft;
+	struct timespec start, end;
+
+	for (length = min_length; length / 2 < sample_rate; length *= 2) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		fft = fft_init(length);
+		if (!fft) {
+			error("tuna_wisdom: Failed to plan FFT of length %u",
+					length);
+			return -1;
+		}
+		fft_exit(fft);
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		printf("%8u Hz %8u samples %10.3f s\n", sample_rate, length,
+				elapsed(&start, &end));
+	}
+
+	return 0;
+}
+
+int main(int argc, char * argv[])
+{
+	int r = 0;
+	int i;
+	uint n;
+	enum fft_efforts effort = FFT_EFFORT_PATIENT;
+	const char * app_name = "tuna_wisdom";
+
+	r = log_init(NULL, app_name);
+	if (r < 0)
+		return r;
+
+	if (argc > 1) {
+		r = fft_set_wisdom_path(argv[1]);
+		if (r < 0)
+			goto out;
+	}
+
+	if (argc > 2) {
+		r = fft_parse_effort(argv[2], &effort);
+		if (r < 0) {
+			error("tuna_wisdom: Unknown planning effort %s", argv[2]);
+			goto out;
+		}
+	}
+
+	r = fft_set_effort(effort);
+	if (r < 0)
+		goto out;
+
+	if (argc > 3) {
+		for (i = 3; i < argc; i++) {
+			r = plan_rate((uint) strtoul(argv[i], NULL, 10));
+			if (r < 0)
+				goto out;
+		}
+	} else {
+		n = sizeof(default_rates) / sizeof(default_rates[0]);
+		for (i = 0; i < (int) n; i++) {
+			r = plan_rate(default_rates[i]);
+			if (r < 0)
+				goto out;
+		}
+	}
+
+out:
+	fft_cleanup();
+	log_exit();
+
+	return r;
+}
@@ -34,6 +34,13 @@
  * This consumer hands data in turn to the pulse and time_slice consumers. See
  * the documentation for <tuna/pulse.h> and <tuna/time_slice.h> for detils of
  * these consumers.
+ *
+ * If initialised with analysis_init_parallel(), each of the two consumers runs
+ * on its own thread, fed through a buffer queue (see <tuna/bufq.h>). Buffers
+ * are shared between the threads by reference counting rather than copied.
+ * Writes return as soon as the data has been queued for both threads but
+ * starting and resynchronising wait for both threads to catch up, so that any
+ * error is reported to the caller.
  */
 
 /**
@@ -61,4 +68,14 @@ int analysis_init(struct consumer * consumer, const char * pulse_csv_name,
 		const char * time_slice_csv_name,
 		const struct pulse_params * pulse_params);
 
+/**
+ * Initialise dual analysis consumer with each analysis running on its own
+ * thread.
+ *
+ * The parameters and return value are the same as for analysis_init().
+ */
+int analysis_init_parallel(struct consumer * consumer,
+		const char * pulse_csv_name, const char * time_slice_csv_name,
+		const struct pulse_params * pulse_params);
+
 #endif /* !__TUNA_ANALYSIS_H_INCLUDED__ */
@@ -27,8 +27,60 @@
  * \file <tuna/buffer.h>
  *
  * \brief Buffer management.
+ *
+ * Buffers are allocated in power of two size classes and recycled through a
+ * pool rather than being returned to the system when released. Each thread has
+ * a small private cache of free buffers in front of the shared pool so that a
+ * producer which acquires buffers in one thread and a consumer which releases
+ * them in another only need to take a lock occasionally, and steady state
+ * operation needs no calls to malloc() or free().
+ *
+ * For real-time capture the whole working set may instead be preallocated up
+ * front with buffer_arena_init(). The arena is locked into memory and backed
+ * by hugepages where possible so that acquiring a buffer never page faults.
+ * If the arena runs out of buffers, buffer_acquire() fails rather than falling
+ * back to the system allocator.
  */
 
+/**
+ * \brief Buffer pool statistics, see buffer_get_stats().
+ */
+struct buffer_stats {
+	/**
+	 * \brief Number of calls to buffer_acquire() which were satisfied by
+	 * a recycled buffer.
+	 */
+	uint64		hits;
+
+	/**
+	 * \brief Number of calls to buffer_acquire() which had to allocate
+	 * memory from the system.
+	 */
+	uint64		misses;
+
+	/**
+	 * \brief Number of buffers currently allocated from the system,
+	 * whether in use or held in the pool.
+	 */
+	uint64		allocated;
+
+	/**
+	 * \brief Number of buffers currently acquired and not yet released.
+	 */
+	uint64		in_use;
+
+	/**
+	 * \brief The highest value which in_use has reached.
+	 */
+	uint64		high_water;
+
+	/**
+	 * \brief Number of calls to buffer_acquire() which failed because the
+	 * arena was exhausted or the request was larger than an arena buffer.
+	 */
+	uint64		arena_failures;
+};
+
 /**
  * \brief Acquire a buffer with space for at least a given number of samples.
  *
@@ -67,10 +119,13 @@ void buffer_addref(sample_t * p);
  * last reference to the given buffer the associated memory may be freed or
  * recycled for use in future buffers.
  *
+ * Buffers may be released from a different thread to the one which acquired
+ * them.
+ *
  * \param p The buffer to which a reference will be released.
  *
- * \return 0 if the buffer remains referenced elsewhere, 1 if the buffer was
- * free'd back to the system.
+ * \return 0 if the buffer remains referenced elsewhere, 1 if this was the last
+ * reference and the buffer was free'd back to the system or the pool.
  */
 int buffer_release(sample_t * p);
 
@@ -85,4 +140,64 @@ int buffer_release(sample_t * p);
  */
 uint buffer_refcount(sample_t * p);
 
+/**
+ * \brief Get a snapshot of the buffer pool statistics.
+ *
+ * The counters are updated independently so a snapshot taken while other
+ * threads are acquiring and releasing buffers may be slightly inconsistent.
+ *
+ * \param stats Structure into which the statistics will be written.
+ */
+void buffer_get_stats(struct buffer_stats * stats);
+
+/**
+ * \brief Preallocate all future buffers from a locked arena.
+ *
+ * The arena holds fixed size buffers large enough for the given buffer size,
+ * rounded up to a power of two. It is sized to cover the given queue depth plus
+ * two seconds of data held back by the analysis modules of each stream, counted
+ * in buffers of the given size, plus a few spare buffers. While the arena is
+ * active buffer_acquire() never falls back to the system allocator: requests
+ * which are larger than an arena buffer, or made while every arena buffer is in
+ * use, fail and are counted in buffer_stats::arena_failures. Explicit hugepages
+ * are used if available, then transparent hugepages, then normal pages. The arena is locked into memory with mlock() if permitted, otherwise
+ * a warning is logged and every page is touched so that it is at least
+ * resident.
+ *
+ * This must be called before any other thread starts acquiring buffers.
+ * Buffers acquired before the arena was created are still released correctly.
+ *
+ * \param sample_rate The sample rate at which data will be captured.
+ *
+ * \param buffer_frames The size in frames of the buffers which the producer
+ * acquires, for example the ALSA period size.
+ *
+ * \param n_streams The number of streams analysed at once, each of which may
+ * hold back data. This is the number of channels processed separately times
+ * the number of files processed at once.
+ *
+ * \param queue_depth The maximum number of buffers which may be held in
+ * buffer queues at once, summed over every queue in every stream.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int buffer_arena_init(uint sample_rate, uint buffer_frames, uint n_streams,
+		uint queue_depth);
+
+/**
+ * \brief Get the largest number of samples which buffer_acquire() can supply.
+ *
+ * \return The size of an arena buffer while the arena is active, otherwise zero
+ * as there is no limit.
+ */
+uint buffer_arena_frames();
+
+/**
+ * \brief Release the arena created by buffer_arena_init().
+ *
+ * Subsequent buffers are allocated from the pool again. If any arena buffers
+ * are still in use, a warning is logged and the arena is left in place.
+ */
+void buffer_arena_exit();
+
 #endif /* !__TUNA_BUFFER_H_INCLUDED__ */
@@ -36,6 +36,9 @@
  * Whereas the basic buffer management routines only deal with the overall size
  * of the buffer, these routines track the number of valid samples in the buffer
  * and allow the start and length of the held buffers to be updated.
+ *
+ * Held buffer objects are pooled within each bufhold queue, so a held_buffer
+ * pointer must not be used after that buffer has been released.
  */
 
 struct bufhold;
@@ -117,6 +120,53 @@ sample_t * bufhold_data(struct held_buffer * h);
  */
 uint bufhold_count(struct held_buffer * h);
 
+/**
+ * \brief Get the total number of samples held in a bufhold queue.
+ *
+ * \param bh The bufhold queue to operate on.
+ *
+ * \return The sum of bufhold_count() over all buffers held in the given
+ * bufhold queue.
+ */
+uint bufhold_total(struct bufhold * bh);
+
+/**
+ * \brief Find the held buffer containing a given sample.
+ *
+ * The held samples are treated as one stream, beginning with the first sample
+ * of the oldest held buffer. The buffer is found by binary search so the cost
+ * grows only logarithmically with the number of buffers held.
+ *
+ * \param bh The bufhold queue to operate on.
+ *
+ * \param offset The position of the sample to find, counted from the oldest
+ * held sample.
+ *
+ * \param index Output parameter for the position of the sample within the
+ * returned held buffer, such that the sample is bufhold_data(h)[*index].
+ *
+ * \return The held buffer containing the given sample or NULL if fewer than
+ * offset + 1 samples are held.
+ */
+struct held_buffer * bufhold_find(struct bufhold * bh, uint offset,
+		uint * index);
+
+/**
+ * \brief Discard the oldest samples held in a bufhold queue.
+ *
+ * Buffers which are wholly discarded are released and the start of the buffer
+ * containing the first remaining sample is advanced as if by
+ * bufhold_advance().
+ *
+ * \param bh The bufhold queue to operate on.
+ *
+ * \param count The number of samples to discard. If this is greater than or
+ * equal to the number of samples held then all buffers are released.
+ *
+ * \return The number of samples which remain held.
+ */
+uint bufhold_discard(struct bufhold * bh, uint count);
+
 /**
  * \brief Advance the start of a buffer held in a bufhold queue.
  *
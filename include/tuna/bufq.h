@@ -41,7 +41,74 @@
  * from the queue and writes the data to the next consumer in the chain. Thus,
  * if the thread handling the consumer is blocked, the original thread may
  * continue adding data to the queue.
+ *
+ * Two queue implementations are available, see ::bufq_modes. The original
+ * linked list queue may grow without bound but takes a mutex on every
+ * operation. The ring queue has a fixed depth and doesn't lock at all in the
+ * common case, but the producer will block if the consumer falls so far behind
+ * that the ring fills up. The drop queue uses the same ring but never blocks
+ * the producer: buffers which don't fit are discarded and counted instead.
+ */
+
+/**
+ * \brief Depth of the ring used by ::BUFQ_MODE_RING if none is given.
+ */
+#define BUFQ_DEFAULT_DEPTH 256
+
+/**
+ * \brief Queue implementation selection values.
  */
+enum bufq_modes {
+	/**
+	 * \brief Unbounded linked list protected by a mutex.
+	 */
+	BUFQ_MODE_LIST,
+
+	/**
+	 * \brief Bounded lock-free single producer, single consumer ring.
+	 *
+	 * The consumer thread spins briefly when the ring is empty before
+	 * sleeping and the producer only signals it if it is actually asleep.
+	 */
+	BUFQ_MODE_RING,
+
+	/**
+	 * \brief Bounded ring which drops buffers rather than blocking.
+	 *
+	 * If the ring is full when a buffer is written, the buffer is dropped
+	 * and counted in ::bufq_stats. The target consumer is resynchronised
+	 * before the next buffer which is queued so that timestamps remain
+	 * correct after the gap. Resyncs from upstream are also deferred until
+	 * the next queued buffer. Use this where a slow consumer must never
+	 * stall the producer, for example a secondary output.
+	 */
+	BUFQ_MODE_DROP
+};
+
+/**
+ * \brief Buffer queue statistics.
+ */
+struct bufq_stats {
+	/**
+	 * \brief Number of entries currently waiting in the queue.
+	 */
+	uint		backlog;
+
+	/**
+	 * \brief Largest number of entries seen waiting in the queue.
+	 */
+	uint		max_backlog;
+
+	/**
+	 * \brief Number of buffers dropped because the queue was full.
+	 */
+	uint64		dropped_buffers;
+
+	/**
+	 * \brief Number of samples in the dropped buffers.
+	 */
+	uint64		dropped_samples;
+};
 
 /**
  * \brief Initialise a buffer queue.
@@ -56,4 +123,66 @@
  */
 int bufq_init(struct consumer * consumer, struct consumer * target);
 
+/**
+ * \brief Initialise a buffer queue using a specific queue implementation.
+ *
+ * \param consumer The consumer object to initialise. The call to
+ * bufq_init_mode() should immediately follow the creation of a consumer object
+ * with consumer_new().
+ *
+ * \param target The consumer to which this buffer queue will write data.
+ *
+ * \param mode The queue implementation to use.
+ *
+ * \param depth The number of entries in the ring for ::BUFQ_MODE_RING and
+ * ::BUFQ_MODE_DROP, which will be rounded up to a power of two. Zero selects a
+ * default depth. Ignored for ::BUFQ_MODE_LIST.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int bufq_init_mode(struct consumer * consumer, struct consumer * target,
+		enum bufq_modes mode, uint depth);
+
+/**
+ * \brief Wait for a buffer queue to drain.
+ *
+ * Blocks until every event queued before this call, including any start or
+ * resync, has been passed on to the target consumer by the queue's thread.
+ * This must be called from the thread which writes to the queue.
+ *
+ * \param consumer A consumer object initialised by bufq_init() or
+ * bufq_init_mode().
+ *
+ * \return >=0 if all queued events were handled successfully, <0 if the
+ * queue's thread has stopped due to an error.
+ */
+int bufq_sync(struct consumer * consumer);
+
+/**
+ * \brief Get the statistics of a buffer queue.
+ *
+ * This should be called from the thread which writes to the queue, or after
+ * writing has stopped.
+ *
+ * \param consumer A consumer object initialised by bufq_init() or
+ * bufq_init_mode().
+ *
+ * \param stats Structure to fill with the current statistics.
+ */
+void bufq_get_stats(struct consumer * consumer, struct bufq_stats * stats);
+
+/**
+ * \brief Pin the thread of a buffer queue to a single CPU.
+ *
+ * See rt_set_cpu(). If this fails, the thread carries on running on any CPU.
+ *
+ * \param consumer A consumer object initialised by bufq_init() or
+ * bufq_init_mode().
+ *
+ * \param cpu The number of the CPU, counting from zero.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int bufq_set_cpu(struct consumer * consumer, int cpu);
+
 #endif /* !__TUNA_BUFQ_H_INCLUDED__ */
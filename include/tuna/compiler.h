@@ -48,6 +48,22 @@
 		(void *)(__iptr & ~(__ir-1));				\
 	})
 
+/* Size of a cache line on the platforms we care about. Data which is written
+ * by one thread and read by another should be padded out to this alignment to
+ * avoid false sharing.
+ */
+#define TUNA_CACHELINE_SIZE 64
+#define __cacheline_aligned __attribute__ ((aligned(TUNA_CACHELINE_SIZE)))
+
+/* Hint to the processor that we are in a spin-wait loop. */
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__arm__) || defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define cpu_relax() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
 /* Support inlines using c99 model. */
 #ifdef ENABLE_INLINE
 #define TUNA_INLINE inline
@@ -90,6 +90,19 @@ int csv_write_sample(FILE * csv, sample_t s);
  */
 int csv_write_uint(FILE * csv, uint u);
 
+/**
+ * Write a field containing a given 64-bit unsigned integer value to an open CSV
+ * file.
+ *
+ * \param csv The CSV file to write to.
+ *
+ * \param u The unsigned integer value to be written as a field in the given CSV
+ * file.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int csv_write_uint64(FILE * csv, uint64 u);
+
 /**
  * Finish the current record in a given CSV file and start a new record. This
  * essentially just means write a newline to the file.
@@ -0,0 +1,54 @@
+/*******************************************************************************
+	deinterleave.h: Split interleaved multichannel samples by channel.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#ifndef __TUNA_DEINTERLEAVE_H_INCLUDED__
+#define __TUNA_DEINTERLEAVE_H_INCLUDED__
+
+#include "types.h"
+
+/**
+ * \file <tuna/deinterleave.h>
+ *
+ * \brief Conversion of interleaved multichannel data to one buffer per channel.
+ *
+ * Sound files and capture devices deliver multichannel data interleaved, with
+ * all channels of one frame stored together. The processing modules work on a
+ * single channel at a time, so each channel must be copied out into a buffer of
+ * its own. This is done in a single pass over the interleaved data using the
+ * widest SIMD instructions available, see <tuna/simd.h>.
+ */
+
+/**
+ * \brief Split interleaved samples into one buffer per channel.
+ *
+ * \param dst An array of channels pointers, each to a buffer with space for
+ * frames samples. Sample i of channel c is written to dst[c][i]. The buffers
+ * must not overlap src or each other.
+ *
+ * \param src The interleaved samples, frames * channels in total.
+ *
+ * \param channels The number of channels in src.
+ *
+ * \param frames The number of frames in src.
+ */
+void deinterleave(sample_t ** dst, const sample_t * src, uint channels,
+		uint frames);
+
+#endif /* !__TUNA_DEINTERLEAVE_H_INCLUDED__ */
@@ -97,6 +97,26 @@ void env_estimate_reset(struct env_estimate * e);
  */
 TUNA_INLINE env_t env_estimate_next(struct env_estimate * e, sample_t x);
 
+/**
+ * \brief Estimate the envelope of a block of samples.
+ *
+ * This is equivalent to calling env_estimate_next() for each sample in turn but
+ * processes several samples at once where SIMD instructions are available. In
+ * that case powers of the decay factor are applied in one step rather than by
+ * repeated multiplication, so results may differ from those of
+ * env_estimate_next() by a relative error of up to 1e-5.
+ *
+ * \param e The envelope estimator to use.
+ *
+ * \param in Array of n signal values.
+ *
+ * \param out Array into which the n estimated envelope values are written.
+ *
+ * \param n The number of samples to process.
+ */
+void env_estimate_block(struct env_estimate * e, sample_t * in, env_t * out,
+		uint n);
+
 #include "tuna_inl/env_estimate.inl"
 
 #endif /* !__TUNA_ENV_ESTIMATE_H_INCLUDED__ */
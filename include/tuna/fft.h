@@ -45,6 +45,13 @@
  * after the call to fft_exit() as it will be freed. The transformation itself
  * is performed by calling fft_transform() once the buffer contains the
  * appropriate data.
+ *
+ * When FFTW is used, plans are shared between all FFT contexts of the same
+ * length. The first context of a given length pays the cost of planning, later
+ * contexts reuse the cached plan. The planning effort and the file used to
+ * store FFTW wisdom between runs may be set before any contexts are created
+ * using fft_set_effort() and fft_set_wisdom_path(). These settings are ignored
+ * when FFTS is used.
  */
 
 struct fft;
@@ -56,6 +63,65 @@ struct fft;
 struct fft {};
 #endif
 
+/**
+ * \brief Planning effort.
+ *
+ * Higher effort takes longer to plan but may produce a faster transform. These
+ * correspond to the FFTW planner flags of the same names.
+ */
+enum fft_efforts {
+	/** Pick a plan using heuristics only. */
+	FFT_EFFORT_ESTIMATE,
+
+	/** Time a few candidate plans. */
+	FFT_EFFORT_MEASURE,
+
+	/** Time a wider range of candidate plans, this is the default. */
+	FFT_EFFORT_PATIENT,
+
+	/** Time every candidate plan. */
+	FFT_EFFORT_EXHAUSTIVE
+};
+
+/**
+ * Set the effort used when planning transforms. This only affects plans which
+ * have not already been made, so it should be called before any FFT contexts are
+ * initialised.
+ *
+ * \param effort The planning effort.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int fft_set_effort(enum fft_efforts effort);
+
+/**
+ * Parse the name of a planning effort: "estimate", "measure", "patient" or
+ * "exhaustive".
+ *
+ * \param name The name to parse.
+ *
+ * \param effort Output location for the parsed effort.
+ *
+ * \return >=0 on success, <0 if the name is not recognised.
+ */
+int fft_parse_effort(const char * name, enum fft_efforts * effort);
+
+/**
+ * Set the path of the file used to load and save FFTW wisdom. The default is
+ * "fftw.wisdom" in the current directory.
+ *
+ * \param path The path of the wisdom file, or NULL to disable wisdom.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int fft_set_wisdom_path(const char * path);
+
+/**
+ * Destroy all cached plans. This should only be called once all FFT contexts
+ * have been destroyed, typically just before the application exits.
+ */
+void fft_cleanup();
+
 /**
  * Initialise an FFT context.
  *
@@ -31,7 +31,174 @@
  * \brief Input driver for ALSA sound cards.
  *
  * This producer captures data from an ALSA sound card.
+ *
+ * Data may be captured either by reading it from the device with
+ * snd_pcm_readi() or by mapping the device's ring buffer and converting
+ * samples straight out of it. The mmap mode saves a system call and a full
+ * copy of the data for every period. If a device doesn't support mmap access,
+ * read access is used instead.
+ *
+ * The sample format is negotiated with the device when it is opened, preferring
+ * the widest format it supports, unless a format is given. Only the first
+ * channel is passed on. Samples are converted into sample_t in one pass with
+ * the resolution of the capture format: 16-bit and 24-bit samples keep their
+ * range and 32-bit integer and floating point samples use the full range of
+ * sample_t, as they do when read from a sound file by input_sndfile.
+ *
+ * Overruns and other capture errors are recovered from and counted, along with
+ * an estimate of the samples lost and a histogram of how late the capture
+ * thread woke up for each period, see ::input_alsa_stats. These may be written
+ * out periodically to a statistics file to help with choosing the period size
+ * and buffer queue depth.
+ *
+ * Neither mode needs real hardware for testing: the ALSA "null" device
+ * captures silence and the "file" plugin can capture from a raw file given as
+ * its "infile", see the ALSA plugin documentation.
+ */
+
+/**
+ * \brief Capture formats.
+ *
+ * These correspond to the ALSA sample formats of the same names.
  */
+enum input_alsa_formats {
+	/** Use the first of the formats below which the device supports. */
+	INPUT_ALSA_FORMAT_AUTO,
+
+	/** Signed 32-bit samples. */
+	INPUT_ALSA_FORMAT_S32_LE,
+
+	/** Signed 24-bit samples in the low three bytes of 32-bit words. */
+	INPUT_ALSA_FORMAT_S24_LE,
+
+	/** Signed 24-bit samples packed into three bytes each. */
+	INPUT_ALSA_FORMAT_S24_3LE,
+
+	/** 32-bit floating point samples in the range -1 to 1. */
+	INPUT_ALSA_FORMAT_FLOAT_LE,
+
+	/** Signed 16-bit samples. */
+	INPUT_ALSA_FORMAT_S16_LE
+};
+
+/**
+ * \brief Number of buckets in each histogram of ::input_alsa_stats.
+ */
+#define INPUT_ALSA_HIST_BUCKETS 20
+
+/**
+ * \brief ALSA capture statistics.
+ *
+ * The histograms have power of two buckets: bucket 0 counts values of 0 or 1,
+ * bucket i counts values from 2^i up to 2^(i+1) - 1 and the last bucket also
+ * counts everything larger.
+ */
+struct input_alsa_stats {
+	/**
+	 * \brief Number of times the capture thread woke up to read data.
+	 */
+	uint64		wakeups;
+
+	/**
+	 * \brief Number of overruns, where the device ran out of buffer space
+	 * before the data was read.
+	 */
+	uint64		xruns;
+
+	/**
+	 * \brief Number of times the device was suspended.
+	 */
+	uint64		suspends;
+
+	/**
+	 * \brief Number of other errors which needed recovery.
+	 */
+	uint64		errors;
+
+	/**
+	 * \brief Number of times the device had to be closed and re-opened to
+	 * recover from an error.
+	 */
+	uint64		deep_recoveries;
+
+	/**
+	 * \brief Total time spent re-opening the device, in seconds.
+	 */
+	double		recovery_time;
+
+	/**
+	 * \brief Estimate of the number of samples lost to errors.
+	 *
+	 * This is the gap between the device's timestamps from before an error
+	 * and after recovering from it, so it depends on the accuracy of the
+	 * sample clock and of the system clock.
+	 */
+	uint64		lost_samples;
+
+	/**
+	 * \brief Histogram of the delay in microseconds between the device's
+	 * last update and the capture thread waking up.
+	 */
+	uint64		latency_hist[INPUT_ALSA_HIST_BUCKETS];
+
+	/**
+	 * \brief Histogram of the number of frames waiting to be read when
+	 * the capture thread woke up.
+	 */
+	uint64		avail_hist[INPUT_ALSA_HIST_BUCKETS];
+};
+
+/**
+ * \brief Parameters for ALSA capture.
+ */
+struct input_alsa_params {
+	/**
+	 * \brief The sampling rate at which to capture data, which must be
+	 * supported by the device.
+	 */
+	uint			sample_rate;
+
+	/**
+	 * \brief If non-zero, capture by mapping the device's ring buffer
+	 * rather than reading from it.
+	 */
+	int			use_mmap;
+
+	/**
+	 * \brief The sample format to capture, or ::INPUT_ALSA_FORMAT_AUTO to
+	 * negotiate one with the device.
+	 */
+	enum input_alsa_formats	format;
+
+	/**
+	 * \brief The number of channels to capture, which must be supported by
+	 * the device. With a single consumer only the first channel is passed
+	 * on, see input_alsa_init_channels().
+	 */
+	uint			channels;
+
+	/**
+	 * \brief The period size in frames. The device may choose a nearby
+	 * size instead.
+	 */
+	uint			period_size;
+
+	/**
+	 * \brief The path of a file to which statistics are written, or NULL
+	 * for none.
+	 *
+	 * A line is appended every stats_interval seconds and when capture
+	 * stops. Each line gives the time followed by the fields of
+	 * ::input_alsa_stats in order, with the counts since capture started.
+	 */
+	const char *		stats_path;
+
+	/**
+	 * \brief Seconds between lines of the statistics file, or zero to only
+	 * write statistics when capture stops.
+	 */
+	uint			stats_interval;
+};
 
 /**
  * \brief Initialise the alsa producer.
@@ -48,9 +215,80 @@
  * sepcified ALSA device. This sampling rate must be supported by the ALSA
  * device.
  *
+ * Two channels of ::INPUT_ALSA_FORMAT_S16_LE samples are captured with a period
+ * of 4096 frames.
+ *
  * \return >=0 on success, <0 on failure.
  */
 int input_alsa_init(struct producer * producer, struct consumer * consumer,
 		const char * device_name, uint sample_rate);
 
+/**
+ * \brief Initialise the alsa producer with the given parameters.
+ *
+ * \param producer The producer object to initialise. The call to
+ * input_alsa_init_params() should immediately follow the creation of a
+ * producer object with producer_new().
+ *
+ * \param consumer The consumer to which this producer will write data.
+ *
+ * \param device_name The name of the ALSA device from which to capture data.
+ *
+ * \param params The capture parameters. This structure is copied.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int input_alsa_init_params(struct producer * producer,
+		struct consumer * consumer, const char * device_name,
+		const struct input_alsa_params * params);
+
+/**
+ * \brief Initialise the alsa producer to give each channel to its own consumer.
+ *
+ * \param producer The producer object to initialise. The call to
+ * input_alsa_init_channels() should immediately follow the creation of a
+ * producer object with producer_new().
+ *
+ * \param consumers The consumers to which this producer will write data, one
+ * for each channel in order. This array is copied.
+ *
+ * \param n_consumers The number of consumers. If one, only the first channel is
+ * passed on. Otherwise this must equal the number of channels captured.
+ *
+ * \param device_name The name of the ALSA device from which to capture data.
+ *
+ * \param params The capture parameters. This structure is copied.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int input_alsa_init_channels(struct producer * producer,
+		struct consumer ** consumers, uint n_consumers,
+		const char * device_name, const struct input_alsa_params * params);
+
+/**
+ * \brief Get the statistics of an alsa producer.
+ *
+ * The statistics are updated by the capture thread without locking, so this
+ * should be called once the producer has stopped running.
+ *
+ * \param producer A producer object initialised by input_alsa_init(),
+ * input_alsa_init_params() or input_alsa_init_channels().
+ *
+ * \param stats Structure to fill with the statistics.
+ */
+void input_alsa_get_stats(struct producer * producer,
+		struct input_alsa_stats * stats);
+
+/**
+ * Parse the name of a capture format: "auto", "s32_le", "s24_le", "s24_3le",
+ * "float_le" or "s16_le".
+ *
+ * \param name The name to parse.
+ *
+ * \param format Output location for the parsed format.
+ *
+ * \return >=0 on success, <0 if the name is not recognised.
+ */
+int input_alsa_parse_format(const char * name, enum input_alsa_formats * format);
+
 #endif /* !__TUNA_INPUT_ALSA_H_INCLUDED__ */
@@ -31,6 +31,28 @@
  *
  * This producer reads data from sound files of any format supported by
  * libsndfile.
+ *
+ * Decoding compressed formats can take a significant share of the time spent
+ * processing a file. With read-ahead enabled, buffers are decoded on a
+ * separate thread into a bounded queue so that decoding overlaps with the
+ * analysis. The time each side spent waiting on the other is logged at EOF
+ * along with the start and finish timestamps, which shows whether decoding or
+ * analysis is the bottleneck.
+ *
+ * A sequence of files, such as the consecutive files written by the sndfile
+ * output module, may also be read as one continuous stream. Each file is
+ * opened on a background thread while the previous one is read, so moving
+ * from one file to the next doesn't stall the pipeline. The consumer is only
+ * resynced between files if the Broadcast Wave timestamps of both files show
+ * that samples are missing or overlap. The sample rate must be the same for
+ * every file in a sequence.
+ *
+ * By default only the first channel of a multichannel file is used. Every
+ * channel may instead be given to a consumer of its own. Each buffer read from
+ * the file is then split into one buffer per channel in a single pass, see
+ * <tuna/deinterleave.h>, so the file is only decoded once however many
+ * channels are processed. To process the channels in parallel, each consumer
+ * should be a buffer queue, see <tuna/bufq.h>.
  */
 
 /**
@@ -49,4 +71,75 @@
 int input_sndfile_init(struct producer * producer, struct consumer * consumer,
 		const char * source);
 
+/**
+ * \brief Initialise the sndfile producer with read-ahead decoding.
+ *
+ * \param producer The producer object to initialise. The call to
+ * input_sndfile_init_readahead() should immediately follow the creation of a
+ * producer object with producer_new().
+ *
+ * \param consumer The consumer to which this producer will write data.
+ *
+ * \param source The name of the sound file from which to read data.
+ *
+ * \param depth The maximum number of decoded buffers to queue ahead of the
+ * consumer. If zero, no decoding thread is started and this is equivalent to
+ * input_sndfile_init().
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int input_sndfile_init_readahead(struct producer * producer,
+		struct consumer * consumer, const char * source, uint depth);
+
+/**
+ * \brief Initialise the sndfile producer to read a sequence of files.
+ *
+ * \param producer The producer object to initialise. The call to
+ * input_sndfile_init_sequence() should immediately follow the creation of a
+ * producer object with producer_new().
+ *
+ * \param consumer The consumer to which this producer will write data.
+ *
+ * \param sources The names of the sound files from which to read data, in
+ * order. This array must remain valid until the producer is destroyed.
+ *
+ * \param n_sources The number of names in sources, which must be at least one.
+ *
+ * \param depth The maximum number of decoded buffers to queue ahead of the
+ * consumer, or zero to decode without a separate thread.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int input_sndfile_init_sequence(struct producer * producer,
+		struct consumer * consumer, const char * const * sources,
+		uint n_sources, uint depth);
+
+/**
+ * \brief Initialise the sndfile producer to give each channel to its own
+ * consumer.
+ *
+ * \param producer The producer object to initialise. The call to
+ * input_sndfile_init_channels() should immediately follow the creation of a
+ * producer object with producer_new().
+ *
+ * \param consumers The consumers to which this producer will write data, one
+ * for each channel in order. This array is copied.
+ *
+ * \param n_consumers The number of consumers. If one, only the first channel of
+ * each file is read. Otherwise every file must have exactly this many channels.
+ *
+ * \param sources The names of the sound files from which to read data, in
+ * order. This array must remain valid until the producer is destroyed.
+ *
+ * \param n_sources The number of names in sources, which must be at least one.
+ *
+ * \param depth The maximum number of decoded buffers to queue ahead of the
+ * consumers, or zero to decode without a separate thread.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int input_sndfile_init_channels(struct producer * producer,
+		struct consumer ** consumers, uint n_consumers,
+		const char * const * sources, uint n_sources, uint depth);
+
 #endif /* !__TUNA_INPUT_SNDFILE_H_INCLUDED__ */
@@ -0,0 +1,62 @@
+/*******************************************************************************
+	input_wavmap.h: Memory mapped input from WAV files.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#ifndef __TUNA_INPUT_WAVMAP_H_INCLUDED__
+#define __TUNA_INPUT_WAVMAP_H_INCLUDED__
+
+#include "consumer.h"
+#include "producer.h"
+
+/**
+ * \file <tuna/input_wavmap.h>
+ *
+ * \brief Memory mapped input driver for uncompressed WAV files.
+ *
+ * This producer maps a WAV or RF64 file into memory and converts samples
+ * straight from the mapped pages into sample buffers, avoiding the extra copy
+ * and conversion pass made when reading through libsndfile. It is intended
+ * for reprocessing large archives of recordings. The file is mapped a window
+ * at a time, so files larger than the address space can be read on 32-bit
+ * targets.
+ *
+ * Only integer PCM data with 8, 16, 24 or 32 bits per sample is supported,
+ * either as a plain format chunk or as WAVE_FORMAT_EXTENSIBLE. Samples are
+ * scaled in the same way as by the sndfile producer so that the two give the
+ * same results. Where a file has more than one channel, only the first is
+ * used.
+ */
+
+/**
+ * \brief Initialise the wavmap producer.
+ *
+ * \param producer The producer object to initialise. The call to
+ * input_wavmap_init() should immediately follow the creation of a producer
+ * object with producer_new().
+ *
+ * \param consumer The consumer to which this producer will write data.
+ *
+ * \param source The name of the WAV or RF64 file from which to read data.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int input_wavmap_init(struct producer * producer, struct consumer * consumer,
+		const char * source);
+
+#endif /* !__TUNA_INPUT_WAVMAP_H_INCLUDED__ */
@@ -0,0 +1,163 @@
+/*******************************************************************************
+	mring.h: Mirrored ring buffer of samples.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#ifndef __TUNA_MRING_H_INCLUDED__
+#define __TUNA_MRING_H_INCLUDED__
+
+#include "types.h"
+
+/**
+ * \file <tuna/mring.h>
+ *
+ * \brief Ring buffer which presents its contents as one contiguous array.
+ *
+ * The storage of a mirrored ring is mapped twice into adjacent regions of
+ * virtual memory, so a run of samples which wraps around the end of the ring
+ * continues seamlessly into the second mapping. This means that the samples
+ * held in the ring can always be read from a single pointer, and space for new
+ * samples can always be written through a single pointer, without any special
+ * handling of the wrap point.
+ *
+ * This is an alternative to <tuna/bufhold.h> for consumers which need a fixed
+ * length window of past data: rather than holding references to the incoming
+ * buffers, the samples are copied into the ring once and can then be read in
+ * place.
+ */
+
+struct mring;
+
+#ifdef DOXYGEN
+/**
+ * \brief A mirrored ring buffer.
+ */
+struct mring {};
+#endif
+
+/**
+ * \brief Get a pointer to the oldest sample held in a mirrored ring.
+ *
+ * \param r The mirrored ring to operate on.
+ *
+ * \return A pointer to the oldest held sample. The following
+ * mring_count() - 1 samples are the rest of the held data in order, so the
+ * whole contents of the ring may be read from this pointer.
+ */
+sample_t * mring_data(struct mring * r);
+
+/**
+ * \brief Get the number of samples held in a mirrored ring.
+ *
+ * \param r The mirrored ring to operate on.
+ *
+ * \return The number of samples held.
+ */
+uint mring_count(struct mring * r);
+
+/**
+ * \brief Get the number of samples which may be added to a mirrored ring.
+ *
+ * \param r The mirrored ring to operate on.
+ *
+ * \return The number of free sample spaces.
+ */
+uint mring_space(struct mring * r);
+
+/**
+ * \brief Get the total number of samples a mirrored ring can hold.
+ *
+ * \param r The mirrored ring to operate on.
+ *
+ * \return The capacity in samples. This is at least the length requested in
+ * mring_init(), rounded up to a whole number of pages.
+ */
+uint mring_capacity(struct mring * r);
+
+/**
+ * \brief Get a pointer to the free space in a mirrored ring.
+ *
+ * This allows samples to be produced directly into the ring. Up to
+ * mring_space() samples may be written from the returned pointer and then
+ * added to the ring by calling mring_commit().
+ *
+ * \param r The mirrored ring to operate on.
+ *
+ * \return A pointer to the first free sample space.
+ */
+sample_t * mring_tail(struct mring * r);
+
+/**
+ * \brief Add samples written through mring_tail() to a mirrored ring.
+ *
+ * \param r The mirrored ring to operate on.
+ *
+ * \param count The number of samples to add, which must not be greater than
+ * mring_space().
+ */
+void mring_commit(struct mring * r, uint count);
+
+/**
+ * \brief Copy samples into a mirrored ring.
+ *
+ * \param r The mirrored ring to operate on.
+ *
+ * \param buf The samples to copy.
+ *
+ * \param count The number of samples to copy.
+ *
+ * \return >=0 on success, <0 if there is not enough space for count samples.
+ * Nothing is copied on failure.
+ */
+int mring_write(struct mring * r, const sample_t * buf, uint count);
+
+/**
+ * \brief Discard the oldest samples held in a mirrored ring.
+ *
+ * \param r The mirrored ring to operate on.
+ *
+ * \param count The number of samples to discard, which must not be greater
+ * than mring_count().
+ */
+void mring_advance(struct mring * r, uint count);
+
+/**
+ * \brief Discard all samples held in a mirrored ring.
+ *
+ * \param r The mirrored ring to empty.
+ */
+void mring_clear(struct mring * r);
+
+/**
+ * \brief Initialise a mirrored ring.
+ *
+ * \param min_count The minimum number of samples which the ring must be able to
+ * hold.
+ *
+ * \return A pointer to a new, empty mirrored ring or NULL on error.
+ */
+struct mring * mring_init(uint min_count);
+
+/**
+ * \brief Destroy a mirrored ring which is no longer needed.
+ *
+ * \param r The mirrored ring to destroy.
+ */
+void mring_exit(struct mring * r);
+
+#endif /* !__TUNA_MRING_H_INCLUDED__ */
@@ -38,6 +38,9 @@
  * within a given time period. Therefore a moving minimum filter is applied to
  * the envelope estimates and the output of this filter is multiplied by the
  * desired ratio to give the detection threshold.
+ *
+ * The moving minimum costs a constant amount of work per sample regardless of
+ * the window length. Whole buffers may be processed with onset_threshold_scan().
  */
 struct onset_threshold;
 
@@ -86,6 +89,28 @@ void onset_threshold_exit(struct onset_threshold * onset);
 TUNA_INLINE void onset_threshold_next(struct onset_threshold * onset,
 		env_t next, env_t * threshold);
 
+/**
+ * \brief Scan a block of envelope estimates for an onset.
+ *
+ * Envelope estimates are processed in order, as if by onset_threshold_next(),
+ * until one exceeds the onset threshold calculated at that sample. Samples after
+ * the crossing are not processed.
+ *
+ * \param onset The onset threshold tracker to use.
+ *
+ * \param env Array of n envelope estimates.
+ *
+ * \param n The number of envelope estimates in env.
+ *
+ * \param threshold The location in which to store the onset threshold at the
+ * last sample processed. This is unchanged if n is zero.
+ *
+ * \return The index of the first envelope estimate which exceeds the onset
+ * threshold, or n if there is no such estimate.
+ */
+uint onset_threshold_scan(struct onset_threshold * onset, env_t * env,
+		uint n, env_t * threshold);
+
 /**
  * \brief Reset a pulse onset threshold tracker.
  *
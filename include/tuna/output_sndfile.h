@@ -33,7 +33,76 @@
  * This consumer module is useful for both testing and basic recording of
  * captured acoustic data without analysis. It uses libsndfile to write data to
  * a WAVE file or other appropriate sound file format.
+ *
+ * The next output file is created under a temporary name, its own name with
+ * ".tmp" added, as soon as the current one is opened. Its space is reserved
+ * with fallocate(), where the filesystem supports it, so that moving on to a
+ * new file doesn't have to wait for space to be found. The file is renamed when
+ * it is used, replacing any existing file of that name, and removed at exit if
+ * it never was. Any unused space is given back when a file is closed.
+ *
+ * Writing may instead be done on a separate thread, see
+ * output_sndfile_init_async(), so that a slow disk only stalls the data path
+ * once the queue between them is full. Each output file is then also synced to
+ * disk when it is closed.
+ */
+
+/**
+ * \brief Statistics of a sndfile output consumer, see
+ * output_sndfile_get_stats().
  */
+struct output_sndfile_stats {
+	/**
+	 * \brief Number of buffers which the queue can hold, or zero if
+	 * writing isn't queued.
+	 */
+	uint		depth;
+
+	/**
+	 * \brief Number of writes and resyncs currently waiting in the queue.
+	 */
+	uint		backlog;
+
+	/**
+	 * \brief Largest number of writes and resyncs seen waiting in the
+	 * queue.
+	 */
+	uint		max_backlog;
+
+	/**
+	 * \brief Number of times a write or resync had to wait for space in
+	 * the queue.
+	 */
+	uint64		stalls;
+
+	/**
+	 * \brief Total time in seconds spent waiting for space in the queue.
+	 */
+	double		stall_time;
+
+	/**
+	 * \brief Longest time in seconds spent waiting for space in the queue
+	 * by a single write or resync.
+	 */
+	double		max_stall_time;
+
+	/**
+	 * \brief Total time in seconds spent writing samples and starting new
+	 * files.
+	 */
+	double		write_time;
+
+	/**
+	 * \brief Longest time in seconds spent on a single write or resync,
+	 * including starting any new file.
+	 */
+	double		max_write_time;
+
+	/**
+	 * \brief Number of output files created.
+	 */
+	uint		files;
+};
 
 /**
  * Initialise sndfile output consumer.
@@ -64,4 +133,53 @@
 int output_sndfile_init(struct consumer * consumer, const char * prefix,
 		const char * suffix, int format, uint max_samples_per_file);
 
+/**
+ * \brief Initialise sndfile output consumer with a writer thread.
+ *
+ * Data written to the consumer is queued, holding a reference to each buffer,
+ * and written to disk by a separate thread which also starts each new output
+ * file. The first output file is opened when the consumer is started. If the
+ * writer thread fails, the error is returned by the next write or resync.
+ * Statistics of the queue are logged when the consumer exits.
+ *
+ * \param consumer The consumer object to initialise. The call to
+ * output_sndfile_init_async() should immediately follow the creation of a
+ * consumer object with consumer_new().
+ *
+ * \param prefix The first part of the path for the output file that is to be
+ * written.
+ *
+ * \param suffix The last part of the path for the output file that is to be
+ * written.
+ *
+ * \param format The output file format. This value should be constructed from
+ * the format flags specified in <sndfile.h>.
+ *
+ * \param max_samples_per_file Maximum number of samples to be written to a
+ * single output file until it is closed and a new output file is started.
+ *
+ * \param depth The maximum number of writes and resyncs to queue. Once the
+ * queue is full, writing blocks until the writer thread catches up. If zero,
+ * no writer thread is started and this is equivalent to output_sndfile_init().
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int output_sndfile_init_async(struct consumer * consumer, const char * prefix,
+		const char * suffix, int format, uint max_samples_per_file,
+		uint depth);
+
+/**
+ * \brief Get the statistics of a sndfile output consumer.
+ *
+ * The file count is updated by the writer thread without locking, so a snapshot
+ * taken while it is running may be slightly out of date.
+ *
+ * \param consumer A consumer object initialised by output_sndfile_init() or
+ * output_sndfile_init_async().
+ *
+ * \param stats Structure to fill with the current statistics.
+ */
+void output_sndfile_get_stats(struct consumer * consumer,
+		struct output_sndfile_stats * stats);
+
 #endif /* !__TUNA_OUTPUT_SNDFILE_H_INCLUDED__ */
@@ -0,0 +1,78 @@
+/*******************************************************************************
+	rt.h: Real-time scheduling, CPU affinity and memory locking.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#ifndef __TUNA_RT_H_INCLUDED__
+#define __TUNA_RT_H_INCLUDED__
+
+#include <pthread.h>
+
+/**
+ * \file <tuna/rt.h>
+ *
+ * \brief Real-time scheduling, CPU affinity and memory locking.
+ *
+ * A producer capturing live data must keep up with the device or samples are
+ * lost. Under load it competes for the processor with everything else on the
+ * system, including the threads which process its data. These functions let a
+ * thread run under the SCHED_FIFO real-time policy, pin threads to particular
+ * CPUs and lock the process's memory so that it is never paged out.
+ *
+ * All of these usually need privileges, such as CAP_SYS_NICE and CAP_IPC_LOCK
+ * or suitable limits in /etc/security/limits.conf. Each function prints a
+ * warning and returns an error if it fails, leaving things as they were, so
+ * that the caller can carry on without.
+ */
+
+/**
+ * Run a thread under the SCHED_FIFO policy.
+ *
+ * \param thread The thread to change.
+ *
+ * \param priority The real-time priority, from 1 to 99 on Linux.
+ *
+ * \return >=0 on success, -EPERM if not permitted, <0 on other failures.
+ */
+int rt_set_priority(pthread_t thread, int priority);
+
+/**
+ * Restrict a thread to running on a single CPU.
+ *
+ * \param thread The thread to change.
+ *
+ * \param cpu The number of the CPU, counting from zero.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int rt_set_cpu(pthread_t thread, int cpu);
+
+/**
+ * Lock all memory mapped by the process into RAM.
+ *
+ * Memory mapped later is also locked if the process may lock an unlimited
+ * amount, otherwise later allocations could fail once the limit is reached so
+ * only the memory already mapped is locked. This should therefore be called
+ * once everything has been set up.
+ *
+ * \return 1 if current and future memory is locked, 0 if only current memory
+ * is locked, -EPERM if not permitted or <0 on other failures.
+ */
+int rt_lock_memory();
+
+#endif /* !__TUNA_RT_H_INCLUDED__ */
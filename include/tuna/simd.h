@@ -0,0 +1,100 @@
+/*******************************************************************************
+	simd.h: Runtime selection of SIMD instruction set.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#ifndef __TUNA_SIMD_H_INCLUDED__
+#define __TUNA_SIMD_H_INCLUDED__
+
+/**
+ * \file <tuna/simd.h>
+ *
+ * \brief Runtime selection of SIMD instruction set.
+ *
+ * When built with ENABLE_X86_SIMD, the processing modules contain kernels for
+ * several generations of x86 vector instructions. The widest set supported by
+ * the processor is detected the first time it is needed and the corresponding
+ * kernels are selected when each module is started. A lower level may be forced
+ * with simd_set_level(), for example to benchmark or check the narrower
+ * kernels.
+ *
+ * Without ENABLE_X86_SIMD the level is always ::SIMD_LEVEL_NONE. ARM NEON
+ * support is selected at compile time by ENABLE_ARM_NEON and is not covered
+ * here.
+ */
+
+/**
+ * \brief SIMD instruction set levels, in increasing order of width.
+ */
+enum simd_levels {
+	/**
+	 * \brief Plain scalar code.
+	 */
+	SIMD_LEVEL_NONE,
+
+	/**
+	 * \brief 128-bit SSE vectors, up to SSE4.1.
+	 */
+	SIMD_LEVEL_SSE4_1,
+
+	/**
+	 * \brief 256-bit AVX2 vectors.
+	 */
+	SIMD_LEVEL_AVX2,
+
+	/**
+	 * \brief 512-bit AVX-512F vectors.
+	 */
+	SIMD_LEVEL_AVX512
+};
+
+/**
+ * Detect the widest SIMD level supported by both this build and the processor.
+ *
+ * \return The detected level.
+ */
+enum simd_levels simd_detect();
+
+/**
+ * Get the SIMD level which should currently be used by processing modules.
+ *
+ * \return The level set by simd_set_level(), or the detected level if none has
+ * been set.
+ */
+enum simd_levels simd_get_level();
+
+/**
+ * Force a SIMD level. This only affects modules started after the call.
+ *
+ * \param level The level to use, which must not be wider than the level
+ * returned by simd_detect().
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int simd_set_level(enum simd_levels level);
+
+/**
+ * Get a printable name for a SIMD level.
+ *
+ * \param level The level to name.
+ *
+ * \return A constant string naming the level.
+ */
+const char * simd_level_name(enum simd_levels level);
+
+#endif /* !__TUNA_SIMD_H_INCLUDED__ */
@@ -0,0 +1,112 @@
+/*******************************************************************************
+	tee.h: Forward data to any number of consumers.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#ifndef __TUNA_TEE_H_INCLUDED__
+#define __TUNA_TEE_H_INCLUDED__
+
+#include "bufq.h"
+#include "consumer.h"
+#include "types.h"
+
+/**
+ * \file <tuna/tee.h>
+ *
+ * \brief Forward data to any number of consumers.
+ *
+ * This consumer passes each start, write and resync on to a list of branch
+ * consumers in the order they were added. A branch may be added directly, in
+ * which case it runs on the writer's thread, or behind its own buffer queue in
+ * ::BUFQ_MODE_DROP. A queued branch runs on its own thread and can never stall
+ * the writer or the other branches: if it falls too far behind, its buffers are
+ * dropped and counted rather than blocking. This is intended for outputs such
+ * as output_sndfile, where a slow disk should not hold up real-time analysis.
+ *
+ * The tee takes ownership of its branches and exits them when it is exited.
+ */
+
+/**
+ * Initialise a tee consumer with no branches.
+ *
+ * \param consumer The consumer object to initialise. The call to tee_init()
+ * should immediately follow the creation of a consumer object with
+ * consumer_new().
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int tee_init(struct consumer * consumer);
+
+/**
+ * Add a branch to a tee consumer. This must be done before the tee is started.
+ *
+ * \param consumer A consumer object initialised by tee_init().
+ *
+ * \param target The consumer which will receive data from this branch. On
+ * success the tee takes ownership of the target.
+ *
+ * \param queued Non-zero to feed the target through its own dropping buffer
+ * queue, zero to write to it directly.
+ *
+ * \param depth Depth of the queue for a queued branch, see bufq_init_mode().
+ * Ignored if the branch is not queued.
+ *
+ * \return The index of the new branch on success, <0 on failure.
+ */
+int tee_add_branch(struct consumer * consumer, struct consumer * target,
+		int queued, uint depth);
+
+/**
+ * Get the number of branches in a tee consumer.
+ *
+ * \param consumer A consumer object initialised by tee_init().
+ *
+ * \return The number of branches.
+ */
+uint tee_get_branch_count(struct consumer * consumer);
+
+/**
+ * Get the queue statistics of a branch of a tee consumer. Branches which aren't
+ * queued always report zero.
+ *
+ * \param consumer A consumer object initialised by tee_init().
+ *
+ * \param index The index of the branch, as returned by tee_add_branch().
+ *
+ * \param stats Structure to fill with the branch statistics.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int tee_get_branch_stats(struct consumer * consumer, uint index,
+		struct bufq_stats * stats);
+
+/**
+ * Pin the queue thread of a branch of a tee consumer to a single CPU, see
+ * bufq_set_cpu().
+ *
+ * \param consumer A consumer object initialised by tee_init().
+ *
+ * \param index The index of the branch, as returned by tee_add_branch().
+ *
+ * \param cpu The number of the CPU, counting from zero.
+ *
+ * \return >=0 on success, <0 on failure or if the branch isn't queued.
+ */
+int tee_set_branch_cpu(struct consumer * consumer, uint index, int cpu);
+
+#endif /* !__TUNA_TEE_H_INCLUDED__ */
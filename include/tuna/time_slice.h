@@ -55,6 +55,13 @@
  * START line is written at the beginning of the file (see csv_write_start())
  * and a RESYNC line is written each time analysis is recovered following a loss
  * of synchronisation (see csv_write_resync()).
+ *
+ * If initialised with time_slice_init_parallel(), whole time slices, including
+ * the half which overlaps with the previous slice, are copied out and handed to
+ * a pool of worker threads, each with its own FFT plan and buffers. The results
+ * are written out in order, so the output is identical to that of a serial
+ * time_slice consumer. This is intended for reprocessing recordings, where the
+ * input can be read much faster than real time.
  */
 
 /**
@@ -75,4 +82,63 @@
 int time_slice_init(struct consumer * consumer, const char * out_name,
 		int out_mode);
 
+/**
+ * Initialise per-time slice analysis using a pool of worker threads.
+ *
+ * \param consumer The consumer object to initialise. The call to
+ * time_slice_init_parallel() should immediately follow the creation of a
+ * consumer object with consumer_new().
+ *
+ * \param out_name The filename of the output file which will be created.
+ * Analysis results will be written to this file in CSV or DAT format depending
+ * on the value of out_mode.
+ *
+ * \param out_mode Output mode, either TUNA_OUT_MODE_CSV or TUNA_OUT_MODE_DAT.
+ *
+ * \param n_threads The number of worker threads to use. Zero processes each
+ * time slice on the calling thread, as time_slice_init() does.
+ *
+ * \return >=0 on success, <0 on failure.
+ */
+int time_slice_init_parallel(struct consumer * consumer, const char * out_name,
+		int out_mode, uint n_threads);
+
+/**
+ * Convert a block of samples to floating point and multiply them by a window,
+ * using the kernel selected for the current SIMD level. This is the kernel
+ * used for the first and last quarters of each time slice and is exposed so
+ * that it can be benchmarked on its own.
+ *
+ * \param data The samples to process.
+ *
+ * \param window The window, with one value for each sample.
+ *
+ * \param out Buffer into which the windowed samples are written.
+ *
+ * \param count The number of samples in data.
+ */
+void time_slice_window(sample_t * data, float * window, float * out,
+		uint count);
+
+/**
+ * As time_slice_window(), also finding the peaks of the samples and
+ * accumulating the sums of the 1st to 4th powers of their magnitudes in the
+ * same pass. This is the kernel used for the middle half of each time slice.
+ *
+ * \param data The samples to process.
+ *
+ * \param window The window, with one value for each sample.
+ *
+ * \param out Buffer into which the windowed samples are written.
+ *
+ * \param count The number of samples in data.
+ *
+ * \param peaks The peak positive and peak negative values, which are updated
+ * with any larger peaks in data.
+ *
+ * \param moments The four sums, to which the sums over data are added.
+ */
+void time_slice_window_stats(sample_t * data, float * window, float * out,
+		uint count, sample_t * peaks, float * moments);
+
 #endif /* !__TUNA_TIME_SLICE_H_INCLUDED__ */
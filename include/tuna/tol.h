@@ -145,7 +145,49 @@ int tol_get_coeffs(struct tol * t, uint level, float * dest, uint length);
  * written. The length of this array can be obtained by calling
  * tol_get_num_levels() and the given buffer must be large enough to store this
  * number of floating point values.
+ *
+ * When x86 SIMD kernels are enabled (see <tuna/simd.h>), the sums are
+ * accumulated in a different order to the scalar code. Each result is then
+ * expected to agree with the scalar result to within a relative tolerance of
+ * 1e-4. In practice the difference is around 1e-6 for a 32768 point transform
+ * and 1e-5 for a 400000 point transform.
  */
 void tol_calculate(struct tol * t, float complex * cdata, float * results);
 
+/**
+ * Sum the power of an array of frequency domain samples using the kernel which
+ * the given context selected for the current SIMD level. This is the kernel
+ * used by tol_calculate() below the transition of each band and is exposed so
+ * that it can be benchmarked on its own.
+ *
+ * \param t The third octave level calculation context to use.
+ *
+ * \param x A pointer to an array of complex frequency domain samples.
+ *
+ * \param N The number of samples in x.
+ *
+ * \return The sum of the squared magnitudes of the samples.
+ */
+float tol_psum(struct tol * t, float complex * x, uint N);
+
+/**
+ * Accumulate the weighted power of an array of frequency domain samples into
+ * two bands using the kernel which the given context selected for the current
+ * SIMD level. This is the kernel used by tol_calculate() over the transition
+ * between two bands and is exposed so that it can be benchmarked on its own.
+ *
+ * \param t The third octave level calculation context to use.
+ *
+ * \param x A pointer to an array of complex frequency domain samples.
+ *
+ * \param w A pointer to an array of 2N weighting coefficients, interleaved so
+ * that w[2i] and w[2i+1] weight sample i for the first and second band.
+ *
+ * \param N The number of samples in x.
+ *
+ * \param e A pointer to the two band results, to which the weighted sums are
+ * added.
+ */
+void tol_wpsum2(struct tol * t, float complex * x, float * w, uint N, float * e);
+
 #endif /* !__TUNA_TOL_H_INCLUDED__ */
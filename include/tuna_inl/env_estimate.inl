@@ -28,9 +28,21 @@
 
 #include "types.h"
 
+/* Number of precomputed powers of the decay factor, enough for the widest
+ * vector used by env_estimate_block().
+ */
+#define ENV_ESTIMATE_MAX_POW 16
+
 struct env_estimate {
 	float		decay;
 	float		cur;
+
+	/* decay_pow[i] = decay^(i + 1). */
+	float		decay_pow[ENV_ESTIMATE_MAX_POW];
+
+	/* Kernel used by env_estimate_block(), selected at init. */
+	void		(*block)(struct env_estimate * e, sample_t * in,
+				env_t * out, uint n);
 };
 
 TUNA_INLINE env_t env_estimate_next(struct env_estimate * e, sample_t x)
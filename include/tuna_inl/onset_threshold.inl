@@ -27,100 +27,75 @@
 
 #include "types.h"
 
-struct minima {
-	env_t			value;
-	uint			expiry;
-};
-
+/* The moving minimum is found using the van Herk/Gil-Werman algorithm. The
+ * input is split into blocks of windowlen samples, so that the window ending at
+ * any sample covers the start of the current block and the end of the previous
+ * block. The minimum over the first part is the running minimum of the current
+ * block, kept in prefix[], and the minimum over the second part is the minimum
+ * from that position to the end of the previous block, kept in suffix[] and
+ * calculated once each block is complete. Thus each sample costs a constant
+ * amount of work regardless of the window length.
+ */
 struct onset_threshold {
 	/* Ratio to multiply the output of the moving minimum filter by to get
 	 * the onset threshold.
 	 */
 	env_t			ratio;
 
-	/* Indices of left and right ends of the queue. Data at mins[left] and
-	 * mins[right] is valid as long as len > 0.
-	 */
-	uint			left;
-	uint			right;
+	/* Length of the analysis window and therefore length of each block. */
+	uint			windowlen;
 
-	/* Number of valid minima in the deque. */
-	uint			len;
+	/* Position in the current block of the next sample. */
+	uint			pos;
 
-	/* Length of the analysis window and therefore length of the circular
-	 * buffer allocated.
+	/* Non-zero once a block has been completed since the last reset, so
+	 * that suffix[] is valid.
 	 */
-	uint			windowlen;
+	int			have_prev;
 
-	/* Incrementing counter used to determine when a minima expires. This
-	 * counts modulo $windowlen.
-	 */
-	uint			ticker;
+	/* Samples of the current block. */
+	env_t *			block;
+
+	/* prefix[i] is the minimum of block[0..i]. */
+	env_t *			prefix;
 
-	struct minima		mins[];
+	/* suffix[i] is the minimum of the previous block from position i to
+	 * the end and suffix_pos[i] is the position of the oldest sample with
+	 * that value. suffix[windowlen] is larger than any envelope so that
+	 * the window ending at the last sample of a block is handled without
+	 * a special case.
+	 */
+	env_t *			suffix;
+	uint *			suffix_pos;
 };
 
+void onset_threshold_end_block(struct onset_threshold * onset);
+
 TUNA_INLINE void onset_threshold_next(struct onset_threshold * onset,
 		env_t next, env_t * threshold)
 {
 	assert(onset);
 	assert(threshold);
 
-	/* Pop from right while highest min > next. */
-	while (onset->len > 1) {
-		if (onset->mins[onset->right].value <= next) {
-			/* Advance ticker and pop from left if expired. */
-			if (onset->mins[onset->left].expiry == ++onset->ticker) {
-				if (++onset->left == onset->windowlen)
-					onset->left = 0;
-				*threshold = onset->mins[onset->left].value * onset->ratio;
-			} else
-				onset->len++;
-
-			if (++onset->right == onset->windowlen)
-				onset->right = 0;
-
-			/* Add to the right of the deque. */
-			onset->mins[onset->right].value = next;
-			onset->mins[onset->right].expiry = onset->ticker + onset->windowlen;
-
-			return;
-		}
-		if (onset->right == 0)
-			onset->right = onset->windowlen;
-		onset->right--;
-		onset->len--;
-	}
-
-	if (onset->mins[onset->right].value <= next) {
-		/* Advance ticker and pop from left if expired. */
-		if (onset->mins[onset->left].expiry == ++onset->ticker) {
-			onset->right = 0;
-			onset->left = 0;
-			onset->mins[0].value = next;
-			onset->mins[0].expiry = onset->ticker + onset->windowlen;
-			*threshold = next * onset->ratio;
-			return;
-		}
-
-		onset->len = 2;
-		if (++onset->right == onset->windowlen)
-			onset->right = 0;
-
-		/* Add to the right of the deque. */
-		onset->mins[onset->right].value = next;
-		onset->mins[onset->right].expiry = onset->ticker + onset->windowlen;
-		return;
-	}
-
-	onset->right = 0;
-	onset->left = 0;
-
-	/* Add to the right of the deque. */
-	onset->mins[0].value = next;
-	onset->mins[0].expiry = onset->ticker + onset->windowlen;
-
-	*threshold = next * onset->ratio;
+	uint p = onset->pos;
+	env_t m;
+
+	/* Extend the running minimum of the current block. */
+	onset->block[p] = next;
+	if (p == 0 || next < onset->prefix[p - 1])
+		m = next;
+	else
+		m = onset->prefix[p - 1];
+	onset->prefix[p] = m;
+
+	/* Combine with the minimum over the end of the previous block. */
+	if (onset->have_prev && onset->suffix[p + 1] < m)
+		m = onset->suffix[p + 1];
+
+	*threshold = m * onset->ratio;
+
+	if (++onset->pos == onset->windowlen)
+		onset_threshold_end_block(onset);
 }
 
 #if defined(ENABLE_INLINE) && defined(__TUNA_ONSET_THRESHOLD_C__)
@@ -24,6 +24,7 @@
 #include <time.h>
 
 #include "analysis.h"
+#include "bufq.h"
 #include "consumer.h"
 #include "fft.h"
 #include "log.h"
@@ -34,18 +35,70 @@
 struct analysis {
 	struct consumer * pulse;
 	struct consumer * time_slice;
+
+	/* In parallel mode each child is fed through its own bufq so that it
+	 * runs on its own thread. Otherwise these point at the children.
+	 */
+	struct consumer * pulse_in;
+	struct consumer * time_slice_in;
+	int parallel;
 };
 
 /*******************************************************************************
 	Private declarations and functions
 *******************************************************************************/
 
+/* In parallel mode, wait for both worker threads to catch up so that errors
+ * from start and resync are reported to our caller.
+ */
+static int join(struct analysis * a)
+{
+	assert(a);
+
+	int r, r2;
+
+	if (!a->parallel)
+		return 0;
+
+	r = bufq_sync(a->pulse_in);
+	r2 = bufq_sync(a->time_slice_in);
+
+	return (r < 0) ? r : r2;
+}
+
+static int init_worker(struct consumer ** in, struct consumer * target)
+{
+	assert(in);
+	assert(target);
+
+	int r;
+
+	*in = consumer_new();
+	if (!*in)
+		return -1;
+
+	r = bufq_init_mode(*in, target, BUFQ_MODE_RING, 0);
+	if (r < 0) {
+		consumer_exit(*in);
+		*in = NULL;
+	}
+
+	return r;
+}
+
 void analysis_exit(struct consumer * consumer)
 {
 	assert(consumer);
 
 	struct analysis * a = (struct analysis *) consumer_get_data(consumer);
 
+	/* Exiting the queues waits for the worker threads to finish with the
+	 * children.
+	 */
+	if (a->parallel) {
+		consumer_exit(a->pulse_in);
+		consumer_exit(a->time_slice_in);
+	}
 	consumer_exit(a->pulse);
 	consumer_exit(a->time_slice);
 	free(a);
@@ -59,11 +112,11 @@ int analysis_write(struct consumer * consumer, sample_t * buf, uint count)
 	int r;
 	struct analysis * a = (struct analysis *) consumer_get_data(consumer);
 
-	r = consumer_write(a->pulse, buf, count);
+	r = consumer_write(a->pulse_in, buf, count);
 	if (r < 0)
 		return r;
 
-	r = consumer_write(a->time_slice, buf, count);
+	r = consumer_write(a->time_slice_in, buf, count);
 
 	return r;
 }
@@ -76,13 +129,15 @@ int analysis_start(struct consumer * consumer, uint sample_rate, struct timespec
 	int r;
 	struct analysis * a = (struct analysis *) consumer_get_data(consumer);
 
-	r = consumer_start(a->pulse, sample_rate, ts);
+	r = consumer_start(a->pulse_in, sample_rate, ts);
 	if (r < 0)
 		return r;
 
-	r = consumer_start(a->time_slice, sample_rate, ts);
+	r = consumer_start(a->time_slice_in, sample_rate, ts);
+	if (r < 0)
+		return r;
 
-	return r;
+	return join(a);
 }
 
 int analysis_resync(struct consumer * consumer, struct timespec * ts)
@@ -93,22 +148,24 @@ int analysis_resync(struct consumer * consumer, struct timespec * ts)
 	int r;
 	struct analysis * a = (struct analysis *) consumer_get_data(consumer);
 
-	r = consumer_resync(a->pulse, ts);
+	r = consumer_resync(a->pulse_in, ts);
 	if (r < 0)
 		return r;
 
-	r = consumer_resync(a->time_slice, ts);
+	r = consumer_resync(a->time_slice_in, ts);
+	if (r < 0)
+		return r;
 
-	return r;
+	return join(a);
 }
 
 /*******************************************************************************
 	Public functions
 *******************************************************************************/
 
-int analysis_init(struct consumer * consumer, const char * pulse_csv_name,
+static int init(struct consumer * consumer, const char * pulse_csv_name,
 		const char * time_slice_csv_name,
-		const struct pulse_params * pulse_params)
+		const struct pulse_params * pulse_params, int parallel)
 {
 	assert(consumer);
 
@@ -148,6 +205,24 @@ int analysis_init(struct consumer * consumer, const char * pulse_csv_name,
 		goto err;
 	}
 
+	a->parallel = parallel;
+	if (parallel) {
+		r = init_worker(&a->pulse_in, a->pulse);
+		if (r < 0) {
+			error("analysis: Failed to create pulse processing thread");
+			goto err;
+		}
+
+		r = init_worker(&a->time_slice_in, a->time_slice);
+		if (r < 0) {
+			error("analysis: Failed to create time slice processing thread");
+			goto err;
+		}
+	} else {
+		a->pulse_in = a->pulse;
+		a->time_slice_in = a->time_slice;
+	}
+
 	consumer_set_module(consumer, analysis_write, analysis_start,
 			analysis_resync, analysis_exit, a);
 
@@ -155,6 +230,10 @@ int analysis_init(struct consumer * consumer, const char * pulse_csv_name,
 
 err:
 	if (a) {
+		if (a->parallel && a->pulse_in)
+			consumer_exit(a->pulse_in);
+		if (a->parallel && a->time_slice_in)
+			consumer_exit(a->time_slice_in);
 		if (a->pulse)
 			consumer_exit(a->pulse);
 		if (a->time_slice)
@@ -164,3 +243,19 @@ err:
 
 	return r;
 }
+
+int analysis_init(struct consumer * consumer, const char * pulse_csv_name,
+		const char * time_slice_csv_name,
+		const struct pulse_params * pulse_params)
+{
+	return init(consumer, pulse_csv_name, time_slice_csv_name, pulse_params,
+			0);
+}
+
+int analysis_init_parallel(struct consumer * consumer,
+		const char * pulse_csv_name, const char * time_slice_csv_name,
+		const struct pulse_params * pulse_params)
+{
+	return init(consumer, pulse_csv_name, time_slice_csv_name, pulse_params,
+			1);
+}
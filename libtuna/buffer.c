@@ -18,39 +18,390 @@
 	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 *******************************************************************************/
 
+/* Needed for MAP_ANONYMOUS, MAP_HUGETLB and MADV_HUGEPAGE. */
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <errno.h>
 #include <malloc.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "buffer.h"
 #include "compiler.h"
+#include "log.h"
 #include "types.h"
 
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* Buffers are pooled in power of two size classes from 2^BUFFER_MIN_SHIFT to
+ * 2^BUFFER_MAX_SHIFT samples. Larger requests are allocated and freed directly.
+ */
+#define BUFFER_MIN_SHIFT	10
+#define BUFFER_MAX_SHIFT	20
+#define BUFFER_N_CLASSES	(BUFFER_MAX_SHIFT - BUFFER_MIN_SHIFT + 1)
+#define BUFFER_UNPOOLED		BUFFER_N_CLASSES
+#define BUFFER_ARENA		(BUFFER_N_CLASSES + 1)
+
+/* Sizing of the arena beyond the queue depth: enough buffers to cover this
+ * many seconds of data held back by the analysis modules for each stream, plus
+ * a few spares for buffers in flight between producer and queue.
+ */
+#define BUFFER_ARENA_HOLD_SECONDS	2
+#define BUFFER_ARENA_SPARE		4
+
+/* Explicit hugepages are 2MiB on the platforms we care about, round the arena
+ * up to this so that a MAP_HUGETLB mapping can succeed.
+ */
+#define BUFFER_ARENA_ALIGN	(2U << 20)
+
+/* Maximum number of free buffers of each size class which a thread may keep in
+ * its private cache. Beyond this, half of the cache is handed back to the
+ * shared pool. When a cache runs dry it is refilled with up to half of this
+ * number from the shared pool.
+ */
+#define BUFFER_CACHE_MAX	16
+
+/* The data is cache line aligned so that the reference count, which may be
+ * updated from several threads, doesn't share a line with sample data.
+ */
 struct buffer_head {
-	uint		refs;
-	sample_t	data		__attribute__ ((aligned(16)));
+	struct buffer_head *	next;
+	uint			refs;
+	uint			size_class;
+	sample_t		data		__cacheline_aligned;
 };
 
+struct buffer_cache {
+	struct buffer_head *	free[BUFFER_N_CLASSES];
+	uint			count[BUFFER_N_CLASSES];
+};
+
+/* Shared pool, protected by pool_mutex. */
+static struct buffer_head * pool_free[BUFFER_N_CLASSES];
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Per-thread cache. The pthread key is only used so that we get a destructor
+ * call when a thread exits, access is through the __thread pointer.
+ */
+static __thread struct buffer_cache * thread_cache;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/* Statistics, updated atomically. */
+static struct buffer_stats stats;
+
+/* Preallocated arena. While the arena is active all buffers come from here.
+ * Arena slots bypass the per-thread caches so that free slots can't get
+ * stranded in the cache of a thread which isn't acquiring buffers.
+ */
+struct buffer_arena {
+	void *			base;
+	size_t			size;
+	size_t			slot_size;
+	uint			slot_frames;
+	uint			n_slots;
+	struct buffer_head *	free;
+	pthread_mutex_t		mutex;
+};
+
+static struct buffer_arena * arena;
+
+static uint get_size_class(uint frames)
+{
+	uint c = 0;
+
+	while (c < BUFFER_N_CLASSES && (1U << (c + BUFFER_MIN_SHIFT)) < frames)
+		c++;
+
+	return c;
+}
+
+static uint get_class_frames(uint size_class)
+{
+	assert(size_class < BUFFER_N_CLASSES);
+
+	return 1U << (size_class + BUFFER_MIN_SHIFT);
+}
+
+static void stats_add(uint64 * counter, uint64 n)
+{
+	__atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+static void stats_sub(uint64 * counter, uint64 n)
+{
+	__atomic_sub_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+static void stats_acquired()
+{
+	uint64 in_use, high;
+
+	in_use = __atomic_add_fetch(&stats.in_use, 1, __ATOMIC_RELAXED);
+	high = __atomic_load_n(&stats.high_water, __ATOMIC_RELAXED);
+	while (in_use > high) {
+		if (__atomic_compare_exchange_n(&stats.high_water, &high,
+					in_use, 1, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+			break;
+	}
+}
+
+static struct buffer_head * alloc_head(uint frames)
+{
+	struct buffer_head * h;
+	size_t sz;
+	int r;
+
+	sz = sizeof(struct buffer_head) + frames * sizeof(sample_t);
+
+	r = posix_memalign((void **)&h, TUNA_CACHELINE_SIZE, sz);
+	if (r)
+		return NULL;
+
+	stats_add(&stats.misses, 1);
+	stats_add(&stats.allocated, 1);
+	return h;
+}
+
+static void free_head(struct buffer_head * h)
+{
+	assert(h);
+
+	stats_sub(&stats.allocated, 1);
+	free(h);
+}
+
+/* Move all but n buffers of the given class from a thread cache to the shared
+ * pool.
+ */
+static void cache_spill(struct buffer_cache * c, uint size_class, uint n)
+{
+	assert(c);
+
+	struct buffer_head * h;
+
+	pthread_mutex_lock(&pool_mutex);
+	while (c->count[size_class] > n) {
+		h = c->free[size_class];
+		c->free[size_class] = h->next;
+		c->count[size_class]--;
+
+		h->next = pool_free[size_class];
+		pool_free[size_class] = h;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+/* Move up to n buffers of the given class from the shared pool to a thread
+ * cache.
+ */
+static void cache_refill(struct buffer_cache * c, uint size_class, uint n)
+{
+	assert(c);
+
+	struct buffer_head * h;
+
+	pthread_mutex_lock(&pool_mutex);
+	while (n-- && pool_free[size_class]) {
+		h = pool_free[size_class];
+		pool_free[size_class] = h->next;
+
+		h->next = c->free[size_class];
+		c->free[size_class] = h;
+		c->count[size_class]++;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+static void cache_destroy(void * p)
+{
+	struct buffer_cache * c = (struct buffer_cache *)p;
+	uint i;
+
+	/* Later destructors may still release buffers on this thread, which
+	 * must not find the cache once it has been freed.
+	 */
+	thread_cache = NULL;
+
+	for (i = 0; i < BUFFER_N_CLASSES; i++)
+		cache_spill(c, i, 0);
+
+	free(c);
+}
+
+static void cache_key_init()
+{
+	pthread_key_create(&cache_key, cache_destroy);
+}
+
+static struct buffer_cache * get_cache()
+{
+	struct buffer_cache * c = thread_cache;
+
+	if (c)
+		return c;
+
+	c = (struct buffer_cache *)calloc(1, sizeof(struct buffer_cache));
+	if (!c)
+		return NULL;
+
+	pthread_once(&cache_key_once, cache_key_init);
+	pthread_setspecific(cache_key, c);
+	thread_cache = c;
+
+	return c;
+}
+
+/* Count a request which the arena couldn't serve. Failures are logged the
+ * first time and then each time their count doubles, so that a shortage which
+ * lasts can't flood the log from the capture thread.
+ */
+static void arena_failed(uint frames, const char * reason)
+{
+	uint64 n;
+
+	n = __atomic_add_fetch(&stats.arena_failures, 1, __ATOMIC_RELAXED);
+	if ((n & (n - 1)) == 0)
+		error("buffer: Arena can't supply %u samples, %s (%llu failures)",
+				frames, reason, n);
+}
+
+static sample_t * arena_acquire(uint * frames)
+{
+	assert(frames);
+
+	struct buffer_head * h;
+
+	/* Fail rather than fall back to malloc, the whole point of the arena
+	 * is that nothing touches the system allocator once it is set up.
+	 */
+	if (*frames > arena->slot_frames) {
+		arena_failed(*frames, "larger than an arena buffer");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&arena->mutex);
+	h = arena->free;
+	if (h)
+		arena->free = h->next;
+	pthread_mutex_unlock(&arena->mutex);
+
+	if (!h) {
+		arena_failed(*frames, "all buffers are in use");
+		return NULL;
+	}
+
+	stats_add(&stats.hits, 1);
+
+	*frames = arena->slot_frames;
+	h->next = NULL;
+	h->refs = 1;
+	h->size_class = BUFFER_ARENA;
+	stats_acquired();
+	return &h->data;
+}
+
+static void arena_release(struct buffer_head * h)
+{
+	assert(h);
+	assert(arena);
+
+	pthread_mutex_lock(&arena->mutex);
+	h->next = arena->free;
+	arena->free = h;
+	pthread_mutex_unlock(&arena->mutex);
+}
+
+static void * arena_map(size_t size, const char ** backing)
+{
+	void * p;
+
+	*backing = "explicit hugepages";
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+		return p;
+#endif
+
+	*backing = "normal pages";
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+#ifdef MADV_HUGEPAGE
+	if (madvise(p, size, MADV_HUGEPAGE) == 0)
+		*backing = "transparent hugepages";
+#endif
+
+	return p;
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
 /* Acquire a buffer of at least (*frames) samples. The actual number of samples
  * which can be stored in the buffer is written back to (*frames).
  *
- * Buffers currently aren't cached so we will allocate exactly the number of
- * frames requested.
+ * While the arena is active requests are only served from there. Otherwise they
+ * are rounded up to a power of two size class and served from the calling
+ * thread's cache where possible, then from the shared pool, and only allocated
+ * from the system if both are empty.
  */
 sample_t * buffer_acquire(uint * frames)
 {
-	size_t sz;
-	struct buffer_head * h;
-	int r;
+	struct buffer_head * h = NULL;
+	struct buffer_cache * c;
+	uint size_class;
 
 	assert(frames);
-	sz = sizeof(struct buffer_head) + (*frames) * sizeof(sample_t);
 
-	r = posix_memalign((void **)&h, 16, sz);
-	if (r)
-		return NULL;
+	if (arena)
+		return arena_acquire(frames);
+
+	size_class = get_size_class(*frames);
+	if (size_class == BUFFER_UNPOOLED) {
+		h = alloc_head(*frames);
+		if (!h)
+			return NULL;
+
+		goto out;
+	}
+
+	c = get_cache();
+	if (c) {
+		if (!c->free[size_class])
+			cache_refill(c, size_class, BUFFER_CACHE_MAX / 2);
+
+		h = c->free[size_class];
+		if (h) {
+			c->free[size_class] = h->next;
+			c->count[size_class]--;
+			stats_add(&stats.hits, 1);
+		}
+	}
+
+	if (!h) {
+		h = alloc_head(get_class_frames(size_class));
+		if (!h)
+			return NULL;
+	}
 
+	*frames = get_class_frames(size_class);
+
+out:
+	h->next = NULL;
 	h->refs = 1;
+	h->size_class = size_class;
+	stats_acquired();
 	return &h->data;
 }
 
@@ -59,22 +410,51 @@ void buffer_addref(sample_t * p)
 	assert(p);
 	struct buffer_head * h = container_of(p, struct buffer_head, data);
 
-	h->refs++;
+	__atomic_add_fetch(&h->refs, 1, __ATOMIC_RELAXED);
 }
 
 int buffer_release(sample_t * p)
 {
 	assert(p);
 	struct buffer_head * h = container_of(p, struct buffer_head, data);
+	struct buffer_cache * c;
+	uint size_class;
+
+	/* Release ordering makes our writes to the buffer visible to whichever
+	 * thread drops the last reference, acquire ordering on that thread
+	 * stops it reusing the buffer before they are.
+	 */
+	if (__atomic_sub_fetch(&h->refs, 1, __ATOMIC_ACQ_REL))
+		return 0;
 
-	h->refs--;
+	stats_sub(&stats.in_use, 1);
 
-	if (!h->refs) {
-		free(h);
+	size_class = h->size_class;
+	if (size_class == BUFFER_UNPOOLED) {
+		free_head(h);
 		return 1;
 	}
 
-	return 0;
+	if (size_class == BUFFER_ARENA) {
+		arena_release(h);
+		return 1;
+	}
+
+	c = get_cache();
+	if (!c) {
+		/* Can't cache it so hand it straight back to the system. */
+		free_head(h);
+		return 1;
+	}
+
+	h->next = c->free[size_class];
+	c->free[size_class] = h;
+	c->count[size_class]++;
+
+	if (c->count[size_class] > BUFFER_CACHE_MAX)
+		cache_spill(c, size_class, BUFFER_CACHE_MAX / 2);
+
+	return 1;
 }
 
 uint buffer_refcount(sample_t * p)
@@ -82,5 +462,142 @@ uint buffer_refcount(sample_t * p)
 	assert(p);
 	struct buffer_head * h = container_of(p, struct buffer_head, data);
 
-	return h->refs;
+	return __atomic_load_n(&h->refs, __ATOMIC_RELAXED);
+}
+
+void buffer_get_stats(struct buffer_stats * s)
+{
+	assert(s);
+
+	s->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+	s->misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+	s->allocated = __atomic_load_n(&stats.allocated, __ATOMIC_RELAXED);
+	s->in_use = __atomic_load_n(&stats.in_use, __ATOMIC_RELAXED);
+	s->high_water = __atomic_load_n(&stats.high_water, __ATOMIC_RELAXED);
+	s->arena_failures = __atomic_load_n(&stats.arena_failures,
+			__ATOMIC_RELAXED);
+}
+
+int buffer_arena_init(uint sample_rate, uint buffer_frames, uint n_streams,
+		uint queue_depth)
+{
+	struct buffer_arena * a;
+	struct buffer_head * h;
+	const char * backing;
+	uint i, n_hold;
+	int r, locked;
+
+	if (arena) {
+		error("buffer: Arena already initialised");
+		return -EBUSY;
+	}
+
+	if (!buffer_frames ||
+			get_size_class(buffer_frames) == BUFFER_UNPOOLED) {
+		error("buffer: Invalid arena buffer size %u", buffer_frames);
+		return -EINVAL;
+	}
+
+	a = (struct buffer_arena *)malloc(sizeof(struct buffer_arena));
+	if (!a) {
+		error("buffer: Failed to allocate memory");
+		return -ENOMEM;
+	}
+
+	/* Slots are rounded up to a size class, the count of held buffers uses
+	 * the producer's real buffer size as that's how the data arrives.
+	 */
+	a->slot_frames = get_class_frames(get_size_class(buffer_frames));
+	n_hold = (BUFFER_ARENA_HOLD_SECONDS * sample_rate + buffer_frames - 1)
+		/ buffer_frames;
+	a->n_slots = queue_depth + n_streams * n_hold + BUFFER_ARENA_SPARE;
+	a->slot_size = sizeof(struct buffer_head) +
+		a->slot_frames * sizeof(sample_t);
+	a->slot_size = (a->slot_size + TUNA_CACHELINE_SIZE - 1) &
+		~((size_t)TUNA_CACHELINE_SIZE - 1);
+	a->size = a->n_slots * a->slot_size;
+	a->size = (a->size + BUFFER_ARENA_ALIGN - 1) &
+		~((size_t)BUFFER_ARENA_ALIGN - 1);
+
+	a->base = arena_map(a->size, &backing);
+	if (!a->base) {
+		error("buffer: Failed to map %zu byte arena", a->size);
+		r = -ENOMEM;
+		goto err_map;
+	}
+
+	/* Locking the arena also faults in every page. If we aren't allowed
+	 * to lock this much memory carry on, but touch every page ourselves
+	 * so that at least the first use of each buffer doesn't fault.
+	 */
+	locked = (mlock(a->base, a->size) == 0);
+	if (!locked) {
+		warn("buffer: Failed to lock arena in memory: %s",
+				strerror(errno));
+		memset(a->base, 0, a->size);
+	}
+
+	r = pthread_mutex_init(&a->mutex, NULL);
+	if (r != 0) {
+		error("buffer: Failed to create mutex");
+		r = -r;
+		goto err_mutex;
+	}
+
+	/* Build the free list in address order. */
+	a->free = NULL;
+	for (i = a->n_slots; i > 0; i--) {
+		h = (struct buffer_head *)
+			ptr_offset(a->base, (i - 1) * a->slot_size);
+		h->next = a->free;
+		a->free = h;
+	}
+
+	stats_add(&stats.allocated, a->n_slots);
+
+	msg("buffer: Arena of %u buffers of %u samples (%zu bytes) backed by "
+			"%s%s", a->n_slots, a->slot_frames, a->size, backing,
+			locked ? ", locked" : "");
+
+	arena = a;
+	return 0;
+
+err_mutex:
+	munmap(a->base, a->size);
+err_map:
+	free(a);
+	return r;
+}
+
+uint buffer_arena_frames()
+{
+	return arena ? arena->slot_frames : 0;
+}
+
+void buffer_arena_exit()
+{
+	struct buffer_arena * a = arena;
+	struct buffer_head * h;
+	uint n_free = 0;
+
+	if (!a)
+		return;
+
+	pthread_mutex_lock(&a->mutex);
+	for (h = a->free; h; h = h->next)
+		n_free++;
+	pthread_mutex_unlock(&a->mutex);
+
+	/* We can't unmap memory which is still referenced. */
+	if (n_free != a->n_slots) {
+		warn("buffer: Leaving arena mapped as %u buffers are still in use",
+				a->n_slots - n_free);
+		return;
+	}
+
+	arena = NULL;
+	stats_sub(&stats.allocated, a->n_slots);
+	pthread_mutex_destroy(&a->mutex);
+	munmap(a->base, a->size);
+	free(a);
 }
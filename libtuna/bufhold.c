@@ -21,17 +21,28 @@
 #include <assert.h>
 #include <malloc.h>
 #include <stddef.h>
+#include <stdlib.h>
 
 #include "buffer.h"
 #include "bufhold.h"
 #include "compiler.h"
-#include "list.h"
 #include "log.h"
 #include "types.h"
 
-struct bufhold {
-	struct list		buffers;
-};
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* Held buffer objects are carved out of slabs of this many at a time and
+ * recycled through a free list, so that holding a buffer on the write path
+ * doesn't normally need to allocate.
+ */
+#define BUFHOLD_SLAB_NODES	32
+
+/* Initial number of slots in the ring of held buffer pointers. The ring doubles
+ * in size whenever it fills.
+ */
+#define BUFHOLD_MIN_SLOTS	16
 
 struct held_buffer {
 	/* We may be starting at an offset into the buffer due to previous
@@ -49,51 +60,157 @@ struct held_buffer {
 	sample_t *		data;
 	uint			count;
 
-	struct list_entry	e;
+	/* Position just past the last sample of this buffer in the stream of
+	 * held samples. Positions are kept contiguous across the whole queue
+	 * so that the buffer holding any sample can be found by binary search.
+	 */
+	uint64			end;
+
+	/* Sequence number of this buffer in the queue, its slot in the ring is
+	 * given by seq & bh->mask.
+	 */
+	uint			seq;
+
+	struct bufhold *	bh;
+	struct held_buffer *	next_free;
+};
+
+struct held_slab {
+	struct held_slab *	next;
+	struct held_buffer	nodes[BUFHOLD_SLAB_NODES];
 };
 
+/* Held buffers are kept in order in a ring of pointers. Buffers with sequence
+ * numbers from head up to tail are present.
+ */
+struct bufhold {
+	struct held_buffer **	ring;
+	uint			mask;
+	uint			head;
+	uint			tail;
+
+	/* Position just past the newest held sample and total number of held
+	 * samples.
+	 */
+	uint64			end;
+	uint			total;
+
+	struct held_buffer *	free;
+	struct held_slab *	slabs;
+};
+
+static inline struct held_buffer * slot(struct bufhold * bh, uint seq)
+{
+	return bh->ring[seq & bh->mask];
+}
+
+static struct held_buffer * alloc_node(struct bufhold * bh)
+{
+	struct held_slab * slab;
+	struct held_buffer * h;
+	uint i;
+
+	if (!bh->free) {
+		slab = (struct held_slab *) malloc(sizeof(struct held_slab));
+		if (!slab)
+			return NULL;
+
+		for (i = 0; i < BUFHOLD_SLAB_NODES; i++) {
+			slab->nodes[i].next_free = bh->free;
+			bh->free = &slab->nodes[i];
+		}
+		slab->next = bh->slabs;
+		bh->slabs = slab;
+	}
+
+	h = bh->free;
+	bh->free = h->next_free;
+	return h;
+}
+
+static void free_node(struct bufhold * bh, struct held_buffer * h)
+{
+	buffer_release(h->base);
+	h->next_free = bh->free;
+	bh->free = h;
+}
+
+static int grow_ring(struct bufhold * bh)
+{
+	struct held_buffer ** ring;
+	uint mask, seq;
+
+	mask = bh->mask * 2 + 1;
+	ring = (struct held_buffer **)
+		malloc((mask + 1) * sizeof(struct held_buffer *));
+	if (!ring)
+		return -1;
+
+	for (seq = bh->head; seq != bh->tail; seq++)
+		ring[seq & mask] = slot(bh, seq);
+
+	free(bh->ring);
+	bh->ring = ring;
+	bh->mask = mask;
+
+	return 0;
+}
+
+/* Account for n samples being dropped from the front of the given buffer by
+ * moving all older buffers up to meet it. Nothing needs to be done in the usual
+ * case where the buffer is the oldest one held.
+ */
+static void close_gap(struct held_buffer * h, uint n)
+{
+	struct bufhold * bh = h->bh;
+	uint seq;
+
+	for (seq = bh->head; seq != h->seq; seq++)
+		slot(bh, seq)->end += n;
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
 struct held_buffer * bufhold_oldest(struct bufhold * bh)
 {
 	assert(bh);
-	struct list_entry * e = list_head(&bh->buffers);
 
-	if (e)
-		return container_of(e, struct held_buffer, e);
-	else
+	if (bh->head == bh->tail)
 		return NULL;
+
+	return slot(bh, bh->head);
 }
 
 struct held_buffer * bufhold_newest(struct bufhold * bh)
 {
 	assert(bh);
-	struct list_entry * e = list_tail(&bh->buffers);
 
-	if (e)
-		return container_of(e, struct held_buffer, e);
-	else
+	if (bh->head == bh->tail)
 		return NULL;
+
+	return slot(bh, bh->tail - 1);
 }
 
 struct held_buffer * bufhold_next(struct held_buffer * h)
 {
 	assert(h);
-	struct list_entry * e = list_next(&h->e);
 
-	if (e)
-		return container_of(e, struct held_buffer, e);
-	else
+	if (h->seq + 1 == h->bh->tail)
 		return NULL;
+
+	return slot(h->bh, h->seq + 1);
 }
 
 struct held_buffer * bufhold_prev(struct held_buffer * h)
 {
 	assert(h);
-	struct list_entry * e = list_prev(&h->e);
 
-	if (e)
-		return container_of(e, struct held_buffer, e);
-	else
+	if (h->seq == h->bh->head)
 		return NULL;
+
+	return slot(h->bh, h->seq - 1);
 }
 
 sample_t * bufhold_data(struct held_buffer * h)
@@ -110,11 +227,20 @@ uint bufhold_count(struct held_buffer * h)
 	return h->count;
 }
 
+uint bufhold_total(struct bufhold * bh)
+{
+	assert(bh);
+
+	return bh->total;
+}
+
 int bufhold_advance(struct held_buffer * h, uint offset)
 {
 	assert(h);
 
 	if (offset < h->count) {
+		close_gap(h, offset);
+		h->bh->total -= offset;
 		h->count -= offset;
 		h->data += offset;
 		return h->count;
@@ -129,23 +255,89 @@ void bufhold_release(struct held_buffer * h)
 {
 	assert(h);
 
-	list_remove(&h->e);
-	buffer_release(h->base);
-	free(h);
+	struct bufhold * bh = h->bh;
+	struct held_buffer * o;
+	uint seq;
+
+	/* Shuffle any older buffers up to fill the slot being vacated. */
+	for (seq = h->seq; seq != bh->head; seq--) {
+		o = slot(bh, seq - 1);
+		o->end += h->count;
+		o->seq = seq;
+		bh->ring[seq & bh->mask] = o;
+	}
+	bh->head++;
+
+	bh->total -= h->count;
+	free_node(bh, h);
 }
 
 void bufhold_release_all(struct bufhold * bh)
 {
 	assert(bh);
 
+	uint seq;
+
+	for (seq = bh->head; seq != bh->tail; seq++)
+		free_node(bh, slot(bh, seq));
+
+	bh->head = bh->tail;
+	bh->total = 0;
+}
+
+struct held_buffer * bufhold_find(struct bufhold * bh, uint offset,
+		uint * index)
+{
+	assert(bh);
+	assert(index);
+
+	struct held_buffer * h;
+	uint64 pos;
+	uint lo, hi, mid;
+
+	if (offset >= bh->total)
+		return NULL;
+
+	/* Find the first buffer which ends after the requested position. */
+	pos = bh->end - bh->total + offset;
+	lo = 0;
+	hi = bh->tail - bh->head - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (slot(bh, bh->head + mid)->end > pos)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	h = slot(bh, bh->head + lo);
+	*index = (uint) (pos - (h->end - h->count));
+	return h;
+}
+
+uint bufhold_discard(struct bufhold * bh, uint count)
+{
+	assert(bh);
+
 	struct held_buffer * h;
-	struct list_entry * e;
+	uint index;
 
-	while ((e = list_pop(&bh->buffers))) {
-		h = container_of(e, struct held_buffer, e);
-		buffer_release(h->base);
-		free(h);
+	h = bufhold_find(bh, count, &index);
+	if (!h) {
+		bufhold_release_all(bh);
+		return 0;
+	}
+
+	while (slot(bh, bh->head) != h) {
+		bh->total -= slot(bh, bh->head)->count;
+		free_node(bh, slot(bh, bh->head));
+		bh->head++;
 	}
+
+	if (index)
+		bufhold_advance(h, index);
+
+	return bh->total;
 }
 
 int bufhold_add(struct bufhold * bh, sample_t * buf, uint count)
@@ -153,18 +345,36 @@ int bufhold_add(struct bufhold * bh, sample_t * buf, uint count)
 	assert(bh);
 	assert(buf);
 
-	struct held_buffer * h = (struct held_buffer *)
-		malloc(sizeof(struct held_buffer));
+	int r;
+	struct held_buffer * h;
+
+	if (bh->tail - bh->head > bh->mask) {
+		r = grow_ring(bh);
+		if (r < 0) {
+			error("bufhold: Failed to allocate memory");
+			return r;
+		}
+	}
+
+	h = alloc_node(bh);
 	if (!h) {
 		error("bufhold: Failed to allocate memory");
 		return -1;
 	}
 
+	bh->end += count;
+	bh->total += count;
+
 	h->base = buf;
 	h->data = buf;
 	h->count = count;
+	h->end = bh->end;
+	h->seq = bh->tail;
+	h->bh = bh;
 	buffer_addref(buf);
-	list_enqueue(&bh->buffers, &h->e);
+
+	bh->ring[bh->tail & bh->mask] = h;
+	bh->tail++;
 
 	return 0;
 }
@@ -173,13 +383,20 @@ struct bufhold * bufhold_init()
 {
 	struct bufhold * bh;
 
-	bh = (struct bufhold *) malloc(sizeof(struct bufhold));
+	bh = (struct bufhold *) calloc(1, sizeof(struct bufhold));
 	if (!bh) {
 		error("bufhold: Failed to allocate memory");
 		return NULL;
 	}
 
-	list_init(&bh->buffers);
+	bh->ring = (struct held_buffer **)
+		malloc(BUFHOLD_MIN_SLOTS * sizeof(struct held_buffer *));
+	if (!bh->ring) {
+		error("bufhold: Failed to allocate memory");
+		free(bh);
+		return NULL;
+	}
+	bh->mask = BUFHOLD_MIN_SLOTS - 1;
 
 	return bh;
 }
@@ -188,9 +405,17 @@ void bufhold_exit(struct bufhold * bh)
 {
 	assert(bh);
 
-	if (list_head(&bh->buffers))
+	struct held_slab * slab;
+
+	if (bh->head != bh->tail)
 		error("bufhold: Destroying a non-empty bufhold will leak memory");
 
-	list_exit(&bh->buffers);
+	while (bh->slabs) {
+		slab = bh->slabs;
+		bh->slabs = slab->next;
+		free(slab);
+	}
+
+	free(bh->ring);
 	free(bh);
 }
@@ -22,12 +22,17 @@
 #include <errno.h>
 #include <malloc.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "buffer.h"
+#include "bufq.h"
 #include "compiler.h"
 #include "consumer.h"
 #include "list.h"
 #include "log.h"
+#include "rt.h"
+#include "timespec.h"
 
 /*******************************************************************************
 	Private declarations
@@ -38,6 +43,14 @@
 #define BUFQ_START	2
 #define BUFQ_RESYNC	3
 #define BUFQ_EXIT	4
+#define BUFQ_SYNC	5
+
+/* Number of times to poll the ring before going to sleep on the condition
+ * variable. This should be long enough to cover the typical gap between
+ * buffers arriving at a busy queue but short enough that an idle consumer
+ * thread doesn't burn a core.
+ */
+#define BUFQ_RING_SPIN_COUNT	1000
 
 struct bufq_entry {
 	uint				event;
@@ -53,9 +66,48 @@ struct bufq_entry {
 	struct list_entry		l;
 };
 
+/* Each slot is padded to a full cache line so that the producer filling one
+ * slot doesn't contend with the consumer reading its neighbour.
+ */
+struct bufq_slot {
+	struct bufq_entry		e;
+} __cacheline_aligned;
+
+/* Lock-free single producer, single consumer ring.
+ *
+ * The head and tail indices are free-running counters which are masked to get
+ * a slot index. Each index is only written by one side, is read by the other
+ * side with acquire semantics and lives on its own cache line. Each side keeps a
+ * private cached copy of the other side's index so that it only needs to touch
+ * the shared cache line when the ring appears to be full or empty.
+ *
+ * The waiting flags let the producer skip the mutex and condition variable
+ * entirely unless the consumer has actually gone to sleep, and vice versa.
+ */
+struct bufq_ring {
+	/* Producer side. */
+	uint				tail __cacheline_aligned;
+	uint				head_cache;
+
+	/* Consumer side. */
+	uint				head __cacheline_aligned;
+	uint				tail_cache;
+
+	/* Sleep flags, written under the bufq mutex. */
+	int				consumer_waiting __cacheline_aligned;
+	int				producer_waiting;
+
+	/* Read-only after init. */
+	uint				mask __cacheline_aligned;
+	uint				spin_count;
+	struct bufq_slot *		slots;
+};
+
 struct bufq {
 	struct consumer *	target;
 
+	enum bufq_modes		mode;
+	struct bufq_ring *	ring;
 
 	uint			sample_rate;
 	volatile int		exit;
@@ -79,12 +131,252 @@ struct bufq {
 
 	/* We need to be able to alert the consumer thread that data is available. */
 	pthread_cond_t		cond;
+
+	/* In ring mode the producer may also need to wait for free space. */
+	pthread_cond_t		space_cond;
+
+	/* Synchronisation points requested by bufq_sync() and reached by the
+	 * consumer thread, protected by the mutex.
+	 */
+	uint			sync_requested;
+	uint			sync_done;
+	pthread_cond_t		sync_cond;
+
+	/* Queue statistics. The list backlog is counted under the mutex, the
+	 * ring backlog is just the distance between tail and head.
+	 */
+	uint			list_backlog;
+	uint			max_backlog;
+	uint64			dropped_buffers;
+	uint64			dropped_samples;
+
+	/* In drop mode we track the timestamp of the next sample so that the
+	 * target can be resynchronised after buffers have been dropped.
+	 */
+	struct timespec		next_ts;
+	int			resync_pending;
 };
 
 /*******************************************************************************
 	Private functions
 *******************************************************************************/
 
+/* The consumer thread writes its exit status when it terminates, which the
+ * producer may need to notice while waiting on a full ring.
+ */
+static int get_exit_status(struct bufq * b)
+{
+	assert(b);
+
+	return __atomic_load_n(&b->thread_exit_status, __ATOMIC_ACQUIRE);
+}
+
+static struct bufq_entry * ring_alloc_entry(struct bufq * b)
+{
+	assert(b);
+
+	struct bufq_ring * q = b->ring;
+	uint tail = q->tail;
+	uint spin = 0;
+
+	/* The ring is full if tail is a whole lap ahead of head. */
+	while (tail - q->head_cache > q->mask) {
+		q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (tail - q->head_cache <= q->mask)
+			break;
+
+		if (get_exit_status(b) < 0)
+			return NULL;
+
+		if (spin++ < q->spin_count) {
+			cpu_relax();
+			continue;
+		}
+
+		/* Park until the consumer frees a slot. The consumer checks
+		 * producer_waiting after publishing a new head so setting the
+		 * flag before re-reading head ensures that the wakeup can't be
+		 * missed.
+		 */
+		pthread_mutex_lock(&b->mutex);
+		while (get_exit_status(b) >= 0) {
+			/* The flag must be re-armed after every wakeup as the
+			 * consumer may have cleared it for an earlier wait.
+			 */
+			__atomic_store_n(&q->producer_waiting, 1,
+					__ATOMIC_SEQ_CST);
+			q->head_cache = __atomic_load_n(&q->head,
+					__ATOMIC_SEQ_CST);
+			if (tail - q->head_cache <= q->mask)
+				break;
+
+			pthread_cond_wait(&b->space_cond, &b->mutex);
+		}
+		q->producer_waiting = 0;
+		pthread_mutex_unlock(&b->mutex);
+		spin = 0;
+	}
+
+	return &q->slots[tail & q->mask].e;
+}
+
+static void ring_free_entry(struct bufq * b, struct bufq_entry * e)
+{
+	assert(b);
+	assert(e);
+
+	struct bufq_ring * q = b->ring;
+
+	/* Entries are consumed in order so e must be the slot at head. */
+	assert(e == &q->slots[q->head & q->mask].e);
+	__unused e;
+
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_SEQ_CST);
+
+	/* If the producer is asleep on a full ring, let it fill up half the
+	 * ring in one go rather than waking it for every free slot. Our
+	 * tail_cache may lag behind the real tail, which at worst wakes the
+	 * producer a little early.
+	 */
+	if (__atomic_load_n(&q->producer_waiting, __ATOMIC_SEQ_CST) &&
+			q->tail_cache - q->head <= (q->mask + 1) / 2) {
+		pthread_mutex_lock(&b->mutex);
+		q->producer_waiting = 0;
+		pthread_cond_signal(&b->space_cond);
+		pthread_mutex_unlock(&b->mutex);
+	}
+}
+
+static int ring_enqueue(struct bufq * b, struct bufq_entry * e)
+{
+	assert(b);
+	assert(e);
+
+	struct bufq_ring * q = b->ring;
+
+	/* alloc_entry handed out the slot at tail. */
+	assert(e == &q->slots[q->tail & q->mask].e);
+	__unused e;
+
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_SEQ_CST);
+
+	/* head_cache may be stale and so overestimate the backlog. Only touch
+	 * the consumer's cache line if it looks like a new maximum.
+	 */
+	if (q->tail - q->head_cache > b->max_backlog) {
+		q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (q->tail - q->head_cache > b->max_backlog)
+			b->max_backlog = q->tail - q->head_cache;
+	}
+
+	/* Only take the mutex if the consumer thread is asleep. */
+	if (__atomic_load_n(&q->consumer_waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&b->mutex);
+		q->consumer_waiting = 0;
+		pthread_cond_signal(&b->cond);
+		pthread_mutex_unlock(&b->mutex);
+	}
+
+	return 0;
+}
+
+/* Number of free slots in the ring, as seen by the producer. */
+static uint ring_space(struct bufq * b)
+{
+	assert(b);
+
+	struct bufq_ring * q = b->ring;
+
+	q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	return q->mask + 1 - (q->tail - q->head_cache);
+}
+
+static struct bufq_entry * ring_dequeue(struct bufq * b)
+{
+	assert(b);
+
+	struct bufq_ring * q = b->ring;
+	uint head = q->head;
+	uint spin = 0;
+
+	while (head == q->tail_cache) {
+		q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		if (head != q->tail_cache)
+			break;
+
+		if (spin++ < q->spin_count) {
+			cpu_relax();
+			continue;
+		}
+
+		/* Park until the producer publishes a new entry. */
+		pthread_mutex_lock(&b->mutex);
+		while (1) {
+			__atomic_store_n(&q->consumer_waiting, 1,
+					__ATOMIC_SEQ_CST);
+			q->tail_cache = __atomic_load_n(&q->tail,
+					__ATOMIC_SEQ_CST);
+			if (head != q->tail_cache)
+				break;
+
+			pthread_cond_wait(&b->cond, &b->mutex);
+		}
+		q->consumer_waiting = 0;
+		pthread_mutex_unlock(&b->mutex);
+	}
+
+	return &q->slots[head & q->mask].e;
+}
+
+static struct bufq_ring * ring_init(uint depth)
+{
+	struct bufq_ring * q;
+	uint n;
+	int r;
+
+	/* Round depth up to a power of two so that indices can be masked. */
+	if (!depth)
+		depth = BUFQ_DEFAULT_DEPTH;
+	for (n = 1; n < depth; n <<= 1)
+		;
+
+	r = posix_memalign((void **)&q, TUNA_CACHELINE_SIZE,
+			sizeof(struct bufq_ring));
+	if (r)
+		return NULL;
+
+	r = posix_memalign((void **)&q->slots, TUNA_CACHELINE_SIZE,
+			n * sizeof(struct bufq_slot));
+	if (r) {
+		free(q);
+		return NULL;
+	}
+
+	q->tail = 0;
+	q->head_cache = 0;
+	q->head = 0;
+	q->tail_cache = 0;
+	q->consumer_waiting = 0;
+	q->producer_waiting = 0;
+	q->mask = n - 1;
+
+	/* Spinning only helps if the other side can run at the same time. */
+	if (sysconf(_SC_NPROCESSORS_ONLN) > 1)
+		q->spin_count = BUFQ_RING_SPIN_COUNT;
+	else
+		q->spin_count = 0;
+
+	return q;
+}
+
+static void ring_exit(struct bufq_ring * q)
+{
+	assert(q);
+
+	free(q->slots);
+	free(q);
+}
+
 static struct bufq_entry * alloc_entry(struct bufq * b)
 {
 	assert(b);
@@ -92,6 +384,9 @@ static struct bufq_entry * alloc_entry(struct bufq * b)
 	struct bufq_entry * e;
 	struct list_entry * l;
 
+	if (b->ring)
+		return ring_alloc_entry(b);
+
 	pthread_mutex_lock(&b->mutex);
 
 	l = list_pop(&b->freestack);
@@ -111,6 +406,11 @@ static void free_entry(struct bufq * b, struct bufq_entry * e)
 	assert(b);
 	assert(e);
 
+	if (b->ring) {
+		ring_free_entry(b, e);
+		return;
+	}
+
 	pthread_mutex_lock(&b->mutex);
 
 	list_push(&b->freestack, &e->l);
@@ -123,9 +423,15 @@ static int enqueue(struct bufq * b, struct bufq_entry * e)
 	assert(b);
 	assert(e);
 
+	if (b->ring)
+		return ring_enqueue(b, e);
+
 	pthread_mutex_lock(&b->mutex);
 
 	list_enqueue(&b->queue, &e->l);
+	b->list_backlog++;
+	if (b->list_backlog > b->max_backlog)
+		b->max_backlog = b->list_backlog;
 
 	/* Signal that there is data in the queue. */
 	pthread_cond_signal(&b->cond);
@@ -142,6 +448,9 @@ static struct bufq_entry * dequeue(struct bufq * b)
 	struct bufq_entry * e;
 	struct list_entry * l;
 
+	if (b->ring)
+		return ring_dequeue(b);
+
 	pthread_mutex_lock(&b->mutex);
 
 	l = list_dequeue(&b->queue);
@@ -162,6 +471,7 @@ static struct bufq_entry * dequeue(struct bufq * b)
 		}
 	}
 
+	b->list_backlog--;
 	pthread_mutex_unlock(&b->mutex);
 
 	e = container_of(l, struct bufq_entry, l);
@@ -182,6 +492,10 @@ static int enqueue_buffer(struct bufq * b, uint event, sample_t * buf, uint coun
 		return -ENOMEM;
 	}
 
+	/* The queue holds its own reference until the consumer thread has
+	 * written the buffer.
+	 */
+	buffer_addref(buf);
 	e->event = event;
 	e->buf = buf;
 	e->count = count;
@@ -208,7 +522,7 @@ static int enqueue_timespec(struct bufq * b, uint event, struct timespec * ts)
 	return enqueue(b, e);
 }
 
-static int enqueue_exit(struct bufq * b)
+static int enqueue_event(struct bufq * b, uint event)
 {
 	assert(b);
 
@@ -220,15 +534,14 @@ static int enqueue_exit(struct bufq * b)
 		return -ENOMEM;
 	}
 
-	e->event = BUFQ_EXIT;
+	e->event = event;
 
 	return enqueue(b, e);
 }
 
-static void * consumer_thread(void * param)
+static void consumer_loop(struct bufq * b)
 {
 	int r;
-	struct bufq * b = (struct bufq *)param;
 	struct bufq_entry * e;
 	uint err_count = 0;
 
@@ -236,7 +549,7 @@ static void * consumer_thread(void * param)
 		/* Check for termination signal. */
 		if (b->exit) {
 			b->thread_exit_status = 1;
-			return NULL;
+			return;
 		}
 
 		e = dequeue(b);
@@ -246,7 +559,7 @@ static void * consumer_thread(void * param)
 			if (err_count > 5) {
 				error("bufq: Too much consecutive missing data");
 				b->thread_exit_status = -EIO;
-				return NULL;
+				return;
 			} else {
 				error("bufq: Ignoring missing data");
 				continue;
@@ -260,8 +573,10 @@ static void * consumer_thread(void * param)
 				r = consumer_write(b->target, e->buf, e->count);
 				if (r < 0) {
 					error("bufq: Failed to write to target consumer");
+					buffer_release(e->buf);
+					free_entry(b, e);
 					b->thread_exit_status = r;
-					return NULL;
+					return;
 				}
 				buffer_release(e->buf);
 				break;
@@ -271,7 +586,7 @@ static void * consumer_thread(void * param)
 				if (r < 0) {
 					error("bufq: Failed to start target consumer");
 					b->thread_exit_status = r;
-					return NULL;
+					return;
 				}
 				break;
 
@@ -280,13 +595,21 @@ static void * consumer_thread(void * param)
 				if (r < 0) {
 					error("bufq: Failed to resync target consumer");
 					b->thread_exit_status = r;
-					return NULL;
+					return;
 				}
 				break;
 
+			case BUFQ_SYNC:
+				pthread_mutex_lock(&b->mutex);
+				b->sync_done++;
+				pthread_cond_broadcast(&b->sync_cond);
+				pthread_mutex_unlock(&b->mutex);
+				break;
+
 			case BUFQ_EXIT:
+				free_entry(b, e);
 				b->thread_exit_status = 0;
-				return NULL;
+				return;
 
 			default:
 				error("bufq: Ignoring unknown event");
@@ -296,33 +619,134 @@ static void * consumer_thread(void * param)
 	}
 }
 
+static void * consumer_thread(void * param)
+{
+	struct bufq * b = (struct bufq *)param;
+
+	consumer_loop(b);
+
+	/* If we stopped due to an error a producer may be waiting for space
+	 * in the ring which will never be freed or for a sync point which will
+	 * never be reached.
+	 */
+	if (b->thread_exit_status < 0) {
+		pthread_mutex_lock(&b->mutex);
+		pthread_cond_signal(&b->space_cond);
+		pthread_cond_broadcast(&b->sync_cond);
+		pthread_mutex_unlock(&b->mutex);
+	}
+
+	return NULL;
+}
+
+/* Release the buffers of any writes left in the queue, which happens if the
+ * consumer thread stopped on an error.
+ */
+static void drain(struct bufq * b)
+{
+	assert(b);
+
+	struct bufq_entry * e;
+	struct bufq_ring * q = b->ring;
+	struct list_entry * l;
+
+	if (q) {
+		for (; q->head != q->tail; q->head++) {
+			e = &q->slots[q->head & q->mask].e;
+			if (e->event == BUFQ_WRITE)
+				buffer_release(e->buf);
+		}
+		return;
+	}
+
+	while ((l = list_dequeue(&b->queue))) {
+		e = container_of(l, struct bufq_entry, l);
+		if (e->event == BUFQ_WRITE)
+			buffer_release(e->buf);
+		free(e);
+	}
+}
+
 void bufq_exit(struct consumer * consumer)
 {
 	assert(consumer);
 
 	struct bufq * b = (struct bufq *)consumer_get_data(consumer);
+	struct list_entry * l;
 
 	/* Wait for the consumer thread to finish processing currently enqueued
 	 * data.
 	 */
-	enqueue_exit(b);
+	enqueue_event(b, BUFQ_EXIT);
 	pthread_join(b->thread, NULL);
 
+	drain(b);
+	if (b->ring)
+		ring_exit(b->ring);
+
+	/* Free the list entries kept for reuse. */
+	while ((l = list_pop(&b->freestack)))
+		free(container_of(l, struct bufq_entry, l));
 	list_exit(&b->freestack);
 	list_exit(&b->queue);
+	pthread_cond_destroy(&b->sync_cond);
+	pthread_cond_destroy(&b->space_cond);
 	pthread_cond_destroy(&b->cond);
 	pthread_mutex_destroy(&b->mutex);
 	free(b);
 }
 
+/* Write to a queue in drop mode without ever blocking. If there isn't room
+ * for the buffer it is dropped and the target is resynchronised before the
+ * next buffer which does fit.
+ */
+static int drop_write(struct bufq * b, sample_t * buf, uint count)
+{
+	assert(b);
+	assert(buf);
+
+	int r;
+	uint needed;
+	struct timespec ts = b->next_ts;
+
+	timespec_add_ticks(&b->next_ts, count, b->sample_rate);
+
+	needed = b->resync_pending ? 2 : 1;
+	if (ring_space(b) < needed) {
+		b->dropped_buffers++;
+		b->dropped_samples += count;
+		b->resync_pending = 1;
+		return 0;
+	}
+
+	if (b->resync_pending) {
+		r = enqueue_timespec(b, BUFQ_RESYNC, &ts);
+		if (r < 0)
+			return r;
+		b->resync_pending = 0;
+	}
+
+	return enqueue_buffer(b, BUFQ_WRITE, buf, count);
+}
+
 int bufq_write(struct consumer * consumer, sample_t * buf, uint count)
 {
 	assert(consumer);
 	assert(buf);
 
 	struct bufq * b = (struct bufq *)consumer_get_data(consumer);
+	int r;
+
+	/* Don't keep queueing data if there is nothing left to consume it. */
+	r = get_exit_status(b);
+	if (r < 0) {
+		error("bufq: Consumer thread has failed");
+		return r;
+	}
+
+	if (b->mode == BUFQ_MODE_DROP)
+		return drop_write(b, buf, count);
 
-	buffer_addref(buf);
 	return enqueue_buffer(b, BUFQ_WRITE, buf, count);
 }
 
@@ -334,6 +758,8 @@ int bufq_start(struct consumer * consumer, uint sample_rate, struct timespec * t
 	struct bufq * b = (struct bufq *)consumer_get_data(consumer);
 
 	b->sample_rate = sample_rate;
+	b->next_ts = *ts;
+	b->resync_pending = 0;
 	return enqueue_timespec(b, BUFQ_START, ts);
 }
 
@@ -344,6 +770,15 @@ int bufq_resync(struct consumer * consumer, struct timespec * ts)
 
 	struct bufq * b = (struct bufq *)consumer_get_data(consumer);
 
+	/* In drop mode the resync is passed on with the next buffer which
+	 * isn't dropped, so that we never block here on a full ring.
+	 */
+	if (b->mode == BUFQ_MODE_DROP) {
+		b->next_ts = *ts;
+		b->resync_pending = 1;
+		return 0;
+	}
+
 	return enqueue_timespec(b, BUFQ_RESYNC, ts);
 }
 
@@ -351,7 +786,72 @@ int bufq_resync(struct consumer * consumer, struct timespec * ts)
 	Public functions
 *******************************************************************************/
 
+int bufq_sync(struct consumer * consumer)
+{
+	assert(consumer);
+
+	struct bufq * b = (struct bufq *)consumer_get_data(consumer);
+	uint ticket;
+	int r;
+
+	r = get_exit_status(b);
+	if (r < 0)
+		return r;
+
+	/* Only the producer thread requests sync points so sync_requested
+	 * doesn't need protecting against concurrent updates.
+	 */
+	ticket = ++b->sync_requested;
+	r = enqueue_event(b, BUFQ_SYNC);
+	if (r < 0)
+		return r;
+
+	pthread_mutex_lock(&b->mutex);
+	while ((int)(b->sync_done - ticket) < 0 && get_exit_status(b) >= 0)
+		pthread_cond_wait(&b->sync_cond, &b->mutex);
+	pthread_mutex_unlock(&b->mutex);
+
+	r = get_exit_status(b);
+	return (r < 0) ? r : 0;
+}
+
+void bufq_get_stats(struct consumer * consumer, struct bufq_stats * stats)
+{
+	assert(consumer);
+	assert(stats);
+
+	struct bufq * b = (struct bufq *)consumer_get_data(consumer);
+
+	if (b->ring) {
+		stats->backlog = __atomic_load_n(&b->ring->tail, __ATOMIC_ACQUIRE) -
+			__atomic_load_n(&b->ring->head, __ATOMIC_ACQUIRE);
+	} else {
+		pthread_mutex_lock(&b->mutex);
+		stats->backlog = b->list_backlog;
+		pthread_mutex_unlock(&b->mutex);
+	}
+
+	stats->max_backlog = b->max_backlog;
+	stats->dropped_buffers = b->dropped_buffers;
+	stats->dropped_samples = b->dropped_samples;
+}
+
+int bufq_set_cpu(struct consumer * consumer, int cpu)
+{
+	assert(consumer);
+
+	struct bufq * b = (struct bufq *)consumer_get_data(consumer);
+
+	return rt_set_cpu(b->thread, cpu);
+}
+
 int bufq_init(struct consumer * consumer, struct consumer * target)
+{
+	return bufq_init_mode(consumer, target, BUFQ_MODE_LIST, 0);
+}
+
+int bufq_init_mode(struct consumer * consumer, struct consumer * target,
+		enum bufq_modes mode, uint depth)
 {
 	assert(target);
 
@@ -364,8 +864,23 @@ int bufq_init(struct consumer * consumer, struct consumer * target)
 	}
 
 	b->target = target;
+	b->mode = mode;
+	b->ring = NULL;
 	b->exit = 0;
 	b->sample_rate = 0;
+	b->list_backlog = 0;
+	b->max_backlog = 0;
+	b->dropped_buffers = 0;
+	b->dropped_samples = 0;
+	b->resync_pending = 0;
+
+	if (mode == BUFQ_MODE_RING || mode == BUFQ_MODE_DROP) {
+		b->ring = ring_init(depth);
+		if (!b->ring) {
+			error("bufq: Failed to allocate ring");
+			goto err_ring;
+		}
+	}
 
 	list_init(&b->queue);
 	list_init(&b->freestack);
@@ -392,6 +907,20 @@ int bufq_init(struct consumer * consumer, struct consumer * target)
 		goto err_cond;
 	}
 
+	r = pthread_cond_init(&b->space_cond, NULL);
+	if (r != 0) {
+		error("bufq: Failed to create condition variable");
+		goto err_space_cond;
+	}
+
+	b->sync_requested = 0;
+	b->sync_done = 0;
+	r = pthread_cond_init(&b->sync_cond, NULL);
+	if (r != 0) {
+		error("bufq: Failed to create condition variable");
+		goto err_sync_cond;
+	}
+
 	b->thread_exit_status = 0;
 	r = pthread_create(&b->thread, NULL, consumer_thread, b);
 	if (r != 0) {
@@ -406,12 +935,19 @@ int bufq_init(struct consumer * consumer, struct consumer * target)
 
 	/* Error cleanup */
 err_thread:
+	pthread_cond_destroy(&b->sync_cond);
+err_sync_cond:
+	pthread_cond_destroy(&b->space_cond);
+err_space_cond:
 	pthread_cond_destroy(&b->cond);
 err_cond:
 	pthread_mutex_destroy(&b->mutex);
 err_mutex:
 err_mutexattr:
+	if (b->ring)
+		ring_exit(b->ring);
+err_ring:
 	free(b);
 err_malloc:
-	return 0;
+	return -1;
 }
@@ -59,6 +59,13 @@ int csv_write_uint(FILE * csv, uint u)
 	return fprintf(csv, "%u, ", u);
 }
 
+int csv_write_uint64(FILE * csv, uint64 u)
+{
+	assert(csv);
+
+	return fprintf(csv, "%llu, ", u);
+}
+
 int csv_next(FILE * csv)
 {
 	assert(csv);
@@ -0,0 +1,246 @@
+/*******************************************************************************
+	deinterleave.c: Split interleaved multichannel samples by channel.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#include <assert.h>
+
+#include "deinterleave.h"
+#include "simd.h"
+#include "types.h"
+
+#ifdef ENABLE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef ENABLE_ARM_NEON
+#include <arm_neon.h>
+#endif
+
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* Plain scalar code for any number of channels, starting at the given frame so
+ * that it can finish off after the vector kernels. On ARM, NEON has structure
+ * loads which deinterleave two, three or four channels directly.
+ */
+static void deinterleave_scalar(sample_t ** dst, const sample_t * src,
+		uint channels, uint frames, uint start)
+{
+	uint i, c;
+
+	i = start;
+
+#ifdef ENABLE_ARM_NEON
+	if (channels == 2) {
+		for (; i + 4 <= frames; i += 4) {
+			int32x4x2_t v = vld2q_s32(&src[i * 2]);
+			vst1q_s32(&dst[0][i], v.val[0]);
+			vst1q_s32(&dst[1][i], v.val[1]);
+		}
+	} else if (channels == 3) {
+		for (; i + 4 <= frames; i += 4) {
+			int32x4x3_t v = vld3q_s32(&src[i * 3]);
+			vst1q_s32(&dst[0][i], v.val[0]);
+			vst1q_s32(&dst[1][i], v.val[1]);
+			vst1q_s32(&dst[2][i], v.val[2]);
+		}
+	} else if (channels == 4) {
+		for (; i + 4 <= frames; i += 4) {
+			int32x4x4_t v = vld4q_s32(&src[i * 4]);
+			vst1q_s32(&dst[0][i], v.val[0]);
+			vst1q_s32(&dst[1][i], v.val[1]);
+			vst1q_s32(&dst[2][i], v.val[2]);
+			vst1q_s32(&dst[3][i], v.val[3]);
+		}
+	}
+#endif
+
+	for (; i < frames; i++)
+		for (c = 0; c < channels; c++)
+			dst[c][i] = src[i * channels + c];
+}
+
+#ifdef ENABLE_X86_SIMD
+/* x86 kernels, selected at runtime in deinterleave(). Each one handles as many
+ * whole vectors as it can and returns the number of frames done so that the
+ * scalar code can finish off the rest.
+ */
+
+/* Two channels, four frames at a time. */
+__attribute__((target("sse4.1")))
+static uint deinterleave2_sse4_1(sample_t ** dst, const sample_t * src,
+		uint frames)
+{
+	uint i;
+
+	for (i = 0; i + 4 <= frames; i += 4) {
+		/* L0 R0 L1 R1 and L2 R2 L3 R3 become L0 L1 R0 R1 and
+		 * L2 L3 R2 R3.
+		 */
+		__m128i a = _mm_loadu_si128((const __m128i *) &src[2 * i]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &src[2 * i + 4]);
+		a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+		b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm_storeu_si128((__m128i *) &dst[0][i],
+				_mm_unpacklo_epi64(a, b));
+		_mm_storeu_si128((__m128i *) &dst[1][i],
+				_mm_unpackhi_epi64(a, b));
+	}
+
+	return i;
+}
+
+/* Any multiple of four channels, transposing four frames of four channels at a
+ * time.
+ */
+__attribute__((target("sse4.1")))
+static uint deinterleave4n_sse4_1(sample_t ** dst, const sample_t * src,
+		uint channels, uint frames)
+{
+	uint i, c;
+
+	for (i = 0; i + 4 <= frames; i += 4) {
+		const sample_t * p = &src[i * channels];
+
+		for (c = 0; c < channels; c += 4) {
+			__m128i f0 = _mm_loadu_si128((const __m128i *)
+					&p[c]);
+			__m128i f1 = _mm_loadu_si128((const __m128i *)
+					&p[channels + c]);
+			__m128i f2 = _mm_loadu_si128((const __m128i *)
+					&p[2 * channels + c]);
+			__m128i f3 = _mm_loadu_si128((const __m128i *)
+					&p[3 * channels + c]);
+
+			__m128i t0 = _mm_unpacklo_epi32(f0, f1);
+			__m128i t1 = _mm_unpacklo_epi32(f2, f3);
+			__m128i t2 = _mm_unpackhi_epi32(f0, f1);
+			__m128i t3 = _mm_unpackhi_epi32(f2, f3);
+
+			_mm_storeu_si128((__m128i *) &dst[c][i],
+					_mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128((__m128i *) &dst[c + 1][i],
+					_mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128((__m128i *) &dst[c + 2][i],
+					_mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128((__m128i *) &dst[c + 3][i],
+					_mm_unpackhi_epi64(t2, t3));
+		}
+	}
+
+	return i;
+}
+
+/* Two channels, eight frames at a time. */
+__attribute__((target("avx2")))
+static uint deinterleave2_avx2(sample_t ** dst, const sample_t * src,
+		uint frames)
+{
+	uint i;
+	const __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		/* Gather each channel into one half of each vector, then swap
+		 * the halves over between the two vectors.
+		 */
+		__m256i a = _mm256_loadu_si256((const __m256i *) &src[2 * i]);
+		__m256i b = _mm256_loadu_si256((const __m256i *)
+				&src[2 * i + 8]);
+		a = _mm256_permutevar8x32_epi32(a, idx);
+		b = _mm256_permutevar8x32_epi32(b, idx);
+
+		_mm256_storeu_si256((__m256i *) &dst[0][i],
+				_mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *) &dst[1][i],
+				_mm256_permute2x128_si256(a, b, 0x31));
+	}
+
+	return i;
+}
+
+/* Any other number of channels, gathering eight frames of one channel at a
+ * time.
+ */
+__attribute__((target("avx2")))
+static uint deinterleave_avx2(sample_t ** dst, const sample_t * src,
+		uint channels, uint frames)
+{
+	uint i, c;
+	const __m256i idx = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32((int) channels));
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		const sample_t * p = &src[i * channels];
+
+		for (c = 0; c < channels; c++)
+			_mm256_storeu_si256((__m256i *) &dst[c][i],
+					_mm256_i32gather_epi32(&p[c], idx, 4));
+	}
+
+	return i;
+}
+#endif
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+void deinterleave(sample_t ** dst, const sample_t * src, uint channels,
+		uint frames)
+{
+	assert(dst);
+	assert(src);
+	assert(channels);
+
+	uint done = 0;
+
+#ifdef ENABLE_X86_SIMD
+	/* There are no AVX-512 kernels as the loads and stores here don't
+	 * benefit from the extra width, so that level uses AVX2.
+	 */
+	switch (simd_get_level()) {
+	    case SIMD_LEVEL_AVX512:
+	    case SIMD_LEVEL_AVX2:
+		if (channels == 2)
+			done = deinterleave2_avx2(dst, src, frames);
+		else if (channels % 4 == 0)
+			done = deinterleave4n_sse4_1(dst, src, channels,
+					frames);
+		else if (channels > 1)
+			done = deinterleave_avx2(dst, src, channels, frames);
+		break;
+
+	    case SIMD_LEVEL_SSE4_1:
+		if (channels == 2)
+			done = deinterleave2_sse4_1(dst, src, frames);
+		else if (channels % 4 == 0)
+			done = deinterleave4n_sse4_1(dst, src, channels,
+					frames);
+		break;
+
+	    default:
+		break;
+	}
+#endif
+
+	deinterleave_scalar(dst, src, channels, frames, done);
+}
@@ -27,11 +27,211 @@
 
 #include "env_estimate.h"
 #include "log.h"
+#include "simd.h"
 #include "types.h"
 
+#ifdef ENABLE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+static void block(struct env_estimate * e, sample_t * in, env_t * out, uint n)
+{
+	assert(e);
+	assert(in);
+	assert(out);
+
+	uint i;
+
+	for (i = 0; i < n; i++)
+		out[i] = env_estimate_next(e, in[i]);
+}
+
+#ifdef ENABLE_X86_SIMD
+/* x86 versions of block(), selected at runtime in env_estimate_init().
+ *
+ * Unrolling the recurrence gives
+ *
+ *	E[n] = max(decay^(n+1) E[-1], max over k <= n of decay^(n-k) |x[k]|)
+ *
+ * which is computed for a vector of samples at once by a max-scan: at each step
+ * the vector is shifted up by s lanes, scaled by decay^s and combined with
+ * itself by max(), for s = 1, 2, 4, ... up to half the vector width. Lanes
+ * shifted in from below are scaled by zero, which is harmless as envelope
+ * values are never negative. The envelope carried from the previous vector is
+ * then scaled by decay^(i+1) for lane i and combined in the same way.
+ *
+ * As powers of the decay factor are multiplied once rather than repeatedly, the
+ * results may differ slightly from env_estimate_next(), see
+ * env_estimate_block().
+ */
+
+__attribute__((target("sse4.1")))
+static void block_sse4_1(struct env_estimate * e, sample_t * in, env_t * out,
+		uint n)
+{
+	assert(e);
+	assert(in);
+	assert(out);
+
+	float * p = e->decay_pow;
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 m1 = _mm_set1_ps(p[0]);
+	__m128 m2 = _mm_set1_ps(p[1]);
+	__m128 mc = _mm_loadu_ps(p);
+	__m128 carry = _mm_set1_ps(e->cur);
+	__m128 v;
+	uint i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_cvtepi32_ps(_mm_loadu_si128((__m128i *) &in[i]));
+		v = _mm_andnot_ps(sign, v);
+
+		/* Byte shifts fill the low lanes with zeros. */
+		v = _mm_max_ps(v, _mm_mul_ps(m1, _mm_castsi128_ps(
+				_mm_slli_si128(_mm_castps_si128(v), 4))));
+		v = _mm_max_ps(v, _mm_mul_ps(m2, _mm_castsi128_ps(
+				_mm_slli_si128(_mm_castps_si128(v), 8))));
+		v = _mm_max_ps(v, _mm_mul_ps(mc, carry));
+
+		_mm_storeu_ps(&out[i], v);
+		carry = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+
+	e->cur = _mm_cvtss_f32(carry);
+	block(e, &in[i], &out[i], n - i);
+}
+
+__attribute__((target("avx2")))
+static void block_avx2(struct env_estimate * e, sample_t * in, env_t * out,
+		uint n)
+{
+	assert(e);
+	assert(in);
+	assert(out);
+
+	float * p = e->decay_pow;
+	__m256 sign = _mm256_set1_ps(-0.0f);
+	__m256i shift1 = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+	__m256i shift2 = _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5);
+	__m256i shift4 = _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3);
+	__m256i last = _mm256_set1_epi32(7);
+	__m256 m1 = _mm256_setr_ps(0, p[0], p[0], p[0], p[0], p[0], p[0], p[0]);
+	__m256 m2 = _mm256_setr_ps(0, 0, p[1], p[1], p[1], p[1], p[1], p[1]);
+	__m256 m4 = _mm256_setr_ps(0, 0, 0, 0, p[3], p[3], p[3], p[3]);
+	__m256 mc = _mm256_loadu_ps(p);
+	__m256 carry = _mm256_set1_ps(e->cur);
+	__m256 v;
+	uint i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_cvtepi32_ps(_mm256_loadu_si256((__m256i *) &in[i]));
+		v = _mm256_andnot_ps(sign, v);
+
+		v = _mm256_max_ps(v, _mm256_mul_ps(m1,
+				_mm256_permutevar8x32_ps(v, shift1)));
+		v = _mm256_max_ps(v, _mm256_mul_ps(m2,
+				_mm256_permutevar8x32_ps(v, shift2)));
+		v = _mm256_max_ps(v, _mm256_mul_ps(m4,
+				_mm256_permutevar8x32_ps(v, shift4)));
+		v = _mm256_max_ps(v, _mm256_mul_ps(mc, carry));
+
+		_mm256_storeu_ps(&out[i], v);
+		carry = _mm256_permutevar8x32_ps(v, last);
+	}
+
+	e->cur = _mm256_cvtss_f32(carry);
+	block(e, &in[i], &out[i], n - i);
+}
+
+__attribute__((target("avx512f")))
+static void block_avx512(struct env_estimate * e, sample_t * in, env_t * out,
+		uint n)
+{
+	assert(e);
+	assert(in);
+	assert(out);
+
+	float * p = e->decay_pow;
+	__m512i shift1 = _mm512_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6,
+			7, 8, 9, 10, 11, 12, 13, 14);
+	__m512i shift2 = _mm512_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5,
+			6, 7, 8, 9, 10, 11, 12, 13);
+	__m512i shift4 = _mm512_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3,
+			4, 5, 6, 7, 8, 9, 10, 11);
+	__m512i shift8 = _mm512_setr_epi32(0, 0, 0, 0, 0, 0, 0, 0,
+			0, 1, 2, 3, 4, 5, 6, 7);
+	__m512i last = _mm512_set1_epi32(15);
+	__m512 m1 = _mm512_set1_ps(p[0]);
+	__m512 m2 = _mm512_set1_ps(p[1]);
+	__m512 m4 = _mm512_set1_ps(p[3]);
+	__m512 m8 = _mm512_set1_ps(p[7]);
+	__m512 mc = _mm512_loadu_ps(p);
+	__m512 carry = _mm512_set1_ps(e->cur);
+	__m512 v;
+	uint i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm512_cvtepi32_ps(_mm512_loadu_si512(&in[i]));
+		v = _mm512_abs_ps(v);
+
+		/* Masked permutes fill the low lanes with zeros. */
+		v = _mm512_max_ps(v, _mm512_mul_ps(m1,
+				_mm512_maskz_permutexvar_ps(0xFFFE, shift1, v)));
+		v = _mm512_max_ps(v, _mm512_mul_ps(m2,
+				_mm512_maskz_permutexvar_ps(0xFFFC, shift2, v)));
+		v = _mm512_max_ps(v, _mm512_mul_ps(m4,
+				_mm512_maskz_permutexvar_ps(0xFFF0, shift4, v)));
+		v = _mm512_max_ps(v, _mm512_mul_ps(m8,
+				_mm512_maskz_permutexvar_ps(0xFF00, shift8, v)));
+		v = _mm512_max_ps(v, _mm512_mul_ps(mc, carry));
+
+		_mm512_storeu_ps(&out[i], v);
+		carry = _mm512_permutexvar_ps(last, v);
+	}
+
+	e->cur = _mm512_cvtss_f32(carry);
+	block(e, &in[i], &out[i], n - i);
+}
+#endif
+
+static void select_kernels(struct env_estimate * e)
+{
+	assert(e);
+
+	e->block = block;
+
+#ifdef ENABLE_X86_SIMD
+	switch (simd_get_level()) {
+	    case SIMD_LEVEL_AVX512:
+		e->block = block_avx512;
+		break;
+
+	    case SIMD_LEVEL_AVX2:
+		e->block = block_avx2;
+		break;
+
+	    case SIMD_LEVEL_SSE4_1:
+		e->block = block_sse4_1;
+		break;
+
+	    default:
+		break;
+	}
+#endif
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
 struct env_estimate * env_estimate_init(float Tc, uint sample_rate)
 {
 	struct env_estimate * e;
+	uint i;
 
 	e = (struct env_estimate *) malloc(sizeof(struct env_estimate));
 	if (!e) {
@@ -42,6 +242,11 @@ struct env_estimate * env_estimate_init(float Tc, uint sample_rate)
 	e->decay = expf(-1.0f / (Tc * sample_rate));
 	e->cur = 0;
 
+	for (i = 0; i < ENV_ESTIMATE_MAX_POW; i++)
+		e->decay_pow[i] = powf(e->decay, (float)(i + 1));
+
+	select_kernels(e);
+
 	return e;
 }
 
@@ -58,3 +263,13 @@ void env_estimate_reset(struct env_estimate * e)
 
 	e->cur = 0;
 }
+
+void env_estimate_block(struct env_estimate * e, sample_t * in, env_t * out,
+		uint n)
+{
+	assert(e);
+	assert(in);
+	assert(out);
+
+	e->block(e, in, out, n);
+}
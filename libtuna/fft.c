@@ -20,10 +20,13 @@
 
 #include <assert.h>
 #include <complex.h>
+#include <errno.h>
 #include <malloc.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include "compiler.h"
 #include "fft.h"
 #include "log.h"
 #include "types.h"
@@ -45,6 +48,102 @@ struct fft {
 	float complex *			cdata;
 };
 
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+#ifndef ENABLE_FFTS
+/* FFTW plans are cached for the life of the process so that every context of
+ * the same length shares one plan, executed on the context's own buffers by
+ * fftwf_execute_dft_r2c(). Only real to complex forward transforms are used so
+ * plans are keyed on length alone.
+ *
+ * The FFTW planner isn't thread safe, so the mutex also serialises planning and
+ * wisdom handling. Executing a plan is thread safe.
+ */
+struct fft_plan {
+	uint				length;
+	fftwf_plan			plan;
+	struct fft_plan *		next;
+};
+
+static pthread_mutex_t plan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fft_plan * plan_cache = NULL;
+static enum fft_efforts plan_effort = FFT_EFFORT_PATIENT;
+
+/* The wisdom file is read before the first plan is made and rewritten after
+ * each new plan. A NULL path disables wisdom.
+ */
+static const char * default_wisdom_path = "fftw.wisdom";
+static char * wisdom_path = NULL;
+static int wisdom_path_set = 0;
+static int wisdom_loaded = 0;
+
+static const char * get_wisdom_path()
+{
+	return wisdom_path_set ? wisdom_path : default_wisdom_path;
+}
+
+static unsigned planner_flags(enum fft_efforts effort)
+{
+	switch (effort) {
+	    case FFT_EFFORT_ESTIMATE:
+		return FFTW_ESTIMATE;
+	    case FFT_EFFORT_MEASURE:
+		return FFTW_MEASURE;
+	    case FFT_EFFORT_EXHAUSTIVE:
+		return FFTW_EXHAUSTIVE;
+	    case FFT_EFFORT_PATIENT:
+	    default:
+		return FFTW_PATIENT;
+	}
+}
+
+/* Must be called with plan_mutex held. The buffers of the given context are
+ * used for planning and so may be overwritten.
+ */
+static fftwf_plan get_plan(struct fft * fft)
+{
+	assert(fft);
+
+	struct fft_plan * p;
+	const char * path;
+
+	for (p = plan_cache; p; p = p->next) {
+		if (p->length == fft->length)
+			return p->plan;
+	}
+
+	p = (struct fft_plan *) malloc(sizeof(struct fft_plan));
+	if (!p) {
+		error("fft: Failed to allocate memory for plan");
+		return NULL;
+	}
+
+	path = get_wisdom_path();
+	if (path && !wisdom_loaded) {
+		fftwf_import_wisdom_from_filename(path);
+		wisdom_loaded = 1;
+	}
+
+	p->length = fft->length;
+	p->plan = fftwf_plan_dft_r2c_1d(fft->length, fft->data,
+			fft->cdata, planner_flags(plan_effort));
+	if (!p->plan) {
+		free(p);
+		return NULL;
+	}
+
+	if (path && !fftwf_export_wisdom_to_filename(path))
+		warn("fft: Failed to write wisdom to %s", path);
+
+	p->next = plan_cache;
+	plan_cache = p;
+
+	return p->plan;
+}
+#endif
+
 /*******************************************************************************
 	Public functions
 *******************************************************************************/
@@ -63,8 +162,10 @@ struct fft * fft_init(uint length)
 
 	fft->length = length;
 
-	/* Align memory to 16-byte boundary */
-	align = 16;
+	/* Shared plans require every context to have the same alignment as
+	 * the buffers used for planning, so align generously.
+	 */
+	align = TUNA_CACHELINE_SIZE;
 
 	r = posix_memalign((void**)&fft->data, align, (length + 4) * sizeof(float));
 	if (r != 0) {
@@ -73,7 +174,7 @@ struct fft * fft_init(uint length)
 		return NULL;
 	}
 	r = posix_memalign((void**)&fft->cdata, align, (length + 4) * sizeof(complex float) / 2);
-	if (!fft->cdata) {
+	if (r != 0) {
 		error("fft: Failed to allocate memory for output data");
 		free(fft->data);
 		free(fft);
@@ -83,8 +184,9 @@ struct fft * fft_init(uint length)
 #ifdef ENABLE_FFTS
 	fft->plan = ffts_init_1d_real(length, -1);
 #else
-	fftwf_import_wisdom_from_filename("fftw.wisdom");
-	fft->plan = fftwf_plan_dft_r2c_1d(length, fft->data, fft->cdata, FFTW_PATIENT);
+	pthread_mutex_lock(&plan_mutex);
+	fft->plan = get_plan(fft);
+	pthread_mutex_unlock(&plan_mutex);
 #endif
 	if (fft->plan == NULL) {
 		error("fft: Failed to plan FFT");
@@ -93,9 +195,6 @@ struct fft * fft_init(uint length)
 		free(fft);
 		return NULL;
 	}
-#ifndef ENABLE_FFTS
-	fftwf_export_wisdom_to_filename("fftw.wisdom");
-#endif
 
 	return fft;
 }
@@ -113,6 +212,83 @@ void fft_exit(struct fft * fft)
 	free(fft);
 }
 
+int fft_set_effort(enum fft_efforts effort)
+{
+	if (effort > FFT_EFFORT_EXHAUSTIVE) {
+		error("fft: Invalid planning effort");
+		return -EINVAL;
+	}
+
+#ifndef ENABLE_FFTS
+	pthread_mutex_lock(&plan_mutex);
+	plan_effort = effort;
+	pthread_mutex_unlock(&plan_mutex);
+#endif
+
+	return 0;
+}
+
+int fft_parse_effort(const char * name, enum fft_efforts * effort)
+{
+	assert(name);
+	assert(effort);
+
+	if (strcmp(name, "estimate") == 0)
+		*effort = FFT_EFFORT_ESTIMATE;
+	else if (strcmp(name, "measure") == 0)
+		*effort = FFT_EFFORT_MEASURE;
+	else if (strcmp(name, "patient") == 0)
+		*effort = FFT_EFFORT_PATIENT;
+	else if (strcmp(name, "exhaustive") == 0)
+		*effort = FFT_EFFORT_EXHAUSTIVE;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+int fft_set_wisdom_path(const char * path)
+{
+#ifndef ENABLE_FFTS
+	char * copy = NULL;
+
+	if (path) {
+		copy = strdup(path);
+		if (!copy) {
+			error("fft: Failed to allocate memory for wisdom path");
+			return -ENOMEM;
+		}
+	}
+
+	pthread_mutex_lock(&plan_mutex);
+	free(wisdom_path);
+	wisdom_path = copy;
+	wisdom_path_set = 1;
+	wisdom_loaded = 0;
+	pthread_mutex_unlock(&plan_mutex);
+#else
+	__unused(path);
+#endif
+
+	return 0;
+}
+
+void fft_cleanup()
+{
+#ifndef ENABLE_FFTS
+	struct fft_plan * p;
+
+	pthread_mutex_lock(&plan_mutex);
+	while (plan_cache) {
+		p = plan_cache;
+		plan_cache = p->next;
+		fftwf_destroy_plan(p->plan);
+		free(p);
+	}
+	pthread_mutex_unlock(&plan_mutex);
+#endif
+}
+
 float * fft_get_data(struct fft * fft)
 {
 	assert(fft);
@@ -141,7 +317,7 @@ int fft_transform(struct fft * fft)
 #ifdef ENABLE_FFTS
 	ffts_execute(fft->plan, fft->data, fft->cdata);
 #else
-	fftwf_execute(fft->plan);
+	fftwf_execute_dft_r2c(fft->plan, fft->data, fft->cdata);
 #endif
 
 	return 0;
@@ -195,6 +195,7 @@ int input_ads1672_run(struct producer * producer)
 
 	int		r;
 	uint		frames;
+	uint		buf_frames;
 	struct timespec ts;
 	sample_t *	buf;
 	int		cond;
@@ -235,7 +236,8 @@ int input_ads1672_run(struct producer * producer)
 		 * within the ADS1672 driver.
 		 */
 		frames = ADS1672_PERIOD_LENGTH;
-		buf = buffer_acquire(&frames);
+		buf_frames = frames;
+		buf = buffer_acquire(&buf_frames);
 		if (!buf) {
 			error("input_ads1672: Failed to acquire buffer");
 			stop(a);
@@ -21,31 +21,90 @@
 #include <alsa/asoundlib.h>
 #include <assert.h>
 #include <malloc.h>
+#include <string.h>
 
 #include "buffer.h"
 #include "consumer.h"
 #include "input_alsa.h"
+#include "csv.h"
+#include "deinterleave.h"
 #include "log.h"
 #include "producer.h"
+#include "simd.h"
+#include "timespec.h"
+
+#ifdef ENABLE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef ENABLE_ARM_NEON
+#include <arm_neon.h>
+#endif
 
 /*******************************************************************************
 	Private declarations
 *******************************************************************************/
 
+/* Copy the first channel of frames of interleaved samples in the device's
+ * format into a sample buffer, converting each sample to sample_t. With
+ * channels set to one, every sample of interleaved data is converted.
+ */
+typedef void (*convert_fn)(sample_t * dst, const void * src, uint channels,
+		uint frames);
+
 struct input_alsa {
-	struct consumer *	consumer;
+	/* Either a single consumer which is given the first channel, or one
+	 * consumer for each channel captured.
+	 */
+	struct consumer **	consumers;
+	uint			n_consumers;
+
+	/* The buffers being filled for each consumer. */
+	sample_t **		bufs;
 
 	snd_pcm_t *		capture;
-	int16_t *		alsa_buf;
 	volatile int		stop;
 	int			stop_condition;
 
+	/* In read mode, samples are read into alsa_buf before conversion. In
+	 * mmap mode they are converted straight from the device's buffer.
+	 */
+	int			use_mmap;
+	void *			alsa_buf;
+	convert_fn		convert;
+
+	/* With more than one consumer, all channels are converted into
+	 * frame_buf and then split between the consumers.
+	 */
+	sample_t *		frame_buf;
+
 	/* ALSA parameters */
 	const char *		device_name;
 	uint			sample_rate;
 	uint			channels;
-	snd_pcm_format_t	format;
 	snd_pcm_uframes_t	period_size;
+
+	/* The format is SND_PCM_FORMAT_UNKNOWN until it has been negotiated
+	 * with the device, after which it is kept for deep recovery.
+	 */
+	snd_pcm_format_t	format;
+
+	/* Statistics. next_time is the estimated time of the first frame which
+	 * hasn't been captured yet, in seconds. It is re-anchored from the
+	 * device's timestamp at every wakeup and moved on as frames are
+	 * captured, so that the gap left by an error can be measured against
+	 * the timestamp after recovery.
+	 */
+	struct input_alsa_stats	stats;
+	double			next_time;
+
+	/* Statistics are appended to stats_file every stats_interval seconds,
+	 * next at stats_due on the monotonic clock.
+	 */
+	const char *		stats_path;
+	FILE *			stats_file;
+	uint			stats_interval;
+	struct timespec		stats_due;
 };
 
 /* Maximum number of frames to read at once. */
@@ -55,6 +114,507 @@ struct input_alsa {
 	Private functions
 *******************************************************************************/
 
+/* Plain scalar conversions for any number of channels. Samples keep their
+ * native resolution, as they do when read from a sound file: 16-bit and 24-bit
+ * samples are sign extended and 32-bit samples are copied as they are. Floating
+ * point samples are scaled to the full 32-bit range, saturating at full scale.
+ *
+ * On ARM, NEON structure loads pick out the first channel of stereo data
+ * directly.
+ */
+static void convert_s16(sample_t * dst, const void * data, uint channels,
+		uint frames)
+{
+	const int16_t * src = (const int16_t *) data;
+	uint i = 0;
+
+#ifdef ENABLE_ARM_NEON
+	if (channels == 1) {
+		for (; i + 8 <= frames; i += 8) {
+			int16x8_t v = vld1q_s16(&src[i]);
+			vst1q_s32(&dst[i], vmovl_s16(vget_low_s16(v)));
+			vst1q_s32(&dst[i + 4], vmovl_s16(vget_high_s16(v)));
+		}
+	} else if (channels == 2) {
+		for (; i + 8 <= frames; i += 8) {
+			int16x8x2_t v = vld2q_s16(&src[2 * i]);
+			vst1q_s32(&dst[i], vmovl_s16(vget_low_s16(v.val[0])));
+			vst1q_s32(&dst[i + 4],
+					vmovl_s16(vget_high_s16(v.val[0])));
+		}
+	}
+#endif
+
+	for (; i < frames; i++)
+		dst[i] = (sample_t) src[i * channels];
+}
+
+/* S24_LE samples are held in the low three bytes of a 32-bit word. The top
+ * byte isn't guaranteed to hold the sign so it is replaced.
+ */
+static void convert_s24(sample_t * dst, const void * data, uint channels,
+		uint frames)
+{
+	const int32_t * src = (const int32_t *) data;
+	uint i = 0;
+
+#ifdef ENABLE_ARM_NEON
+	if (channels == 1) {
+		for (; i + 4 <= frames; i += 4) {
+			int32x4_t v = vld1q_s32(&src[i]);
+			vst1q_s32(&dst[i], vshrq_n_s32(vshlq_n_s32(v, 8), 8));
+		}
+	} else if (channels == 2) {
+		for (; i + 4 <= frames; i += 4) {
+			int32x4x2_t v = vld2q_s32(&src[2 * i]);
+			vst1q_s32(&dst[i],
+					vshrq_n_s32(vshlq_n_s32(v.val[0], 8), 8));
+		}
+	}
+#endif
+
+	for (; i < frames; i++)
+		dst[i] = (sample_t) ((int32_t) ((uint32_t) src[i * channels]
+					<< 8) >> 8);
+}
+
+/* S24_3LE samples are packed into three bytes each. */
+static void convert_s24_3(sample_t * dst, const void * data, uint channels,
+		uint frames)
+{
+	const uint8_t * src = (const uint8_t *) data;
+	const uint8_t * p;
+	uint i;
+
+	for (i = 0; i < frames; i++) {
+		p = &src[i * channels * 3];
+		dst[i] = (sample_t) ((int32_t) (((uint32_t) p[0] << 8) |
+					((uint32_t) p[1] << 16) |
+					((uint32_t) p[2] << 24)) >> 8);
+	}
+}
+
+static void convert_s32(sample_t * dst, const void * data, uint channels,
+		uint frames)
+{
+	const int32_t * src = (const int32_t *) data;
+	uint i = 0;
+
+#ifdef ENABLE_ARM_NEON
+	if (channels == 2) {
+		for (; i + 4 <= frames; i += 4) {
+			int32x4x2_t v = vld2q_s32(&src[2 * i]);
+			vst1q_s32(&dst[i], v.val[0]);
+		}
+	}
+#endif
+
+	for (; i < frames; i++)
+		dst[i] = (sample_t) src[i * channels];
+}
+
+/* The largest float below 2^31. Clamping to this rather than converting out of
+ * range values keeps the result defined, and NaN fails the lower bound check so
+ * that it gives the same result as the x86 conversion instructions.
+ */
+#define FLOAT_SAMPLE_MAX 2147483520.0f
+#define FLOAT_SAMPLE_MIN -2147483648.0f
+#define FLOAT_SAMPLE_SCALE 2147483648.0f
+
+static void convert_float(sample_t * dst, const void * data, uint channels,
+		uint frames)
+{
+	const float * src = (const float *) data;
+	float f;
+	uint i;
+
+	for (i = 0; i < frames; i++) {
+		f = src[i * channels] * FLOAT_SAMPLE_SCALE;
+		if (f > FLOAT_SAMPLE_MAX)
+			f = FLOAT_SAMPLE_MAX;
+		dst[i] = (f >= FLOAT_SAMPLE_MIN) ? (sample_t) f : INT32_MIN;
+	}
+}
+
+#ifdef ENABLE_X86_SIMD
+/* x86 kernels, selected at runtime in select_convert(). Each one converts as
+ * many whole vectors as it can and then calls the scalar code to finish off.
+ */
+
+/* For stereo data each frame is one 32-bit word with the first channel in the
+ * low half, so shifting it up and arithmetically back down both extracts and
+ * sign extends the sample.
+ */
+__attribute__((target("sse4.1")))
+static void convert_s16_sse4_1(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const int16_t * src = (const int16_t *) data;
+	uint i = 0;
+
+	if (channels == 1) {
+		for (; i + 4 <= frames; i += 4) {
+			__m128i v = _mm_loadl_epi64((const __m128i *) &src[i]);
+			_mm_storeu_si128((__m128i *) &dst[i],
+					_mm_cvtepi16_epi32(v));
+		}
+	} else if (channels == 2) {
+		for (; i + 4 <= frames; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *)
+					&src[2 * i]);
+			v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+			_mm_storeu_si128((__m128i *) &dst[i], v);
+		}
+	}
+
+	convert_s16(&dst[i], &src[i * channels], channels, frames - i);
+}
+
+/* As above, eight frames at a time. Other channel counts gather the 32-bit
+ * word starting at each wanted sample. That word runs into the next channel
+ * of the same frame, so the last frame is left to the scalar code to avoid
+ * reading past the end of the data.
+ */
+__attribute__((target("avx2")))
+static void convert_s16_avx2(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const int16_t * src = (const int16_t *) data;
+	uint i = 0;
+
+	if (channels == 1) {
+		for (; i + 8 <= frames; i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *) &src[i]);
+			_mm256_storeu_si256((__m256i *) &dst[i],
+					_mm256_cvtepi16_epi32(v));
+		}
+	} else if (channels == 2) {
+		for (; i + 8 <= frames; i += 8) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)
+					&src[2 * i]);
+			v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+			_mm256_storeu_si256((__m256i *) &dst[i], v);
+		}
+	} else {
+		const __m256i idx = _mm256_mullo_epi32(
+				_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+				_mm256_set1_epi32((int) channels));
+
+		for (; i + 8 < frames; i += 8) {
+			__m256i v = _mm256_i32gather_epi32(
+					(const int *) &src[i * channels],
+					idx, 2);
+			v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+			_mm256_storeu_si256((__m256i *) &dst[i], v);
+		}
+	}
+
+	convert_s16(&dst[i], &src[i * channels], channels, frames - i);
+}
+
+/* Load the first channel of four frames of 32-bit samples. */
+__attribute__((target("sse4.1")))
+static inline __m128i load4_sse4_1(const int32_t * src, uint channels)
+{
+	if (channels == 1)
+		return _mm_loadu_si128((const __m128i *) src);
+
+	if (channels == 2) {
+		__m128 a = _mm_loadu_ps((const float *) src);
+		__m128 b = _mm_loadu_ps((const float *) &src[4]);
+		return _mm_castps_si128(_mm_shuffle_ps(a, b,
+					_MM_SHUFFLE(2, 0, 2, 0)));
+	}
+
+	return _mm_setr_epi32(src[0], src[channels], src[2 * channels],
+			src[3 * channels]);
+}
+
+/* Load the first channel of eight frames of 32-bit samples, where idx holds
+ * the offset of each frame in samples.
+ */
+__attribute__((target("avx2")))
+static inline __m256i load8_avx2(const int32_t * src, uint channels,
+		__m256i idx)
+{
+	if (channels == 1)
+		return _mm256_loadu_si256((const __m256i *) src);
+
+	if (channels == 2) {
+		/* The shuffle works within each 128-bit lane, leaving frames
+		 * 0, 1, 4, 5, 2, 3, 6, 7 which are then put in order.
+		 */
+		__m256 a = _mm256_loadu_ps((const float *) src);
+		__m256 b = _mm256_loadu_ps((const float *) &src[8]);
+		__m256 v = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		return _mm256_permute4x64_epi64(_mm256_castps_si256(v),
+				_MM_SHUFFLE(3, 1, 2, 0));
+	}
+
+	return _mm256_i32gather_epi32((const int *) src, idx, 4);
+}
+
+__attribute__((target("sse4.1")))
+static void convert_s24_sse4_1(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const int32_t * src = (const int32_t *) data;
+	uint i;
+
+	for (i = 0; i + 4 <= frames; i += 4) {
+		__m128i v = load4_sse4_1(&src[i * channels], channels);
+		v = _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+		_mm_storeu_si128((__m128i *) &dst[i], v);
+	}
+
+	convert_s24(&dst[i], &src[i * channels], channels, frames - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_s24_avx2(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const int32_t * src = (const int32_t *) data;
+	const __m256i idx = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32((int) channels));
+	uint i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m256i v = load8_avx2(&src[i * channels], channels, idx);
+		v = _mm256_srai_epi32(_mm256_slli_epi32(v, 8), 8);
+		_mm256_storeu_si256((__m256i *) &dst[i], v);
+	}
+
+	convert_s24(&dst[i], &src[i * channels], channels, frames - i);
+}
+
+/* For mono data, four packed samples are spread out into the top three bytes
+ * of each 32-bit word and then shifted down. Sixteen bytes are loaded to get
+ * the twelve needed, so the last few frames are left to the scalar code.
+ */
+__attribute__((target("sse4.1")))
+static void convert_s24_3_sse4_1(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const uint8_t * src = (const uint8_t *) data;
+	const __m128i shuf = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5,
+			-1, 6, 7, 8, -1, 9, 10, 11);
+	uint i = 0;
+
+	if (channels == 1) {
+		for (; i + 6 <= frames; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *)
+					&src[i * 3]);
+			v = _mm_srai_epi32(_mm_shuffle_epi8(v, shuf), 8);
+			_mm_storeu_si128((__m128i *) &dst[i], v);
+		}
+	}
+
+	convert_s24_3(&dst[i], &src[i * channels * 3], channels, frames - i);
+}
+
+/* Gather the 32-bit word starting at each wanted sample, byte addressed. As
+ * with 16-bit data the word runs on past the sample, so the last frame is left
+ * to the scalar code.
+ */
+__attribute__((target("avx2")))
+static void convert_s24_3_avx2(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const uint8_t * src = (const uint8_t *) data;
+	const __m256i idx = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32((int) (channels * 3)));
+	uint i;
+
+	for (i = 0; i + 8 < frames; i += 8) {
+		__m256i v = _mm256_i32gather_epi32(
+				(const int *) &src[i * channels * 3], idx, 1);
+		v = _mm256_srai_epi32(_mm256_slli_epi32(v, 8), 8);
+		_mm256_storeu_si256((__m256i *) &dst[i], v);
+	}
+
+	convert_s24_3(&dst[i], &src[i * channels * 3], channels, frames - i);
+}
+
+__attribute__((target("sse4.1")))
+static void convert_s32_sse4_1(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const int32_t * src = (const int32_t *) data;
+	uint i;
+
+	for (i = 0; i + 4 <= frames; i += 4)
+		_mm_storeu_si128((__m128i *) &dst[i],
+				load4_sse4_1(&src[i * channels], channels));
+
+	convert_s32(&dst[i], &src[i * channels], channels, frames - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_s32_avx2(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const int32_t * src = (const int32_t *) data;
+	const __m256i idx = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32((int) channels));
+	uint i;
+
+	for (i = 0; i + 8 <= frames; i += 8)
+		_mm256_storeu_si256((__m256i *) &dst[i],
+				load8_avx2(&src[i * channels], channels, idx));
+
+	convert_s32(&dst[i], &src[i * channels], channels, frames - i);
+}
+
+/* Truncating conversion gives INT32_MIN for anything out of range, including
+ * NaN, which is correct for the negative side. The positive side is clamped
+ * first. The clamp takes its second operand when either is NaN, so the
+ * order of operands passes NaN through.
+ */
+__attribute__((target("sse4.1")))
+static void convert_float_sse4_1(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const int32_t * src = (const int32_t *) data;
+	const __m128 scale = _mm_set1_ps(FLOAT_SAMPLE_SCALE);
+	const __m128 max = _mm_set1_ps(FLOAT_SAMPLE_MAX);
+	uint i;
+
+	for (i = 0; i + 4 <= frames; i += 4) {
+		__m128 v = _mm_castsi128_ps(load4_sse4_1(&src[i * channels],
+					channels));
+		v = _mm_min_ps(max, _mm_mul_ps(v, scale));
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_cvttps_epi32(v));
+	}
+
+	convert_float(&dst[i], &src[i * channels], channels, frames - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_float_avx2(sample_t * dst, const void * data,
+		uint channels, uint frames)
+{
+	const int32_t * src = (const int32_t *) data;
+	const __m256i idx = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32((int) channels));
+	const __m256 scale = _mm256_set1_ps(FLOAT_SAMPLE_SCALE);
+	const __m256 max = _mm256_set1_ps(FLOAT_SAMPLE_MAX);
+	uint i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m256 v = _mm256_castsi256_ps(load8_avx2(&src[i * channels],
+					channels, idx));
+		v = _mm256_min_ps(max, _mm256_mul_ps(v, scale));
+		_mm256_storeu_si256((__m256i *) &dst[i],
+				_mm256_cvttps_epi32(v));
+	}
+
+	convert_float(&dst[i], &src[i * channels], channels, frames - i);
+}
+#endif
+
+/* Each supported format with its conversion kernels, in the order in which
+ * formats are tried when negotiating with a device: the widest first.
+ */
+struct alsa_format {
+	enum input_alsa_formats	id;
+	snd_pcm_format_t	format;
+	const char *		name;
+	convert_fn		convert;
+#ifdef ENABLE_X86_SIMD
+	convert_fn		convert_sse4_1;
+	convert_fn		convert_avx2;
+#endif
+};
+
+#ifdef ENABLE_X86_SIMD
+#define KERNELS(fn) fn, fn##_sse4_1, fn##_avx2
+#else
+#define KERNELS(fn) fn
+#endif
+
+static const struct alsa_format formats[] = {
+	{INPUT_ALSA_FORMAT_S32_LE, SND_PCM_FORMAT_S32_LE, "s32_le",
+		KERNELS(convert_s32)},
+	{INPUT_ALSA_FORMAT_S24_LE, SND_PCM_FORMAT_S24_LE, "s24_le",
+		KERNELS(convert_s24)},
+	{INPUT_ALSA_FORMAT_S24_3LE, SND_PCM_FORMAT_S24_3LE, "s24_3le",
+		KERNELS(convert_s24_3)},
+	{INPUT_ALSA_FORMAT_FLOAT_LE, SND_PCM_FORMAT_FLOAT_LE, "float_le",
+		KERNELS(convert_float)},
+	{INPUT_ALSA_FORMAT_S16_LE, SND_PCM_FORMAT_S16_LE, "s16_le",
+		KERNELS(convert_s16)}
+};
+
+#define N_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+static const struct alsa_format * find_format(snd_pcm_format_t format)
+{
+	uint i;
+
+	for (i = 0; i < N_FORMATS; i++)
+		if (formats[i].format == format)
+			return &formats[i];
+
+	return NULL;
+}
+
+/* Pick the conversion for the negotiated format. There are no AVX-512 kernels
+ * as a period of data is converted far faster than it arrives even with AVX2,
+ * so that level uses AVX2.
+ */
+static void select_convert(struct input_alsa * a)
+{
+	assert(a);
+
+	const struct alsa_format * f = find_format(a->format);
+
+	assert(f);
+
+	a->convert = f->convert;
+
+#ifdef ENABLE_X86_SIMD
+	switch (simd_get_level()) {
+	    case SIMD_LEVEL_AVX512:
+	    case SIMD_LEVEL_AVX2:
+		a->convert = f->convert_avx2;
+		break;
+
+	    case SIMD_LEVEL_SSE4_1:
+		a->convert = f->convert_sse4_1;
+		break;
+
+	    default:
+		break;
+	}
+#endif
+}
+
+/* Pick the first format in the table which the device supports. */
+static int negotiate_format(struct input_alsa * a,
+		snd_pcm_hw_params_t * hw_params)
+{
+	assert(a);
+	assert(hw_params);
+
+	uint i;
+
+	for (i = 0; i < N_FORMATS; i++) {
+		if (snd_pcm_hw_params_test_format(a->capture, hw_params,
+					formats[i].format) == 0) {
+			a->format = formats[i].format;
+			return 0;
+		}
+	}
+
+	error("input_alsa: Device %s supports none of the capture formats", a->device_name);
+	return -EINVAL;
+}
+
 static int prep(struct input_alsa * a)
 {
 	assert(a);
@@ -83,10 +643,27 @@ static int prep(struct input_alsa * a)
 		goto handle_err;
 	}
 
-	r = snd_pcm_hw_params_set_access(a->capture, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-	if (r < 0) {
-		error("input_alsa: Failed to set access mode to RW_INTERLEAVED: %s", snd_strerror(r));
-		goto handle_err;
+	if (a->use_mmap) {
+		r = snd_pcm_hw_params_set_access(a->capture, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+		if (r < 0) {
+			warn("input_alsa: Device %s doesn't support MMAP_INTERLEAVED access, using RW_INTERLEAVED: %s", a->device_name, snd_strerror(r));
+			a->use_mmap = 0;
+		}
+	}
+
+	if (!a->use_mmap) {
+		r = snd_pcm_hw_params_set_access(a->capture, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+		if (r < 0) {
+			error("input_alsa: Failed to set access mode to RW_INTERLEAVED: %s", snd_strerror(r));
+			goto handle_err;
+		}
+	}
+	msg("input_alsa: Capturing with %s access", a->use_mmap ? "MMAP_INTERLEAVED" : "RW_INTERLEAVED");
+
+	if (a->format == SND_PCM_FORMAT_UNKNOWN) {
+		r = negotiate_format(a, hw_params);
+		if (r < 0)
+			goto handle_err;
 	}
 
 	r = snd_pcm_hw_params_set_format(a->capture, hw_params, a->format);
@@ -94,6 +671,7 @@ static int prep(struct input_alsa * a)
 		error("input_alsa: Failed to set format to %s: %s", snd_pcm_format_name(a->format), snd_strerror(r));
 		goto handle_err;
 	}
+	msg("input_alsa: Capturing in %s format", snd_pcm_format_name(a->format));
 
 	r = snd_pcm_hw_params_set_rate_near(a->capture, hw_params, &a->sample_rate, 0);
 	if (r < 0) {
@@ -142,7 +720,8 @@ static int prep(struct input_alsa * a)
 		goto handle_err;
 	}
 
-	r = snd_pcm_sw_params_set_avail_min(a->capture, sw_params, 512);
+	r = snd_pcm_sw_params_set_avail_min(a->capture, sw_params,
+			(a->period_size < 512) ? a->period_size : 512);
 	if (r < 0) {
 		error("input_alsa: Failed to set minimum available threshold: %s", snd_strerror(r));
 		goto handle_err;
@@ -157,14 +736,21 @@ static int prep(struct input_alsa * a)
 	snd_pcm_sw_params_free(sw_params);
 	sw_params = NULL;
 
-	/* Allocate memory for samples in ALSA format. */
-	a->alsa_buf = (int16_t *)malloc(MAX_FRAMES * a->channels * sizeof(int16_t));
-	if (!a->alsa_buf) {
-		error("input_alsa: Failed to allocate memory for incoming samples");
-		r = -ENOMEM;
-		goto handle_err;
+	/* Allocate memory for samples in ALSA format if we need to read them.
+	 * This is kept if the device is re-opened for deep recovery.
+	 */
+	if (!a->use_mmap && !a->alsa_buf) {
+		a->alsa_buf = malloc(MAX_FRAMES * a->channels *
+				(snd_pcm_format_physical_width(a->format) / 8));
+		if (!a->alsa_buf) {
+			error("input_alsa: Failed to allocate memory for incoming samples");
+			r = -ENOMEM;
+			goto handle_err;
+		}
 	}
 
+	select_convert(a);
+
 	r = snd_pcm_prepare(a->capture);
 	if (r < 0) {
 		error("input_alsa: Failed to prepare for reading: %s", snd_strerror(r));
@@ -175,8 +761,10 @@ static int prep(struct input_alsa * a)
 
 handle_err:
 	/* Error cleanup. */
-	if (a->alsa_buf)
+	if (a->alsa_buf) {
 		free(a->alsa_buf);
+		a->alsa_buf = NULL;
+	}
 
 	if (hw_params)
 		snd_pcm_hw_params_free(hw_params);
@@ -188,14 +776,116 @@ handle_err:
 		r2 = snd_pcm_close(a->capture);
 		if (r2 < 0)
 			error("input_alsa: Error closing device: %s", snd_strerror(r2));
+		a->capture = NULL;
 	}
 
 	return r;
 }
 
+static double ts_seconds(const struct timespec * ts)
+{
+	return (double) ts->tv_sec + (double) ts->tv_nsec / 1e9;
+}
+
+static uint hist_bucket(uint64 v)
+{
+	uint i;
+
+	for (i = 0; v > 1 && i < INPUT_ALSA_HIST_BUCKETS - 1; i++)
+		v >>= 1;
+
+	return i;
+}
+
+/* Each line of the statistics file is the time followed by every count in
+ * struct input_alsa_stats.
+ */
+static int write_stats(struct input_alsa * a)
+{
+	assert(a);
+	assert(a->stats_file);
+
+	struct timespec now;
+	uint i;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	timespec_fprint(&now, a->stats_file);
+	fprintf(a->stats_file, ", ");
+
+	csv_write_uint64(a->stats_file, a->stats.wakeups);
+	csv_write_uint64(a->stats_file, a->stats.xruns);
+	csv_write_uint64(a->stats_file, a->stats.suspends);
+	csv_write_uint64(a->stats_file, a->stats.errors);
+	csv_write_uint64(a->stats_file, a->stats.deep_recoveries);
+	csv_write_float(a->stats_file, (float) a->stats.recovery_time);
+	csv_write_uint64(a->stats_file, a->stats.lost_samples);
+	for (i = 0; i < INPUT_ALSA_HIST_BUCKETS; i++)
+		csv_write_uint64(a->stats_file, a->stats.latency_hist[i]);
+	for (i = 0; i < INPUT_ALSA_HIST_BUCKETS; i++)
+		csv_write_uint64(a->stats_file, a->stats.avail_hist[i]);
+	csv_next(a->stats_file);
+
+	/* Flush so that the file can be watched while capture is running. */
+	if (fflush(a->stats_file) != 0) {
+		error("input_alsa: Failed to write statistics to %s", a->stats_path);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/* Record the timing of a wakeup. The device's timestamp gives the time of its
+ * last update, when avail frames were waiting, so it also gives the time of
+ * the first frame not yet captured.
+ */
+static void record_wakeup(struct input_alsa * a)
+{
+	assert(a);
+
+	int			r;
+	struct timespec		ts;
+	struct timespec		now;
+	snd_pcm_uframes_t	avail;
+	double			latency;
+
+	a->stats.wakeups++;
+
+	r = snd_pcm_htimestamp(a->capture, &avail, (snd_htimestamp_t *) &ts);
+	if (r < 0)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	latency = (ts_seconds(&now) - ts_seconds(&ts)) * 1e6;
+	a->stats.latency_hist[hist_bucket((latency > 0) ?
+			(uint64) latency : 0)]++;
+
+	a->next_time = ts_seconds(&ts) - (double) avail / a->sample_rate;
+}
+
+/* Write out statistics if the interval has passed. */
+static int check_stats(struct input_alsa * a)
+{
+	assert(a);
+
+	struct timespec now;
+
+	if (!a->stats_file || !a->stats_interval)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec < a->stats_due.tv_sec || (now.tv_sec ==
+				a->stats_due.tv_sec && now.tv_nsec <
+				a->stats_due.tv_nsec))
+		return 0;
+
+	a->stats_due.tv_sec += a->stats_interval;
+	return write_stats(a);
+}
+
 static int start(struct input_alsa * a)
 {
 	int r;
+	uint c;
 	struct timespec		ts;
 
 	/* Unused but snd_pcm_htimestamp doesn't say whether the second argument
@@ -224,10 +914,24 @@ static int start(struct input_alsa * a)
 		return r;
 	}
 
-	r = consumer_start(a->consumer, a->sample_rate, &ts);
-	if (r < 0) {
-		error("input_alsa: Failed to start consumer");
-		return r;
+	for (c = 0; c < a->n_consumers; c++) {
+		r = consumer_start(a->consumers[c], a->sample_rate, &ts);
+		if (r < 0) {
+			error("input_alsa: Failed to start consumer");
+			return r;
+		}
+	}
+	a->next_time = ts_seconds(&ts);
+
+	if (a->stats_path) {
+		a->stats_file = csv_open(a->stats_path);
+		if (!a->stats_file) {
+			error("input_alsa: Failed to open statistics file %s", a->stats_path);
+			return -EIO;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &a->stats_due);
+		a->stats_due.tv_sec += a->stats_interval;
 	}
 
 	r = snd_pcm_start(a->capture);
@@ -244,22 +948,37 @@ static int handle_error(struct input_alsa * a, int err)
 	assert(a);
 
 	int r;
+	uint c;
 	struct timespec ts;
-
-	/* Unused but snd_pcm_htimestamp doesn't say whether the second argument
-	 * can be null or not.
-	 */
+	struct timespec rec_start, rec_end;
 	snd_pcm_uframes_t	avail;
+	double			gap;
+
+	if (err == -EPIPE)
+		a->stats.xruns++;
+	else if (err == -ESTRPIPE)
+		a->stats.suspends++;
+	else
+		a->stats.errors++;
 
 	msg("input_alsa: Attempting to recover from error");
 
-	/* See if ALSA layer can deal with the error. */
+	/* See if ALSA layer can deal with the error. Recovery from an overrun
+	 * leaves the device prepared, so it must be started again.
+	 */
 	r = snd_pcm_recover(a->capture, err, 0);
+	if (r == 0 && snd_pcm_state(a->capture) == SND_PCM_STATE_PREPARED) {
+		r = snd_pcm_start(a->capture);
+		if (r < 0)
+			error("input_alsa: Could not re-start capture: %s", snd_strerror(r));
+	}
 
 	if (r < 0) {
 		/* Deep recovery: Close and re-open the ALSA input device. */
 		error("input_alsa: Standard recovery failed: %s", snd_strerror(r));
 		msg("input_alsa: Attempting deep recovery");
+		a->stats.deep_recoveries++;
+		clock_gettime(CLOCK_MONOTONIC, &rec_start);
 
 		r = snd_pcm_close(a->capture);
 		if (r < 0) {
@@ -278,6 +997,10 @@ static int handle_error(struct input_alsa * a, int err)
 			error("input_alsa: Could not re-start capture: %s", snd_strerror(r));
 			return r;
 		}
+
+		clock_gettime(CLOCK_MONOTONIC, &rec_end);
+		a->stats.recovery_time += ts_seconds(&rec_end) -
+			ts_seconds(&rec_start);
 	}
 
 	/* Resync the consumer. */
@@ -286,31 +1009,177 @@ static int handle_error(struct input_alsa * a, int err)
 		error("input_alsa: Unable to get timestamp for resync: %s", snd_strerror(r));
 		return r;
 	}
+
+	/* Whatever is missing between the last frame captured and the first
+	 * frame now waiting has been lost.
+	 */
+	gap = ts_seconds(&ts) - (double) avail / a->sample_rate - a->next_time;
+	if (gap > 0)
+		a->stats.lost_samples += (uint64) (gap * a->sample_rate + 0.5);
+	a->next_time = ts_seconds(&ts) - (double) avail / a->sample_rate;
 	
-	r = consumer_resync(a->consumer, &ts);
-	if (r < 0) {
-		error("input_alsa: Failed to resync consumer");
-		return r;
+	for (c = 0; c < a->n_consumers; c++) {
+		r = consumer_resync(a->consumers[c], &ts);
+		if (r < 0) {
+			error("input_alsa: Failed to resync consumer");
+			return r;
+		}
 	}
 
 	return r;
 }
 
-/* Convert 16-bit samples from ALSA into our sample_t type and if multiple
- * channels are present the select only the first one. The samples are copied
- * from the ALSA buffer to a new buffer (given as an argument) as they are 
- * converted.
+/* Release the buffers acquired for the consumers. */
+static void release_bufs(struct input_alsa * a)
+{
+	assert(a);
+
+	uint c;
+
+	for (c = 0; c < a->n_consumers; c++) {
+		if (a->bufs[c])
+			buffer_release(a->bufs[c]);
+		a->bufs[c] = NULL;
+	}
+}
+
+/* Acquire a buffer for each consumer and convert frames of interleaved samples
+ * from src into them. A single consumer is given the first channel. Otherwise
+ * every channel is converted and then split out, one to each consumer.
  */
-static void convert_buffer(struct input_alsa * a, sample_t * buf, uint frames)
+static int convert_frames(struct input_alsa * a, const void * src, uint frames)
 {
-	uint i;
+	assert(a);
+	assert(src);
+
+	uint c, n;
+
+	for (c = 0; c < a->n_consumers; c++) {
+		/* The buffer may be larger than we asked for. */
+		n = frames;
+		a->bufs[c] = buffer_acquire(&n);
+		if (!a->bufs[c]) {
+			error("input_alsa: Failed to acquire buffer");
+			release_bufs(a);
+			return -ENOMEM;
+		}
+	}
+
+	if (a->n_consumers == 1) {
+		a->convert(a->bufs[0], src, a->channels, frames);
+	} else {
+		a->convert(a->frame_buf, src, 1, frames * a->channels);
+		deinterleave(a->bufs, a->frame_buf, a->channels, frames);
+	}
+
+	return 0;
+}
 
+/* Pass the converted buffers on and release them. */
+static int write_frames(struct input_alsa * a, uint frames)
+{
 	assert(a);
-	assert(buf);
 
-	for (i = 0; i < frames; i++) {
-		buf[i] = (sample_t)a->alsa_buf[i * a->channels];
+	int r = 0;
+	uint c;
+
+	for (c = 0; c < a->n_consumers && r >= 0; c++) {
+		r = consumer_write(a->consumers[c], a->bufs[c], frames);
+		if (r < 0)
+			error("input_alsa: Failed to write to consumer");
 	}
+
+	release_bufs(a);
+	return r;
+}
+
+/* Read up to the given number of frames into alsa_buf, then convert them into
+ * new buffers and pass them on.
+ */
+static int capture_read(struct input_alsa * a, uint frames)
+{
+	assert(a);
+
+	int			r;
+	snd_pcm_sframes_t	sf;
+
+	sf = snd_pcm_readi(a->capture, a->alsa_buf, (snd_pcm_uframes_t) frames);
+	r = (int)sf;
+
+	if (r < 0) {
+		error("input_alsa: Read error: %s", snd_strerror(r));
+
+		/* If the error can't be handled, the message has already been
+		 * printed.
+		 */
+		return handle_error(a, r);
+	}
+
+	/* Got sf frames. */
+	frames = (uint)sf;
+
+	/* Convert samples from ALSA into our sample_t type. */
+	r = convert_frames(a, a->alsa_buf, frames);
+	if (r < 0)
+		return r;
+	a->next_time += (double) frames / a->sample_rate;
+
+	return write_frames(a, frames);
+}
+
+/* Convert up to the given number of frames straight out of the device's ring
+ * buffer into new buffers and pass them on. The frames available may wrap
+ * around the end of the ring, in which case they are handled in two parts.
+ */
+static int capture_mmap(struct input_alsa * a, uint frames)
+{
+	assert(a);
+
+	int				r;
+	const snd_pcm_channel_area_t *	areas;
+	snd_pcm_uframes_t		offset;
+	snd_pcm_uframes_t		n;
+	snd_pcm_sframes_t		committed;
+	const void *			src;
+
+	while (frames) {
+		n = frames;
+		r = snd_pcm_mmap_begin(a->capture, &areas, &offset, &n);
+		if (r < 0) {
+			error("input_alsa: Failed to map capture buffer: %s", snd_strerror(r));
+			return handle_error(a, r);
+		}
+
+		if (!n)
+			return 0;
+
+		/* All channels of an interleaved buffer share one area. */
+		src = (const char *) areas[0].addr +
+			(areas[0].first + offset * areas[0].step) / 8;
+		r = convert_frames(a, src, (uint) n);
+		if (r < 0)
+			return r;
+
+		/* The samples have been copied out so the device may reuse its
+		 * buffer before we pass them on.
+		 */
+		committed = snd_pcm_mmap_commit(a->capture, offset, n);
+		if (committed < 0 || (snd_pcm_uframes_t) committed != n) {
+			release_bufs(a);
+			r = (committed < 0) ? (int) committed : -EPIPE;
+			error("input_alsa: Failed to commit capture buffer: %s", snd_strerror(r));
+			return handle_error(a, r);
+		}
+		a->next_time += (double) n / a->sample_rate;
+
+		r = write_frames(a, (uint) n);
+		if (r < 0)
+			return r;
+
+		frames -= (uint) n;
+	}
+
+	return 0;
 }
 
 int input_alsa_run(struct producer * producer)
@@ -320,11 +1189,10 @@ int input_alsa_run(struct producer * producer)
 	struct input_alsa * a = (struct input_alsa *)
 		producer_get_data(producer);
 
-	int			r;
-	snd_pcm_sframes_t	sf;
+	int			r, r2;
 	snd_pcm_sframes_t	avail;
 	uint			frames;
-	sample_t *		buf;
+	uint			max_frames = buffer_arena_frames();
 
 	r = start(a);
 	if (r < 0)
@@ -335,54 +1203,66 @@ int input_alsa_run(struct producer * producer)
 		/* Check for termination signal. */
 		if (a->stop) {
 			msg("input_alsa: Stop");
-			return a->stop_condition;
+			r = a->stop_condition;
+			break;
 		}
 
 		r = snd_pcm_wait(a->capture, -1);
 		if (r < 0) {
-			/* TODO: Handle errors like xrun and suspend. */
-			fatal("input_alsa: snd_pcm_wait failed: %s", snd_strerror(r));
+			error("input_alsa: Failed waiting for data: %s", snd_strerror(r));
+			r = handle_error(a, r);
+			if (r < 0)
+				break;
+			continue;
 		}
 
-		avail = snd_pcm_avail_update(a->capture);
-		frames = (avail > MAX_FRAMES) ? MAX_FRAMES : (uint)avail;
-		
-		sf = snd_pcm_readi(a->capture, a->alsa_buf, (snd_pcm_uframes_t) frames);
-		r = (int)sf;
+		record_wakeup(a);
 
-		if (r < 0) {
-			error("input_alsa: Read error: %s", snd_strerror(r));
-			
+		avail = snd_pcm_avail_update(a->capture);
+		if (avail < 0) {
+			r = (int) avail;
+			error("input_alsa: Failed to get available frames: %s", snd_strerror(r));
 			r = handle_error(a, r);
-			if (r < 0) {
-				/* failed to handle error, message has already been printed */
-				return r;
-			}
-		} else {
-			/* Got sf frames. */
-			frames = (uint)sf;
-
-			buf = buffer_acquire(&frames);
-			if (!buf) {
-				error("input_alsa: Failed to acquire buffer");
-				return -1;
-			}
-
-			/* Convert samples from ALSA into our sample_t type. */
-			convert_buffer(a, buf, frames);
-			
-			r = consumer_write(a->consumer, buf, frames);
-			if (r < 0) {
-				error("input_alsa: Failed to write to consumer");
-				buffer_release(buf);
-				return r;
-			}
-
-			buffer_release(buf);
+			if (r < 0)
+				break;
+			continue;
 		}
+		a->stats.avail_hist[hist_bucket((uint64) avail)]++;
+		frames = (avail > MAX_FRAMES) ? MAX_FRAMES : (uint)avail;
+
+		/* Arena buffers are sized from the period, anything more is
+		 * left for the next pass as the device is then already due.
+		 */
+		if (max_frames && frames > max_frames)
+			frames = max_frames;
+
+		if (a->use_mmap)
+			r = capture_mmap(a, frames);
+		else
+			r = capture_read(a, frames);
+
+		/* Any error message has already been printed. */
+		if (r < 0)
+			break;
+
+		r = check_stats(a);
+		if (r < 0)
+			break;
 	}
 
-	return 0;
+	msg("input_alsa: %llu wakeups, %llu xruns, %llu suspends, %llu other errors, "
+			"%llu deep recoveries taking %.3f s, about %llu samples lost",
+			a->stats.wakeups, a->stats.xruns, a->stats.suspends,
+			a->stats.errors, a->stats.deep_recoveries,
+			a->stats.recovery_time, a->stats.lost_samples);
+
+	if (a->stats_file) {
+		r2 = write_stats(a);
+		if (r2 < 0 && r >= 0)
+			r = r2;
+	}
+
+	return r;
 }
 
 void input_alsa_exit(struct producer * producer)
@@ -394,11 +1274,20 @@ void input_alsa_exit(struct producer * producer)
 	struct input_alsa * a = (struct input_alsa *)
 		producer_get_data(producer);
 
-	r = snd_pcm_close(a->capture);
-	if (r < 0) {
-		error("input_alsa: Error closing device: %s", snd_strerror(r));
+	if (a->capture) {
+		r = snd_pcm_close(a->capture);
+		if (r < 0) {
+			error("input_alsa: Error closing device: %s", snd_strerror(r));
+		}
 	}
 
+	if (a->stats_file)
+		csv_close(a->stats_file);
+
+	free(a->alsa_buf);
+	free(a->frame_buf);
+	free(a->bufs);
+	free(a->consumers);
 	free(a);
 }
 
@@ -419,41 +1308,151 @@ int input_alsa_stop(struct producer * producer, int condition)
 	Public functions
 *******************************************************************************/
 
-int input_alsa_init(struct producer * producer, struct consumer * consumer,
-		const char * device_name, uint sample_rate)
+int input_alsa_init_channels(struct producer * producer,
+		struct consumer ** consumers, uint n_consumers,
+		const char * device_name, const struct input_alsa_params * params)
 {
 	assert(producer);
-	assert(consumer);
+	assert(consumers);
+	assert(n_consumers);
+	assert(params);
 
 	int r;
+	uint i;
+
+	if (!params->channels) {
+		error("input_alsa: Invalid number of channels");
+		return -EINVAL;
+	}
+
+	if (n_consumers > 1 && n_consumers != params->channels) {
+		error("input_alsa: Capturing %u channels but %u outputs were given",
+				params->channels, n_consumers);
+		return -EINVAL;
+	}
+
+	if (!params->period_size) {
+		error("input_alsa: Invalid period size");
+		return -EINVAL;
+	}
 
 	struct input_alsa * a = (struct input_alsa *)
-		malloc(sizeof(struct input_alsa));
+		calloc(1, sizeof(struct input_alsa));
 	if (!a) {
 		error("input_alsa: Failed to allocate memory");
 		return -ENOMEM;
 	}
 
-	a->consumer = consumer;
+	a->consumers = (struct consumer **)
+		calloc(n_consumers, sizeof(struct consumer *));
+	a->bufs = (sample_t **) calloc(n_consumers, sizeof(sample_t *));
+	if (n_consumers > 1)
+		a->frame_buf = (sample_t *) malloc(MAX_FRAMES *
+				n_consumers * sizeof(sample_t));
+	if (!a->consumers || !a->bufs || (n_consumers > 1 && !a->frame_buf)) {
+		error("input_alsa: Failed to allocate memory");
+		r = -ENOMEM;
+		goto err;
+	}
+
+	memcpy(a->consumers, consumers,
+			n_consumers * sizeof(struct consumer *));
+	a->n_consumers = n_consumers;
 	a->device_name = device_name;
-	a->sample_rate = sample_rate;
-	a->channels = 2;
-	a->format = SND_PCM_FORMAT_S16_LE;
-	a->period_size = 4096;			/* ~93 ms at 44.1kHz */
+	a->sample_rate = params->sample_rate;
+	a->use_mmap = params->use_mmap;
+	a->channels = params->channels;
+	a->period_size = params->period_size;
+
+	a->format = SND_PCM_FORMAT_UNKNOWN;
+	for (i = 0; i < N_FORMATS; i++)
+		if (formats[i].id == params->format)
+			a->format = formats[i].format;
 	a->stop = 0;
 
 	a->capture = NULL;
 	a->alsa_buf = NULL;
 
+	memset(&a->stats, 0, sizeof(a->stats));
+	a->next_time = 0;
+	a->stats_path = params->stats_path;
+	a->stats_file = NULL;
+	a->stats_interval = params->stats_interval;
+
 	r = prep(a);
-	if (r < 0) {
+	if (r < 0)
 		/* Prep failed, error message has already been printed */
-		free(a);
-		return r;
-	}
+		goto err;
 
 	producer_set_module(producer, input_alsa_run, input_alsa_stop,
 			input_alsa_exit, a);
 
 	return 0;
+
+err:
+	free(a->frame_buf);
+	free(a->bufs);
+	free(a->consumers);
+	free(a);
+	return r;
+}
+
+int input_alsa_init_params(struct producer * producer,
+		struct consumer * consumer, const char * device_name,
+		const struct input_alsa_params * params)
+{
+	assert(consumer);
+
+	return input_alsa_init_channels(producer, &consumer, 1, device_name,
+			params);
+}
+
+int input_alsa_init(struct producer * producer, struct consumer * consumer,
+		const char * device_name, uint sample_rate)
+{
+	struct input_alsa_params params;
+
+	params.sample_rate = sample_rate;
+	params.use_mmap = 0;
+	params.format = INPUT_ALSA_FORMAT_S16_LE;
+	params.channels = 2;
+	params.period_size = 4096;		/* ~93 ms at 44.1kHz */
+	params.stats_path = NULL;
+	params.stats_interval = 0;
+
+	return input_alsa_init_params(producer, consumer, device_name, &params);
+}
+
+void input_alsa_get_stats(struct producer * producer,
+		struct input_alsa_stats * stats)
+{
+	assert(producer);
+	assert(stats);
+
+	struct input_alsa * a = (struct input_alsa *)
+		producer_get_data(producer);
+
+	*stats = a->stats;
+}
+
+int input_alsa_parse_format(const char * name, enum input_alsa_formats * format)
+{
+	assert(name);
+	assert(format);
+
+	uint i;
+
+	if (strcmp(name, "auto") == 0) {
+		*format = INPUT_ALSA_FORMAT_AUTO;
+		return 0;
+	}
+
+	for (i = 0; i < N_FORMATS; i++) {
+		if (strcmp(name, formats[i].name) == 0) {
+			*format = formats[i].id;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
 }
@@ -20,12 +20,19 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <malloc.h>
+#include <math.h>
+#include <pthread.h>
 #include <sndfile.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "buffer.h"
 #include "consumer.h"
+#include "deinterleave.h"
 #include "input_sndfile.h"
 #include "log.h"
 #include "producer.h"
@@ -39,8 +46,45 @@
 	Private declarations
 *******************************************************************************/
 
+/* Amount of the next file in a sequence to ask the kernel to read in while the
+ * current file is still being processed.
+ */
+#define SNDFILE_PREFETCH_BYTES		(4 << 20)
+
+/* Timestamps of consecutive files in a sequence may disagree by this many
+ * seconds without being treated as a gap, to allow for drift between the
+ * sample clock and the clock used for the timestamps.
+ */
+#define SNDFILE_GAP_TOLERANCE		1.0
+
+/* A buffer of decoded samples for each consumer, or if bufs[0] is NULL a
+ * discontinuity in the input after which the consumers must be resynced to ts.
+ */
+struct sndfile_block {
+	sample_t **		bufs;
+	uint			frames;
+	struct timespec		ts;
+};
+
+/* An open file and the time at which its first sample was recorded, if known.
+ */
+struct sndfile_file {
+	const char *		name;
+	SNDFILE *		sf;
+	SF_INFO			info;
+	int			has_time;
+	struct timespec		ts;
+};
+
 struct input_sndfile {
-	struct consumer *	consumer;
+	/* Each consumer is given one channel of the input. A single consumer
+	 * is given the first channel of the file however many it has,
+	 * otherwise every file must have one channel for each consumer. The
+	 * bufs array holds the buffer pointers of every block.
+	 */
+	struct consumer **	consumers;
+	uint			n_consumers;
+	sample_t **		bufs;
 
 	const char *		source;
 	SNDFILE *		sf;
@@ -48,6 +92,50 @@ struct input_sndfile {
 	const char *		sf_name;
 	volatile int		stop;
 	int			stop_condition;
+
+	/* The files to read as one continuous stream and the index of the
+	 * current file. While the current file is being read, the next is
+	 * opened on the prefetch thread. Frames read from the current file
+	 * are counted so that the time at which the next file should start
+	 * can be found if the current file has a start time.
+	 */
+	const char * const *	sources;
+	uint			n_sources;
+	uint			index;
+	int			has_time;
+	struct timespec		file_ts;
+	uint64			file_frames;
+	struct sndfile_file	next;
+	int			next_r;
+	int			prefetching;
+	pthread_t		prefetch_thread;
+	uint			n_resyncs;
+	double			wait_open;
+
+	/* If depth is non-zero, a decoder thread reads up to depth buffers
+	 * ahead of the consumer into the blocks ring. Blocks from head up to
+	 * tail are ready to be written. Once the decoder reaches EOF or an
+	 * error it sets done and leaves the result in status. The ring indices
+	 * and flags are protected by the mutex. Without a decoder thread, only
+	 * the first block is used.
+	 */
+	uint			depth;
+	struct sndfile_block *	blocks;
+	uint			head;
+	uint			tail;
+	int			done;
+	int			status;
+	int			decode_stop;
+	pthread_t		thread;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		ready_cond;
+	pthread_cond_t		space_cond;
+
+	/* Time in seconds spent by the consumer waiting for decoded data and
+	 * by the decoder waiting for space in the queue.
+	 */
+	double			wait_data;
+	double			wait_space;
 };
 
 /*******************************************************************************
@@ -79,29 +167,216 @@ static const char * sample_type(int format)
 	}
 }
 
-static int open_sndfile(struct input_sndfile * snd, const char * sf_name)
+/* Days from 1970-01-01 to the given date in the proleptic Gregorian calendar.
+ */
+static long days_from_civil(long y, long m, long d)
 {
-	assert(snd);
-	assert(sf_name);
+	long era, yoe, doy, doe;
 
-	int r;
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+/* Find the time at which the first sample of a file was recorded from its
+ * Broadcast Wave 'bext' chunk. The time reference gives the sample count since
+ * midnight, falling back to the origination time if it is zero. Times are
+ * taken to be UTC, as written by output_sndfile.
+ *
+ * Returns 1 if a start time was found, otherwise 0.
+ */
+static int file_start_time(struct sndfile_file * f)
+{
+	assert(f);
+
+	SF_BROADCAST_INFO bext;
+	char date_str[sizeof(bext.origination_date) + 1];
+	char time_str[sizeof(bext.origination_time) + 1];
+	int year, month, day, hour, min, sec;
+	uint64 ref;
 
-	/* Store filename to be opened. */
-	snd->sf_name = sf_name;
+	memset(&bext, 0, sizeof(bext));
+	if (sf_command(f->sf, SFC_GET_BROADCAST_INFO, &bext,
+				sizeof(bext)) != SF_TRUE)
+		return 0;
 
-	memset(&snd->sf_info, 0, sizeof(snd->sf_info));
-	snd->sf = sf_open(sf_name, SFM_READ, &snd->sf_info);
-	if (!snd->sf) {
+	/* The date and time fields aren't null terminated. */
+	memcpy(date_str, bext.origination_date, sizeof(bext.origination_date));
+	date_str[sizeof(bext.origination_date)] = '\0';
+	memcpy(time_str, bext.origination_time, sizeof(bext.origination_time));
+	time_str[sizeof(bext.origination_time)] = '\0';
+
+	if (sscanf(date_str, "%4d%*c%2d%*c%2d", &year, &month, &day) != 3)
+		return 0;
+
+	f->ts.tv_sec = (time_t) days_from_civil(year, month, day) * 86400;
+	f->ts.tv_nsec = 0;
+
+	ref = ((uint64) bext.time_reference_high << 32) |
+		bext.time_reference_low;
+	if (ref) {
+		f->ts.tv_sec += (time_t) (ref / f->info.samplerate);
+		f->ts.tv_nsec = (long) ((ref % f->info.samplerate) *
+				1000000000ULL / f->info.samplerate);
+	} else {
+		if (sscanf(time_str, "%2d%*c%2d%*c%2d", &hour, &min, &sec) != 3)
+			return 0;
+		f->ts.tv_sec += hour * 3600 + min * 60 + sec;
+	}
+
+	return 1;
+}
+
+static int open_file(struct sndfile_file * f, const char * name)
+{
+	assert(f);
+	assert(name);
+
+	int r, fd;
+	char ts_str[100];
+
+	f->name = name;
+
+	/* Open the file ourselves so that we can ask for the start of it to be
+	 * read in before libsndfile gets to it.
+	 */
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		r = errno;
+		error("input_sndfile: Failed to open file %s: %s", name,
+				strerror(r));
+		return -r;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fd, 0, SNDFILE_PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+
+	/* libsndfile takes ownership of fd, closing it even on failure. */
+	memset(&f->info, 0, sizeof(f->info));
+	f->sf = sf_open_fd(fd, SFM_READ, &f->info, SF_TRUE);
+	if (!f->sf) {
 		r = sf_error(NULL);
 		error("libsndfile: Error %d: %s", r, sf_strerror(NULL));
-		error("input_sndfile: Failed to open file %s", sf_name);
+		error("input_sndfile: Failed to open file %s", name);
 		return -r;	/* libsndfile error values are positive. */
 	}
 
 	/* Print some info to the log. */
 	msg("input_sndfile: Opened file %s, %u channels sampled at %u Hz, sample type %s",
-		sf_name, snd->sf_info.channels, snd->sf_info.samplerate,
-		sample_type(snd->sf_info.format));
+		name, f->info.channels, f->info.samplerate,
+		sample_type(f->info.format));
+
+	f->has_time = file_start_time(f);
+	if (f->has_time && timespec_snprint(&f->ts, ts_str,
+				sizeof(ts_str)) >= 0)
+		msg("input_sndfile: File %s starts at %s", name, ts_str);
+
+	return 0;
+}
+
+static void * prefetch_thread(void * param)
+{
+	struct input_sndfile * snd = (struct input_sndfile *) param;
+
+	snd->next_r = open_file(&snd->next, snd->sources[snd->index + 1]);
+
+	return NULL;
+}
+
+/* Start opening the file after the current one, if there is one. */
+static void start_prefetch(struct input_sndfile * snd)
+{
+	assert(snd);
+
+	int r;
+
+	if (snd->index + 1 >= snd->n_sources)
+		return;
+
+	r = pthread_create(&snd->prefetch_thread, NULL, prefetch_thread,
+			snd);
+	if (r != 0) {
+		/* Open the file when we reach it instead. */
+		warn("input_sndfile: Failed to start prefetch thread");
+		snd->next_r = open_file(&snd->next,
+				snd->sources[snd->index + 1]);
+		return;
+	}
+
+	snd->prefetching = 1;
+}
+
+/* Wait for the prefetch thread to finish opening the next file. */
+static int finish_prefetch(struct input_sndfile * snd)
+{
+	assert(snd);
+
+	struct timespec start, end;
+
+	if (snd->prefetching) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pthread_join(snd->prefetch_thread, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		snd->wait_open += (double)(end.tv_sec - start.tv_sec) +
+			(double)(end.tv_nsec - start.tv_nsec) / 1e9;
+		snd->prefetching = 0;
+	}
+
+	return snd->next_r;
+}
+
+static void set_current(struct input_sndfile * snd, struct sndfile_file * f)
+{
+	assert(snd);
+	assert(f);
+
+	snd->sf_name = f->name;
+	snd->sf = f->sf;
+	snd->sf_info = f->info;
+	snd->has_time = f->has_time;
+	snd->file_ts = f->ts;
+	snd->file_frames = 0;
+}
+
+/* Check that a file can be split between our consumers. */
+static int check_channels(struct input_sndfile * snd, struct sndfile_file * f)
+{
+	assert(snd);
+	assert(f);
+
+	if (snd->n_consumers > 1 &&
+			(uint) f->info.channels != snd->n_consumers) {
+		error("input_sndfile: File %s has %u channels but %u outputs were given",
+				f->name, f->info.channels, snd->n_consumers);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int open_sndfile(struct input_sndfile * snd)
+{
+	assert(snd);
+
+	int r;
+	struct sndfile_file f;
+
+	r = open_file(&f, snd->sources[0]);
+	if (r < 0)
+		return r;
+
+	r = check_channels(snd, &f);
+	if (r < 0) {
+		sf_close(f.sf);
+		return r;
+	}
+
+	set_current(snd, &f);
+	snd->index = 0;
 
 	return 0;
 }
@@ -121,6 +396,78 @@ static void close_sndfile(struct input_sndfile * snd)
 	snd->sf = NULL;
 }
 
+/* Move on to the next file of a sequence once the current one is exhausted. If
+ * the timestamps of the two files show that samples are missing between them,
+ * or that they overlap, (*resync) is set and ts is set to the start time of the
+ * new file.
+ *
+ * Returns 0 on success or <0 on error, including if the sample rate changes as
+ * consumers can't follow this.
+ */
+static int next_file(struct input_sndfile * snd, int * resync,
+		struct timespec * ts)
+{
+	assert(snd);
+	assert(resync);
+	assert(ts);
+
+	int r;
+	uint rate;
+	double expected, gap;
+
+	*resync = 0;
+
+	r = finish_prefetch(snd);
+	if (r < 0) {
+		error("input_sndfile: Failed to open next file in sequence");
+		return r;
+	}
+
+	rate = snd->sf_info.samplerate;
+	if ((uint) snd->next.info.samplerate != rate) {
+		error("input_sndfile: Sample rate changes from %u Hz to %u Hz at %s",
+				rate, snd->next.info.samplerate,
+				snd->next.name);
+		sf_close(snd->next.sf);
+		snd->next.sf = NULL;
+		return -EINVAL;
+	}
+
+	r = check_channels(snd, &snd->next);
+	if (r < 0) {
+		sf_close(snd->next.sf);
+		snd->next.sf = NULL;
+		return r;
+	}
+
+	/* Without a start time for both files, assume that they are
+	 * contiguous.
+	 */
+	if (snd->has_time && snd->next.has_time) {
+		expected = (double) snd->file_ts.tv_sec +
+			(double) snd->file_ts.tv_nsec / 1e9 +
+			(double) snd->file_frames / rate;
+		gap = (double) snd->next.ts.tv_sec +
+			(double) snd->next.ts.tv_nsec / 1e9 - expected;
+		if (fabs(gap) > SNDFILE_GAP_TOLERANCE) {
+			msg("input_sndfile: Gap of %.3f s before %s",
+					gap, snd->next.name);
+			*resync = 1;
+			*ts = snd->next.ts;
+			snd->n_resyncs++;
+		}
+	}
+
+	close_sndfile(snd);
+	set_current(snd, &snd->next);
+	snd->next.sf = NULL;
+	snd->index++;
+
+	start_prefetch(snd);
+
+	return 0;
+}
+
 static int convert_frames(struct input_sndfile * snd, sample_t * buf, uint frames)
 {
 	assert(snd);
@@ -237,76 +584,203 @@ static int convert_frames(struct input_sndfile * snd, sample_t * buf, uint frame
 	}
 }
 
-int run_single_channel(struct input_sndfile * snd)
+static double elapsed(struct timespec * start, struct timespec * end)
+{
+	return (double)(end->tv_sec - start->tv_sec) +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Release any buffers held by a block. */
+static void release_block(struct input_sndfile * snd, struct sndfile_block * b)
+{
+	assert(snd);
+	assert(b);
+
+	uint c;
+
+	for (c = 0; c < snd->n_consumers; c++) {
+		if (b->bufs[c])
+			buffer_release(b->bufs[c]);
+		b->bufs[c] = NULL;
+	}
+}
+
+/* Split n frames of interleaved samples in buf into one new buffer for each
+ * consumer and convert them. buf is released.
+ */
+static int split_channels(struct input_sndfile * snd, struct sndfile_block * b,
+		sample_t * buf, uint frames)
 {
 	assert(snd);
+	assert(b);
+	assert(buf);
+
+	int r;
+	uint c, n;
+
+	for (c = 0; c < snd->n_consumers; c++) {
+		n = frames;
+		b->bufs[c] = buffer_acquire(&n);
+		if (!b->bufs[c]) {
+			error("input_sndfile: Failed to acquire buffer");
+			buffer_release(buf);
+			release_block(snd, b);
+			return -ENOMEM;
+		}
+	}
+
+	deinterleave(b->bufs, buf, snd->n_consumers, frames);
+	buffer_release(buf);
+
+	for (c = 0; c < snd->n_consumers; c++) {
+		r = convert_frames(snd, b->bufs[c], frames);
+		if (r < 0) {
+			error("input_sndfile: Unable to convert samples");
+			release_block(snd, b);
+			return r;
+		}
+	}
+
+	b->frames = frames;
+	return 1;
+}
+
+/* Read and convert the next buffer of samples from the file. If the file has
+ * more than one channel, read into a multi-channel buffer and either split it
+ * into one buffer per consumer or, for a single consumer, strip out just the
+ * first channel into the front of the buffer. At the end of each file of a
+ * sequence, carry on into the next one.
+ *
+ * Returns 1 with either a buffer of samples or a resync marker in (*b), 0 at
+ * the end of the last file or <0 on error.
+ */
+static int read_block(struct input_sndfile * snd, struct sndfile_block * b)
+{
+	assert(snd);
+	assert(b);
 
 	int		r;
+	int		resync;
+	sf_count_t	n;
 	uint		frames;
+	uint		i;
+	uint		channels;
+	uint		selected_channel;
 	sample_t *	buf;
 
+	frames = 1<<16;
+	buf = buffer_acquire(&frames);
+	if (!buf) {
+		error("input_sndfile: Failed to acquire buffer");
+		return -ENOMEM;
+	}
+
 	while (1) {
-		/* Check for termination signal. */
-		if (snd->stop) {
-			msg("input_sndfile: Stop");
-			return snd->stop_condition;
-		}
+		channels = snd->sf_info.channels;
+		selected_channel = 0;	/* zero-based. TODO: Make configurable. */
 
-		frames = 1<<16;
-		buf = buffer_acquire(&frames);
-		if (!buf) {
-			error("input_sndfile: Failed to acquire buffer");
-			return -ENOMEM;
-		}
+		/* Divide frames down by the number of channels. */
+		n = sf_readf_int(snd->sf, buf, frames / channels);
+		if (n > 0)
+			break;
 
-		r = sf_readf_int(snd->sf, buf, frames);
-		if (r <= 0) {
-			r = sf_error(snd->sf);
-			error("libsndfile: Error %d: %s", r, sf_strerror(snd->sf));
-			error("input_sndfile: Failed to read samples");
+		r = sf_error(snd->sf);
+		if (r) {
 			buffer_release(buf);
+			error("libsndfile: Error %d: %s", r,
+					sf_strerror(snd->sf));
+			error("input_sndfile: Failed to read samples");
 			return -r;	/* libsndfile error values are positive. */
 		}
 
-		/* Got r frames. */
-		frames = (uint)r;
-		
-		r = convert_frames(snd, buf, frames);
-		if (r < 0) {
-			error("input_sndfile: Unable to convert samples");
+		/* EOF. */
+		if (snd->index + 1 >= snd->n_sources) {
 			buffer_release(buf);
-			return r;
+			return 0;
 		}
 
-		r = consumer_write(snd->consumer, buf, frames);
+		r = next_file(snd, &resync, &b->ts);
 		if (r < 0) {
-			error("input_sndfile: Failed to write to consumer");
 			buffer_release(buf);
 			return r;
 		}
 
+		if (resync) {
+			buffer_release(buf);
+			b->bufs[0] = NULL;
+			b->frames = 0;
+			return 1;
+		}
+	}
+
+	/* Got n frames. */
+	frames = (uint)n;
+	snd->file_frames += frames;
+
+	if (snd->n_consumers > 1)
+		return split_channels(snd, b, buf, frames);
+
+	if (channels > 1) {
+		for (i = 0; i < frames; i++)
+			buf[i] = buf[i*channels + selected_channel];
+	}
+
+	r = convert_frames(snd, buf, frames);
+	if (r < 0) {
+		error("input_sndfile: Unable to convert samples");
 		buffer_release(buf);
+		return r;
 	}
+
+	b->bufs[0] = buf;
+	b->frames = frames;
+	return 1;
 }
 
-int run_multi_channel(struct input_sndfile * snd)
+/* Pass a block to the consumers and release it. */
+static int write_block(struct input_sndfile * snd, struct sndfile_block * b)
 {
 	assert(snd);
+	assert(b);
 
-	int		r;
-	uint		frames;
-	uint		i;
-	uint		channels;
-	uint		selected_channel;
-	sample_t *	buf;
+	int r = 0;
+	uint c;
+	char ts_str[100];
+
+	if (!b->bufs[0]) {
+		timespec_snprint(&b->ts, ts_str, sizeof(ts_str));
+		msg("input_sndfile: Resync at %s", ts_str);
+
+		for (c = 0; c < snd->n_consumers; c++) {
+			r = consumer_resync(snd->consumers[c], &b->ts);
+			if (r < 0) {
+				error("input_sndfile: Failed to resync consumer");
+				return r;
+			}
+		}
+		return r;
+	}
+
+	for (c = 0; c < snd->n_consumers; c++) {
+		r = consumer_write(snd->consumers[c], b->bufs[c], b->frames);
+		if (r < 0) {
+			error("input_sndfile: Failed to write to consumer");
+			break;
+		}
+	}
 
-	channels = snd->sf_info.channels;
-	selected_channel = 0;	/* zero-based. TODO: Make configurable. */
+	release_block(snd, b);
+	return r;
+}
+
+/* Decode and write each buffer in turn. */
+static int run_direct(struct input_sndfile * snd)
+{
+	assert(snd);
+
+	int			r;
+	struct sndfile_block *	b = &snd->blocks[0];
 
-	/*
-		Read into multi-channel buffer and strip out just the channel we
-		want into the front of the buffer.
-	*/
 	while (1) {
 		/* Check for termination signal. */
 		if (snd->stop) {
@@ -314,66 +788,160 @@ int run_multi_channel(struct input_sndfile * snd)
 			return snd->stop_condition;
 		}
 
-		frames = 1<<16;
-		buf = buffer_acquire(&frames);
-		if (!buf) {
-			error("input_sndfile: Failed to acquire buffer");
-			return -ENOMEM;
+		r = read_block(snd, b);
+		if (r <= 0)
+			return r;
+
+		r = write_block(snd, b);
+		if (r < 0)
+			return r;
+	}
+}
+
+static void * decode_thread(void * param)
+{
+	struct input_sndfile * snd = (struct input_sndfile *) param;
+	struct timespec start, end;
+	int r;
+
+	pthread_mutex_lock(&snd->mutex);
+	while (1) {
+		if (!snd->decode_stop && snd->tail - snd->head == snd->depth) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			while (!snd->decode_stop &&
+					snd->tail - snd->head == snd->depth)
+				pthread_cond_wait(&snd->space_cond,
+						&snd->mutex);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			snd->wait_space += elapsed(&start, &end);
 		}
 
-		/* Divide frames down by the number of channels. */
-		frames /= channels;
+		if (snd->decode_stop)
+			break;
+
+		/* Only the consumer moves head, so decoding into the block at
+		 * tail can be done without holding the lock.
+		 */
+		pthread_mutex_unlock(&snd->mutex);
+		r = read_block(snd, &snd->blocks[snd->tail % snd->depth]);
+		pthread_mutex_lock(&snd->mutex);
 
-		r = sf_readf_int(snd->sf, buf, frames);
 		if (r <= 0) {
-			r = sf_error(snd->sf);
-			error("libsndfile: Error %d: %s", r, sf_strerror(snd->sf));
-			error("input_sndfile: Failed to read samples");
-			buffer_release(buf);
-			return -r;	/* libsndfile error values are positive. */
+			snd->status = r;
+			snd->done = 1;
+			pthread_cond_signal(&snd->ready_cond);
+			break;
 		}
 
-		/* Got r frames. */
-		frames = (uint)r;
+		snd->tail++;
+		pthread_cond_signal(&snd->ready_cond);
+	}
+	pthread_mutex_unlock(&snd->mutex);
 
-		for (i = 0; i < frames; i++)
-			buf[i] = buf[i*channels + selected_channel];
+	return NULL;
+}
 
-		r = convert_frames(snd, buf, frames);
-		if (r < 0) {
-			error("input_sndfile: Unable to convert samples");
-			buffer_release(buf);
-			return r;
+/* Write buffers decoded ahead of time by decode_thread(). */
+static int run_readahead(struct input_sndfile * snd)
+{
+	assert(snd);
+
+	int r;
+	struct timespec start, end;
+	struct sndfile_block * b;
+
+	snd->head = snd->tail = 0;
+	snd->done = 0;
+	snd->decode_stop = 0;
+
+	r = pthread_create(&snd->thread, NULL, decode_thread, snd);
+	if (r != 0) {
+		error("input_sndfile: Failed to start read-ahead thread");
+		return -r;
+	}
+
+	while (1) {
+		/* Check for termination signal. */
+		if (snd->stop) {
+			msg("input_sndfile: Stop");
+			r = snd->stop_condition;
+			break;
 		}
 
-		r = consumer_write(snd->consumer, buf, frames);
-		if (r < 0) {
-			error("input_sndfile: Failed to write to consumer");
-			buffer_release(buf);
-			return r;
+		pthread_mutex_lock(&snd->mutex);
+		if (snd->head == snd->tail && !snd->done) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			while (snd->head == snd->tail && !snd->done)
+				pthread_cond_wait(&snd->ready_cond,
+						&snd->mutex);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			snd->wait_data += elapsed(&start, &end);
 		}
 
-		buffer_release(buf);
+		if (snd->head == snd->tail) {
+			/* The decoder has finished and everything it read
+			 * has been written.
+			 */
+			r = snd->status;
+			pthread_mutex_unlock(&snd->mutex);
+			break;
+		}
+
+		/* The decoder won't reuse this block until head moves on. */
+		b = &snd->blocks[snd->head % snd->depth];
+		pthread_mutex_unlock(&snd->mutex);
+
+		r = write_block(snd, b);
+
+		pthread_mutex_lock(&snd->mutex);
+		snd->head++;
+		pthread_cond_signal(&snd->space_cond);
+		pthread_mutex_unlock(&snd->mutex);
+
+		if (r < 0)
+			break;
 	}
+
+	/* Stop the decoder and drop anything it read which wasn't written. */
+	pthread_mutex_lock(&snd->mutex);
+	snd->decode_stop = 1;
+	pthread_cond_signal(&snd->space_cond);
+	pthread_mutex_unlock(&snd->mutex);
+	pthread_join(snd->thread, NULL);
+
+	for (; snd->head != snd->tail; snd->head++)
+		release_block(snd, &snd->blocks[snd->head % snd->depth]);
+
+	return r;
 }
 
 int input_sndfile_run(struct producer * producer)
 {
 	assert(producer);
 
-	int r;
+	int r, r2;
+	uint c;
 	struct timespec ts;
 	char ts_str[100];
 	struct input_sndfile * snd = (struct input_sndfile *)
 		producer_get_data(producer);
 
-	memset(&ts, 0, sizeof(struct timespec));
-	r = consumer_start(snd->consumer, snd->sf_info.samplerate, &ts);
-	if (r < 0) {
-		error("input_sndfile: Failed to start consumer");
-		return r;
+	/* Use the recording time of the first file if we know it. */
+	if (snd->has_time)
+		ts = snd->file_ts;
+	else
+		memset(&ts, 0, sizeof(struct timespec));
+	for (c = 0; c < snd->n_consumers; c++) {
+		r = consumer_start(snd->consumers[c], snd->sf_info.samplerate,
+				&ts);
+		if (r < 0) {
+			error("input_sndfile: Failed to start consumer");
+			return r;
+		}
 	}
 
+	start_prefetch(snd);
+
 	/* Print a timestamp to the log file now so that we can measure the
 	 * runtime of the main signal pipeline, excluding the time taken to
 	 * initialise everything.
@@ -390,10 +958,10 @@ int input_sndfile_run(struct producer * producer)
 	}
 	msg("input_sndfile: Started at %s", ts_str);
 
-	if (snd->sf_info.channels > 1)
-		r = run_multi_channel(snd);
+	if (snd->depth)
+		r = run_readahead(snd);
 	else
-		r = run_single_channel(snd);
+		r = run_direct(snd);
 
 	/* Error or EOF. */
 	if (r < 0)
@@ -404,18 +972,27 @@ int input_sndfile_run(struct producer * producer)
 	/* Print a timestamp again so that we can exclude the time taken to
 	 * cleanup and exit from measurements.
 	 */
-	r = clock_gettime(CLOCK_REALTIME, &ts);
-	if (r < 0) {
+	r2 = clock_gettime(CLOCK_REALTIME, &ts);
+	if (r2 < 0) {
 		error("input_sndfile: Failed to get timestamp");
-		return r;
+		return r2;
 	}
-	r = timespec_snprint(&ts, ts_str, sizeof(ts_str));
-	if (r < 0) {
+	r2 = timespec_snprint(&ts, ts_str, sizeof(ts_str));
+	if (r2 < 0) {
 		error("input_sndfile: Failed to prepare timestamp for printing");
-		return r;
+		return r2;
 	}
 	msg("input_sndfile: Finished at %s", ts_str);
 
+	if (snd->depth)
+		msg("input_sndfile: Read-ahead of %u buffers, waited %.3f s for decoding, decoder waited %.3f s for space",
+				snd->depth, snd->wait_data, snd->wait_space);
+
+	if (snd->n_sources > 1)
+		msg("input_sndfile: Read %u of %u files with %u resyncs, waited %.3f s for files to open",
+				snd->index + 1, snd->n_sources,
+				snd->n_resyncs, snd->wait_open);
+
 	return r;
 }
 
@@ -430,6 +1007,20 @@ void input_sndfile_exit(struct producer * producer)
 	if (snd->sf)
 		close_sndfile(snd);
 
+	/* Close the next file if it has been opened. */
+	finish_prefetch(snd);
+	if (snd->next.sf)
+		sf_close(snd->next.sf);
+
+	if (snd->depth) {
+		pthread_cond_destroy(&snd->space_cond);
+		pthread_cond_destroy(&snd->ready_cond);
+		pthread_mutex_destroy(&snd->mutex);
+	}
+
+	free(snd->blocks);
+	free(snd->bufs);
+	free(snd->consumers);
 	free(snd);
 }
 
@@ -450,36 +1041,114 @@ int input_sndfile_stop(struct producer * producer, int condition)
 	Public functions
 *******************************************************************************/
 
-int input_sndfile_init(struct producer * producer, struct consumer * consumer,
-		const char * source)
+int input_sndfile_init_channels(struct producer * producer,
+		struct consumer ** consumers, uint n_consumers,
+		const char * const * sources, uint n_sources, uint depth)
 {
 	assert(producer);
-	assert(consumer);
-	assert(source);
+	assert(consumers);
+	assert(n_consumers);
+	assert(sources);
+	assert(n_sources);
 
 	int r;
+	uint i, n_blocks;
 
 	struct input_sndfile * snd = (struct input_sndfile *)
-		malloc(sizeof(struct input_sndfile));
+		calloc(1, sizeof(struct input_sndfile));
 	if (!snd) {
 		error("input_sndfile: Failed to allocate memory");
 		return -ENOMEM;
 	}
 
-	/* Currently, source must be one filename. Open this file and set
-	 * variables.
+	/* Without read-ahead a single block is reused for every read. */
+	n_blocks = depth ? depth : 1;
+	snd->consumers = (struct consumer **)
+		calloc(n_consumers, sizeof(struct consumer *));
+	snd->blocks = (struct sndfile_block *)
+		calloc(n_blocks, sizeof(struct sndfile_block));
+	snd->bufs = (sample_t **)
+		calloc(n_blocks * n_consumers, sizeof(sample_t *));
+	if (!snd->consumers || !snd->blocks || !snd->bufs) {
+		error("input_sndfile: Failed to allocate memory");
+		r = -ENOMEM;
+		goto err;
+	}
+
+	memcpy(snd->consumers, consumers,
+			n_consumers * sizeof(struct consumer *));
+	snd->n_consumers = n_consumers;
+	for (i = 0; i < n_blocks; i++)
+		snd->blocks[i].bufs = &snd->bufs[i * n_consumers];
+
+	/* Open the first file and set variables. The rest are opened as we
+	 * reach them.
 	 */
-	snd->source = source;
-	snd->consumer = consumer;
+	snd->source = sources[0];
+	snd->sources = sources;
+	snd->n_sources = n_sources;
 	snd->stop = 0;
 
-	r = open_sndfile(snd, source);
-	if (r < 0)
+	r = open_sndfile(snd);
+	if (r < 0) {
 		/* Error message already printed. */
-		return r;
+		goto err;
+	}
+
+	if (depth) {
+		snd->depth = depth;
+		pthread_mutex_init(&snd->mutex, NULL);
+		pthread_cond_init(&snd->ready_cond, NULL);
+		pthread_cond_init(&snd->space_cond, NULL);
+	}
 
 	producer_set_module(producer, input_sndfile_run, input_sndfile_stop,
 			input_sndfile_exit, snd);
 
 	return 0;
+
+err:
+	free(snd->bufs);
+	free(snd->blocks);
+	free(snd->consumers);
+	free(snd);
+	return r;
+}
+
+int input_sndfile_init_sequence(struct producer * producer,
+		struct consumer * consumer, const char * const * sources,
+		uint n_sources, uint depth)
+{
+	assert(consumer);
+
+	return input_sndfile_init_channels(producer, &consumer, 1, sources,
+			n_sources, depth);
+}
+
+int input_sndfile_init_readahead(struct producer * producer,
+		struct consumer * consumer, const char * source, uint depth)
+{
+	assert(source);
+
+	int r;
+	struct input_sndfile * snd;
+
+	r = input_sndfile_init_sequence(producer, consumer, &source, 1,
+			depth);
+	if (r < 0)
+		return r;
+
+	/* The sources array must outlive the producer, so point it at the copy
+	 * of source held in the producer itself.
+	 */
+	snd = (struct input_sndfile *) producer_get_data(producer);
+	snd->sources = &snd->source;
+
+	return 0;
+}
+
+int input_sndfile_init(struct producer * producer, struct consumer * consumer,
+		const char * source)
+{
+	return input_sndfile_init_readahead(producer, consumer, source, 0);
 }
@@ -0,0 +1,594 @@
+/*******************************************************************************
+	input_wavmap.c: Memory mapped input from WAV files.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+/* Needed for madvise() and its MADV_* flags. */
+#define _GNU_SOURCE
+
+/* Needed so that file offsets beyond 2GiB can be mapped on 32-bit targets. */
+#define _FILE_OFFSET_BITS 64
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "consumer.h"
+#include "input_wavmap.h"
+#include "log.h"
+#include "producer.h"
+#include "timespec.h"
+#include "types.h"
+
+/*******************************************************************************
+	Private declarations
+*******************************************************************************/
+
+#define WAVE_FORMAT_PCM		0x0001
+#define WAVE_FORMAT_EXTENSIBLE	0xFFFE
+
+/* In an RF64 file, 32-bit sizes with this value are replaced by the 64-bit
+ * sizes given in the ds64 chunk.
+ */
+#define RF64_SIZE_IN_DS64	0xFFFFFFFFU
+
+/* Frames converted into each buffer, as for the other file producers. */
+#define WAVMAP_FRAMES		(1U << 16)
+
+/* Size of the window of the file which is mapped at once. Mapping the whole
+ * file would run out of address space for large files on 32-bit targets, and
+ * a window also stops the resident size growing with the length of the file.
+ */
+#define WAVMAP_WINDOW		(64U << 20)
+
+struct input_wavmap {
+	struct consumer *	consumer;
+
+	const char *		source;
+	int			fd;
+	uint64			file_len;
+
+	/* The mapped window, which starts at file offset map_offset. */
+	const unsigned char *	map;
+	size_t			map_len;
+	uint64			map_offset;
+
+	/* Format of the data chunk, which starts at file offset data_offset.
+	 * Samples are converted from the first channel of each frame, with
+	 * block_align bytes between frames.
+	 */
+	uint64			data_offset;
+	uint64			frames;
+	uint			sample_rate;
+	uint			channels;
+	uint			block_align;
+	uint			bits;
+
+	volatile int		stop;
+	int			stop_condition;
+};
+
+/*******************************************************************************
+	Private functions
+*******************************************************************************/
+
+static inline uint get_le16(const unsigned char * p)
+{
+	return (uint)p[0] | ((uint)p[1] << 8);
+}
+
+static inline uint get_le32(const unsigned char * p)
+{
+	return (uint)p[0] | ((uint)p[1] << 8) | ((uint)p[2] << 16) |
+		((uint)p[3] << 24);
+}
+
+static inline uint64 get_le64(const unsigned char * p)
+{
+	return (uint64)get_le32(p) | ((uint64)get_le32(&p[4]) << 32);
+}
+
+static int parse_fmt(struct input_wavmap * w, const unsigned char * p,
+		uint64 size)
+{
+	assert(w);
+	assert(p);
+
+	uint format;
+
+	if (size < 16) {
+		error("input_wavmap: Format chunk is too short");
+		return -EINVAL;
+	}
+
+	format = get_le16(p);
+	w->channels = get_le16(&p[2]);
+	w->sample_rate = get_le32(&p[4]);
+	w->block_align = get_le16(&p[12]);
+	w->bits = get_le16(&p[14]);
+
+	/* The real format of an extensible file is given by the first two bytes
+	 * of the sub-format GUID.
+	 */
+	if (format == WAVE_FORMAT_EXTENSIBLE) {
+		if (size < 40) {
+			error("input_wavmap: Extensible format chunk is too short");
+			return -EINVAL;
+		}
+		format = get_le16(&p[24]);
+	}
+
+	if (format != WAVE_FORMAT_PCM) {
+		error("input_wavmap: Unsupported format 0x%04x, only integer PCM can be mapped",
+				format);
+		return -EINVAL;
+	}
+
+	if (w->bits != 8 && w->bits != 16 && w->bits != 24 && w->bits != 32) {
+		error("input_wavmap: Unsupported sample size of %u bits",
+				w->bits);
+		return -EINVAL;
+	}
+
+	if (!w->channels || !w->sample_rate ||
+			w->block_align < w->channels * (w->bits / 8)) {
+		error("input_wavmap: Invalid format chunk");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Read len bytes from the given offset of the file. Returns 0 on success or <0
+ * if they couldn't all be read.
+ */
+static int read_at(struct input_wavmap * w, uint64 offset, unsigned char * p,
+		size_t len)
+{
+	assert(w);
+	assert(p);
+
+	ssize_t n;
+
+	while (len) {
+		n = pread(w->fd, p, len, (off_t) offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			error("input_wavmap: Failed to read header of %s",
+					w->source);
+			return n < 0 ? -errno : -EIO;
+		}
+
+		p += n;
+		offset += (uint64) n;
+		len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+/* Walk the chunks of a WAV or RF64 file to find the format and data. Only the
+ * data itself is mapped, the headers are read directly.
+ */
+static int parse_wav(struct input_wavmap * w)
+{
+	assert(w);
+
+	unsigned char p[12];
+	unsigned char chunk[8];
+	unsigned char body[40];
+	uint64 len = w->file_len;
+	uint64 offset;
+	uint64 size;
+	uint64 ds64_data_size = 0;
+	int rf64, have_fmt = 0;
+	int r;
+
+	if (len < 12) {
+		error("input_wavmap: %s is not a WAV file", w->source);
+		return -EINVAL;
+	}
+
+	r = read_at(w, 0, p, sizeof(p));
+	if (r < 0)
+		return r;
+
+	if (memcmp(&p[8], "WAVE", 4) != 0) {
+		error("input_wavmap: %s is not a WAV file", w->source);
+		return -EINVAL;
+	}
+
+	if (memcmp(p, "RIFF", 4) == 0) {
+		rf64 = 0;
+	} else if (memcmp(p, "RF64", 4) == 0) {
+		rf64 = 1;
+	} else {
+		error("input_wavmap: %s is not a WAV file", w->source);
+		return -EINVAL;
+	}
+
+	for (offset = 12; offset + 8 <= len; offset += 8 + size + (size & 1)) {
+		r = read_at(w, offset, chunk, sizeof(chunk));
+		if (r < 0)
+			return r;
+		size = get_le32(&chunk[4]);
+
+		if (memcmp(chunk, "ds64", 4) == 0 && rf64) {
+			if (size < 24 || offset + 8 + size > len) {
+				error("input_wavmap: Invalid ds64 chunk");
+				return -EINVAL;
+			}
+			r = read_at(w, offset + 8, body, 24);
+			if (r < 0)
+				return r;
+			ds64_data_size = get_le64(&body[8]);
+		} else if (memcmp(chunk, "fmt ", 4) == 0) {
+			if (offset + 8 + size > len) {
+				error("input_wavmap: Truncated format chunk");
+				return -EINVAL;
+			}
+			r = read_at(w, offset + 8, body,
+					size < sizeof(body) ? size : sizeof(body));
+			if (r < 0)
+				return r;
+			r = parse_fmt(w, body, size);
+			if (r < 0)
+				return r;
+			have_fmt = 1;
+		} else if (memcmp(chunk, "data", 4) == 0) {
+			if (!have_fmt) {
+				error("input_wavmap: Data chunk found before format chunk");
+				return -EINVAL;
+			}
+
+			if (rf64 && size == RF64_SIZE_IN_DS64)
+				size = ds64_data_size;
+
+			/* Recordings which were cut short may not contain all
+			 * of the data promised by the header.
+			 */
+			if (size > len - offset - 8) {
+				warn("input_wavmap: Data chunk is truncated");
+				size = len - offset - 8;
+			}
+
+			w->data_offset = offset + 8;
+			w->frames = size / w->block_align;
+			return 0;
+		}
+
+		/* Skip over any other chunks. */
+	}
+
+	error("input_wavmap: No data chunk found in %s", w->source);
+	return -EINVAL;
+}
+
+/* Map the window of the file starting at the page containing the given offset,
+ * replacing any current window.
+ */
+static int map_window(struct input_wavmap * w, uint64 offset)
+{
+	assert(w);
+
+	uint64 page = (uint64) sysconf(_SC_PAGESIZE);
+	uint64 start = offset / page * page;
+	size_t len = WAVMAP_WINDOW;
+	void * p;
+	int r;
+
+	if (w->map) {
+		munmap((void *) w->map, w->map_len);
+		w->map = NULL;
+	}
+
+	if (start + len > w->file_len)
+		len = (size_t) (w->file_len - start);
+
+	p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, w->fd, (off_t) start);
+	if (p == MAP_FAILED) {
+		r = -errno;
+		error("input_wavmap: Failed to map file %s at offset %llu",
+				w->source, start);
+		return r;
+	}
+
+	w->map = (const unsigned char *) p;
+	w->map_len = len;
+	w->map_offset = start;
+
+	/* We will read the window once from start to finish. */
+	madvise(p, len, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+static int open_wav(struct input_wavmap * w)
+{
+	assert(w);
+
+	int r;
+	struct stat st;
+
+	w->fd = open(w->source, O_RDONLY);
+	if (w->fd < 0) {
+		r = -errno;
+		error("input_wavmap: Failed to open file %s", w->source);
+		return r;
+	}
+
+	r = fstat(w->fd, &st);
+	if (r < 0) {
+		r = -errno;
+		error("input_wavmap: Failed to get size of file %s", w->source);
+		return r;
+	}
+
+	if (!st.st_size) {
+		error("input_wavmap: File %s is empty", w->source);
+		return -EINVAL;
+	}
+
+	w->file_len = (uint64) st.st_size;
+
+	r = parse_wav(w);
+	if (r < 0)
+		return r;
+
+	msg("input_wavmap: Opened file %s, %u channels sampled at %u Hz, %u bit PCM, %llu frames",
+		w->source, w->channels, w->sample_rate, w->bits, w->frames);
+
+	return 0;
+}
+
+/* Convert samples from the first channel of each frame. Samples are scaled to
+ * the native range of the sample size, as input_sndfile does, including its
+ * treatment of unsigned 8-bit data.
+ */
+static void convert_frames(struct input_wavmap * w, const unsigned char * src,
+		sample_t * dest, uint frames)
+{
+	assert(w);
+	assert(src);
+	assert(dest);
+
+	uint i;
+	uint stride = w->block_align;
+
+	switch (w->bits) {
+	case 8:
+		for (i = 0; i < frames; i++, src += stride)
+			dest[i] = src[0] ^ 0x80;
+		break;
+
+	case 16:
+		for (i = 0; i < frames; i++, src += stride)
+			dest[i] = (int16_t) get_le16(src);
+		break;
+
+	case 24:
+		for (i = 0; i < frames; i++, src += stride)
+			dest[i] = (int32_t) (((uint32_t) src[0] << 8) |
+					((uint32_t) src[1] << 16) |
+					((uint32_t) src[2] << 24)) >> 8;
+		break;
+
+	case 32:
+		for (i = 0; i < frames; i++, src += stride)
+			dest[i] = (int32_t) get_le32(src);
+		break;
+	}
+}
+
+static int run_wavmap(struct input_wavmap * w)
+{
+	assert(w);
+
+	int		r;
+	uint		frames, max_frames;
+	uint64		pos = 0;
+	uint64		src_offset;
+	uint64		len;
+	sample_t *	buf;
+
+	/* Leave room for the offset of a block into its first page so that a
+	 * whole block always fits in the window.
+	 */
+	max_frames = (WAVMAP_WINDOW - (uint) sysconf(_SC_PAGESIZE)) /
+		w->block_align;
+	if (max_frames > WAVMAP_FRAMES)
+		max_frames = WAVMAP_FRAMES;
+
+	src_offset = w->data_offset;
+
+	while (pos < w->frames) {
+		/* Check for termination signal. */
+		if (w->stop) {
+			msg("input_wavmap: Stop");
+			return w->stop_condition;
+		}
+
+		frames = WAVMAP_FRAMES;
+		buf = buffer_acquire(&frames);
+		if (!buf) {
+			error("input_wavmap: Failed to acquire buffer");
+			return -ENOMEM;
+		}
+
+		if (frames > max_frames)
+			frames = max_frames;
+		if (frames > w->frames - pos)
+			frames = (uint) (w->frames - pos);
+
+		/* Move the window on once the block runs past its end. */
+		len = (uint64) frames * w->block_align;
+		if (!w->map || src_offset + len > w->map_offset + w->map_len) {
+			r = map_window(w, src_offset);
+			if (r < 0) {
+				buffer_release(buf);
+				return r;
+			}
+		}
+
+		convert_frames(w, &w->map[src_offset - w->map_offset], buf,
+				frames);
+		pos += frames;
+		src_offset += len;
+
+		r = consumer_write(w->consumer, buf, frames);
+		if (r < 0) {
+			error("input_wavmap: Failed to write to consumer");
+			buffer_release(buf);
+			return r;
+		}
+
+		buffer_release(buf);
+	}
+
+	return 0;
+}
+
+int input_wavmap_run(struct producer * producer)
+{
+	assert(producer);
+
+	int r, r2;
+	struct timespec ts;
+	char ts_str[100];
+	struct input_wavmap * w = (struct input_wavmap *)
+		producer_get_data(producer);
+
+	memset(&ts, 0, sizeof(struct timespec));
+	r = consumer_start(w->consumer, w->sample_rate, &ts);
+	if (r < 0) {
+		error("input_wavmap: Failed to start consumer");
+		return r;
+	}
+
+	/* Print timestamps to the log file around the main loop so that the
+	 * runtime of the signal pipeline can be measured, as for
+	 * input_sndfile.
+	 */
+	r = clock_gettime(CLOCK_REALTIME, &ts);
+	if (r < 0) {
+		error("input_wavmap: Failed to get timestamp");
+		return r;
+	}
+	r = timespec_snprint(&ts, ts_str, sizeof(ts_str));
+	if (r < 0) {
+		error("input_wavmap: Failed to prepare timestamp for printing");
+		return r;
+	}
+	msg("input_wavmap: Started at %s", ts_str);
+
+	r = run_wavmap(w);
+
+	/* Error or EOF. */
+	if (r < 0)
+		error("input_wavmap: Unrecoverable error reading frames");
+	else
+		msg("input_wavmap: EOF");
+
+	r2 = clock_gettime(CLOCK_REALTIME, &ts);
+	if (r2 < 0) {
+		error("input_wavmap: Failed to get timestamp");
+		return r2;
+	}
+	r2 = timespec_snprint(&ts, ts_str, sizeof(ts_str));
+	if (r2 < 0) {
+		error("input_wavmap: Failed to prepare timestamp for printing");
+		return r2;
+	}
+	msg("input_wavmap: Finished at %s", ts_str);
+
+	return r;
+}
+
+void input_wavmap_exit(struct producer * producer)
+{
+	assert(producer);
+
+	struct input_wavmap * w = (struct input_wavmap *)
+		producer_get_data(producer);
+
+	if (w->map)
+		munmap((void *) w->map, w->map_len);
+	close(w->fd);
+
+	free(w);
+}
+
+int input_wavmap_stop(struct producer * producer, int condition)
+{
+	assert(producer);
+
+	struct input_wavmap * w = (struct input_wavmap *)
+		producer_get_data(producer);
+
+	w->stop = 1;
+	w->stop_condition = condition;
+
+	return 0;
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+int input_wavmap_init(struct producer * producer, struct consumer * consumer,
+		const char * source)
+{
+	assert(producer);
+	assert(consumer);
+	assert(source);
+
+	int r;
+
+	struct input_wavmap * w = (struct input_wavmap *)
+		calloc(1, sizeof(struct input_wavmap));
+	if (!w) {
+		error("input_wavmap: Failed to allocate memory");
+		return -ENOMEM;
+	}
+
+	w->source = source;
+	w->consumer = consumer;
+
+	r = open_wav(w);
+	if (r < 0) {
+		/* Error message already printed. */
+		if (w->fd >= 0)
+			close(w->fd);
+		free(w);
+		return r;
+	}
+
+	producer_set_module(producer, input_wavmap_run, input_wavmap_stop,
+			input_wavmap_exit, w);
+
+	return 0;
+}
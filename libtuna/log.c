@@ -46,6 +46,9 @@ static const char * messages[LOG_MAX_LEVEL + 1] = {
 	"(Bad Log Level)"
 };
 
+/* The message is written in several parts, so hold the stream lock throughout
+ * to stop messages from different threads being interleaved.
+ */
 static int __log_printf(int level, const char * s, va_list va)
 {
 	int r, count;
@@ -56,22 +59,27 @@ static int __log_printf(int level, const char * s, va_list va)
 	if ((level > LOG_MAX_LEVEL) || (level < 0))
 		level = LOG_MAX_LEVEL;
 
+	flockfile(file);
+
 	r = fprintf(file, "%s: ", messages[level]);
 	if (r < 0)
-		return r;
+		goto out;
 	count += r;
 
 	r = vfprintf(file, s, va);
 	if (r < 0)
-		return r;
+		goto out;
 	count += r;
 
 	r = fprintf(file, "\n");
 	if (r < 0)
-		return r;
+		goto out;
 	count += r;
 
-	return count;
+	r = count;
+out:
+	funlockfile(file);
+	return r;
 }
 
 /*******************************************************************************
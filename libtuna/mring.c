@@ -0,0 +1,250 @@
+/*******************************************************************************
+	mring.c: Mirrored ring buffer of samples.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+/* Needed for memfd_create() and MAP_ANONYMOUS. */
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "mring.h"
+#include "types.h"
+
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* The ring occupies the first 'size' bytes of a reserved region of twice that
+ * length. Both halves of the region map the same file so every sample is
+ * visible at base[i] and base[i + capacity], and head always lies in the first
+ * half.
+ */
+struct mring {
+	sample_t *		base;
+	size_t			size;
+	uint			capacity;
+	uint			head;
+	uint			count;
+};
+
+/* Create an anonymous file to back the ring. Where memfd_create() isn't
+ * available a POSIX shared memory object is used instead, unlinked straight
+ * away so that it doesn't outlive us.
+ */
+static int open_backing(void)
+{
+	int fd;
+
+#ifdef MFD_CLOEXEC
+	fd = memfd_create("tuna-mring", MFD_CLOEXEC);
+	if (fd >= 0 || errno != ENOSYS)
+		return fd;
+#endif
+
+	static uint serial;
+	char name[64];
+
+	snprintf(name, sizeof(name), "/tuna-mring-%ld-%u", (long) getpid(),
+			__sync_fetch_and_add(&serial, 1));
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0)
+		shm_unlink(name);
+
+	return fd;
+}
+
+/* Map the backing file twice, back to back. The whole region is reserved first
+ * so that nothing else can be placed between the two mappings.
+ */
+static sample_t * map_mirrored(int fd, size_t size)
+{
+	char * p;
+	void * q;
+
+	p = (char *) mmap(NULL, 2 * size, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	q = mmap(p, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+			0);
+	if (q == MAP_FAILED)
+		goto err;
+
+	q = mmap(p + size, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, 0);
+	if (q == MAP_FAILED)
+		goto err;
+
+	return (sample_t *) p;
+
+err:
+	munmap(p, 2 * size);
+	return NULL;
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+sample_t * mring_data(struct mring * r)
+{
+	assert(r);
+
+	return &r->base[r->head];
+}
+
+uint mring_count(struct mring * r)
+{
+	assert(r);
+
+	return r->count;
+}
+
+uint mring_space(struct mring * r)
+{
+	assert(r);
+
+	return r->capacity - r->count;
+}
+
+uint mring_capacity(struct mring * r)
+{
+	assert(r);
+
+	return r->capacity;
+}
+
+sample_t * mring_tail(struct mring * r)
+{
+	assert(r);
+
+	return &r->base[r->head + r->count];
+}
+
+void mring_commit(struct mring * r, uint count)
+{
+	assert(r);
+	assert(count <= r->capacity - r->count);
+
+	r->count += count;
+}
+
+int mring_write(struct mring * r, const sample_t * buf, uint count)
+{
+	assert(r);
+	assert(buf);
+
+	if (count > r->capacity - r->count)
+		return -ENOSPC;
+
+	memcpy(mring_tail(r), buf, count * sizeof(sample_t));
+	r->count += count;
+
+	return 0;
+}
+
+void mring_advance(struct mring * r, uint count)
+{
+	assert(r);
+	assert(count <= r->count);
+
+	r->count -= count;
+	r->head += count;
+	if (r->head >= r->capacity)
+		r->head -= r->capacity;
+}
+
+void mring_clear(struct mring * r)
+{
+	assert(r);
+
+	r->head = 0;
+	r->count = 0;
+}
+
+struct mring * mring_init(uint min_count)
+{
+	int r, fd;
+	size_t page, size;
+	struct mring * ring;
+
+	assert(min_count);
+
+	/* Each half of the mapping must be a whole number of pages. */
+	page = (size_t) sysconf(_SC_PAGESIZE);
+	size = (size_t) min_count * sizeof(sample_t);
+	size = (size + page - 1) / page * page;
+	if (size / sizeof(sample_t) > UINT_MAX / 2) {
+		error("mring: Ring of %u samples is too large", min_count);
+		return NULL;
+	}
+
+	ring = (struct mring *) calloc(1, sizeof(struct mring));
+	if (!ring) {
+		error("mring: Failed to allocate memory");
+		return NULL;
+	}
+
+	fd = open_backing();
+	if (fd < 0) {
+		error("mring: Failed to create backing file");
+		goto err;
+	}
+
+	r = ftruncate(fd, (off_t) size);
+	if (r < 0) {
+		error("mring: Failed to size backing file");
+		close(fd);
+		goto err;
+	}
+
+	/* The mappings keep the file alive, we don't need the descriptor. */
+	ring->base = map_mirrored(fd, size);
+	close(fd);
+	if (!ring->base) {
+		error("mring: Failed to map ring buffer");
+		goto err;
+	}
+
+	ring->size = size;
+	ring->capacity = (uint) (size / sizeof(sample_t));
+
+	return ring;
+
+err:
+	free(ring);
+	return NULL;
+}
+
+void mring_exit(struct mring * r)
+{
+	assert(r);
+
+	munmap(r->base, 2 * r->size);
+	free(r);
+}
@@ -29,20 +29,162 @@
 #include "onset_threshold.h"
 #include "types.h"
 
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* Larger than any envelope estimate, as sample magnitudes are below 2^31. */
+static const env_t no_minimum = 4294967296.0f;
+
+/* Number of samples compared at once when scanning for a threshold crossing.
+ * The comparison loop has no early exit so that it may be vectorised.
+ */
+#define SCAN_GROUP 64
+
+/* Find the minimum of the current window and the position of the oldest sample
+ * having that value, given as an age relative to the last sample processed.
+ */
+static env_t current_minimum(struct onset_threshold * onset, uint * age)
+{
+	assert(onset);
+
+	uint p = onset->pos;
+	uint lo, hi, mid;
+	env_t m;
+
+	if (p == 0 && !onset->have_prev) {
+		/* Nothing has been processed since the last reset. */
+		if (age)
+			*age = 0;
+		return no_minimum;
+	}
+
+	/* The previous block holds the older samples, so it is preferred when
+	 * both parts of the window have the same minimum.
+	 */
+	if (onset->have_prev && (p == 0 || onset->suffix[p] <= onset->prefix[p - 1])) {
+		if (age)
+			*age = (onset->windowlen - onset->suffix_pos[p]) + p - 1;
+		return onset->suffix[p];
+	}
+
+	m = onset->prefix[p - 1];
+	if (age) {
+		/* The running minimum never increases, so binary search for the
+		 * first position at which it reached its current value.
+		 */
+		lo = 0;
+		hi = p - 1;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (onset->prefix[mid] <= m)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		*age = p - 1 - lo;
+	}
+
+	return m;
+}
+
+/* Process up to the end of the current block, stopping after the first sample
+ * which exceeds the threshold. Returns the offset of that sample, or n if there
+ * is no crossing.
+ */
+static uint scan_block(struct onset_threshold * onset, env_t * env, uint n)
+{
+	assert(onset);
+	assert(env);
+	assert(onset->pos + n <= onset->windowlen);
+
+	uint p = onset->pos;
+	env_t * prefix = &onset->prefix[p];
+	env_t * suffix = &onset->suffix[p + 1];
+	env_t ratio = onset->ratio;
+	env_t m;
+	uint i, j, end;
+	int any;
+
+	/* Store the samples and extend the running minimum of the block. */
+	m = p ? onset->prefix[p - 1] : env[0];
+	for (i = 0; i < n; i++) {
+		onset->block[p + i] = env[i];
+		m = (env[i] < m) ? env[i] : m;
+		prefix[i] = m;
+	}
+
+	/* Find the first sample exceeding the threshold. Values beyond the
+	 * crossing written above are simply overwritten later.
+	 */
+	for (i = 0; i < n; i += SCAN_GROUP) {
+		end = (n - i < SCAN_GROUP) ? n : i + SCAN_GROUP;
+		any = 0;
+
+		if (onset->have_prev) {
+			for (j = i; j < end; j++) {
+				m = (suffix[j] < prefix[j]) ? suffix[j] : prefix[j];
+				any |= env[j] > m * ratio;
+			}
+		} else {
+			for (j = i; j < end; j++)
+				any |= env[j] > prefix[j] * ratio;
+		}
+
+		if (!any)
+			continue;
+
+		for (j = i; j < end; j++) {
+			m = prefix[j];
+			if (onset->have_prev && suffix[j] < m)
+				m = suffix[j];
+			if (env[j] > m * ratio)
+				break;
+		}
+
+		onset->pos += j + 1;
+		if (onset->pos == onset->windowlen)
+			onset_threshold_end_block(onset);
+		return j;
+	}
+
+	onset->pos += n;
+	if (onset->pos == onset->windowlen)
+		onset_threshold_end_block(onset);
+	return n;
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
 struct onset_threshold * onset_threshold_init(float Tw, uint sample_rate,
 		env_t ratio)
 {
 	uint Tw_w = (uint) floor(Tw * sample_rate);
+	struct onset_threshold * onset;
+
+	if (!Tw_w) {
+		error("onset_threshold: Window is shorter than one sample");
+		return NULL;
+	}
 
-	struct onset_threshold * onset = (struct onset_threshold *)
-		malloc(sizeof(struct onset_threshold) + Tw_w * sizeof(struct minima));
+	/* Allocate the arrays along with the tracker itself. */
+	onset = (struct onset_threshold *) malloc(sizeof(struct onset_threshold) +
+			(3 * Tw_w + 1) * sizeof(env_t) + Tw_w * sizeof(uint));
 	if (!onset) {
 		error("onset_threshold: Failed to allocate memory");
 		return NULL;
 	}
 
+	onset->block = (env_t *) &onset[1];
+	onset->prefix = &onset->block[Tw_w];
+	onset->suffix = &onset->prefix[Tw_w];
+	onset->suffix_pos = (uint *) &onset->suffix[Tw_w + 1];
+
 	onset->windowlen = Tw_w;
 	onset->ratio = ratio;
+	onset->suffix[Tw_w] = no_minimum;
 	onset_threshold_reset(onset);
 
 	return onset;
@@ -59,56 +201,83 @@ void onset_threshold_reset(struct onset_threshold * onset)
 {
 	assert(onset);
 
-	onset->left = 0;
-	onset->right = 0;
-	onset->ticker = 0;
-	onset->len = 1;
-	onset->mins[0].expiry = 0;
-	onset->mins[0].value = 4294967296.0f;
+	onset->pos = 0;
+	onset->have_prev = 0;
+}
+
+/* Called by onset_threshold_next() once a block is complete. */
+void onset_threshold_end_block(struct onset_threshold * onset)
+{
+	assert(onset);
+
+	uint W = onset->windowlen;
+	uint i;
+
+	onset->suffix[W - 1] = onset->block[W - 1];
+	onset->suffix_pos[W - 1] = W - 1;
+
+	/* Ties go to the earlier sample as it is older. */
+	for (i = W - 1; i-- > 0; ) {
+		if (onset->block[i] <= onset->suffix[i + 1]) {
+			onset->suffix[i] = onset->block[i];
+			onset->suffix_pos[i] = i;
+		} else {
+			onset->suffix[i] = onset->suffix[i + 1];
+			onset->suffix_pos[i] = onset->suffix_pos[i + 1];
+		}
+	}
+
+	onset->pos = 0;
+	onset->have_prev = 1;
+}
+
+uint onset_threshold_scan(struct onset_threshold * onset, env_t * env,
+		uint n, env_t * threshold)
+{
+	assert(onset);
+	assert(env);
+	assert(threshold);
+
+	uint i = 0;
+	uint len, r;
+
+	while (i < n) {
+		len = onset->windowlen - onset->pos;
+		if (len > n - i)
+			len = n - i;
+
+		r = scan_block(onset, &env[i], len);
+		i += r;
+		if (r < len)
+			break;
+	}
+
+	if (n)
+		*threshold = current_minimum(onset, NULL) * onset->ratio;
+
+	return i;
 }
 
 uint onset_threshold_age(struct onset_threshold * onset)
 {
 	assert(onset);
-	uint life;
 
-	/* As age is by definition always positive, we can return -1 on error.
-	 */
-	if (onset->len == 0)
-		return -1;
+	uint age;
 
-	/* Determine the remaining lifetime of the current minima and then
-	 * subtract this from the window length.
-	 */
-	life = ((onset->windowlen + onset->mins[onset->left].expiry) - (onset->ticker + 1))
-		% onset->windowlen;
-	return onset->windowlen - (life + 1);
+	current_minimum(onset, &age);
+	return age;
 }
 
 env_t onset_threshold_current_minimum(struct onset_threshold * onset)
 {
 	assert(onset);
 
-	/* Check whether there is valid data in the minima tracker. As we're
-	 * storing minima of energy levels and these are always positive, we can
-	 * return a negative value to indicate an error.
-	 */
-	if (onset->len == 0)
-		return -1;
-
-	return onset->mins[onset->left].value;
+	return current_minimum(onset, NULL);
 }
 
 env_t onset_threshold_current(struct onset_threshold * onset)
 {
 	assert(onset);
 
-	/* Check whether there is valid data in the minima tracker. As we're
-	 * storing minima of energy levels and these are always positive, we can
-	 * return a negative value to indicate an error.
-	 */
-	if (onset->len == 0)
-		return -1;
-
-	return onset->mins[onset->left].value * onset->ratio;
+	return current_minimum(onset, NULL) * onset->ratio;
 }
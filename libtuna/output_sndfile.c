@@ -18,13 +18,23 @@
 	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 *******************************************************************************/
 
+/* Needed for fallocate() and FALLOC_FL_KEEP_SIZE. */
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <malloc.h>
+#include <pthread.h>
 #include <sndfile.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "buffer.h"
 #include "consumer.h"
 #include "log.h"
 #include "output_sndfile.h"
@@ -35,11 +45,41 @@
 	Private declarations and functions
 *******************************************************************************/
 
+#define SNDFILE_WRITE	1
+#define SNDFILE_RESYNC	2
+
+/* Space allowed for the file header and any chunks written by libsndfile when
+ * working out how much to preallocate for a file.
+ */
+#define SNDFILE_HEADER_SPACE	4096
+
+/* Suffix added to the name of the next output file until it is used. */
+#define SNDFILE_TMP_SUFFIX	".tmp"
+
+struct sndfile_entry {
+	uint			event;
+	sample_t *		buf;
+	uint			count;
+	struct timespec		ts;
+};
+
 struct output_sndfile {
 	SNDFILE *		sf;
 	SF_INFO			sf_info;
 	char *			sf_name;
 	size_t			sf_name_len;
+	int			fd;
+
+	/* The next output file is created and has its space reserved as soon
+	 * as the current file is opened, so that starting a new file doesn't
+	 * have to wait for the filesystem to find space for it. Until it is
+	 * used it is kept under tmp_name, so that an existing file called
+	 * next_name is only replaced if this run writes to it. next_fd is -1
+	 * if the next file hasn't been created.
+	 */
+	char *			next_name;
+	char *			tmp_name;
+	int			next_fd;
 
 	/* Samples written to the current output file - this is reset to zero
 	 * when a new file is opened.
@@ -47,6 +87,11 @@ struct output_sndfile {
 	uint			samples_written;
 	uint			samples_max;
 
+	/* Time of the first sample in the current output file, or zero if
+	 * unknown.
+	 */
+	struct timespec		file_ts;
+
 	/* The output filename is formed by putting a three digit number between
 	 * prefix and suffix. For example, with prefix="REC-" and suffix=".wav",
 	 * output files will be "REC-000.wav", "REC-001.wav", etc. The index
@@ -55,111 +100,307 @@ struct output_sndfile {
 	const char *		prefix;
 	const char *		suffix;
 	uint			index;
+
+	/* If depth is non-zero, samples and resyncs are passed to a writer
+	 * thread through the entries ring, which holds a reference on each
+	 * buffer. Entries from head up to tail are waiting to be written. If
+	 * the writer fails it leaves the error in status. The ring indices,
+	 * flags and queue statistics are protected by the mutex.
+	 */
+	uint			depth;
+	struct sndfile_entry *	entries;
+	uint			head;
+	uint			tail;
+	int			status;
+	int			stop;
+	int			running;
+	pthread_t		thread;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		ready_cond;
+	pthread_cond_t		space_cond;
+
+	struct output_sndfile_stats	stats;
 };
 
+static double elapsed(struct timespec * start, struct timespec * end)
+{
+	return (double)(end->tv_sec - start->tv_sec) +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Size to preallocate for a full output file, or zero if the size of each
+ * sample isn't fixed.
+ */
+static off_t full_size(struct output_sndfile * snd)
+{
+	assert(snd);
+
+	off_t bytes;
+
+	switch (snd->sf_info.format & SF_FORMAT_SUBMASK) {
+	    case SF_FORMAT_PCM_S8:
+	    case SF_FORMAT_PCM_U8:
+		bytes = 1;
+		break;
+
+	    case SF_FORMAT_PCM_16:
+		bytes = 2;
+		break;
+
+	    case SF_FORMAT_PCM_24:
+		bytes = 3;
+		break;
+
+	    case SF_FORMAT_PCM_32:
+	    case SF_FORMAT_FLOAT:
+		bytes = 4;
+		break;
+
+	    case SF_FORMAT_DOUBLE:
+		bytes = 8;
+		break;
+
+	    default:
+		return 0;
+	}
+
+	return (off_t) snd->samples_max * snd->sf_info.channels * bytes +
+		SNDFILE_HEADER_SPACE;
+}
+
+/* Create the next output file under its temporary name and reserve space for
+ * all of its data. The space is reserved without changing the file size so that
+ * libsndfile sees an empty file, and any which isn't used is given back when the
+ * file is closed. Not every filesystem supports this, in which case the file is
+ * just created.
+ */
+static int create_next(struct output_sndfile * snd)
+{
+	assert(snd);
+	assert(snd->next_fd < 0);
+
+	int r;
+	off_t len;
+
+	snprintf(snd->next_name, snd->sf_name_len, "%s%03d%s", snd->prefix,
+			snd->index, snd->suffix);
+	snprintf(snd->tmp_name, snd->sf_name_len + strlen(SNDFILE_TMP_SUFFIX),
+			"%s" SNDFILE_TMP_SUFFIX, snd->next_name);
+
+	snd->next_fd = open(snd->tmp_name, O_WRONLY | O_CREAT | O_TRUNC,
+			0666);
+	if (snd->next_fd < 0) {
+		r = -errno;
+		error("output_sndfile: Failed to create file %s",
+				snd->tmp_name);
+		return r;
+	}
+	snd->index++;
+
+	len = full_size(snd);
+	if (len && fallocate(snd->next_fd, FALLOC_FL_KEEP_SIZE, 0, len) < 0)
+		warn("output_sndfile: Failed to preallocate %s: %s",
+				snd->tmp_name, strerror(errno));
+
+	return 0;
+}
+
+/* Remove the next output file if it was created but never used. */
+static void discard_next(struct output_sndfile * snd)
+{
+	assert(snd);
+
+	if (snd->next_fd < 0)
+		return;
+
+	close(snd->next_fd);
+	unlink(snd->tmp_name);
+	snd->next_fd = -1;
+}
+
+/* Record the start time of a new file in a Broadcast Wave 'bext' chunk, so that
+ * input_sndfile can tell whether consecutive files are contiguous. The date and
+ * time are given in UTC and the time reference is the number of samples since
+ * midnight.
+ */
+static void set_start_time(struct output_sndfile * snd)
+{
+	assert(snd);
+
+	SF_BROADCAST_INFO bext;
+	struct tm tm;
+	char tmp[16];
+	uint64 rate, ref;
+
+	if (!snd->file_ts.tv_sec && !snd->file_ts.tv_nsec)
+		return;
+
+	memset(&bext, 0, sizeof(bext));
+	gmtime_r(&snd->file_ts.tv_sec, &tm);
+
+	/* The date and time fields aren't null terminated. */
+	strftime(tmp, sizeof(tmp), "%Y-%m-%d", &tm);
+	memcpy(bext.origination_date, tmp, sizeof(bext.origination_date));
+	strftime(tmp, sizeof(tmp), "%H:%M:%S", &tm);
+	memcpy(bext.origination_time, tmp, sizeof(bext.origination_time));
+	snprintf(bext.originator, sizeof(bext.originator), "tuna");
+
+	rate = snd->sf_info.samplerate;
+	ref = (uint64) (tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec) * rate
+		+ (uint64) snd->file_ts.tv_nsec * rate / 1000000000;
+	bext.time_reference_low = (uint) ref;
+	bext.time_reference_high = (uint) (ref >> 32);
+	bext.version = 1;
+
+	if (sf_command(snd->sf, SFC_SET_BROADCAST_INFO, &bext,
+				sizeof(bext)) != SF_TRUE)
+		warn("output_sndfile: Failed to store start time in %s",
+				snd->sf_name);
+}
+
 static int open_sndfile(struct output_sndfile * snd)
 {
 	int r;
+	char * name;
 
 	assert(snd);
 
-	snprintf(snd->sf_name, snd->sf_name_len, "%s%03d%s", snd->prefix, snd->index, snd->suffix);
-	snd->index++;
+	if (snd->next_fd < 0) {
+		r = create_next(snd);
+		if (r < 0)
+			/* Error message already printed. */
+			return r;
+	}
+
+	/* The next file becomes the current file, replacing any file of the
+	 * same name.
+	 */
+	if (rename(snd->tmp_name, snd->next_name) < 0) {
+		r = -errno;
+		error("output_sndfile: Failed to rename %s to %s",
+				snd->tmp_name, snd->next_name);
+		discard_next(snd);
+		return r;
+	}
+
+	name = snd->sf_name;
+	snd->sf_name = snd->next_name;
+	snd->next_name = name;
+	snd->fd = snd->next_fd;
+	snd->next_fd = -1;
 
-	snd->sf = sf_open(snd->sf_name, SFM_WRITE, &snd->sf_info);
+	/* The file descriptor is kept open after sf_close() so that the file
+	 * can be trimmed and synced.
+	 */
+	snd->sf = sf_open_fd(snd->fd, SFM_WRITE, &snd->sf_info, 0);
 	if (!snd->sf) {
 		r = sf_error(NULL);
 		error("libsndfile: Error %d: %s", r, sf_strerror(NULL));
 		error("output_sndfile: Failed to create file %s", snd->sf_name);
+		close(snd->fd);
+		snd->fd = -1;
 		return -r;	/* libsndfile error values are positive. */
 	}
 
 	msg("output_sndfile: Created new file %s", snd->sf_name);
 	snd->samples_written = 0;
 
+	if (snd->depth)
+		pthread_mutex_lock(&snd->mutex);
+	snd->stats.files++;
+	if (snd->depth)
+		pthread_mutex_unlock(&snd->mutex);
+
+	set_start_time(snd);
+
+	/* If this fails, it is tried again when the next file is needed. */
+	create_next(snd);
+
 	return 0;
 }
 
-static void close_sndfile(struct output_sndfile * snd)
+static int close_sndfile(struct output_sndfile * snd)
 {
 	assert(snd);
 
 	int r;
+	struct stat st;
 
 	if (!snd->sf) {
 		warn("output_sndfile: Skipping close_sndfile()");
-		return;
+		return 0;
 	}
 
 	r = sf_close(snd->sf);
+	snd->sf = NULL;
 	if (r != 0) {
-		error("libsndfile: Error %d: %s", r, sf_strerror(snd->sf));
-		fatal("output_sndfile: Could not close file %s", snd->sf_name);
+		error("libsndfile: Error %d: %s", r, sf_strerror(NULL));
+		error("output_sndfile: Could not close file %s", snd->sf_name);
+		close(snd->fd);
+		snd->fd = -1;
+		return -r;
 	}
 
-	msg("output_sndfile: Closed file %s", snd->sf_name);
-
-	snd->sf = NULL;
-}
+	/* Give back any preallocated space beyond the end of the data. */
+	if (fstat(snd->fd, &st) == 0)
+		if (ftruncate(snd->fd, st.st_size) < 0)
+			warn("output_sndfile: Failed to trim file %s",
+					snd->sf_name);
 
-void output_sndfile_exit(struct consumer * consumer)
-{
-	assert(consumer);
+	/* Sync the file when writing is queued. Without a queue this would
+	 * stall the data path, so writeback is left to the kernel.
+	 */
+	if (snd->depth && fsync(snd->fd) < 0) {
+		r = -errno;
+		error("output_sndfile: Failed to sync file %s", snd->sf_name);
+		close(snd->fd);
+		snd->fd = -1;
+		return r;
+	}
 
-	struct output_sndfile * snd = (struct output_sndfile *)
-		consumer_get_data(consumer);
+	close(snd->fd);
+	snd->fd = -1;
 
-	close_sndfile(snd);
+	msg("output_sndfile: Closed file %s", snd->sf_name);
 
-	free(snd->sf_name);
-	free(snd);
+	return 0;
 }
 
-int output_sndfile_write(struct consumer * consumer, sample_t * buf, uint count)
+static int write_samples(struct output_sndfile * snd, sample_t * buf,
+		uint count)
 {
-	assert(consumer);
+	assert(snd);
 	assert(buf);
 
 	int r;
-	uint w = 0;
+	uint n, w = 0;
 
-	struct output_sndfile * snd = (struct output_sndfile *)
-		consumer_get_data(consumer);
+	while (w < count) {
+		if (snd->samples_written == snd->samples_max) {
+			/* Start a new wavefile, which begins where the old one
+			 * ended.
+			 */
+			if (snd->file_ts.tv_sec || snd->file_ts.tv_nsec)
+				timespec_add_ticks(&snd->file_ts,
+						snd->samples_written,
+						snd->sf_info.samplerate);
 
-	if (snd->samples_written + count > snd->samples_max) {
-		/* We need to start a new wavefile before we can write all the
-		 * samples we have been given. We may still have space for more
-		 * samples in the current file so check that first.
-		 */
-		uint remaining = snd->samples_max - snd->samples_written;
-		if (remaining) {
-			r = output_sndfile_write(consumer, buf, remaining);
-			if (r <= 0) {
-				/* Something went wrong. */
-				error("output_sndfile: Nested write call failed");
+			r = close_sndfile(snd);
+			if (r < 0)
 				return r;
-			}
-			/* As this function doesn't exit unless it hits an error
-			 * or it has written all the samples with was asked to
-			 * we know that r=remaining here.
-			 */
-		} else {
-			r = 0;
+			r = open_sndfile(snd);
+			if (r < 0)
+				/* Error message already printed. */
+				return r;
+			msg("output_sndfile: Old file was full");
 		}
 
-		close_sndfile(snd);
-		r = open_sndfile(snd);
-		if (r < 0)
-			/* Error message already printed. */
-			return r;
-		msg("output_sndfile: Old file was full");
-
-		w += r;
-		buf += r;
-	}
+		/* Write as much as will fit in the current file. */
+		n = count - w;
+		if (n > snd->samples_max - snd->samples_written)
+			n = snd->samples_max - snd->samples_written;
 
-	while (w < count) {
-		r = sf_writef_int(snd->sf, buf, count - w);
+		r = sf_writef_int(snd->sf, buf, n);
 		if (r <= 0) {
 			r = sf_error(snd->sf);
 			error("libsndfile: Error %d: %s", r, sf_strerror(snd->sf));
@@ -172,25 +413,26 @@ int output_sndfile_write(struct consumer * consumer, sample_t * buf, uint count)
 		 */
 		w += r;
 		buf += r;
+		snd->samples_written += r;
 	}
-	
+
 	/* If we get to here we have written all the samples we were asked to.
 	 */
 	return w;
 }
 
-int output_sndfile_start(struct consumer * consumer, uint sample_rate, struct timespec * ts)
+static int resync_file(struct output_sndfile * snd, struct timespec * ts)
 {
-	assert(consumer);
+	assert(snd);
 	assert(ts);
 
 	int r;
 
-	struct output_sndfile * snd = (struct output_sndfile *)
-		consumer_get_data(consumer);
-
-	snd->sf_info.samplerate = sample_rate;
-
+	/* Create a new output file. */
+	snd->file_ts = *ts;
+	r = close_sndfile(snd);
+	if (r < 0)
+		return r;
 	r = open_sndfile(snd);
 	if (r < 0)
 		/* Error message already printed. */
@@ -198,12 +440,201 @@ int output_sndfile_start(struct consumer * consumer, uint sample_rate, struct ti
 
 	char s[64];
 	timespec_snprint(ts, s, 64);
-	msg("output_sndfile: START at %s", s);
+	msg("output_sndfile: RESYNC at %s", s);
 
 	return 0;
 }
 
-int output_sndfile_resync(struct consumer * consumer, struct timespec * ts)
+/* Handle a write or resync, timing how long it takes. In queued mode this is
+ * only called from the writer thread.
+ */
+static int handle_event(struct output_sndfile * snd, uint event,
+		sample_t * buf, uint count, struct timespec * ts)
+{
+	assert(snd);
+
+	int r;
+	double t;
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (event == SNDFILE_WRITE)
+		r = write_samples(snd, buf, count);
+	else
+		r = resync_file(snd, ts);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	t = elapsed(&start, &end);
+
+	if (snd->depth)
+		pthread_mutex_lock(&snd->mutex);
+	snd->stats.write_time += t;
+	if (t > snd->stats.max_write_time)
+		snd->stats.max_write_time = t;
+	if (snd->depth)
+		pthread_mutex_unlock(&snd->mutex);
+
+	return r;
+}
+
+static void * writer_thread(void * param)
+{
+	struct output_sndfile * snd = (struct output_sndfile *) param;
+	struct sndfile_entry * e;
+	int r;
+
+	pthread_mutex_lock(&snd->mutex);
+	while (1) {
+		while (!snd->stop && snd->head == snd->tail)
+			pthread_cond_wait(&snd->ready_cond, &snd->mutex);
+
+		/* Everything queued before the stop is written first. */
+		if (snd->head == snd->tail)
+			break;
+
+		/* Only the writer moves head, so the entry at head can be
+		 * handled without holding the lock.
+		 */
+		e = &snd->entries[snd->head % snd->depth];
+		pthread_mutex_unlock(&snd->mutex);
+
+		r = handle_event(snd, e->event, e->buf, e->count, &e->ts);
+		if (e->event == SNDFILE_WRITE)
+			buffer_release(e->buf);
+
+		pthread_mutex_lock(&snd->mutex);
+		snd->head++;
+		pthread_cond_signal(&snd->space_cond);
+
+		if (r < 0) {
+			error("output_sndfile: Writer thread stopped");
+			snd->status = r;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&snd->mutex);
+
+	return NULL;
+}
+
+/* Pass an event to the writer thread, waiting for space if the queue is full.
+ * Once the writer has failed, its error is returned instead.
+ */
+static int enqueue(struct output_sndfile * snd, uint event, sample_t * buf,
+		uint count, struct timespec * ts)
+{
+	assert(snd);
+
+	struct sndfile_entry * e;
+	struct timespec start, end;
+	double t;
+	int r;
+
+	pthread_mutex_lock(&snd->mutex);
+
+	if (snd->status >= 0 && snd->tail - snd->head == snd->depth) {
+		snd->stats.stalls++;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		while (snd->status >= 0 && snd->tail - snd->head == snd->depth)
+			pthread_cond_wait(&snd->space_cond, &snd->mutex);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		t = elapsed(&start, &end);
+		snd->stats.stall_time += t;
+		if (t > snd->stats.max_stall_time)
+			snd->stats.max_stall_time = t;
+	}
+
+	r = snd->status;
+	if (r < 0) {
+		pthread_mutex_unlock(&snd->mutex);
+		return r;
+	}
+
+	e = &snd->entries[snd->tail % snd->depth];
+	e->event = event;
+	e->buf = buf;
+	e->count = count;
+	if (ts)
+		e->ts = *ts;
+	if (buf)
+		buffer_addref(buf);
+
+	snd->tail++;
+	if (snd->tail - snd->head > snd->stats.max_backlog)
+		snd->stats.max_backlog = snd->tail - snd->head;
+	pthread_cond_signal(&snd->ready_cond);
+
+	pthread_mutex_unlock(&snd->mutex);
+
+	return event == SNDFILE_WRITE ? (int) count : 0;
+}
+
+void output_sndfile_exit(struct consumer * consumer)
+{
+	assert(consumer);
+
+	struct output_sndfile * snd = (struct output_sndfile *)
+		consumer_get_data(consumer);
+	struct sndfile_entry * e;
+
+	if (snd->running) {
+		/* Let the writer finish everything that has been queued. */
+		pthread_mutex_lock(&snd->mutex);
+		snd->stop = 1;
+		pthread_cond_signal(&snd->ready_cond);
+		pthread_mutex_unlock(&snd->mutex);
+		pthread_join(snd->thread, NULL);
+
+		/* Anything left was queued after the writer failed. */
+		for (; snd->head != snd->tail; snd->head++) {
+			e = &snd->entries[snd->head % snd->depth];
+			if (e->event == SNDFILE_WRITE)
+				buffer_release(e->buf);
+		}
+	}
+
+	if (snd->sf)
+		close_sndfile(snd);
+	discard_next(snd);
+
+	if (snd->depth) {
+		msg("output_sndfile: Queue of %u buffers, max backlog %u, "
+				"%llu stalls for %.3f s (longest %.3f s)",
+				snd->depth, snd->stats.max_backlog,
+				snd->stats.stalls, snd->stats.stall_time,
+				snd->stats.max_stall_time);
+		pthread_cond_destroy(&snd->space_cond);
+		pthread_cond_destroy(&snd->ready_cond);
+		pthread_mutex_destroy(&snd->mutex);
+	}
+	msg("output_sndfile: Wrote %u files, spent %.3f s writing (longest %.3f s)",
+			snd->stats.files, snd->stats.write_time,
+			snd->stats.max_write_time);
+
+	free(snd->entries);
+	free(snd->tmp_name);
+	free(snd->next_name);
+	free(snd->sf_name);
+	free(snd);
+}
+
+int output_sndfile_write(struct consumer * consumer, sample_t * buf, uint count)
+{
+	assert(consumer);
+	assert(buf);
+
+	struct output_sndfile * snd = (struct output_sndfile *)
+		consumer_get_data(consumer);
+
+	if (snd->depth)
+		return enqueue(snd, SNDFILE_WRITE, buf, count, NULL);
+
+	return handle_event(snd, SNDFILE_WRITE, buf, count, NULL);
+}
+
+int output_sndfile_start(struct consumer * consumer, uint sample_rate, struct timespec * ts)
 {
 	assert(consumer);
 	assert(ts);
@@ -213,39 +644,86 @@ int output_sndfile_resync(struct consumer * consumer, struct timespec * ts)
 	struct output_sndfile * snd = (struct output_sndfile *)
 		consumer_get_data(consumer);
 
-	/* Create a new output file. */
-	close_sndfile(snd);
+	snd->sf_info.samplerate = sample_rate;
+	snd->file_ts = *ts;
+
+	/* The first file is opened here so that any error is reported
+	 * straight away, later files are opened by the writer thread.
+	 */
 	r = open_sndfile(snd);
 	if (r < 0)
 		/* Error message already printed. */
 		return r;
 
+	if (snd->depth) {
+		r = pthread_create(&snd->thread, NULL, writer_thread, snd);
+		if (r != 0) {
+			error("output_sndfile: Failed to start writer thread");
+			return -r;
+		}
+		snd->running = 1;
+	}
+
 	char s[64];
 	timespec_snprint(ts, s, 64);
-	msg("output_sndfile: RESYNC at %s", s);
-	
+	msg("output_sndfile: START at %s", s);
+
 	return 0;
 }
 
+int output_sndfile_resync(struct consumer * consumer, struct timespec * ts)
+{
+	assert(consumer);
+	assert(ts);
+
+	struct output_sndfile * snd = (struct output_sndfile *)
+		consumer_get_data(consumer);
+
+	if (snd->depth)
+		return enqueue(snd, SNDFILE_RESYNC, NULL, 0, ts);
+
+	return handle_event(snd, SNDFILE_RESYNC, NULL, 0, ts);
+}
+
 /*******************************************************************************
 	Public functions
 *******************************************************************************/
 
-int output_sndfile_init(struct consumer * consumer, const char * prefix,
-		const char * suffix, int format, uint max_samples_per_file)
+void output_sndfile_get_stats(struct consumer * consumer,
+		struct output_sndfile_stats * stats)
+{
+	assert(consumer);
+	assert(stats);
+
+	struct output_sndfile * snd = (struct output_sndfile *)
+		consumer_get_data(consumer);
+
+	if (snd->depth)
+		pthread_mutex_lock(&snd->mutex);
+	*stats = snd->stats;
+	stats->backlog = snd->tail - snd->head;
+	if (snd->depth)
+		pthread_mutex_unlock(&snd->mutex);
+}
+
+int output_sndfile_init_async(struct consumer * consumer, const char * prefix,
+		const char * suffix, int format, uint max_samples_per_file,
+		uint depth)
 {
 	assert(consumer);
 	assert(prefix);
 	assert(suffix);
 
 	struct output_sndfile * snd = (struct output_sndfile *)
-		malloc(sizeof(struct output_sndfile));
+		calloc(1, sizeof(struct output_sndfile));
 	if (!snd) {
 		error("output_sndfile: Failed to allocate memory for internal data");
 		return -ENOMEM;
 	}
 
 	snd->sf = NULL;
+	snd->fd = -1;
+	snd->next_fd = -1;
 	snd->prefix = prefix;
 	snd->suffix = suffix;
 	snd->index = 0;
@@ -253,17 +731,49 @@ int output_sndfile_init(struct consumer * consumer, const char * prefix,
 
 	snd->sf_name_len = strlen(prefix) + strlen(suffix) + 10;
 	snd->sf_name = (char *)malloc(snd->sf_name_len);
-	if (!snd->sf_name) {
+	snd->next_name = (char *)malloc(snd->sf_name_len);
+	snd->tmp_name = (char *)malloc(snd->sf_name_len +
+			strlen(SNDFILE_TMP_SUFFIX));
+	if (!snd->sf_name || !snd->next_name || !snd->tmp_name) {
 		error("output_sndfile: Failed to allocate memory for filename");
-		return -ENOMEM;
+		goto err;
 	}
 
+	if (depth) {
+		snd->entries = (struct sndfile_entry *)
+			malloc(depth * sizeof(struct sndfile_entry));
+		if (!snd->entries) {
+			error("output_sndfile: Failed to allocate memory for queue");
+			goto err;
+		}
+
+		snd->depth = depth;
+		pthread_mutex_init(&snd->mutex, NULL);
+		pthread_cond_init(&snd->ready_cond, NULL);
+		pthread_cond_init(&snd->space_cond, NULL);
+	}
+	snd->stats.depth = depth;
+
 	snd->sf_info.format = format;
 	snd->sf_info.channels = 1;
-	
+
 	consumer_set_module(consumer, output_sndfile_write,
 			output_sndfile_start, output_sndfile_resync,
 			output_sndfile_exit, snd);
 
 	return 0;
+
+err:
+	free(snd->tmp_name);
+	free(snd->next_name);
+	free(snd->sf_name);
+	free(snd);
+	return -ENOMEM;
+}
+
+int output_sndfile_init(struct consumer * consumer, const char * prefix,
+		const char * suffix, int format, uint max_samples_per_file)
+{
+	return output_sndfile_init_async(consumer, prefix, suffix, format,
+			max_samples_per_file, 0);
 }
@@ -35,13 +35,29 @@
 #include "onset_threshold.h"
 #include "offset_threshold.h"
 #include "pulse.h"
+#include "simd.h"
 #include "tol.h"
 #include "types.h"
 
+#ifdef ENABLE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 /*******************************************************************************
 	Private declarations and functions
 *******************************************************************************/
 
+/* Band levels are those found by padding each pulse to the longest FFT length.
+ * Pulses of up to fft_length / PULSE_SHORT_DIV samples instead get the same
+ * levels from the autocorrelation of the pulse, found with the smallest power
+ * of two FFT which is at least twice the pulse duration but no shorter than
+ * 2^PULSE_MIN_FFT_POW2 samples. For longer pulses, summing each band over the
+ * autocorrelation costs too much for the short FFTs to save time over the
+ * longest. See calc_tols().
+ */
+#define PULSE_MIN_FFT_POW2 8
+#define PULSE_SHORT_DIV 16
+
 enum pulse_state {
 	STATE_NONPULSE,
 	STATE_PULSE
@@ -69,7 +85,7 @@ struct pulse_results {
 };
 
 struct pulse_processor {
-	/* Third-octave analysis. */
+	/* Third-octave analysis of the longest FFT. */
 	struct tol *				tol;
 
 	/* Current result set. */
@@ -87,16 +103,51 @@ struct pulse_processor {
 	/* Filename of output stream. */
 	char *					out_name;
 
-	/* FFT: This is provided during initialisation and is not exited when
-	 * the pulse processor is exited.
-	 */
+	/* FFT context of length fft_length. */
 	struct fft *				fft;
 
-	/* Pointer to FFT data buffer, when open. */
+	/* Data buffer of the longest FFT context. Pulse samples are collected
+	 * here and copied to a shorter context if the pulse is short enough.
+	 */
 	float *					fft_data;
 
-	/* A buffer to store squared sample values. */
-	float *					sq_data;
+	/* FFT contexts for short pulses, for each power of two length from
+	 * 2^PULSE_MIN_FFT_POW2 up to 2 * fft_length / PULSE_SHORT_DIV.
+	 */
+	struct fft **				short_ffts;
+
+	/* Number of short FFT lengths available. */
+	uint					n_short_ffts;
+
+	/* Autocorrelation kernel of each third octave band: kernels[i *
+	 * kernel_length + m] is the real part of the DFT of the band weights
+	 * over fft_length bins at lag m. Summing the autocorrelation of a pulse
+	 * weighted by these gives the band levels of the pulse padded to
+	 * fft_length.
+	 */
+	float *					kernels;
+
+	/* Number of lags in each kernel, the longest short pulse. */
+	uint					kernel_length;
+
+	/* Number of pulses analysed with each short FFT length, followed by the
+	 * number analysed with the longest FFT.
+	 */
+	uint64 *				fft_counts;
+
+	/* Cumulative energy of the current pulse: cum_energy[i] is the sum of
+	 * squared sample values from the onset up to and including sample i.
+	 * Being non-decreasing, it can be binary searched for the 5% and 95%
+	 * energy points.
+	 */
+	double *				cum_energy;
+
+	/* Kernel which squares a block of samples and appends their running
+	 * sum to cum_energy, selected in pulse_start().
+	 */
+	double					(*energy_block)(double * cum,
+							sample_t * x, uint n,
+							double e);
 
 	/* Onset threshold tracker. */
 	struct onset_threshold *		onset;
@@ -107,24 +158,32 @@ struct pulse_processor {
 	/* Envelope estimation. */
 	struct env_estimate *			env;
 
+	/* Envelope of the buffer currently being processed, estimated for the
+	 * whole buffer at once before detection. This is grown as needed to
+	 * hold the largest buffer seen.
+	 */
+	env_t *					env_data;
+	uint					env_data_len;
+
 	/* Cumulative energy observed so far in the current pulse - may be
 	 * considered an additional result if ENABLE_PULSE_TOL is not defined.
 	 */
-	float					energy;
+	double					energy;
 
 	/* Current state: See enum above. */
 	enum pulse_state			state;
 
-	/* Length of the FFT window. Pulses are padded to this length before
-	 * transformation so that only one set of third octave level
-	 * coefficients are needed.
+	/* Length of the longest FFT window, equal to the maximum pulse
+	 * duration.
 	 */
 	uint					fft_length;
 
 	/* Index within current pulse, once a pulse has been detected. */
 	uint					index;
 
-	/* Number of active third octave levels. */
+	/* Number of active third octave levels. This sets the number of
+	 * levels in each result set.
+	 */
 	uint					n_tol;
 
 	/* Maximum pulse duration in samples, calculated from
@@ -212,34 +271,189 @@ static int write_results_dat(struct pulse_processor * p)
 	return dat_write_record(p->out, TUNA_DAT_PULSE, p->results, sz);
 }
 
-void calc_offsets(struct pulse_processor * p)
+/* Square each of the n samples in x and write the running total, starting from
+ * e, to cum. Returns the final total.
+ */
+static double energy_block(double * cum, sample_t * x, uint n, double e)
+{
+	assert(cum);
+	assert(x);
+
+	uint i;
+	double f;
+
+	for (i = 0; i < n; i++) {
+		f = (double) x[i];
+		e += f * f;
+		cum[i] = e;
+	}
+
+	return e;
+}
+
+#ifdef ENABLE_X86_SIMD
+/* x86 versions of energy_block(), selected at runtime in pulse_start(). Each
+ * vector of squares is prefix summed in-register by adding shifted copies of
+ * itself, then offset by the total carried from the previous vector. As the
+ * additions happen in a different order, the totals may differ from the scalar
+ * code in the last few bits.
+ */
+
+__attribute__((target("sse4.1")))
+static double energy_block_sse4_1(double * cum, sample_t * x, uint n, double e)
+{
+	assert(cum);
+	assert(x);
+
+	__m128d carry = _mm_set1_pd(e);
+	__m128d zero = _mm_setzero_pd();
+	uint i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128d f = _mm_cvtepi32_pd(_mm_loadl_epi64((__m128i *) &x[i]));
+		__m128d v = _mm_mul_pd(f, f);
+
+		v = _mm_add_pd(v, _mm_unpacklo_pd(zero, v));
+		v = _mm_add_pd(v, carry);
+		_mm_storeu_pd(&cum[i], v);
+
+		carry = _mm_unpackhi_pd(v, v);
+	}
+
+	return energy_block(&cum[i], &x[i], n - i, _mm_cvtsd_f64(carry));
+}
+
+__attribute__((target("avx2")))
+static double energy_block_avx2(double * cum, sample_t * x, uint n, double e)
+{
+	assert(cum);
+	assert(x);
+
+	__m256d carry = _mm256_set1_pd(e);
+	__m256d zero = _mm256_setzero_pd();
+	__m256d t;
+	uint i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256d f = _mm256_cvtepi32_pd(_mm_loadu_si128((__m128i *) &x[i]));
+		__m256d v = _mm256_mul_pd(f, f);
+
+		/* Shift up by one lane then by two lanes. */
+		t = _mm256_permute4x64_pd(v, _MM_SHUFFLE(2, 1, 0, 0));
+		v = _mm256_add_pd(v, _mm256_blend_pd(t, zero, 0x1));
+		t = _mm256_permute4x64_pd(v, _MM_SHUFFLE(1, 0, 0, 0));
+		v = _mm256_add_pd(v, _mm256_blend_pd(t, zero, 0x3));
+
+		v = _mm256_add_pd(v, carry);
+		_mm256_storeu_pd(&cum[i], v);
+
+		carry = _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+
+	return energy_block(&cum[i], &x[i], n - i, _mm256_cvtsd_f64(carry));
+}
+
+__attribute__((target("avx512f")))
+static double energy_block_avx512(double * cum, sample_t * x, uint n, double e)
+{
+	assert(cum);
+	assert(x);
+
+	__m512d carry = _mm512_set1_pd(e);
+	__m512i shift1 = _mm512_set_epi64(6, 5, 4, 3, 2, 1, 0, 0);
+	__m512i shift2 = _mm512_set_epi64(5, 4, 3, 2, 1, 0, 0, 0);
+	__m512i shift4 = _mm512_set_epi64(3, 2, 1, 0, 0, 0, 0, 0);
+	__m512i last = _mm512_set1_epi64(7);
+	uint i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m512d f = _mm512_cvtepi32_pd(_mm256_loadu_si256((__m256i *) &x[i]));
+		__m512d v = _mm512_mul_pd(f, f);
+
+		v = _mm512_add_pd(v, _mm512_maskz_permutexvar_pd(0xFE, shift1, v));
+		v = _mm512_add_pd(v, _mm512_maskz_permutexvar_pd(0xFC, shift2, v));
+		v = _mm512_add_pd(v, _mm512_maskz_permutexvar_pd(0xF0, shift4, v));
+
+		v = _mm512_add_pd(v, carry);
+		_mm512_storeu_pd(&cum[i], v);
+
+		carry = _mm512_permutexvar_pd(last, v);
+	}
+
+	return energy_block(&cum[i], &x[i], n - i,
+			_mm_cvtsd_f64(_mm512_castpd512_pd128(carry)));
+}
+#endif
+
+static void select_kernels(struct pulse_processor * p)
 {
 	assert(p);
 
-	float e;
-	float energy_5perc;
+	p->energy_block = energy_block;
 
-	/* This looks hideously inefficient - there must be a faster way to find
-	 * these offsets.
-	 */
+#ifdef ENABLE_X86_SIMD
+	switch (simd_get_level()) {
+	    case SIMD_LEVEL_AVX512:
+		p->energy_block = energy_block_avx512;
+		break;
+
+	    case SIMD_LEVEL_AVX2:
+		p->energy_block = energy_block_avx2;
+		break;
 
-	energy_5perc = p->energy / 20.0f;
+	    case SIMD_LEVEL_SSE4_1:
+		p->energy_block = energy_block_sse4_1;
+		break;
 
-	/* Find 5% offset. */
-	p->results->offset_5 = 0;
-	e = p->sq_data[0];
-	while (e <= energy_5perc) {
-		p->results->offset_5++;
-		e += p->sq_data[p->results->offset_5];
+	    default:
+		break;
 	}
+#endif
+}
+
+/* Return the index of the first element of the non-decreasing array a which is
+ * greater than x, or n if there is no such element.
+ */
+static uint upper_bound(double * a, uint n, double x)
+{
+	assert(a);
+
+	uint lo = 0, hi = n, mid;
 
-	/* Find 5% offset from end. */
-	p->results->offset_95 = p->index - 1;
-	e = p->sq_data[p->results->offset_95];
-	while (e < energy_5perc) {
-		p->results->offset_95--;
-		e += p->sq_data[p->results->offset_95];
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (a[mid] > x)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
+
+	return lo;
+}
+
+void calc_offsets(struct pulse_processor * p)
+{
+	assert(p);
+	assert(p->index > 0);
+
+	double energy_5perc;
+	uint n = p->index;
+
+	energy_5perc = p->cum_energy[n - 1] / 20.0;
+
+	/* The 5% offset is the first sample at which the cumulative energy
+	 * exceeds 5% of the total.
+	 */
+	p->results->offset_5 = upper_bound(p->cum_energy, n, energy_5perc);
+	if (p->results->offset_5 >= n)
+		p->results->offset_5 = n - 1;
+
+	/* The 95% offset is the last sample from which the remaining energy
+	 * is at least 5% of the total, that is the first sample preceded by
+	 * more than 95% of the energy.
+	 */
+	p->results->offset_95 = upper_bound(p->cum_energy, n - 1,
+			p->cum_energy[n - 1] - energy_5perc);
 }
 
 void process_start_pulse(struct pulse_processor * p, uint onset)
@@ -253,6 +467,110 @@ void process_start_pulse(struct pulse_processor * p, uint onset)
 	p->energy = 0;
 }
 
+#ifdef ENABLE_PULSE_TOL
+/* Sum the products of the first n values of r and kernel. Separate partial sums
+ * let the products be accumulated in parallel.
+ */
+static double kernel_sum(float * r, float * kernel, uint n)
+{
+	assert(r);
+	assert(kernel);
+
+	float acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	double sum = 0;
+	uint i, j;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		for (j = 0; j < 8; j++)
+			acc[j] += r[i + j] * kernel[i + j];
+
+	for (; i < n; i++)
+		sum += r[i] * kernel[i];
+
+	for (j = 0; j < 8; j++)
+		sum += acc[j];
+
+	return sum;
+}
+
+/* Find the band levels of a short pulse from its autocorrelation.
+ *
+ * Padding a pulse of duration D to fft_length gives a power spectrum which is
+ * the DFT of the autocorrelation r[m] of the pulse, which is zero for |m| >= D.
+ * The level of band i is therefore the sum over m of r[m] weighted by the
+ * kernel of that band, with each lag m > 0 counted twice for -m. As the FFT
+ * length is at least 2D the power spectrum of the pulse at this length doesn't
+ * alias r[m], so transforming it again gives length * r[m] in its real part.
+ */
+static void calc_tols_short(struct pulse_processor * p, struct fft * fft)
+{
+	assert(p);
+	assert(fft);
+
+	uint duration = p->results->duration;
+	uint length = fft_get_length(fft);
+	float * data = fft_get_data(fft);
+	float complex * cdata = fft_get_cdata(fft);
+	float * kernel;
+	uint i, m;
+
+	memcpy(data, p->fft_data, duration * sizeof(float));
+	memset(&data[duration], 0, (length - duration) * sizeof(float));
+	fft_transform(fft);
+
+	/* Replace the pulse with its power spectrum, which is real and even. */
+	for (i = 0; i <= length / 2; i++) {
+		data[i] = crealf(cdata[i]) * crealf(cdata[i]) +
+			cimagf(cdata[i]) * cimagf(cdata[i]);
+		if (i && i < length / 2)
+			data[length - i] = data[i];
+	}
+	fft_transform(fft);
+
+	/* Collect r[m] in the data buffer so each band sums two arrays, halving
+	 * r[0] as the sum is doubled to count the negative lags.
+	 */
+	for (m = 0; m < duration; m++)
+		data[m] = crealf(cdata[m]) / length;
+	data[0] *= 0.5f;
+
+	for (i = 0; i < p->n_tol; i++) {
+		kernel = &p->kernels[i * p->kernel_length];
+		p->results->tols[i] = (float) (2 * kernel_sum(data, kernel,
+					duration));
+	}
+}
+
+/* Find the band levels of the pulse padded to fft_length, using a short FFT if
+ * one is at least twice the pulse duration.
+ */
+static void calc_tols(struct pulse_processor * p)
+{
+	assert(p);
+
+	uint duration = p->results->duration;
+	uint pow2, k;
+
+	/* Find the smallest power of two not less than twice the duration. */
+	pow2 = (duration > 1) ? 33 - __builtin_clz(duration - 1) : 1;
+	k = (pow2 > PULSE_MIN_FFT_POW2) ? pow2 - PULSE_MIN_FFT_POW2 : 0;
+
+	if (k < p->n_short_ffts) {
+		calc_tols_short(p, p->short_ffts[k]);
+	} else {
+		k = p->n_short_ffts;
+		if (duration < p->fft_length)
+			memset(&p->fft_data[duration], 0,
+					(p->fft_length - duration) * sizeof(float));
+
+		fft_transform(p->fft);
+		tol_calculate(p->tol, fft_get_cdata(p->fft), p->results->tols);
+	}
+
+	p->fft_counts[k]++;
+}
+#endif
+
 static void process_end_pulse(struct pulse_processor * p)
 {
 	assert(p);
@@ -262,15 +580,10 @@ static void process_end_pulse(struct pulse_processor * p)
 	calc_offsets(p);
 
 #ifdef ENABLE_PULSE_TOL
-	/* Add padding, perform FFT and third octave analysis. */
-	if (p->results->duration < p->fft_length)
-		memset(&p->fft_data[p->results->duration], 0,
-				(p->fft_length - p->results->duration) * sizeof(float));
-	fft_transform(p->fft);
-	tol_calculate(p->tol, fft_get_cdata(p->fft), p->results->tols);
+	calc_tols(p);
 #else
 	/* Copy the pulse energy to the results. */
-	p->results->tols[0] = p->energy;
+	p->results->tols[0] = (float) p->energy;
 #endif
 
 	if (p->params->out_mode == TUNA_OUT_MODE_CSV)
@@ -291,20 +604,17 @@ static int process_sample(struct pulse_processor * p, sample_t x)
 {
 	assert(p);
 	int r = 0;
-	float f = (float)x;
-	float f2 = f * f;
+	double f = (double)x;
 
 	/* Track energy */
-	p->energy += f2;
+	p->energy += f * f;
+	p->cum_energy[p->index] = p->energy;
 
 #ifdef ENABLE_PULSE_TOL
 	/* Copy into fft buffer. */
-	p->fft_data[p->index] = f;
+	p->fft_data[p->index] = (float)x;
 #endif
 
-	/* Copy sample energy into squared data buffer. */
-	p->sq_data[p->index] = f2;
-
 	/* Detect Peaks */
 	if (x > p->results->peak_positive) {
 		p->results->peak_positive = x;
@@ -326,10 +636,31 @@ static void process_data(struct pulse_processor * p, sample_t * data,
 	assert(p);
 	assert(data);
 
-	uint i;
+	uint i, j;
 
-	for (i = 0; i < count; i++)
-		process_sample(p, data[i]);
+	/* Energy is handled for the whole block at once. Peaks are tracked in
+	 * the same way as in process_sample() but no reset of the pulse end
+	 * detector is needed here as it is set up after this data is
+	 * processed.
+	 */
+	p->energy = p->energy_block(&p->cum_energy[p->index], data, count,
+			p->energy);
+
+	for (i = 0, j = p->index; i < count; i++, j++) {
+#ifdef ENABLE_PULSE_TOL
+		p->fft_data[j] = (float)data[i];
+#endif
+
+		if (data[i] > p->results->peak_positive) {
+			p->results->peak_positive = data[i];
+			p->results->peak_positive_offset = j;
+		} else if (data[i] < p->results->peak_negative) {
+			p->results->peak_negative = data[i];
+			p->results->peak_negative_offset = j;
+		}
+	}
+
+	p->index += count;
 }
 
 /* Discard data older than the given offset measured backwards from the end of
@@ -341,43 +672,22 @@ static struct held_buffer * discard_leading_data(struct pulse_processor * p, uin
 {
 	assert(p);
 
-	/* Work backwards through the list of held buffers until we get the the
-	 * starting sample.
-	 */
-	struct held_buffer * h;
-	struct held_buffer * h_tmp;
-	struct held_buffer * h_release;
-	uint i;
+	uint total;
 
-	h = bufhold_newest(p->held_buffers);
-	if (!h)
+	total = bufhold_total(p->held_buffers);
+	if (!total)
 		return NULL;
-	i = bufhold_count(h);
-
-	while (i < offset) {
-		h = bufhold_prev(h);
-		if (!h) {
-			/* This should never happen, make sure we catch it if it
-			 * does though.
-			 */
-			fatal("pulse: Internal error - expected data is not present");
-		}
-		i += bufhold_count(h);
-	}
 
-	h_tmp = bufhold_oldest(p->held_buffers);
-	while (h != h_tmp) {
-		h_release = h_tmp;
-		h_tmp = bufhold_next(h_tmp);
-		bufhold_release(h_release);
+	if (total < offset) {
+		/* This should never happen, make sure we catch it if it does
+		 * though.
+		 */
+		fatal("pulse: Internal error - expected data is not present");
 	}
 
-	/* Line up the first buffer with the given offset and discard any
-	 * previous buffers.
-	 */
-	bufhold_advance(h, i - offset);
+	bufhold_discard(p->held_buffers, total - offset);
 
-	return h;
+	return bufhold_oldest(p->held_buffers);
 }
 
 /* Process and the discard all held data. */
@@ -386,20 +696,14 @@ static void process_leading_data(struct pulse_processor * p, uint offset)
 	assert(p);
 
 	struct held_buffer * h;
-	struct held_buffer * h_release;
 
-	/* Work backwards through the list of held buffers until we get the the
-	 * starting sample.
-	 */
 	h = discard_leading_data(p, offset);
 
 	/* Now process the remaining held data in order. */
-	while (h) {
+	for (; h; h = bufhold_next(h))
 		process_data(p, bufhold_data(h), bufhold_count(h));
-		h_release = h;
-		h = bufhold_next(h);
-		bufhold_release(h_release);
-	}
+
+	bufhold_release_all(p->held_buffers);
 }
 
 /* Returns 0 to remain in pulse, 1 to exit pulse. */
@@ -425,53 +729,58 @@ static void detect_data(struct pulse_processor * p, sample_t * data,
 	uint age;
 	env_t e;
 
+	/* The envelope doesn't depend on the detector state so it can be
+	 * estimated for the whole buffer up front, leaving only threshold
+	 * tracking and pulse processing to be done sample by sample.
+	 */
+	env_estimate_block(p->env, data, p->env_data, count);
+
 	if (p->state == STATE_NONPULSE) {
 state_nonpulse:
 		while (i < count) {
-			e = env_estimate_next(p->env, data[i]);
-			onset_threshold_next(p->onset, e, &p->threshold);
-
-			if (e > p->threshold) {
-				p->state = STATE_PULSE;
-
-				/* Mark the pulse as beginning from the minimum point.
-				 *
-				 * We want start_offset to be the signed offset from the
-				 * start of the current data buffer so we subtract the
-				 * age of the current minimum from our current offset
-				 * into the buffer.
-				 */
-				age = onset_threshold_age(p->onset);
-				start_offset = i - age;
-				process_start_pulse(p, p->write_counter + start_offset);
-
-				/* Process the data between the minimum point and the
-				 * start of the buffer passed to this function.
-				 */
-				if (start_offset < 0) {
-					process_leading_data(p, -start_offset);
-					start_offset = 0;
-				}
-
-				/* Advance i so that the current sample is
-				 * processed in the process_data call below and
-				 * the next sample is processed in state_pulse.
-				 */
-				i++;
-
-				/* Process the data in the buffer passed to this
-				 * function between the minimum point and the current
-				 * sample.
-				 */
-				process_data(p, &data[start_offset], i - start_offset);
-
-				/* Setup the pulse end detector. */
-				offset_threshold_reset(p->offset, e);
+			i += onset_threshold_scan(p->onset, &p->env_data[i],
+					count - i, &p->threshold);
+			if (i == count)
+				break;
+
+			e = p->env_data[i];
+			p->state = STATE_PULSE;
+
+			/* Mark the pulse as beginning from the minimum point.
+			 *
+			 * We want start_offset to be the signed offset from the
+			 * start of the current data buffer so we subtract the
+			 * age of the current minimum from our current offset
+			 * into the buffer.
+			 */
+			age = onset_threshold_age(p->onset);
+			start_offset = i - age;
+			process_start_pulse(p, p->write_counter + start_offset);
 
-				goto state_pulse;
+			/* Process the data between the minimum point and the
+			 * start of the buffer passed to this function.
+			 */
+			if (start_offset < 0) {
+				process_leading_data(p, -start_offset);
+				start_offset = 0;
 			}
 
+			/* Advance i so that the current sample is
+			 * processed in the process_data call below and
+			 * the next sample is processed in state_pulse.
+			 */
 			i++;
+
+			/* Process the data in the buffer passed to this
+			 * function between the minimum point and the current
+			 * sample.
+			 */
+			process_data(p, &data[start_offset], i - start_offset);
+
+			/* Setup the pulse end detector. */
+			offset_threshold_reset(p->offset, e);
+
+			goto state_pulse;
 		}
 	} else {
 state_pulse:
@@ -479,7 +788,7 @@ state_pulse:
 			/* We're in a pulse but this isn't the first sample of
 			 * it.
 			 */
-			e = env_estimate_next(p->env, data[i]);
+			e = p->env_data[i];
 
 			if (process_sample(p, data[i])) {
 				/* A new peak was found. */
@@ -504,6 +813,9 @@ void pulse_exit(struct consumer * consumer)
 	assert(consumer);
 
 	struct pulse_processor * p;
+#ifdef ENABLE_PULSE_TOL
+	uint i, length;
+#endif
 	
 	p = (struct pulse_processor *)consumer_get_data(consumer);
 
@@ -517,18 +829,43 @@ void pulse_exit(struct consumer * consumer)
 		free(p->results);
 
 #ifdef ENABLE_PULSE_TOL
-	if (p->tol)
-		tol_exit(p->tol);
+	if (p->fft_counts) {
+		for (i = 0; i <= p->n_short_ffts; i++) {
+			length = (i < p->n_short_ffts) ?
+				1U << (PULSE_MIN_FFT_POW2 + i) : p->fft_length;
+			if (p->fft_counts[i])
+				msg("pulse: %llu pulses analysed with %u point FFTs",
+						p->fft_counts[i], length);
+		}
+		free(p->fft_counts);
+	}
+
+	for (i = 0; i < p->n_short_ffts; i++) {
+		if (p->short_ffts[i])
+			fft_exit(p->short_ffts[i]);
+	}
+
+	if (p->short_ffts)
+		free(p->short_ffts);
+
+	if (p->kernels)
+		free(p->kernels);
 
 	if (p->fft)
 		fft_exit(p->fft);
+
+	if (p->tol)
+		tol_exit(p->tol);
 #endif
-	if (p->sq_data)
-		free(p->sq_data);
+	if (p->cum_energy)
+		free(p->cum_energy);
 
 	if (p->env)
 		env_estimate_exit(p->env);
 
+	if (p->env_data)
+		free(p->env_data);
+
 	if (p->params->out_mode == TUNA_OUT_MODE_CSV)
 		csv_close(p->out);
 	else
@@ -548,17 +885,37 @@ int pulse_write(struct consumer * consumer, sample_t * buf, uint count)
 	int r;
 	struct pulse_processor * p;
 	uint age, offset;
+	env_t * env;
 	
 	p = (struct pulse_processor *)consumer_get_data(consumer);
 
+	if (count > p->env_data_len) {
+		env = (env_t *) realloc(p->env_data, count * sizeof(env_t));
+		if (!env) {
+			error("pulse: Failed to allocate memory for envelope");
+			return -ENOMEM;
+		}
+		p->env_data = env;
+		p->env_data_len = count;
+	}
+
 	detect_data(p, buf, count);
 
-	/* Discard all data before the current minimum if we are not currently
-	 * in a pulse as it will not be needed.
+	/* Within a pulse the onset tracker is idle and is reset when the pulse
+	 * ends, so no past data will be needed and its age is meaningless.
+	 */
+	if (p->state == STATE_PULSE) {
+		bufhold_release_all(p->held_buffers);
+		goto out;
+	}
+
+	/* Discard all data before the current minimum as it will not be
+	 * needed. The minimum is age samples before the last sample of this
+	 * buffer, so age + 1 - count samples before its start.
 	 */
 	age = onset_threshold_age(p->onset);
-	if (age > count)
-		offset = age - count;
+	if (age + 1 > count)
+		offset = age + 1 - count;
 	else
 		offset = 0;
 	discard_leading_data(p, offset);
@@ -569,6 +926,8 @@ int pulse_write(struct consumer * consumer, sample_t * buf, uint count)
 		return r;
 	}
 
+out:
+
 	/* Update the amount of data we have handled. */
 	p->write_counter += count;
 
@@ -585,6 +944,11 @@ int pulse_start(struct consumer * consumer, uint sample_rate,
 	uint duration;
 	int duration_pow2;
 	struct pulse_processor * p;
+#ifdef ENABLE_PULSE_TOL
+	uint i, n, m;
+	float * kernel;
+	float complex * cdata;
+#endif
 	
 	p = (struct pulse_processor *)consumer_get_data(consumer);
 
@@ -618,7 +982,6 @@ int pulse_start(struct consumer * consumer, uint sample_rate,
 		error("pulse: Failed to initialise FFT");
 		return -1;
 	}
-	p->fft_data = fft_get_data(p->fft);
 
 	p->tol = tol_init(sample_rate, p->fft_length, 0.4, 3);
 	if (!p->tol) {
@@ -626,7 +989,45 @@ int pulse_start(struct consumer * consumer, uint sample_rate,
 		return -1;
 	}
 
+	p->fft_data = fft_get_data(p->fft);
 	p->n_tol = tol_get_num_levels(p->tol);
+
+	/* Prepare an FFT for each short pulse length. */
+	p->kernel_length = p->fft_length / PULSE_SHORT_DIV;
+	n = 0;
+	while ((1U << (PULSE_MIN_FFT_POW2 + n)) <= 2 * p->kernel_length)
+		n++;
+
+	p->short_ffts = (struct fft **) calloc(n, sizeof(struct fft *));
+	p->kernels = (float *) malloc(p->n_tol * p->kernel_length *
+			sizeof(float));
+	p->fft_counts = (uint64 *) calloc(n + 1, sizeof(uint64));
+	if (!p->fft_counts || (n && (!p->short_ffts || !p->kernels))) {
+		error("pulse: Failed to allocate memory");
+		return -ENOMEM;
+	}
+	p->n_short_ffts = n;
+
+	for (i = 0; i < n; i++) {
+		p->short_ffts[i] = fft_init(1U << (PULSE_MIN_FFT_POW2 + i));
+		if (!p->short_ffts[i]) {
+			error("pulse: Failed to initialise FFT");
+			return -1;
+		}
+	}
+
+	/* The kernel of each band is the real part of the DFT of its weights,
+	 * found using the longest FFT before any pulse samples are collected.
+	 */
+	cdata = fft_get_cdata(p->fft);
+	for (i = 0; n && i < p->n_tol; i++) {
+		tol_get_coeffs(p->tol, i, p->fft_data, p->fft_length);
+		fft_transform(p->fft);
+
+		kernel = &p->kernels[i * p->kernel_length];
+		for (m = 0; m < p->kernel_length; m++)
+			kernel[m] = crealf(cdata[m]);
+	}
 #else
 	/* Instead of third octave levels we have a single energy value. This is
 	 * copied into the memory where third octave levels would be so that it
@@ -636,12 +1037,14 @@ int pulse_start(struct consumer * consumer, uint sample_rate,
 	p->n_tol = 1;
 #endif
 
-	p->sq_data = (float *) malloc(p->pulse_max_duration_w * sizeof(float));
-	if (!p->sq_data) {
+	p->cum_energy = (double *) malloc(p->pulse_max_duration_w * sizeof(double));
+	if (!p->cum_energy) {
 		error("pulse: Failed to allocate memory");
 		return -1;
 	}
 
+	select_kernels(p);
+
 	p->results = (struct pulse_results *)
 		malloc(sizeof(struct pulse_results) + (p->n_tol + 1) *
 				sizeof(float));
@@ -748,11 +1151,17 @@ int pulse_init(struct consumer * consumer, const char * out_name,
 
 	p->params = params;
 	p->env = NULL;
+	p->env_data = NULL;
+	p->env_data_len = 0;
 	p->onset = NULL;
-	p->fft = NULL;
 	p->tol = NULL;
+	p->fft = NULL;
 	p->fft_data = NULL;
-	p->sq_data = NULL;
+	p->short_ffts = NULL;
+	p->n_short_ffts = 0;
+	p->kernels = NULL;
+	p->fft_counts = NULL;
+	p->cum_energy = NULL;
 
 	consumer_set_module(consumer, pulse_write, pulse_start, pulse_resync,
 			pulse_exit, p);
@@ -0,0 +1,112 @@
+/*******************************************************************************
+	rt.c: Real-time scheduling, CPU affinity and memory locking.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+/* Needed for pthread_setaffinity_np() and the CPU_* macros. */
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "rt.h"
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+int rt_set_priority(pthread_t thread, int priority)
+{
+	struct sched_param param;
+	int r;
+
+	if (priority < sched_get_priority_min(SCHED_FIFO) ||
+			priority > sched_get_priority_max(SCHED_FIFO)) {
+		error("rt: Invalid SCHED_FIFO priority %d", priority);
+		return -EINVAL;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+
+	r = pthread_setschedparam(thread, SCHED_FIFO, &param);
+	if (r != 0) {
+		warn("rt: Failed to set SCHED_FIFO priority %d: %s", priority,
+				strerror(r));
+		return -r;
+	}
+
+	return 0;
+}
+
+int rt_set_cpu(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+	int r;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE) {
+		error("rt: Invalid CPU %d", cpu);
+		return -EINVAL;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	r = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (r != 0) {
+		warn("rt: Failed to pin thread to CPU %d: %s", cpu,
+				strerror(r));
+		return -r;
+	}
+
+	return 0;
+}
+
+int rt_lock_memory()
+{
+	struct rlimit limit;
+	int flags = MCL_CURRENT;
+	int r;
+
+	/* Root is exempt from the limit, barring capabilities being dropped,
+	 * which we can't easily check for.
+	 */
+	r = getrlimit(RLIMIT_MEMLOCK, &limit);
+	if (geteuid() == 0 || (r == 0 && limit.rlim_cur == RLIM_INFINITY))
+		flags |= MCL_FUTURE;
+
+	r = mlockall(flags);
+	if (r < 0) {
+		r = -errno;
+		warn("rt: Failed to lock memory: %s", strerror(-r));
+
+		/* mlockall() reports a lack of permission as ENOMEM if the
+		 * limit is simply too low.
+		 */
+		return (r == -ENOMEM) ? -EPERM : r;
+	}
+
+	return (flags & MCL_FUTURE) ? 1 : 0;
+}
@@ -39,18 +39,24 @@ srcs := $(d)/analysis.c \
 	$(d)/counter.c \
 	$(d)/csv.c \
 	$(d)/dat.c \
+	$(d)/deinterleave.c \
 	$(d)/env_estimate.c \
 	$(d)/fft.c \
 	$(d)/input_alsa.c \
 	$(d)/input_sndfile.c \
+	$(d)/input_wavmap.c \
 	$(d)/input_zero.c \
 	$(d)/log.c \
+	$(d)/mring.c \
 	$(d)/onset_threshold.c \
 	$(d)/offset_threshold.c \
 	$(d)/output_null.c \
 	$(d)/output_sndfile.c \
 	$(d)/producer.c \
 	$(d)/pulse.c \
+	$(d)/rt.c \
+	$(d)/simd.c \
+	$(d)/tee.c \
 	$(d)/time_slice.c \
 	$(d)/timespec.c \
 	$(d)/tol.c \
@@ -0,0 +1,94 @@
+/*******************************************************************************
+	simd.c: Runtime selection of SIMD instruction set.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#include <assert.h>
+#include <errno.h>
+
+#include "log.h"
+#include "simd.h"
+#include "types.h"
+
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* Negative until the level has been detected or set. */
+static int simd_level = -1;
+
+static const char * simd_level_names[] = {
+	"none",
+	"sse4.1",
+	"avx2",
+	"avx512"
+};
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+enum simd_levels simd_detect()
+{
+#ifdef ENABLE_X86_SIMD
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+		return SIMD_LEVEL_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_LEVEL_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return SIMD_LEVEL_SSE4_1;
+#endif
+
+	return SIMD_LEVEL_NONE;
+}
+
+enum simd_levels simd_get_level()
+{
+	int level = __atomic_load_n(&simd_level, __ATOMIC_RELAXED);
+
+	/* Detection is idempotent so it doesn't matter if two threads race
+	 * to do it.
+	 */
+	if (level < 0) {
+		level = simd_detect();
+		__atomic_store_n(&simd_level, level, __ATOMIC_RELAXED);
+	}
+
+	return (enum simd_levels) level;
+}
+
+int simd_set_level(enum simd_levels level)
+{
+	if (level > simd_detect()) {
+		error("simd: Level %s is not supported", simd_level_name(level));
+		return -EINVAL;
+	}
+
+	__atomic_store_n(&simd_level, level, __ATOMIC_RELAXED);
+	return 0;
+}
+
+const char * simd_level_name(enum simd_levels level)
+{
+	if ((uint) level > SIMD_LEVEL_AVX512)
+		return "unknown";
+
+	return simd_level_names[level];
+}
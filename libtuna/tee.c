@@ -0,0 +1,253 @@
+/*******************************************************************************
+	tee.c: Forward data to any number of consumers.
+
+	Copyright (C) 2014 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <string.h>
+#include <time.h>
+
+#include "bufq.h"
+#include "consumer.h"
+#include "log.h"
+#include "tee.h"
+#include "types.h"
+
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+struct tee_branch {
+	/* The consumer which was added to the tee. */
+	struct consumer *	target;
+
+	/* Where we actually write data: either the target itself or a bufq
+	 * feeding the target from its own thread.
+	 */
+	struct consumer *	in;
+	int			queued;
+};
+
+struct tee {
+	struct tee_branch *	branches;
+	uint			n_branches;
+	uint			max_branches;
+};
+
+void tee_exit(struct consumer * consumer)
+{
+	assert(consumer);
+
+	uint i;
+	struct tee * t = (struct tee *) consumer_get_data(consumer);
+
+	/* Exiting a queue waits for its thread to finish with the target. */
+	for (i = 0; i < t->n_branches; i++) {
+		if (t->branches[i].queued)
+			consumer_exit(t->branches[i].in);
+		consumer_exit(t->branches[i].target);
+	}
+
+	free(t->branches);
+	free(t);
+}
+
+int tee_write(struct consumer * consumer, sample_t * buf, uint count)
+{
+	assert(consumer);
+	assert(buf);
+
+	int r;
+	uint i;
+	struct tee * t = (struct tee *) consumer_get_data(consumer);
+
+	for (i = 0; i < t->n_branches; i++) {
+		r = consumer_write(t->branches[i].in, buf, count);
+		if (r < 0) {
+			error("tee: Failed to write to branch %u", i);
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+int tee_start(struct consumer * consumer, uint sample_rate, struct timespec * ts)
+{
+	assert(consumer);
+	assert(ts);
+
+	int r;
+	uint i;
+	struct tee * t = (struct tee *) consumer_get_data(consumer);
+
+	for (i = 0; i < t->n_branches; i++) {
+		r = consumer_start(t->branches[i].in, sample_rate, ts);
+		if (r < 0) {
+			error("tee: Failed to start branch %u", i);
+			return r;
+		}
+	}
+
+	/* Wait for queued branches to start so that errors such as failing to
+	 * open an output file are reported here rather than on a later write.
+	 */
+	for (i = 0; i < t->n_branches; i++) {
+		if (!t->branches[i].queued)
+			continue;
+
+		r = bufq_sync(t->branches[i].in);
+		if (r < 0) {
+			error("tee: Failed to start branch %u", i);
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+int tee_resync(struct consumer * consumer, struct timespec * ts)
+{
+	assert(consumer);
+	assert(ts);
+
+	int r;
+	uint i;
+	struct tee * t = (struct tee *) consumer_get_data(consumer);
+
+	for (i = 0; i < t->n_branches; i++) {
+		r = consumer_resync(t->branches[i].in, ts);
+		if (r < 0) {
+			error("tee: Failed to resync branch %u", i);
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+int tee_init(struct consumer * consumer)
+{
+	assert(consumer);
+
+	struct tee * t = (struct tee *) calloc(sizeof(struct tee), 1);
+	if (!t) {
+		error("tee: Failed to allocate memory");
+		return -ENOMEM;
+	}
+
+	consumer_set_module(consumer, tee_write, tee_start, tee_resync,
+			tee_exit, t);
+
+	return 0;
+}
+
+int tee_add_branch(struct consumer * consumer, struct consumer * target,
+		int queued, uint depth)
+{
+	assert(consumer);
+	assert(target);
+
+	int r;
+	uint max;
+	struct tee_branch * branches;
+	struct tee_branch * br;
+	struct tee * t = (struct tee *) consumer_get_data(consumer);
+
+	if (t->n_branches == t->max_branches) {
+		max = t->max_branches ? t->max_branches * 2 : 4;
+		branches = (struct tee_branch *) realloc(t->branches,
+				max * sizeof(struct tee_branch));
+		if (!branches) {
+			error("tee: Failed to allocate memory");
+			return -ENOMEM;
+		}
+
+		t->branches = branches;
+		t->max_branches = max;
+	}
+
+	br = &t->branches[t->n_branches];
+	br->target = target;
+	br->queued = queued;
+
+	if (queued) {
+		br->in = consumer_new();
+		if (!br->in) {
+			error("tee: Failed to create consumer object for queue");
+			return -1;
+		}
+
+		r = bufq_init_mode(br->in, target, BUFQ_MODE_DROP, depth);
+		if (r < 0) {
+			error("tee: Failed to create queue for branch");
+			consumer_exit(br->in);
+			return r;
+		}
+	} else {
+		br->in = target;
+	}
+
+	return t->n_branches++;
+}
+
+uint tee_get_branch_count(struct consumer * consumer)
+{
+	assert(consumer);
+
+	struct tee * t = (struct tee *) consumer_get_data(consumer);
+
+	return t->n_branches;
+}
+
+int tee_get_branch_stats(struct consumer * consumer, uint index,
+		struct bufq_stats * stats)
+{
+	assert(consumer);
+	assert(stats);
+
+	struct tee * t = (struct tee *) consumer_get_data(consumer);
+
+	if (index >= t->n_branches)
+		return -EINVAL;
+
+	if (t->branches[index].queued)
+		bufq_get_stats(t->branches[index].in, stats);
+	else
+		memset(stats, 0, sizeof(struct bufq_stats));
+
+	return 0;
+}
+
+int tee_set_branch_cpu(struct consumer * consumer, uint index, int cpu)
+{
+	assert(consumer);
+
+	struct tee * t = (struct tee *) consumer_get_data(consumer);
+
+	if (index >= t->n_branches || !t->branches[index].queued)
+		return -EINVAL;
+
+	return bufq_set_cpu(t->branches[index].in, cpu);
+}
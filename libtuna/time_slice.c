@@ -22,18 +22,20 @@
 #include <errno.h>
 #include <malloc.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "buffer.h"
-#include "bufhold.h"
 #include "compiler.h"
 #include "consumer.h"
 #include "csv.h"
 #include "dat.h"
 #include "log.h"
+#include "mring.h"
+#include "simd.h"
 #include "time_slice.h"
 #include "timespec.h"
 #include "tol.h"
@@ -44,37 +46,97 @@
 #include <arm_neon.h>
 #endif
 
+#ifdef ENABLE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 /*******************************************************************************
 	Private declarations and functions
 *******************************************************************************/
 
 #define MAX_TIME_SLICE_RESULTS (6 + MAX_THIRD_OCTAVE_LEVELS)
 
-struct time_slice {
+struct time_slice;
+struct time_slice_ctx;
+
+/* Each kernel processes a block of samples starting at the current index into
+ * the time slice and advances the index past them.
+ */
+typedef void (*time_slice_kernel)(struct time_slice_ctx * ctx, sample_t * data,
+		uint count);
+
+/* Everything needed to process one time slice. In serial mode there is just
+ * one of these. In parallel mode each worker thread has its own, with its own
+ * FFT plan and buffers.
+ */
+struct time_slice_ctx {
 #ifdef ENABLE_ARM_NEON
 	float32x4x4_t			moments_vec;
 #endif
 
+	/* The following fields are initialised in time_slice_start(). */
+	struct time_slice *		t;
+	struct fft *			fft;
+	float *				fft_data;
+	struct tol *			tol;
+	float *				window;
+	time_slice_kernel		process_common;
+	time_slice_kernel		process_middle;
+	pthread_t			thread;
+
+	/* The following fields are used within process_slice(). */
+	struct time_slice_results *	results;
+	uint				index;
+};
+
+/* A time slice copied out of the sample ring along with space for its
+ * results. In serial mode the samples are read in place from the ring and
+ * only the results are used.
+ */
+struct time_slice_job {
+	sample_t *			samples;
+	struct time_slice_results *	results;
+	int				done;
+};
+
+struct time_slice {
 	/* The following fields are initialised in time_slice_init(). */
-	struct bufhold *		held_buffers;
 	FILE *				out;
 	char *				out_name;
-	struct fft *			fft;
-	float *				fft_data;
 	int				out_mode;
+	uint				n_threads;
 
 	/* The following fields are initialised in time_slice_start(). */
-	struct tol *			tol;
-	struct time_slice_results *	results;
 	float *				window;
 	uint				sample_rate;
 	uint				slice_length;
 	uint				slice_period;
-	uint				available;
 	uint				n_tol;
 
-	/* The following field is used within process_time_slice(). */
-	uint				index;
+	/* Incoming samples are copied into a mirrored ring so that each time
+	 * slice can be read as one contiguous array.
+	 */
+	struct mring *			ring;
+	struct time_slice_ctx *		ctx;
+	uint				n_ctx;
+	struct time_slice_job *		jobs;
+	uint				n_jobs;
+	uint				n_started;
+
+	/* In parallel mode, jobs are used in order as a ring. Jobs from
+	 * job_head up to job_next have been taken by a worker and may be
+	 * finished, jobs from job_next up to job_tail are waiting for a worker.
+	 * Results are written out from job_head in order so that the output is
+	 * the same as in serial mode. The indices, the done flags and stop are
+	 * protected by the mutex.
+	 */
+	uint				job_head;
+	uint				job_next;
+	uint				job_tail;
+	int				stop;
+	pthread_mutex_t			mutex;
+	pthread_cond_t			work_cond;
+	pthread_cond_t			done_cond;
 };
 
 struct time_slice_results {
@@ -104,29 +166,31 @@ static inline sample_t sample_min(sample_t a, sample_t b)
 	return (a < b) ? a : b;
 }
 
-static int write_results_csv(struct time_slice * t)
+static int write_results_csv(struct time_slice * t,
+		struct time_slice_results * res)
 {
 	int r;
 	uint i;
 
 	assert(t);
+	assert(res);
 
-	r = csv_write_sample(t->out, t->results->peak_positive);
+	r = csv_write_sample(t->out, res->peak_positive);
 	if (r < 0)
 		goto error;
 
-	r = csv_write_sample(t->out, t->results->peak_negative);
+	r = csv_write_sample(t->out, res->peak_negative);
 	if (r < 0)
 		goto error;
 
 	for (i = 0; i < 4; i++) {
-		r = csv_write_float(t->out, t->results->moments[i]);
+		r = csv_write_float(t->out, res->moments[i]);
 		if (r < 0)
 			goto error;
 	}
 
 	for (i = 0; i < t->n_tol; i++) {
-		r = csv_write_float(t->out, t->results->tols[i]);
+		r = csv_write_float(t->out, res->tols[i]);
 		if (r < 0)
 			goto error;
 	}
@@ -142,34 +206,44 @@ error:
 	return r;
 }
 
-static int write_results_dat(struct time_slice * t)
+static int write_results_dat(struct time_slice * t,
+		struct time_slice_results * res)
 {
 	assert(t);
+	assert(res);
 
 	size_t sz = sizeof(struct time_slice_results) + t->n_tol * sizeof(float);
 
-	return dat_write_record(t->out, TUNA_DAT_TIME_SLICE, t->results, sz);
+	return dat_write_record(t->out, TUNA_DAT_TIME_SLICE, res, sz);
 }
 
-static inline void copy_to_fft_sca(struct time_slice * t, float v)
+static int write_results(struct time_slice * t, struct time_slice_results * res)
 {
-	t->fft_data[t->index] = v * t->window[t->index];
+	if (t->out_mode == TUNA_OUT_MODE_CSV)
+		return write_results_csv(t, res);
+	else
+		return write_results_dat(t, res);
 }
 
-static inline void process_common_sca(struct time_slice * t, int32_t * p_data)
+static inline void copy_to_fft_sca(struct time_slice_ctx * ctx, float v)
 {
-	assert(t);
+	ctx->fft_data[ctx->index] = v * ctx->window[ctx->index];
+}
+
+static inline void process_common_sca(struct time_slice_ctx * ctx, int32_t * p_data)
+{
+	assert(ctx);
 	assert(p_data);
 
 	float data_f32 = (float) *p_data;
-	copy_to_fft_sca(t, data_f32);
+	copy_to_fft_sca(ctx, data_f32);
 }
 
-static inline void update_stats_sca(struct time_slice * t, float v)
+static inline void update_stats_sca(struct time_slice_ctx * ctx, float v)
 {
-	assert(t);
+	assert(ctx);
 
-	float * m = t->results->moments;
+	float * m = ctx->results->moments;
 	float e = fabsf(v);
 	float e2 = e * e;
 
@@ -179,36 +253,36 @@ static inline void update_stats_sca(struct time_slice * t, float v)
 	m[3] += e2 * e2;
 }
 
-static inline void detect_peaks_sca(struct time_slice * t, int32_t v)
+static inline void detect_peaks_sca(struct time_slice_ctx * ctx, int32_t v)
 {
-	assert(t);
+	assert(ctx);
 
-	if (v > t->results->peak_positive) {
-		t->results->peak_positive = v;
-	} else if (v < t->results->peak_negative) {
-		t->results->peak_negative = v;
+	if (v > ctx->results->peak_positive) {
+		ctx->results->peak_positive = v;
+	} else if (v < ctx->results->peak_negative) {
+		ctx->results->peak_negative = v;
 	}
 }
 
-static inline void process_middle_sca(struct time_slice * t, int32_t * p_data)
+static inline void process_middle_sca(struct time_slice_ctx * ctx, int32_t * p_data)
 {
-	assert(t);
+	assert(ctx);
 	assert(p_data);
 
 	int32_t data_i32 = *p_data;
 
-	detect_peaks_sca(t, data_i32);
+	detect_peaks_sca(ctx, data_i32);
 
 	float data_f32 = (float) data_i32;
 
-	copy_to_fft_sca(t, data_f32);
-	update_stats_sca(t, data_f32);
+	copy_to_fft_sca(ctx, data_f32);
+	update_stats_sca(ctx, data_f32);
 }
 
 #ifdef ENABLE_ARM_NEON
-static inline void copy_to_fft_vec(struct time_slice * t, float32x4_t vec)
+static inline void copy_to_fft_vec(struct time_slice_ctx * ctx, float32x4_t vec)
 {
-	float32_t * p_coeffs = (float32_t *) &t->window[t->index];
+	float32_t * p_coeffs = (float32_t *) &ctx->window[ctx->index];
 
 	/* Prefetch next set of coeffs the fetch the current set. */
 	__builtin_prefetch(p_coeffs + 4);
@@ -216,13 +290,13 @@ static inline void copy_to_fft_vec(struct time_slice * t, float32x4_t vec)
 
 	float32x4_t dest = vmulq_f32(vec, coeffs);
 
-	float32_t * p_dest = (float32_t *) &t->fft_data[t->index];
+	float32_t * p_dest = (float32_t *) &ctx->fft_data[ctx->index];
 	vst1q_f32(p_dest, dest);
 }
 
-static inline void process_common_vec(struct time_slice * t, int32_t * p_data)
+static inline void process_common_vec(struct time_slice_ctx * ctx, int32_t * p_data)
 {
-	assert(t);
+	assert(ctx);
 	assert(p_data);
 
 	/* Prefetch next element. */
@@ -230,14 +304,14 @@ static inline void process_common_vec(struct time_slice * t, int32_t * p_data)
 
 	int32x4_t data_i32 = vld1q_s32(p_data);
 	float32x4_t data_f32 = vcvtq_f32_s32(data_i32);
-	copy_to_fft_vec(t, data_f32);
+	copy_to_fft_vec(ctx, data_f32);
 }
 
-static inline void update_stats_vec(struct time_slice * t, float32x4_t x)
+static inline void update_stats_vec(struct time_slice_ctx * ctx, float32x4_t x)
 {
-	assert(t);
+	assert(ctx);
 
-	float32x4x4_t m = t->moments_vec;
+	float32x4x4_t m = ctx->moments_vec;
 
 	float32x4_t e = vabsq_f32(x);
 	m.val[0] = vaddq_f32(m.val[0], e);
@@ -249,12 +323,12 @@ static inline void update_stats_vec(struct time_slice * t, float32x4_t x)
 
 	m.val[3] = vmlaq_f32(m.val[3], e2, e2);
 
-	t->moments_vec = m;
+	ctx->moments_vec = m;
 }
 
-static inline void detect_peaks_vec(struct time_slice * t, int32x4_t vec)
+static inline void detect_peaks_vec(struct time_slice_ctx * ctx, int32x4_t vec)
 {
-	assert(t);
+	assert(ctx);
 
 	int32x2_t vec_lo = vget_low_s32(vec);
 	int32x2_t vec_hi = vget_high_s32(vec);
@@ -262,17 +336,17 @@ static inline void detect_peaks_vec(struct time_slice * t, int32x4_t vec)
 	/* Find and check max. */
 	int32x2_t max_pair = vpmax_s32(vec_lo, vec_hi);
 	sample_t max = sample_max(max_pair[0], max_pair[1]);
-	t->results->peak_positive = sample_max(max, t->results->peak_positive);
+	ctx->results->peak_positive = sample_max(max, ctx->results->peak_positive);
 
 	/* Find and check min. */
 	int32x2_t min_pair = vpmin_s32(vec_lo, vec_hi);
 	sample_t min = sample_min(min_pair[0], min_pair[1]);
-	t->results->peak_negative = sample_min(min, t->results->peak_negative);
+	ctx->results->peak_negative = sample_min(min, ctx->results->peak_negative);
 }
 
-static inline void process_middle_vec(struct time_slice * t, int32_t * p_data)
+static inline void process_middle_vec(struct time_slice_ctx * ctx, int32_t * p_data)
 {
-	assert(t);
+	assert(ctx);
 	assert(p_data);
 
 	/* Prefetch next element. */
@@ -281,21 +355,21 @@ static inline void process_middle_vec(struct time_slice * t, int32_t * p_data)
 	int32x4_t data_i32 = vld1q_s32(p_data);
 
 	/* Perform integer calculations. */
-	detect_peaks_vec(t, data_i32);
+	detect_peaks_vec(ctx, data_i32);
 
 	float32x4_t data_f32 = vcvtq_f32_s32(data_i32);
 
 	/* Perform float calculations. */
-	copy_to_fft_vec(t, data_f32);
-	update_stats_vec(t, data_f32);
+	copy_to_fft_vec(ctx, data_f32);
+	update_stats_vec(ctx, data_f32);
 }
 
-static inline void update_stats_finish(struct time_slice * t)
+static inline void update_stats_finish(struct time_slice_ctx * ctx)
 {
-	assert(t);
+	assert(ctx);
 
-	float32x4x4_t m_vec = t->moments_vec;
-	float32x4_t m = vld1q_f32(t->results->moments);
+	float32x4x4_t m_vec = ctx->moments_vec;
+	float32x4_t m = vld1q_f32(ctx->results->moments);
 
 	float32x2_t m0_lo = vget_low_f32(m_vec.val[0]);
 	float32x2_t m0_hi = vget_high_f32(m_vec.val[0]);
@@ -318,175 +392,536 @@ static inline void update_stats_finish(struct time_slice * t)
 
 	float32x4_t m_summed = vcombine_f32(m0m1_pair, m2m3_pair);
 	m = vaddq_f32(m, m_summed);
-	vst1q_f32(t->results->moments, m);
+	vst1q_f32(ctx->results->moments, m);
 }
 #endif
 
-static void process_buffer(struct time_slice * t, struct held_buffer * h)
+/* Default kernels, using NEON if enabled at compile time and scalar code for
+ * any remainder.
+ */
+static void process_common_block(struct time_slice_ctx * ctx, sample_t * data,
+		uint count)
 {
-	assert(t);
-	assert(h);
+	assert(ctx);
+	assert(data);
+
+	uint i = 0;
+
+#ifdef ENABLE_ARM_NEON
+	while ((i + 3) < count) {
+		process_common_vec(ctx, (int32_t *) &data[i]);
+		ctx->index += 4;
+		i += 4;
+	}
+#endif
+	while (i < count) {
+		process_common_sca(ctx, (int32_t *) &data[i]);
+		ctx->index++;
+		i++;
+	}
+}
+
+static void process_middle_block(struct time_slice_ctx * ctx, sample_t * data,
+		uint count)
+{
+	assert(ctx);
+	assert(data);
+
+	uint i = 0;
+
+#ifdef ENABLE_ARM_NEON
+	while ((i + 3) < count) {
+		process_middle_vec(ctx, (int32_t *) &data[i]);
+		ctx->index += 4;
+		i += 4;
+	}
+#endif
+	while (i < count) {
+		process_middle_sca(ctx, (int32_t *) &data[i]);
+		ctx->index++;
+		i++;
+	}
+}
+
+#ifdef ENABLE_X86_SIMD
+/* x86 kernels are compiled for each instruction set using target attributes
+ * so that the library as a whole still runs on any x86 processor. The right
+ * set is chosen at runtime in select_kernels().
+ *
+ * Unlike the NEON kernels, the moments are reduced to scalars at the end of
+ * each block rather than at the end of the time slice. Summing in a different
+ * order means the moments may differ from the scalar code in the last few
+ * bits.
+ */
+
+__attribute__((target("sse4.1")))
+static void process_common_sse4_1(struct time_slice_ctx * ctx, sample_t * data,
+		uint count)
+{
+	assert(ctx);
+	assert(data);
+
+	float * w = &ctx->window[ctx->index];
+	float * f = &ctx->fft_data[ctx->index];
+	uint i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128i x_i32 = _mm_loadu_si128((__m128i *) &data[i]);
+		__m128 x = _mm_cvtepi32_ps(x_i32);
+		_mm_storeu_ps(&f[i], _mm_mul_ps(x, _mm_loadu_ps(&w[i])));
+	}
+
+	ctx->index += i;
+	process_common_block(ctx, &data[i], count - i);
+}
+
+__attribute__((target("sse4.1")))
+static void process_middle_sse4_1(struct time_slice_ctx * ctx, sample_t * data,
+		uint count)
+{
+	assert(ctx);
+	assert(data);
+
+	struct time_slice_results * res = ctx->results;
+	float * w = &ctx->window[ctx->index];
+	float * f = &ctx->fft_data[ctx->index];
+	float m[4][4];
+	int32_t p[2][4];
+	uint i, j;
+
+	__m128i pos = _mm_set1_epi32(res->peak_positive);
+	__m128i neg = _mm_set1_epi32(res->peak_negative);
+	__m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 m0 = _mm_setzero_ps();
+	__m128 m1 = _mm_setzero_ps();
+	__m128 m2 = _mm_setzero_ps();
+	__m128 m3 = _mm_setzero_ps();
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128i x_i32 = _mm_loadu_si128((__m128i *) &data[i]);
+
+		/* Perform integer calculations. */
+		pos = _mm_max_epi32(pos, x_i32);
+		neg = _mm_min_epi32(neg, x_i32);
+
+		/* Perform float calculations. */
+		__m128 x = _mm_cvtepi32_ps(x_i32);
+		_mm_storeu_ps(&f[i], _mm_mul_ps(x, _mm_loadu_ps(&w[i])));
+
+		__m128 e = _mm_and_ps(x, abs_mask);
+		__m128 e2 = _mm_mul_ps(e, e);
+		m0 = _mm_add_ps(m0, e);
+		m1 = _mm_add_ps(m1, e2);
+		m2 = _mm_add_ps(m2, _mm_mul_ps(e2, e));
+		m3 = _mm_add_ps(m3, _mm_mul_ps(e2, e2));
+	}
+
+	_mm_storeu_si128((__m128i *) p[0], pos);
+	_mm_storeu_si128((__m128i *) p[1], neg);
+	_mm_storeu_ps(m[0], m0);
+	_mm_storeu_ps(m[1], m1);
+	_mm_storeu_ps(m[2], m2);
+	_mm_storeu_ps(m[3], m3);
+	for (j = 0; j < 4; j++) {
+		res->peak_positive = sample_max(res->peak_positive, p[0][j]);
+		res->peak_negative = sample_min(res->peak_negative, p[1][j]);
+		res->moments[j] += m[j][0] + m[j][1] + m[j][2] + m[j][3];
+	}
+
+	ctx->index += i;
+	process_middle_block(ctx, &data[i], count - i);
+}
+
+__attribute__((target("avx2")))
+static void process_common_avx2(struct time_slice_ctx * ctx, sample_t * data,
+		uint count)
+{
+	assert(ctx);
+	assert(data);
+
+	float * w = &ctx->window[ctx->index];
+	float * f = &ctx->fft_data[ctx->index];
+	uint i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256i x_i32 = _mm256_loadu_si256((__m256i *) &data[i]);
+		__m256 x = _mm256_cvtepi32_ps(x_i32);
+		_mm256_storeu_ps(&f[i], _mm256_mul_ps(x, _mm256_loadu_ps(&w[i])));
+	}
+
+	ctx->index += i;
+	process_common_block(ctx, &data[i], count - i);
+}
+
+__attribute__((target("avx2")))
+static void process_middle_avx2(struct time_slice_ctx * ctx, sample_t * data,
+		uint count)
+{
+	assert(ctx);
+	assert(data);
+
+	struct time_slice_results * res = ctx->results;
+	float * w = &ctx->window[ctx->index];
+	float * f = &ctx->fft_data[ctx->index];
+	float m[4][8];
+	int32_t p[2][8];
+	uint i, j;
+
+	__m256i pos = _mm256_set1_epi32(res->peak_positive);
+	__m256i neg = _mm256_set1_epi32(res->peak_negative);
+	__m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256 m0 = _mm256_setzero_ps();
+	__m256 m1 = _mm256_setzero_ps();
+	__m256 m2 = _mm256_setzero_ps();
+	__m256 m3 = _mm256_setzero_ps();
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256i x_i32 = _mm256_loadu_si256((__m256i *) &data[i]);
+
+		/* Perform integer calculations. */
+		pos = _mm256_max_epi32(pos, x_i32);
+		neg = _mm256_min_epi32(neg, x_i32);
+
+		/* Perform float calculations. */
+		__m256 x = _mm256_cvtepi32_ps(x_i32);
+		_mm256_storeu_ps(&f[i], _mm256_mul_ps(x, _mm256_loadu_ps(&w[i])));
+
+		__m256 e = _mm256_and_ps(x, abs_mask);
+		__m256 e2 = _mm256_mul_ps(e, e);
+		m0 = _mm256_add_ps(m0, e);
+		m1 = _mm256_add_ps(m1, e2);
+		m2 = _mm256_add_ps(m2, _mm256_mul_ps(e2, e));
+		m3 = _mm256_add_ps(m3, _mm256_mul_ps(e2, e2));
+	}
+
+	_mm256_storeu_si256((__m256i *) p[0], pos);
+	_mm256_storeu_si256((__m256i *) p[1], neg);
+	_mm256_storeu_ps(m[0], m0);
+	_mm256_storeu_ps(m[1], m1);
+	_mm256_storeu_ps(m[2], m2);
+	_mm256_storeu_ps(m[3], m3);
+	for (j = 0; j < 8; j++) {
+		res->peak_positive = sample_max(res->peak_positive, p[0][j]);
+		res->peak_negative = sample_min(res->peak_negative, p[1][j]);
+	}
+	for (j = 0; j < 4; j++)
+		res->moments[j] += (m[j][0] + m[j][1]) + (m[j][2] + m[j][3]) +
+			(m[j][4] + m[j][5]) + (m[j][6] + m[j][7]);
+
+	ctx->index += i;
+	process_middle_block(ctx, &data[i], count - i);
+}
+
+__attribute__((target("avx512f")))
+static void process_common_avx512(struct time_slice_ctx * ctx, sample_t * data,
+		uint count)
+{
+	assert(ctx);
+	assert(data);
+
+	float * w = &ctx->window[ctx->index];
+	float * f = &ctx->fft_data[ctx->index];
+	uint i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m512i x_i32 = _mm512_loadu_si512(&data[i]);
+		__m512 x = _mm512_cvtepi32_ps(x_i32);
+		_mm512_storeu_ps(&f[i], _mm512_mul_ps(x, _mm512_loadu_ps(&w[i])));
+	}
+
+	ctx->index += i;
+	process_common_block(ctx, &data[i], count - i);
+}
+
+__attribute__((target("avx512f")))
+static void process_middle_avx512(struct time_slice_ctx * ctx, sample_t * data,
+		uint count)
+{
+	assert(ctx);
+	assert(data);
+
+	struct time_slice_results * res = ctx->results;
+	float * w = &ctx->window[ctx->index];
+	float * f = &ctx->fft_data[ctx->index];
+	uint i;
+
+	__m512i pos = _mm512_set1_epi32(res->peak_positive);
+	__m512i neg = _mm512_set1_epi32(res->peak_negative);
+	__m512 m0 = _mm512_setzero_ps();
+	__m512 m1 = _mm512_setzero_ps();
+	__m512 m2 = _mm512_setzero_ps();
+	__m512 m3 = _mm512_setzero_ps();
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m512i x_i32 = _mm512_loadu_si512(&data[i]);
+
+		/* Perform integer calculations. */
+		pos = _mm512_max_epi32(pos, x_i32);
+		neg = _mm512_min_epi32(neg, x_i32);
+
+		/* Perform float calculations. */
+		__m512 x = _mm512_cvtepi32_ps(x_i32);
+		_mm512_storeu_ps(&f[i], _mm512_mul_ps(x, _mm512_loadu_ps(&w[i])));
+
+		__m512 e = _mm512_abs_ps(x);
+		__m512 e2 = _mm512_mul_ps(e, e);
+		m0 = _mm512_add_ps(m0, e);
+		m1 = _mm512_add_ps(m1, e2);
+		m2 = _mm512_add_ps(m2, _mm512_mul_ps(e2, e));
+		m3 = _mm512_add_ps(m3, _mm512_mul_ps(e2, e2));
+	}
+
+	res->peak_positive = _mm512_reduce_max_epi32(pos);
+	res->peak_negative = _mm512_reduce_min_epi32(neg);
+	res->moments[0] += _mm512_reduce_add_ps(m0);
+	res->moments[1] += _mm512_reduce_add_ps(m1);
+	res->moments[2] += _mm512_reduce_add_ps(m2);
+	res->moments[3] += _mm512_reduce_add_ps(m3);
+
+	ctx->index += i;
+	process_middle_block(ctx, &data[i], count - i);
+}
+#endif
+
+static void select_kernels(struct time_slice_ctx * ctx)
+{
+	assert(ctx);
+
+	ctx->process_common = process_common_block;
+	ctx->process_middle = process_middle_block;
+
+#ifdef ENABLE_X86_SIMD
+	switch (simd_get_level()) {
+	    case SIMD_LEVEL_AVX512:
+		ctx->process_common = process_common_avx512;
+		ctx->process_middle = process_middle_avx512;
+		break;
+
+	    case SIMD_LEVEL_AVX2:
+		ctx->process_common = process_common_avx2;
+		ctx->process_middle = process_middle_avx2;
+		break;
+
+	    case SIMD_LEVEL_SSE4_1:
+		ctx->process_common = process_common_sse4_1;
+		ctx->process_middle = process_middle_sse4_1;
+		break;
+
+	    default:
+		break;
+	}
+#endif
+}
+
+static void process_slice(struct time_slice_ctx * ctx, sample_t * data,
+		struct time_slice_results * results)
+{
+	assert(ctx);
+	assert(data);
+	assert(results);
+
+	uint len = ctx->t->slice_length;
+
+	memset(results, 0,
+		sizeof(struct time_slice_results) + ctx->t->n_tol * sizeof(float));
+
+#ifdef ENABLE_ARM_NEON
+	memset(&ctx->moments_vec, 0, sizeof(ctx->moments_vec));
+#endif
+
+	ctx->results = results;
+	ctx->index = 0;
 
 	/* We split processing into quarters as we need overlapped windowed
 	 * analysis in the frequency domain and non-overlapped non-windowed
 	 * analysis in the time domain.
 	 *
-	 * - The first quarter is copied with windowing into the fft buffer and
-	 *   discarded.
+	 * - The first quarter is copied with windowing into the fft buffer.
 	 *
-	 * - The second quarter is copied with windowing into the fft buffer, is
-	 *   processed in the time domain to check for peaks and is then
-	 *   discarded.
+	 * - The second and third quarters are copied with windowing into the
+	 *   fft buffer and are processed in the time domain to check for peaks
+	 *   and accumulate moments.
 	 *
-	 * - The third quarter is copied with windowing into the fft buffer, is
-	 *   processed in the time domain to check for peaks and is then kept as
-	 *   it will form the first quarter of the next time slice.
+	 * - The fourth quarter is copied with windowing into the fft buffer.
 	 *
-	 * - The fourth is copied with windowing into the fft buffer and is kept
-	 *   as it will form the first quarter of the next time slice.
+	 * The third and fourth quarters will form the first half of the next
+	 * time slice.
 	 */
+	ctx->process_common(ctx, data, len / 4);
+	ctx->process_middle(ctx, &data[len / 4], len / 2);
+	ctx->process_common(ctx, &data[len * 3 / 4], len / 4);
+
+	fft_transform(ctx->fft);
+	tol_calculate(ctx->tol, fft_get_cdata(ctx->fft), results->tols);
 
-	uint avail;	/* Number of available samples remaining. */
-	uint len = t->slice_period * 2;
-	uint i, c;
-	uint offset = 0;
-	sample_t * data;
-	
-	avail = bufhold_count(h);
-	data = bufhold_data(h);
-	if (avail && t->index < len/4) {
-		c = min(len/4 - t->index, avail);
-		i = 0;
-#ifdef ENABLE_ARM_NEON
-		do {
-			process_common_vec(t, (int32_t *) &data[i]);
-			t->index += 4;
-			i += 4;
-		} while ((i + 3) < c);
-#endif
-		while (i < c) {
-			process_common_sca(t, (int32_t *) &data[i]);
-			t->index++;
-			i++;
-		}
-		avail -= c;
-		offset = c;
-	}
-	if (avail && t->index < len*3/4) {
-		c = min(len*3/4 - t->index, avail);
-		i = 0;
 #ifdef ENABLE_ARM_NEON
-		do {
-			process_middle_vec(t, (int32_t *) &data[offset + i]);
-			t->index += 4;
-			i += 4;
-		} while ((i + 3) < c);
+	update_stats_finish(ctx);
 #endif
-		while (i < c) {
-			process_middle_sca(t, (int32_t *) &data[offset + i]);
-			t->index++;
-			i++;
-		}
-		avail -= c;
-		offset += c;
+}
+
+static void * worker_thread(void * param)
+{
+	struct time_slice_ctx * ctx = (struct time_slice_ctx *) param;
+	struct time_slice * t = ctx->t;
+	struct time_slice_job * job;
+
+	pthread_mutex_lock(&t->mutex);
+	while (1) {
+		while (!t->stop && t->job_next == t->job_tail)
+			pthread_cond_wait(&t->work_cond, &t->mutex);
+
+		/* Only stop once there is no work left. */
+		if (t->job_next == t->job_tail)
+			break;
+
+		job = &t->jobs[t->job_next % t->n_jobs];
+		t->job_next++;
+		pthread_mutex_unlock(&t->mutex);
+
+		process_slice(ctx, job->samples, job->results);
+
+		pthread_mutex_lock(&t->mutex);
+		job->done = 1;
+		pthread_cond_signal(&t->done_cond);
 	}
+	pthread_mutex_unlock(&t->mutex);
 
-	/* We know (t->index < len) as we wouldn't have been called otherwise
-	 * and the previous code will not advance t->index that far.
-	 */
-	if (avail) {
-		c = min(len - t->index, avail);
-		i = 0;
-#ifdef ENABLE_ARM_NEON
-		do {
-			process_common_vec(t, (int32_t *) &data[i]);
-			t->index += 4;
-			i += 4;
-		} while ((i + 3) < c);
-#endif
-		while (i < c) {
-			process_common_sca(t, (int32_t *) &data[i]);
-			t->index++;
-			i++;
+	return NULL;
+}
+
+/* Write out finished jobs in order, waiting for the oldest job to finish
+ * while more than 'keep' jobs are outstanding.
+ */
+static int flush_jobs(struct time_slice * t, uint keep)
+{
+	assert(t);
+
+	int r = 0;
+	struct time_slice_job * job;
+
+	pthread_mutex_lock(&t->mutex);
+	while (t->job_head != t->job_tail) {
+		job = &t->jobs[t->job_head % t->n_jobs];
+		if (!job->done) {
+			if (t->job_tail - t->job_head <= keep)
+				break;
+
+			pthread_cond_wait(&t->done_cond, &t->mutex);
+			continue;
 		}
+
+		/* Workers never touch a finished job so we can drop the lock
+		 * while writing.
+		 */
+		pthread_mutex_unlock(&t->mutex);
+		r = write_results(t, job->results);
+		pthread_mutex_lock(&t->mutex);
+
+		job->done = 0;
+		t->job_head++;
+		if (r < 0)
+			break;
 	}
+	pthread_mutex_unlock(&t->mutex);
+
+	return r;
 }
 
 static int process_time_slice(struct time_slice * t)
 {
 	assert(t);
 
-	struct held_buffer * h;
-	uint start, offset;
+	int r;
+	struct time_slice_job * job;
 
-	memset(t->results, 0,
-		sizeof(struct time_slice_results) + t->n_tol * sizeof(float));
+	if (!t->n_threads) {
+		job = &t->jobs[0];
+		process_slice(&t->ctx[0], mring_data(t->ring), job->results);
+		return write_results(t, job->results);
+	}
 
-#ifdef ENABLE_ARM_NEON
-	memset(&t->moments_vec, 0, sizeof(t->moments_vec));
-#endif
+	/* Make sure there is a free job, writing out any which are finished. */
+	r = flush_jobs(t, t->n_jobs - 1);
+	if (r < 0)
+		return r;
 
-	t->index = 0;
+	/* Only this thread moves job_tail, so the job at the tail is ours
+	 * until we hand it over.
+	 */
+	job = &t->jobs[t->job_tail % t->n_jobs];
+	memcpy(job->samples, mring_data(t->ring),
+			t->slice_length * sizeof(sample_t));
 
-	h = bufhold_oldest(t->held_buffers);
-	while (h) {
-		struct held_buffer * next = bufhold_next(h);
-		start = t->index;
-		process_buffer(t, h);
+	pthread_mutex_lock(&t->mutex);
+	t->job_tail++;
+	pthread_cond_signal(&t->work_cond);
+	pthread_mutex_unlock(&t->mutex);
 
-		/* Check whether this buffer extends into the second half of
-		 * this time slice, if not then we can discard it.
-		 */
-		if (t->index <= t->slice_period) {
-			bufhold_release(h);
-		} else {
-			/* Adjust start of buffer if this is the first buffer
-			 * that we need to keep for the next time slice.
-			 */
-			if (start < t->slice_period) {
-				offset = t->slice_period - start;
-				bufhold_advance(h, offset);
-			}
-		}
-		h = next;
-	}
+	return 0;
+}
 
-	fft_transform(t->fft);
-	tol_calculate(t->tol, fft_get_cdata(t->fft), t->results->tols);
+static void stop_workers(struct time_slice * t)
+{
+	assert(t);
 
-#ifdef ENABLE_ARM_NEON
-	update_stats_finish(t);
-#endif
+	uint i;
 
-	if (t->out_mode == TUNA_OUT_MODE_CSV)
-		return write_results_csv(t);
-	else
-		return write_results_dat(t);
+	pthread_mutex_lock(&t->mutex);
+	t->stop = 1;
+	pthread_cond_broadcast(&t->work_cond);
+	pthread_mutex_unlock(&t->mutex);
+
+	for (i = 0; i < t->n_started; i++)
+		pthread_join(t->ctx[i].thread, NULL);
+	t->n_started = 0;
 }
 
 void time_slice_exit(struct consumer * consumer)
 {
 	assert(consumer);
 
+	int r;
+	uint i;
 	struct time_slice * t = (struct time_slice *)
 		consumer_get_data(consumer);
 
+	if (t->n_started) {
+		r = flush_jobs(t, 0);
+		if (r < 0)
+			error("time_slice: Failed to write final results");
+		stop_workers(t);
+	}
+
+	for (i = 0; i < t->n_ctx; i++) {
+		if (t->ctx[i].fft)
+			fft_exit(t->ctx[i].fft);
+		if (t->ctx[i].tol)
+			tol_exit(t->ctx[i].tol);
+	}
+	free(t->ctx);
+
+	if (t->jobs) {
+		for (i = 0; i < t->n_jobs; i++) {
+			free(t->jobs[i].samples);
+			free(t->jobs[i].results);
+		}
+		free(t->jobs);
+	}
+
 	if (t->window)
 		free(t->window);
 
-	if (t->results)
-		free(t->results);
-
-        if (t->tol)
-                tol_exit(t->tol);
+	if (t->ring)
+		mring_exit(t->ring);
 
-	bufhold_release_all(t->held_buffers);
-	bufhold_exit(t->held_buffers);
 	if (t->out_mode == TUNA_OUT_MODE_CSV)
 		csv_close(t->out);
 	else
 		dat_close(t->out);
 
+	pthread_cond_destroy(&t->done_cond);
+	pthread_cond_destroy(&t->work_cond);
+	pthread_mutex_destroy(&t->mutex);
 	free(t->out_name);
 	free(t);
 }
@@ -497,24 +932,54 @@ int time_slice_write(struct consumer * consumer, sample_t * buf, uint count)
 	assert(buf);
 
 	int r;
+	uint c;
 
 	struct time_slice * t = (struct time_slice *)
 		consumer_get_data(consumer);
-	
-	t->available += count;
-	r = bufhold_add(t->held_buffers, buf, count);
-	if (r < 0) {
-		error("time_slice: Failed to hold buffer");
-		return r;
-	}
 
-	while (t->available >= t->slice_length) {
-		r = process_time_slice(t);
-		if (r < 0) {
-			error("time_slice: Failed to process time slice");
-			return r;
+	/* The ring holds at least two time slices and never has a whole time
+	 * slice left in it between iterations, so there is always space to
+	 * copy more of the buffer in.
+	 */
+	while (count) {
+		c = min(count, mring_space(t->ring));
+		mring_write(t->ring, buf, c);
+		buf += c;
+		count -= c;
+
+		while (mring_count(t->ring) >= t->slice_length) {
+			r = process_time_slice(t);
+			if (r < 0) {
+				error("time_slice: Failed to process time slice");
+				return r;
+			}
+			mring_advance(t->ring, t->slice_period);
 		}
-		t->available -= t->slice_period;
+	}
+
+	return 0;
+}
+
+static int init_ctx(struct time_slice * t, struct time_slice_ctx * ctx)
+{
+	assert(t);
+	assert(ctx);
+
+	ctx->t = t;
+	ctx->window = t->window;
+	select_kernels(ctx);
+
+	ctx->fft = fft_init(t->slice_length);
+	if (!ctx->fft) {
+		error("time_slice: Failed to initialise FFT");
+		return -1;
+	}
+	ctx->fft_data = fft_get_data(ctx->fft);
+
+	ctx->tol = tol_init(t->sample_rate, t->slice_length, 0.4, 3);
+	if (!ctx->tol) {
+		error("time_slice: Failed to initialise third octave level calculation");
+		return -1;
 	}
 
 	return 0;
@@ -527,6 +992,8 @@ int time_slice_start(struct consumer * consumer, uint sample_rate, struct timesp
 
 	int r;
 	int rate_pow2;
+	uint i;
+	size_t results_size;
 
 	struct time_slice * t = (struct time_slice *)
 		consumer_get_data(consumer);
@@ -538,7 +1005,12 @@ int time_slice_start(struct consumer * consumer, uint sample_rate, struct timesp
 	t->slice_length = 1<<rate_pow2;
 
 	t->slice_period = t->slice_length / 2;
-	t->available = 0;
+
+	t->ring = mring_init(2 * t->slice_length);
+	if (!t->ring) {
+		error("time_slice: Failed to initialise sample ring");
+		return -1;
+	}
 
 	/* Create window function. */
 	t->window = (float *)malloc(sizeof(float) * t->slice_length);
@@ -549,29 +1021,69 @@ int time_slice_start(struct consumer * consumer, uint sample_rate, struct timesp
 
 	window_init_sine(t->window, t->slice_length);
 
-	t->fft = fft_init(t->slice_length);
-	if (!t->fft) {
-		error("time_slice: Failed to initialise FFT");
-		return -1;
+	/* If we are using neon vectorisation, we want the first element of
+	 * each context ('moments_vec') to be correctly aligned.
+	 */
+	t->n_ctx = t->n_threads ? t->n_threads : 1;
+	r = posix_memalign((void **)&t->ctx, 16,
+			t->n_ctx * sizeof(struct time_slice_ctx));
+	if (r) {
+		t->n_ctx = 0;
+		error("time_slice: Failed to allocate memory for processing contexts");
+		return -ENOMEM;
 	}
-	t->fft_data = fft_get_data(t->fft);
+	memset(t->ctx, 0, t->n_ctx * sizeof(struct time_slice_ctx));
 
-	t->tol = tol_init(sample_rate, t->slice_length, 0.4, 3);
-	if (!t->tol) {
-		error("time_slice: Failed to initialise third octave level calculation");
-		return -1;
+	for (i = 0; i < t->n_ctx; i++) {
+		r = init_ctx(t, &t->ctx[i]);
+		if (r < 0)
+			return r;
 	}
 
-	t->n_tol = tol_get_num_levels(t->tol);
+	t->n_tol = tol_get_num_levels(t->ctx[0].tol);
 
-	t->results = (struct time_slice_results *)
-		malloc(sizeof(struct time_slice_results) + (t->n_tol + 1) *
-				sizeof(float));
-	if (!t->results) {
-		error("time_slice: Failed to allocate memory for results");
+	/* Allow each worker a second job so that it doesn't go idle while we
+	 * copy out slices and write results.
+	 */
+	t->n_jobs = t->n_threads ? t->n_threads * 2 : 1;
+	t->jobs = (struct time_slice_job *)
+		calloc(t->n_jobs, sizeof(struct time_slice_job));
+	if (!t->jobs) {
+		error("time_slice: Failed to allocate memory for jobs");
 		return -ENOMEM;
 	}
 
+	results_size = sizeof(struct time_slice_results) + (t->n_tol + 1) *
+		sizeof(float);
+	for (i = 0; i < t->n_jobs; i++) {
+		t->jobs[i].results = (struct time_slice_results *)
+			malloc(results_size);
+		if (!t->jobs[i].results) {
+			error("time_slice: Failed to allocate memory for results");
+			return -ENOMEM;
+		}
+
+		if (!t->n_threads)
+			continue;
+
+		t->jobs[i].samples = (sample_t *)
+			malloc(t->slice_length * sizeof(sample_t));
+		if (!t->jobs[i].samples) {
+			error("time_slice: Failed to allocate memory for results");
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0; i < t->n_threads; i++) {
+		r = pthread_create(&t->ctx[i].thread, NULL, worker_thread,
+				&t->ctx[i]);
+		if (r != 0) {
+			error("time_slice: Failed to start worker thread");
+			return -r;
+		}
+		t->n_started++;
+	}
+
 	if (t->out_mode == TUNA_OUT_MODE_CSV)
 		r = csv_write_start(t->out, ts);
 	else
@@ -595,9 +1107,15 @@ int time_slice_resync(struct consumer * consumer, struct timespec * ts)
 	struct time_slice * t = (struct time_slice *)
 		consumer_get_data(consumer);
 
+	/* Results from before the loss of sync must be written first. */
+	if (t->n_threads) {
+		r = flush_jobs(t, 0);
+		if (r < 0)
+			return r;
+	}
+
 	/* We're going to have to dump old data. */
-	bufhold_release_all(t->held_buffers);
-	t->available = 0;
+	mring_clear(t->ring);
 
 	if (t->out_mode == TUNA_OUT_MODE_CSV)
 		r = csv_write_resync(t->out, ts);
@@ -616,30 +1134,23 @@ int time_slice_resync(struct consumer * consumer, struct timespec * ts)
 	Public functions
 *******************************************************************************/
 
-int time_slice_init(struct consumer * consumer, const char * out_name,
-		int out_mode)
+static int init(struct consumer * consumer, const char * out_name,
+		int out_mode, uint n_threads)
 {
 	assert(out_name);
 	int r;
 	struct time_slice * t;
 
-	/* If we are using neon vectorisation, we want the first element of
-	 * struct time_slice ('moments_vec') to be correctly aligned.
-	 */
-	r = posix_memalign((void **)&t, 16, sizeof(struct time_slice));
-	if (r) {
+	t = (struct time_slice *) calloc(sizeof(struct time_slice), 1);
+	if (!t) {
 		error("time_slice: Failed to allocate memory");
-		r = -ENOMEM;
-		goto err;
+		return -ENOMEM;
 	}
-	memset(t, 0, sizeof(struct time_slice));
 
-	t->held_buffers = bufhold_init();
-	if (!t->held_buffers) {
-		error("time_slice: Failed to allocate memory for held buffers");
-		r = -1;
-		goto err;
-	}
+	t->n_threads = n_threads;
+	pthread_mutex_init(&t->mutex, NULL);
+	pthread_cond_init(&t->work_cond, NULL);
+	pthread_cond_init(&t->done_cond, NULL);
 
 	/* Initialize csv file. */
 	t->out_name = strdup(out_name);
@@ -675,10 +1186,72 @@ err:
 	}
 	if (t->out_name)
 		free(t->out_name);
-	if (t->held_buffers)
-		bufhold_exit(t->held_buffers);
-	if (t)
-		free(t);
+	pthread_cond_destroy(&t->done_cond);
+	pthread_cond_destroy(&t->work_cond);
+	pthread_mutex_destroy(&t->mutex);
+	free(t);
 
 	return r;
 }
+
+int time_slice_init(struct consumer * consumer, const char * out_name,
+		int out_mode)
+{
+	return init(consumer, out_name, out_mode, 0);
+}
+
+int time_slice_init_parallel(struct consumer * consumer, const char * out_name,
+		int out_mode, uint n_threads)
+{
+	return init(consumer, out_name, out_mode, n_threads);
+}
+
+void time_slice_window(sample_t * data, float * window, float * out,
+		uint count)
+{
+	assert(data);
+	assert(window);
+	assert(out);
+
+	struct time_slice_ctx ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.window = window;
+	ctx.fft_data = out;
+	select_kernels(&ctx);
+
+	ctx.process_common(&ctx, data, count);
+}
+
+void time_slice_window_stats(sample_t * data, float * window, float * out,
+		uint count, sample_t * peaks, float * moments)
+{
+	assert(data);
+	assert(window);
+	assert(out);
+	assert(peaks);
+	assert(moments);
+
+	struct time_slice_ctx ctx;
+	struct time_slice_results res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.window = window;
+	ctx.fft_data = out;
+	ctx.results = &res;
+	select_kernels(&ctx);
+
+	res.peak_positive = peaks[0];
+	res.peak_negative = peaks[1];
+	memcpy(res.moments, moments, sizeof(res.moments));
+
+	ctx.process_middle(&ctx, data, count);
+
+#ifdef ENABLE_ARM_NEON
+	update_stats_finish(&ctx);
+#endif
+
+	peaks[0] = res.peak_positive;
+	peaks[1] = res.peak_negative;
+	memcpy(moments, res.moments, sizeof(res.moments));
+}
@@ -42,8 +42,12 @@ void timespec_add_ticks(struct timespec * ts, uint ticks, uint sample_rate)
 {
 	assert(ts);
 
-	uint64 tmp = ticks * NS;
+	/* Whole seconds are added separately and the remainder is scaled in
+	 * 64 bits so that large tick counts can't overflow.
+	 */
+	uint64 tmp = (uint64)(ticks % sample_rate) * NS;
 	uint ns = tmp / sample_rate;
+	ts->tv_sec += ticks / sample_rate;
 	timespec_add_ns(ts, ns);
 }
 
@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include "log.h"
+#include "simd.h"
 #include "tol.h"
 #include "types.h"
 
@@ -33,6 +34,10 @@
 #include <arm_neon.h>
 #endif
 
+#ifdef ENABLE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 struct tol_transition {
 	uint				t_onset;
 	uint				t_width;
@@ -48,6 +53,11 @@ struct tol {
 	uint				n_tol;
 
 	struct tol_transition		desc[MAX_THIRD_OCTAVE_LEVELS];
+
+	/* Power sum kernels, selected in tol_init(). */
+	float				(*psum)(float complex * x, uint N);
+	void				(*wpsum2)(float complex * x, float * w,
+						uint N, float * e);
 };
 
 /*******************************************************************************
@@ -152,7 +162,7 @@ static const float band_edges[MAX_THIRD_OCTAVE_LEVELS + 1] = {
 *******************************************************************************/
 
 /* Unweighted power sum. */
-static inline float psum(float complex *x, uint N)
+static float psum(float complex *x, uint N)
 {
 	assert(x);
 
@@ -203,7 +213,7 @@ static inline float psum(float complex *x, uint N)
 
 /* Dual band weighted power sum. */
 /* Weighting coefficients are interleaved to speed up memory loads. */
-static inline void wpsum2(float complex *x, float *w, uint N, float *e)
+static void wpsum2(float complex *x, float *w, uint N, float *e)
 {
 	assert(x);
 	assert(w);
@@ -316,6 +326,189 @@ static inline void wpsum2(float complex *x, float *w, uint N, float *e)
 #endif
 }
 
+#ifdef ENABLE_X86_SIMD
+/* x86 versions of psum() and wpsum2(), selected at runtime in tol_init(). They
+ * treat the complex data as an array of 2N floats, in the same way as the NEON
+ * versions above, and finish off any remainder with the scalar code. As the
+ * sums are accumulated in a different order, the results may differ slightly
+ * from the scalar code, see tol_calculate().
+ */
+
+__attribute__((target("sse4.1")))
+static float psum_sse4_1(float complex *x, uint N)
+{
+	assert(x);
+
+	float * data = (float *) x;
+	float sum[4];
+	__m128 sum_vec = _mm_setzero_ps();
+	uint i;
+
+	for (i = 0; i + 2 <= N; i += 2) {
+		__m128 f = _mm_loadu_ps(data + 2 * i);
+		sum_vec = _mm_add_ps(sum_vec, _mm_mul_ps(f, f));
+	}
+
+	_mm_storeu_ps(sum, sum_vec);
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]) + psum(&x[i], N - i);
+}
+
+__attribute__((target("sse4.1")))
+static void wpsum2_sse4_1(float complex *x, float *w, uint N, float *e)
+{
+	assert(x);
+	assert(w);
+	assert(e);
+
+	float * data = (float *) x;
+	float sum[4];
+	__m128 sum_vec = _mm_setzero_ps();
+	uint i;
+
+	for (i = 0; i + 2 <= N; i += 2) {
+		/* As in the NEON version, the squares are added within each
+		 * pair to give [v0, v0, v1, v1] which lines up with the
+		 * interleaved coefficients.
+		 */
+		__m128 f = _mm_loadu_ps(data + 2 * i);
+		__m128 q = _mm_mul_ps(f, f);
+		__m128 q_rev = _mm_shuffle_ps(q, q, _MM_SHUFFLE(2, 3, 0, 1));
+		__m128 v = _mm_add_ps(q, q_rev);
+		__m128 w_vec = _mm_loadu_ps(w + 2 * i);
+		sum_vec = _mm_add_ps(sum_vec, _mm_mul_ps(v, w_vec));
+	}
+
+	/* Even lanes hold the lower band sum, odd lanes the upper. */
+	_mm_storeu_ps(sum, sum_vec);
+	e[0] += sum[0] + sum[2];
+	e[1] += sum[1] + sum[3];
+
+	wpsum2(&x[i], &w[2 * i], N - i, e);
+}
+
+__attribute__((target("avx2")))
+static float psum_avx2(float complex *x, uint N)
+{
+	assert(x);
+
+	float * data = (float *) x;
+	float sum[8];
+	__m256 sum_vec = _mm256_setzero_ps();
+	uint i;
+
+	for (i = 0; i + 4 <= N; i += 4) {
+		__m256 f = _mm256_loadu_ps(data + 2 * i);
+		sum_vec = _mm256_add_ps(sum_vec, _mm256_mul_ps(f, f));
+	}
+
+	_mm256_storeu_ps(sum, sum_vec);
+	return ((sum[0] + sum[1]) + (sum[2] + sum[3])) +
+		((sum[4] + sum[5]) + (sum[6] + sum[7])) + psum(&x[i], N - i);
+}
+
+__attribute__((target("avx2")))
+static void wpsum2_avx2(float complex *x, float *w, uint N, float *e)
+{
+	assert(x);
+	assert(w);
+	assert(e);
+
+	float * data = (float *) x;
+	float sum[8];
+	__m256 sum_vec = _mm256_setzero_ps();
+	uint i;
+
+	for (i = 0; i + 4 <= N; i += 4) {
+		__m256 f = _mm256_loadu_ps(data + 2 * i);
+		__m256 q = _mm256_mul_ps(f, f);
+		__m256 q_rev = _mm256_permute_ps(q, _MM_SHUFFLE(2, 3, 0, 1));
+		__m256 v = _mm256_add_ps(q, q_rev);
+		__m256 w_vec = _mm256_loadu_ps(w + 2 * i);
+		sum_vec = _mm256_add_ps(sum_vec, _mm256_mul_ps(v, w_vec));
+	}
+
+	_mm256_storeu_ps(sum, sum_vec);
+	e[0] += (sum[0] + sum[2]) + (sum[4] + sum[6]);
+	e[1] += (sum[1] + sum[3]) + (sum[5] + sum[7]);
+
+	wpsum2(&x[i], &w[2 * i], N - i, e);
+}
+
+__attribute__((target("avx512f")))
+static float psum_avx512(float complex *x, uint N)
+{
+	assert(x);
+
+	float * data = (float *) x;
+	__m512 sum_vec = _mm512_setzero_ps();
+	uint i;
+
+	for (i = 0; i + 8 <= N; i += 8) {
+		__m512 f = _mm512_loadu_ps(data + 2 * i);
+		sum_vec = _mm512_add_ps(sum_vec, _mm512_mul_ps(f, f));
+	}
+
+	return _mm512_reduce_add_ps(sum_vec) + psum(&x[i], N - i);
+}
+
+__attribute__((target("avx512f")))
+static void wpsum2_avx512(float complex *x, float *w, uint N, float *e)
+{
+	assert(x);
+	assert(w);
+	assert(e);
+
+	float * data = (float *) x;
+	__m512 sum_vec = _mm512_setzero_ps();
+	uint i;
+
+	for (i = 0; i + 8 <= N; i += 8) {
+		__m512 f = _mm512_loadu_ps(data + 2 * i);
+		__m512 q = _mm512_mul_ps(f, f);
+		__m512 q_rev = _mm512_permute_ps(q, _MM_SHUFFLE(2, 3, 0, 1));
+		__m512 v = _mm512_add_ps(q, q_rev);
+		__m512 w_vec = _mm512_loadu_ps(w + 2 * i);
+		sum_vec = _mm512_add_ps(sum_vec, _mm512_mul_ps(v, w_vec));
+	}
+
+	/* Split the even and odd lanes with masks before reducing. */
+	e[0] += _mm512_mask_reduce_add_ps(0x5555, sum_vec);
+	e[1] += _mm512_mask_reduce_add_ps(0xAAAA, sum_vec);
+
+	wpsum2(&x[i], &w[2 * i], N - i, e);
+}
+#endif
+
+static void select_kernels(struct tol * t)
+{
+	assert(t);
+
+	t->psum = psum;
+	t->wpsum2 = wpsum2;
+
+#ifdef ENABLE_X86_SIMD
+	switch (simd_get_level()) {
+	    case SIMD_LEVEL_AVX512:
+		t->psum = psum_avx512;
+		t->wpsum2 = wpsum2_avx512;
+		break;
+
+	    case SIMD_LEVEL_AVX2:
+		t->psum = psum_avx2;
+		t->wpsum2 = wpsum2_avx2;
+		break;
+
+	    case SIMD_LEVEL_SSE4_1:
+		t->psum = psum_sse4_1;
+		t->wpsum2 = wpsum2_sse4_1;
+		break;
+
+	    default:
+		break;
+	}
+#endif
+}
+
 static inline float phi(float p, uint l)
 {
 	uint i;
@@ -345,16 +538,34 @@ void tol_calculate(struct tol * t, float complex * cdata, float * results)
 
 	for (i = 0; i < t->n_tol; i++) {
 		/* Unweighted sum from current position to start of transition, this is added to band i. */
-		results[i] += psum(&cdata[j], (t->desc[i].t_onset - j));
+		results[i] += t->psum(&cdata[j], (t->desc[i].t_onset - j));
 
 		/* Weighted sum over the transition, added to bands i and i+1. */
-		wpsum2(&cdata[t->desc[i].t_onset], t->desc[i].coeffs, t->desc[i].t_width, &results[i]);
+		t->wpsum2(&cdata[t->desc[i].t_onset], t->desc[i].coeffs, t->desc[i].t_width, &results[i]);
 
 		/* Update j to end of transition. */
 		j = t->desc[i].t_onset + t->desc[i].t_width;
 	}
 }
 
+float tol_psum(struct tol * t, float complex * x, uint N)
+{
+	assert(t);
+	assert(x);
+
+	return t->psum(x, N);
+}
+
+void tol_wpsum2(struct tol * t, float complex * x, float * w, uint N, float * e)
+{
+	assert(t);
+	assert(x);
+	assert(w);
+	assert(e);
+
+	t->wpsum2(x, w, N, e);
+}
+
 uint tol_get_num_levels(struct tol * t)
 {
 	assert(t);
@@ -437,6 +648,8 @@ struct tol * tol_init(uint sample_rate, uint analysis_length, float overlap, uin
 		return NULL;
 	}
 
+	select_kernels(t);
+
 	step = (float)sample_rate / (float)analysis_length;
 
 	/* Prepare each transition region. */
@@ -470,7 +683,7 @@ struct tol * tol_init(uint sample_rate, uint analysis_length, float overlap, uin
 		/* Fill memory with correct coefficients. */
 		for (j = 0; j < t->desc[i].t_width; j++) {
 			if (delta) {
-				cur_freq = t->desc[i].t_onset + j * step;
+				cur_freq = (t->desc[i].t_onset + j) * step;
 				offset = cur_freq - band_edges[i];
 				p = offset / delta;
 			} else {
@@ -492,9 +705,15 @@ void tol_exit(struct tol * t)
 {
 	assert(t);
 
-	uint i;
+	uint i, n;
 
-	for (i = 0; i < t->n_tol; i++) {
+	/* Each band lies between two transitions, so if tol_init() stopped
+	 * early there is one more transition than there are bands.
+	 */
+	n = t->n_tol < MAX_THIRD_OCTAVE_LEVELS ? t->n_tol + 1 :
+		MAX_THIRD_OCTAVE_LEVELS;
+
+	for (i = 0; i < n; i++) {
 		free(t->desc[i].coeffs);
 	}
 
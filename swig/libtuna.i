@@ -42,6 +42,7 @@
         #include "counter.h"
         #include "csv.h"
         #include "dat.h"
+        #include "deinterleave.h"
         #include "env_estimate.h"
         #include "fft.h"
 #ifdef ENABLE_ADS1672
@@ -49,13 +50,17 @@
 #endif
         #include "input_alsa.h"
         #include "input_sndfile.h"
+        #include "input_wavmap.h"
         #include "input_zero.h"
         #include "log.h"
+        #include "mring.h"
         #include "onset_threshold.h"
         #include "offset_threshold.h"
         #include "output_null.h"
         #include "output_sndfile.h"
         #include "pulse.h"
+        #include "simd.h"
+        #include "tee.h"
         #include "time_slice.h"
         #include "tol.h"
         #include "types.h"
@@ -74,6 +79,7 @@
 %include "counter.h"
 %include "csv.h"
 %include "dat.h"
+%include "deinterleave.h"
 %include "env_estimate.h"
 %include "fft.h"
 #ifdef ENABLE_ADS1672
@@ -81,13 +87,17 @@
 #endif
 %include "input_alsa.h"
 %include "input_sndfile.h"
+%include "input_wavmap.h"
 %include "input_zero.h"
 %include "log.h"
+%include "mring.h"
 %include "onset_threshold.h"
 %include "offset_threshold.h"
 %include "output_null.h"
 %include "output_sndfile.h"
 %include "pulse.h"
+%include "simd.h"
+%include "tee.h"
 %include "time_slice.h"
 %include "tol.h"
 %include "types.h"
@@ -15,6 +15,7 @@
  * full name `unsigned int`.
  */
 %numpy_typemaps(float, NPY_FLOAT, unsigned int)
+%numpy_typemaps(int, NPY_INT, unsigned int)
 
 /* Mapping for window_init_sine(w) where w is a pre-allocated numpy array. */
 %apply (float* INPLACE_ARRAY1, unsigned int DIM1) {(float *window, uint length)}
@@ -22,12 +23,16 @@
 /* Mapping for `frames_out = buffer_acquire(frames_in)`. */
 %apply (unsigned int *INOUT) {(uint *frames)}
 
+/* Mapping for `h, index = bufhold_find(bh, offset)`. */
+%apply (unsigned int *OUTPUT) {(uint * index)}
+
 /* Mapping for `tol_get_coeffs(w)` where w is a pre-allocated numpy array. */
 %apply (float * INPLACE_ARRAY1, unsigned int DIM1) {(float *dest, uint length)}
 
 /* Mapping for `threshold_out = onset_threshold_next(onset, next, threshold_in)`
  */
 %apply (float *INOUT) {(env_t * threshold)}
+%apply (float * IN_ARRAY1, unsigned int DIM1) {(env_t * env, uint n)}
 
 /* Mapping for 'psd = fft_power_spectrum(cdata)' where psd is to be returned as
  * a numpy array.
@@ -39,6 +44,17 @@
  */
 %ignore fft_get_data;
 
+/* Likewise for mring_data and mring_write. */
+%ignore mring_data;
+%ignore mring_write;
+
+/* Likewise for deinterleave. */
+%ignore deinterleave;
+
+/* Likewise for consumer_start and consumer_write. */
+%ignore consumer_start;
+%ignore consumer_write;
+
 %include "swig/libtuna.i"
 
 /* Wrapper for `tol_calculate(t, data, results)` where both data and results are
@@ -74,3 +90,110 @@ void fft_get_data_wrapper(struct fft * fft, float ** data, uint * data_length)
         *data_length = fft_get_length(fft);
 }
 %}
+
+%apply (int * IN_ARRAY1, unsigned int DIM1) {(sample_t * in, uint in_length)}
+%apply (float * INPLACE_ARRAY1, unsigned int DIM1) {(env_t * out,
+                                                    uint out_length)}
+%rename (env_estimate_block) env_estimate_block_wrapper;
+%inline %{
+void env_estimate_block_wrapper(struct env_estimate * e, sample_t * in,
+                                uint in_length, env_t * out, uint out_length)
+{
+        uint n = (in_length < out_length) ? in_length : out_length;
+
+        env_estimate_block(e, in, out, n);
+}
+%}
+
+/* Wrapper for 'x = mring_data(r)' where x is to be returned as a numpy array
+ * viewing the samples held in the ring.
+ */
+%apply (int ** ARGOUTVIEW_ARRAY1, unsigned int * DIM1) {(sample_t ** data, uint * data_length)}
+
+%rename (mring_data) mring_data_wrapper;
+
+%inline %{
+void mring_data_wrapper(struct mring * r, sample_t ** data, uint * data_length)
+{
+        *data = mring_data(r);
+        *data_length = mring_count(r);
+}
+%}
+
+/* Wrapper for 'mring_write(r, x)' where x is a numpy array. */
+%rename (mring_write) mring_write_wrapper;
+
+%inline %{
+int mring_write_wrapper(struct mring * r, sample_t * in, uint in_length)
+{
+        return mring_write(r, in, in_length);
+}
+%}
+
+/* Wrapper for 'deinterleave(dst, src)' where src is a numpy array of
+ * interleaved samples and dst is a pre-allocated (channels, frames) numpy array.
+ */
+%apply (int * IN_ARRAY1, unsigned int DIM1) {(sample_t * src, uint src_length)}
+%apply (int * INPLACE_ARRAY2, unsigned int DIM1, unsigned int DIM2) {(sample_t * dst, uint channels, uint frames)}
+%rename (deinterleave) deinterleave_wrapper;
+
+%inline %{
+int deinterleave_wrapper(sample_t * dst, uint channels, uint frames,
+                         sample_t * src, uint src_length)
+{
+        sample_t ** ptrs;
+        uint c;
+
+        if (src_length != channels * frames)
+                return -1;
+
+        ptrs = (sample_t **) malloc(channels * sizeof(sample_t *));
+        if (!ptrs)
+                return -1;
+
+        for (c = 0; c < channels; c++)
+                ptrs[c] = &dst[c * frames];
+
+        deinterleave(ptrs, src, channels, frames);
+        free(ptrs);
+        return 0;
+}
+%}
+
+/* Wrapper for 'consumer_start(c, sample_rate)'. There is no binding for struct
+ * timespec so the consumer is started at time zero.
+ */
+%rename (consumer_start) consumer_start_wrapper;
+
+%inline %{
+int consumer_start_wrapper(struct consumer * consumer, uint sample_rate)
+{
+        struct timespec ts = {0, 0};
+
+        return consumer_start(consumer, sample_rate, &ts);
+}
+%}
+
+/* Wrapper for 'consumer_write(c, x)' where x is a numpy array. Consumers may
+ * hold on to the buffers written to them so x is copied into a new buffer.
+ */
+%rename (consumer_write) consumer_write_wrapper;
+
+%inline %{
+int consumer_write_wrapper(struct consumer * consumer, sample_t * in,
+                           uint in_length)
+{
+        sample_t * buf;
+        uint frames = in_length;
+        int r;
+
+        buf = buffer_acquire(&frames);
+        if (!buf)
+                return -1;
+
+        memcpy(buf, in, in_length * sizeof(sample_t));
+        r = consumer_write(consumer, buf, in_length);
+        buffer_release(buf);
+        return r;
+}
+%}
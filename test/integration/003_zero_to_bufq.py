@@ -0,0 +1,36 @@
+#! /usr/bin/env python
+################################################################################
+#   003_zero_to_bufq.py: Test both bufq implementations
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+from tuna_test import *
+import unittest
+import tuna
+
+class tunaZeroBufqNullTests(tunaTestCase):
+    def test_list(self):
+        # Process 640k samples through a linked list bufq
+        r = tuna.run("-i zero -o null --bufq=list -c 640000")
+
+        self.assertEqual(r, 0)
+
+    def test_ring(self):
+        # Process 640k samples through a small ring bufq so that the producer
+        # has to wait for the consumer thread
+        r = tuna.run("-i zero -o null --bufq=ring:2 -c 640000")
+
+        self.assertEqual(r, 0)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
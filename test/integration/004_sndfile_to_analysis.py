@@ -0,0 +1,85 @@
+#! /usr/bin/env python
+################################################################################
+#   004_sndfile_to_analysis.py: Test serial and parallel analysis of a recording
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+from tuna_test import *
+import unittest
+import tuna
+
+import math
+import random
+import struct
+import wave
+
+class tunaSndfileAnalysisTests(tunaTestCase):
+    in_file = "input-tunaSndfileAnalysisTests.wav"
+    rate = 48000
+
+    def setUp(self):
+        super(tunaSndfileAnalysisTests, self).setUp()
+
+        # Low level noise under a tone which steps up in frequency every
+        # half second, with a short loud pulse in each step so that both
+        # parts of the analysis have something to find
+        rng = random.Random(4)
+        data = bytearray()
+        for i in range(4 * self.rate):
+            step = i // (self.rate // 2)
+            t = float(i) / self.rate
+            x = 0.02 * math.sin(2 * math.pi * 500 * (step + 1) * t)
+            x += rng.uniform(-0.005, 0.005)
+            if i % (self.rate // 2) in range(self.rate // 4,
+                    self.rate // 4 + self.rate // 50):
+                x += 0.5 * math.sin(2 * math.pi * 3000 * t)
+            data += struct.pack('<h', int(x * 32767))
+
+        w = wave.open(self.in_file, 'wb')
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(self.rate)
+        w.writeframes(bytes(data))
+        w.close()
+
+    def run_analysis(self, name, flags):
+        pulse = "results-tunaSndfileAnalysisTests-%s-pulse.csv" % name
+        time_slice = "results-tunaSndfileAnalysisTests-%s-time_slice.csv" % name
+
+        r = tuna.run("-i sndfile:%s -o analysis:%s:%s %s" %
+                (self.in_file, pulse, time_slice, flags))
+        self.assertEqual(r, 0)
+
+        results = []
+        for fname in (pulse, time_slice):
+            f = open(fname, 'r')
+            self.assertIsNotNone(f)
+            results.append(f.read())
+            f.close()
+
+        return results
+
+    def test_parallel(self):
+        # Running each analysis on its own thread should give exactly the same
+        # results as running them in turn
+        serial = self.run_analysis("serial", "")
+        parallel = self.run_analysis("parallel", "--parallel")
+
+        # Make sure there was something to compare beyond the header line
+        self.assertGreater(len(serial[0].splitlines()), 1)
+        self.assertGreater(len(serial[1].splitlines()), 1)
+
+        self.assertEqual(serial, parallel)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
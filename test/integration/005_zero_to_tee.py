@@ -0,0 +1,53 @@
+#! /usr/bin/env python
+################################################################################
+#   005_zero_to_tee.py: Test multiple outputs through a tee
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+from tuna_test import *
+import unittest
+import tuna
+
+class tunaZeroTeeTests(tunaTestCase):
+    def read_results(self, fname):
+        f = open(fname, 'r')
+        self.assertIsNotNone(f)
+        results = f.read()
+        f.close()
+
+        return results
+
+    def test_two_outputs(self):
+        # Each branch of the tee should see exactly the same data as a single
+        # output would
+        single = "results-tunaZeroTeeTests-single.csv"
+        first = "results-tunaZeroTeeTests-first.csv"
+        second = "results-tunaZeroTeeTests-second.csv"
+
+        r = tuna.run("-i zero -o time_slice:%s -c 800000 -r 400000" % single)
+        self.assertEqual(r, 0)
+
+        r = tuna.run("-i zero -o time_slice:%s -o time_slice:%s -c 800000 -r 400000" %
+                (first, second))
+        self.assertEqual(r, 0)
+
+        expected = self.read_results(single)
+        self.assertEqual(self.read_results(first), expected)
+        self.assertEqual(self.read_results(second), expected)
+
+    def test_queued_output(self):
+        r = tuna.run("-i zero -o null -o queue:null -c 800000 -r 400000")
+        self.assertEqual(r, 0)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
@@ -0,0 +1,81 @@
+#! /usr/bin/env python
+################################################################################
+#   006_zero_to_time_slice_jobs.py: Test time slice worker threads
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+from tuna_test import *
+import unittest
+import tuna
+
+import math
+import struct
+import wave
+
+class tunaZeroTimeSliceJobsTests(tunaTestCase):
+    in_file = "input-tunaZeroTimeSliceJobsTests.wav"
+    rate = 96000
+
+    def setUp(self):
+        super(tunaZeroTimeSliceJobsTests, self).setUp()
+
+        # A chirp sweeping up through most of the third octave bands with a
+        # slowly varying amplitude, so that every time slice is different
+        seconds = 10
+        f0 = 20.0
+        f1 = 40000.0
+        k = math.log(f1 / f0) / seconds
+        data = bytearray()
+        for i in range(seconds * self.rate):
+            t = float(i) / self.rate
+            phase = 2 * math.pi * f0 * (math.exp(k * t) - 1) / k
+            x = math.sin(phase) * (0.5 + 0.3 * math.sin(t * 1.7))
+            data += struct.pack('<h', int(x * 32767))
+
+        w = wave.open(self.in_file, 'wb')
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(self.rate)
+        w.writeframes(bytes(data))
+        w.close()
+
+    def run_time_slice(self, name, flags):
+        fname = "results-tunaZeroTimeSliceJobsTests-%s.csv" % name
+
+        r = tuna.run("-i sndfile:%s -o time_slice:%s %s" %
+                (self.in_file, fname, flags))
+        self.assertEqual(r, 0)
+
+        f = open(fname, 'r')
+        self.assertIsNotNone(f)
+        results = f.read()
+        f.close()
+
+        return results
+
+    def test_jobs(self):
+        # Processing time slices on worker threads should give exactly the same
+        # results, in the same order, as processing them in turn
+        serial = self.run_time_slice("serial", "")
+
+        # Make sure there are several distinct slices to put out of order
+        lines = serial.splitlines()[1:]
+        self.assertGreater(len(lines), 10)
+        self.assertEqual(len(set(lines)), len(lines))
+
+        for jobs in (1, 3):
+            parallel = self.run_time_slice("jobs%d" % jobs, "-j %d" % jobs)
+            self.assertEqual(serial, parallel)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
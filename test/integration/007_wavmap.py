@@ -0,0 +1,86 @@
+#! /usr/bin/env python
+################################################################################
+#   007_wavmap.py: Test memory mapped WAV input against input_sndfile
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+
+from tuna_test import *
+import unittest
+import tuna
+
+import math
+import struct
+import wave
+
+class tunaWavmapTests(tunaTestCase):
+    def write_wav(self, fname, sampwidth, channels, rate, frames):
+        # A tone in the first channel and a different one in any others so
+        # that reading the wrong channel would be noticed
+        scale = (1 << (8 * sampwidth - 1)) - 1
+        data = bytearray()
+        for i in range(frames):
+            for c in range(channels):
+                x = math.sin(i * 0.01 * (c + 1)) * 0.7
+                v = int(x * scale)
+                if sampwidth == 1:
+                    # 8-bit WAV data is unsigned
+                    data += struct.pack('<B', v + 128)
+                else:
+                    data += struct.pack('<i', v)[:sampwidth]
+
+        w = wave.open(fname, 'wb')
+        w.setnchannels(channels)
+        w.setsampwidth(sampwidth)
+        w.setframerate(rate)
+        w.writeframes(bytes(data))
+        w.close()
+
+    def run_time_slice(self, name, source):
+        fname = "results-tunaWavmapTests-%s.csv" % name
+
+        r = tuna.run("-i %s -o time_slice:%s" % (source, fname))
+        self.assertEqual(r, 0)
+
+        f = open(fname, 'r')
+        self.assertIsNotNone(f)
+        results = f.read()
+        f.close()
+
+        return results
+
+    def check_format(self, name, sampwidth, channels):
+        wav = "input-tunaWavmapTests-%s.wav" % name
+        self.write_wav(wav, sampwidth, channels, 8000, 100000)
+
+        expected = self.run_time_slice("%s-sndfile" % name, "sndfile:" + wav)
+        results = self.run_time_slice("%s-wavmap" % name, "wavmap:" + wav)
+        self.assertEqual(expected, results)
+
+    def test_00_mono16(self):
+        self.check_format("mono16", 2, 1)
+
+    def test_01_stereo16(self):
+        self.check_format("stereo16", 2, 2)
+
+    def test_02_mono24(self):
+        self.check_format("mono24", 3, 1)
+
+    def test_03_stereo32(self):
+        self.check_format("stereo32", 4, 2)
+
+    def test_04_stereo8(self):
+        self.check_format("stereo8", 1, 2)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
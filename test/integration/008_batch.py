@@ -0,0 +1,100 @@
+#! /usr/bin/env python
+################################################################################
+#   008_batch.py: Test batch processing of several input files
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+
+from tuna_test import *
+import unittest
+import tuna
+
+import math
+import os
+import shutil
+import struct
+import wave
+
+class tunaBatchTests(tunaTestCase):
+    names = ["rec0", "rec1", "rec2", "rec3"]
+    in_dir = "input-tunaBatchTests"
+    out_dir = "results-tunaBatchTests"
+
+    def setUp(self):
+        super(tunaBatchTests, self).setUp()
+
+        for d in (self.in_dir, self.out_dir):
+            if os.path.exists(d):
+                shutil.rmtree(d)
+            os.mkdir(d)
+
+        # A different tone in each file so that mixing up the outputs would
+        # be noticed
+        for n, name in enumerate(self.names):
+            data = bytearray()
+            for i in range(50000):
+                x = math.sin(i * 0.01 * (n + 1)) * 0.7
+                data += struct.pack('<h', int(x * 32767))
+
+            w = wave.open(os.path.join(self.in_dir, name + ".wav"), 'wb')
+            w.setnchannels(1)
+            w.setsampwidth(2)
+            w.setframerate(8000)
+            w.writeframes(bytes(data))
+            w.close()
+
+    def read(self, fname):
+        f = open(fname, 'r')
+        self.assertIsNotNone(f)
+        results = f.read()
+        f.close()
+        return results
+
+    def check_outputs(self):
+        # Each batch output must match a run on that file alone
+        for name in self.names:
+            single = os.path.join(self.out_dir, "single-%s.csv" % name)
+            r = tuna.run("-i sndfile:%s -o time_slice:%s" %
+                    (os.path.join(self.in_dir, name + ".wav"), single))
+            self.assertEqual(r, 0)
+
+            batch = os.path.join(self.out_dir, "%s-results.csv" % name)
+            self.assertEqual(self.read(single), self.read(batch))
+
+    def test_00_directory(self):
+        r = tuna.run("-b %s -W 2 -o time_slice:%s/results.csv" %
+                (self.in_dir, self.out_dir))
+        self.assertEqual(r, 0)
+        self.check_outputs()
+
+    def test_01_glob(self):
+        r = tuna.run("-b '%s/rec*.wav' -W 3 -o time_slice:%s/results.csv" %
+                (self.in_dir, self.out_dir))
+        self.assertEqual(r, 0)
+        self.check_outputs()
+
+    def test_02_manifest(self):
+        manifest = os.path.join(self.out_dir, "manifest.txt")
+        f = open(manifest, 'w')
+        f.write("# Test manifest\n\n")
+        for name in self.names:
+            f.write(os.path.join(self.in_dir, name + ".wav") + "\n")
+        f.close()
+
+        r = tuna.run("-b @%s -o time_slice:%s/results.csv" %
+                (manifest, self.out_dir))
+        self.assertEqual(r, 0)
+        self.check_outputs()
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
@@ -0,0 +1,89 @@
+#! /usr/bin/env python
+################################################################################
+#   009_sequence.py: Test reading a sequence of files as one stream
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+
+from tuna_test import *
+import unittest
+import tuna
+
+import math
+import os
+import shutil
+import struct
+import wave
+
+class tunaSequenceTests(tunaTestCase):
+    in_dir = "input-tunaSequenceTests"
+
+    def write_wav(self, fname, data):
+        w = wave.open(fname, 'wb')
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(8000)
+        w.writeframes(bytes(data))
+        w.close()
+
+    def setUp(self):
+        super(tunaSequenceTests, self).setUp()
+
+        if os.path.exists(self.in_dir):
+            shutil.rmtree(self.in_dir)
+        os.mkdir(self.in_dir)
+
+        # One recording, and the same recording split into files at points
+        # which don't line up with time slices or input buffers
+        data = bytearray()
+        for i in range(200000):
+            x = math.sin(i * 0.01) * math.sin(i * 0.0001) * 0.7
+            data += struct.pack('<h', int(x * 32767))
+
+        self.write_wav("input-tunaSequenceTests-whole.wav", data)
+
+        splits = [0, 33333, 100001, 177777, 200000]
+        for n in range(len(splits) - 1):
+            part = data[splits[n] * 2 : splits[n + 1] * 2]
+            self.write_wav(os.path.join(self.in_dir, "REC-%03d.wav" % n),
+                    part)
+
+    def run_time_slice(self, name, args):
+        fname = "results-tunaSequenceTests-%s.csv" % name
+
+        r = tuna.run("%s -o time_slice:%s" % (args, fname))
+        self.assertEqual(r, 0)
+
+        f = open(fname, 'r')
+        self.assertIsNotNone(f)
+        results = f.read()
+        f.close()
+
+        return results
+
+    def test_00_directory(self):
+        expected = self.run_time_slice("whole",
+                "-i sndfile:input-tunaSequenceTests-whole.wav")
+        results = self.run_time_slice("directory",
+                "-i sndfile:%s" % self.in_dir)
+        self.assertEqual(expected, results)
+
+    def test_01_glob_read_ahead(self):
+        expected = self.run_time_slice("whole",
+                "-i sndfile:input-tunaSequenceTests-whole.wav")
+        results = self.run_time_slice("glob",
+                "-i 'sndfile:%s/REC-*.wav' -R 4" % self.in_dir)
+        self.assertEqual(expected, results)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
@@ -0,0 +1,91 @@
+#! /usr/bin/env python
+################################################################################
+#   010_all_channels.py: Test processing every channel of a file
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+
+from tuna_test import *
+import unittest
+import tuna
+
+import math
+import os
+import shutil
+import struct
+import wave
+
+class tunaAllChannelsTests(tunaTestCase):
+    channels = 3
+
+    def write_wav(self, fname, nchannels, data):
+        w = wave.open(fname, 'wb')
+        w.setnchannels(nchannels)
+        w.setsampwidth(2)
+        w.setframerate(8000)
+        w.writeframes(bytes(data))
+        w.close()
+
+    def setUp(self):
+        super(tunaAllChannelsTests, self).setUp()
+
+        # A different signal on each channel, written both interleaved into
+        # one file and as a mono file per channel
+        mono = [bytearray() for c in range(self.channels)]
+        interleaved = bytearray()
+        for i in range(100000):
+            for c in range(self.channels):
+                x = math.sin(i * 0.01 * (c + 1)) * 0.7 / (c + 1)
+                sample = struct.pack('<h', int(x * 32767))
+                mono[c] += sample
+                interleaved += sample
+
+        self.write_wav("input-tunaAllChannelsTests.wav", self.channels,
+                interleaved)
+        for c in range(self.channels):
+            self.write_wav("input-tunaAllChannelsTests-%d.wav" % c, 1,
+                    mono[c])
+
+    def read_results(self, fname):
+        f = open(fname, 'r')
+        self.assertIsNotNone(f)
+        results = f.read()
+        f.close()
+        return results
+
+    def check_channels(self, name, args):
+        r = tuna.run("-C -i sndfile:input-tunaAllChannelsTests.wav %s "
+                "-o time_slice:results-tunaAllChannelsTests-%s.csv"
+                % (args, name))
+        self.assertEqual(r, 0)
+
+        for c in range(self.channels):
+            r = tuna.run("-i sndfile:input-tunaAllChannelsTests-%d.wav "
+                    "-o time_slice:results-tunaAllChannelsTests-mono.csv"
+                    % c)
+            self.assertEqual(r, 0)
+
+            expected = self.read_results(
+                    "results-tunaAllChannelsTests-mono.csv")
+            results = self.read_results(
+                    "ch%d-results-tunaAllChannelsTests-%s.csv" % (c, name))
+            self.assertEqual(expected, results)
+
+    def test_00_channels(self):
+        self.check_channels("direct", "")
+
+    def test_01_read_ahead(self):
+        self.check_channels("read-ahead", "-R 4")
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
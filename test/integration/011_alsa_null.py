@@ -0,0 +1,79 @@
+#! /usr/bin/env python
+################################################################################
+#   011_alsa_null.py: Test ALSA capture from the null device
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+
+from tuna_test import *
+import unittest
+import tuna
+
+import os
+
+class tunaAlsaNullTests(tunaTestCase):
+    # The ALSA null device captures silence without any hardware, so both
+    # capture modes can be run anywhere that alsa-lib is installed.
+
+    def test_00_read(self):
+        r = tuna.run("-i alsa:null -o null -c 64000")
+        self.assertEqual(r, 0)
+
+    def test_01_mmap(self):
+        r = tuna.run("-i alsa:null -m -o null -c 64000")
+        self.assertEqual(r, 0)
+
+    def test_02_formats(self):
+        # The null device accepts any format and channel count.
+        for fmt in ("s32_le", "s24_le", "s24_3le", "float_le", "s16_le"):
+            r = tuna.run("-i alsa:null -F %s -N 4 -P 1024 -o null -c 64000" % fmt)
+            self.assertEqual(r, 0)
+
+            r = tuna.run("-i alsa:null -m -F %s -N 4 -P 1024 -o null -c 64000" % fmt)
+            self.assertEqual(r, 0)
+
+    def test_03_stats(self):
+        fname = "stats-tunaAlsaNullTests.csv"
+
+        r = tuna.run("-i alsa:null -S %s -T 0 -o null -c 64000" % fname)
+        self.assertEqual(r, 0)
+
+        # With no interval, one line is written when capture stops: the time
+        # followed by seven counts and two histograms of 20 buckets.
+        f = open(fname, 'r')
+        self.assertIsNotNone(f)
+        lines = f.read().splitlines()
+        f.close()
+
+        self.assertEqual(len(lines), 1)
+        fields = lines[0].rstrip(", ").split(", ")
+        self.assertEqual(len(fields), 1 + 7 + 2 * 20)
+
+    def test_04_all_channels(self):
+        # Each channel captured gets its own outputs, counted on the first
+        for mode in ("", "-m"):
+            for c in range(4):
+                fname = "ch%d-results-tunaAlsaNullTests.csv" % c
+                if os.path.exists(fname):
+                    os.unlink(fname)
+
+            r = tuna.run("-i alsa:null %s -N 4 -P 1024 -C -c 64000 "
+                    "-o time_slice:results-tunaAlsaNullTests.csv" % mode)
+            self.assertEqual(r, 0)
+
+            for c in range(4):
+                fname = "ch%d-results-tunaAlsaNullTests.csv" % c
+                self.assertTrue(os.path.exists(fname), fname)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
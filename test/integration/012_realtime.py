@@ -0,0 +1,104 @@
+#! /usr/bin/env python
+################################################################################
+#   012_realtime.py: Test real-time scheduling options
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+from tuna_test import *
+import unittest
+import tuna
+
+import os
+import wave
+
+class tunaRealtimeTests(tunaTestCase):
+    def run_time_slice(self, name, flags):
+        fname = "results-tunaRealtimeTests-%s.csv" % name
+
+        r = tuna.run("-i zero -o time_slice:%s -o queue:null -c 4000000 "
+                "-r 400000 -q %s" % (fname, flags))
+        self.assertEqual(r, 0)
+
+        f = open(fname, 'r')
+        self.assertIsNotNone(f)
+        results = f.read()
+        f.close()
+
+        return results
+
+    def read_log(self, offset):
+        # Lines appended to the log since it was offset bytes long
+        f = open("tuna.log", 'r')
+        self.assertIsNotNone(f)
+        f.seek(offset)
+        lines = f.read().splitlines()
+        f.close()
+        return lines
+
+    def assertApplied(self, report, log, applied, failed, warning):
+        # Each option is either reported as applied or reported as skipped
+        # along with the warning logged when it failed
+        if applied in report:
+            return
+        self.assertIn(failed, report)
+        self.assertTrue([l for l in log if warning in l], warning)
+
+    def test_realtime(self):
+        # The tests usually run without the privileges needed for real-time
+        # scheduling or locking memory, so the options must then be skipped
+        # without changing the results.
+        normal = self.run_time_slice("normal", "")
+
+        offset = os.path.getsize("tuna.log")
+        realtime = self.run_time_slice("realtime", "-X 10 -A 0,0 -L")
+        self.assertEqual(normal, realtime)
+
+        log = self.read_log(offset)
+        reports = [l for l in log if "tuna: Real-time setup: " in l]
+        self.assertEqual(len(reports), 1)
+        report = reports[0]
+
+        self.assertApplied(report, log, "SCHED_FIFO priority 10",
+                "normal scheduling (SCHED_FIFO ",
+                "rt: Failed to set SCHED_FIFO priority 10")
+        self.assertApplied(report, log, "producer on CPU 0",
+                "producer on any CPU (pinning failed)",
+                "rt: Failed to pin thread to CPU 0")
+        self.assertApplied(report, log, "memory locked",
+                "memory not locked (",
+                "rt: Failed to lock memory")
+        self.assertIn("2 of 2 queue threads pinned", report)
+
+        for l in log:
+            self.assertFalse(l.startswith("ERROR"), l)
+
+    def test_batch(self):
+        # The options apply to a single producer thread so they are rejected
+        # for batch processing rather than silently ignored.
+        fname = "input-tunaRealtimeTests.wav"
+        w = wave.open(fname, 'wb')
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(8000)
+        w.writeframes(bytes(16000))
+        w.close()
+
+        r = tuna.run("-b %s -o null" % fname)
+        self.assertEqual(r, 0)
+
+        for flags in ("-X 10", "-A 0", "-L"):
+            r = tuna.run("-b %s %s -o null" % (fname, flags))
+            self.assertNotEqual(r, 0)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
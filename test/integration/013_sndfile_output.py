@@ -0,0 +1,87 @@
+#! /usr/bin/env python
+################################################################################
+#   013_sndfile_output.py: Test queued sndfile output against direct output
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+from tuna_test import *
+import unittest
+import tuna
+
+import glob
+import math
+import os
+import struct
+import wave
+
+class tunaSndfileOutputTests(tunaTestCase):
+    in_name = "input-tunaSndfileOutputTests.wav"
+
+    def setUp(self):
+        super(tunaSndfileOutputTests, self).setUp()
+
+        data = bytearray()
+        for i in range(80000):
+            x = math.sin(i * 0.01) * 0.7
+            data += struct.pack('<h', int(x * 32767))
+
+        w = wave.open(self.in_name, 'wb')
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(8000)
+        w.writeframes(bytes(data))
+        w.close()
+
+    def run_sndfile(self, name, flags):
+        prefix = "output-tunaSndfileOutputTests-%s-" % name
+        for fname in glob.glob(prefix + "*"):
+            os.remove(fname)
+
+        # A file left by an earlier run under the name of the file created
+        # in advance for the next part of the recording
+        kept = prefix + "003.wav"
+        f = open(kept, 'wb')
+        f.write(b"earlier run")
+        f.close()
+
+        # With a sample rate of 10, each output file is limited to 36000
+        # samples so the input is split over three files
+        r = tuna.run("-i sndfile:%s -o sndfile:%s -r 10 %s" %
+                (self.in_name, prefix, flags))
+        self.assertEqual(r, 0)
+
+        # The file created in advance must be removed when it isn't used,
+        # leaving the earlier file alone
+        names = sorted(glob.glob(prefix + "*"))
+        self.assertEqual(names, [prefix + "%03d.wav" % i for i in range(4)])
+
+        f = open(kept, 'rb')
+        self.assertEqual(f.read(), b"earlier run")
+        f.close()
+
+        frames = []
+        for fname in names[:3]:
+            w = wave.open(fname, 'rb')
+            frames.append(w.readframes(w.getnframes()))
+            w.close()
+
+        self.assertEqual([len(f) // 2 for f in frames], [36000, 36000, 8000])
+        return frames
+
+    def test_queue(self):
+        expected = self.run_sndfile("direct", "")
+        results = self.run_sndfile("queued", "-Q 2")
+        self.assertEqual(expected, results)
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
@@ -22,7 +22,18 @@ d := test/integration
 
 tests := $(d)/000_run.py \
 	$(d)/001_zero_to_null.py \
-	$(d)/002_zero_to_time_slice.py
+	$(d)/002_zero_to_time_slice.py \
+	$(d)/003_zero_to_bufq.py \
+	$(d)/004_sndfile_to_analysis.py \
+	$(d)/005_zero_to_tee.py \
+	$(d)/006_zero_to_time_slice_jobs.py \
+	$(d)/007_wavmap.py \
+	$(d)/008_batch.py \
+	$(d)/009_sequence.py \
+	$(d)/010_all_channels.py \
+	$(d)/011_alsa_null.py \
+	$(d)/012_realtime.py \
+	$(d)/013_sndfile_output.py
 
 run_tests := $(tests:$(d)/%.py=run-i%.py)
 
@@ -45,5 +45,38 @@ class tunaBufferTests(tunaTestCase):
         libtuna.log_exit()
         os.unlink(logpath)
 
+    def test_buffer_stats(self):
+        (h, logpath) = tempfile.mkstemp()
+        self.assertSuccess(libtuna.log_init(logpath, __file__))
+        os.close(h)
+
+        before = libtuna.buffer_stats()
+        libtuna.buffer_get_stats(before)
+
+        # Acquire and release a buffer, it should then be recycled by the next
+        # acquire of the same size
+        frames_in = 1000
+        ptr, frames_out = libtuna.buffer_acquire(frames_in)
+        self.assertIsNotNone(ptr)
+
+        during = libtuna.buffer_stats()
+        libtuna.buffer_get_stats(during)
+        self.assertEqual(during.in_use, before.in_use + 1)
+        self.assertGreaterEqual(during.high_water, during.in_use)
+
+        self.assertEqual(libtuna.buffer_release(ptr), 1)
+
+        ptr, frames_out = libtuna.buffer_acquire(frames_in)
+        self.assertIsNotNone(ptr)
+        self.assertEqual(libtuna.buffer_release(ptr), 1)
+
+        after = libtuna.buffer_stats()
+        libtuna.buffer_get_stats(after)
+        self.assertEqual(after.in_use, before.in_use)
+        self.assertGreaterEqual(after.hits, before.hits + 1)
+
+        libtuna.log_exit()
+        os.unlink(logpath)
+
 if __name__ == '__main__':
     unittest.main(testRunner=tunaTestRunner())
@@ -263,5 +263,66 @@ class tunaBufholdTests(tunaTestCase):
         self.assertEqual(libtuna.buffer_release(ptr_2), 1)
         self.assertNoErrors()
 
+    def test_bufhold_04_find_discard(self):
+        bh = libtuna.bufhold_init()
+        self.assertIsNotNone(bh)
+
+        # Hold enough buffers to make the queue grow past its initial size,
+        # each of a different length
+        ptrs = []
+        lengths = []
+        for i in range(40):
+            frames_in = 10 + i
+            ptr, frames_out = libtuna.buffer_acquire(frames_in)
+            self.assertIsNotNone(ptr)
+            self.assertSuccess(libtuna.bufhold_add(bh, ptr, frames_in))
+            ptrs.append(ptr)
+            lengths.append(frames_in)
+        self.assertEqual(libtuna.bufhold_total(bh), sum(lengths))
+
+        # Every sample should be found in the right buffer at the right index
+        held = libtuna.bufhold_oldest(bh)
+        offset = 0
+        while held is not None:
+            count = libtuna.bufhold_count(held)
+            for i in (0, count // 2, count - 1):
+                h, index = libtuna.bufhold_find(bh, offset + i)
+                self.assertEqual(h, held)
+                self.assertEqual(index, i)
+            offset += count
+            held = libtuna.bufhold_next(held)
+
+        h, index = libtuna.bufhold_find(bh, sum(lengths))
+        self.assertIsNone(h)
+
+        # Discard part way into the fourth buffer
+        n = lengths[0] + lengths[1] + lengths[2] + 5
+        self.assertEqual(libtuna.bufhold_discard(bh, n), sum(lengths) - n)
+        self.assertEqual(libtuna.bufhold_total(bh), sum(lengths) - n)
+        held = libtuna.bufhold_oldest(bh)
+        self.assertEqual(libtuna.bufhold_count(held), lengths[3] - 5)
+        for ptr in ptrs[:3]:
+            self.assertEqual(libtuna.buffer_refcount(ptr), 1)
+
+        # Releasing a buffer from the middle leaves the remaining samples
+        # contiguous
+        middle = libtuna.bufhold_next(libtuna.bufhold_next(held))
+        libtuna.bufhold_release(middle)
+        h, index = libtuna.bufhold_find(bh, lengths[3] - 5 + lengths[4])
+        self.assertEqual(h, libtuna.bufhold_next(libtuna.bufhold_next(held)))
+        self.assertEqual(index, 0)
+        self.assertEqual(libtuna.bufhold_total(bh),
+                         sum(lengths) - n - lengths[5])
+
+        # Discarding everything empties the queue
+        self.assertEqual(libtuna.bufhold_discard(bh, sum(lengths)), 0)
+        self.assertIsNone(libtuna.bufhold_oldest(bh))
+        self.assertEqual(libtuna.bufhold_total(bh), 0)
+
+        libtuna.bufhold_exit(bh)
+        for ptr in ptrs:
+            self.assertEqual(libtuna.buffer_release(ptr), 1)
+        self.assertNoErrors()
+
 if __name__ == '__main__':
     unittest.main(testRunner=tunaTestRunner())
@@ -176,5 +176,35 @@ class tunaTOLTests(tunaTestCase):
         libtuna.tol_exit(tol)
         self.assertNoErrors()
 
+    def test_tol_05_simd_levels(self):
+        # Each SIMD level supported by this machine must agree with the scalar
+        # code to within the tolerance documented for tol_calculate()
+        sample_rate = 400000
+        analysis_length = sample_rate
+
+        np.random.seed(0)
+        w = np.random.uniform(-1, 1, [analysis_length,]).astype(np.float32)
+
+        all_results = []
+        for level in range(libtuna.simd_detect() + 1):
+            self.assertSuccess(libtuna.simd_set_level(level))
+
+            tol = libtuna.tol_init(sample_rate, analysis_length, 0.4, 3)
+            self.assertIsNotNone(tol)
+
+            n_tol = libtuna.tol_get_num_levels(tol)
+            results = np.zeros([n_tol + 1,], dtype=np.float32)
+            libtuna.tol_calculate(tol, w, results)
+            all_results.append(results)
+
+            libtuna.tol_exit(tol)
+
+        self.assertSuccess(libtuna.simd_set_level(libtuna.simd_detect()))
+
+        for results in all_results[1:]:
+            self.assertTrue(np.allclose(results, all_results[0], rtol=1e-4, atol=0))
+
+        self.assertNoErrors()
+
 if __name__ == '__main__':
     unittest.main(testRunner=tunaTestRunner())
@@ -103,5 +103,35 @@ class tunaEnvEstimateTests(tunaTestCase):
         libtuna.env_estimate_exit(env)
         self.assertNoErrors()
 
+    def test_04_block(self):
+        # Each SIMD level supported by this machine must give the same envelope
+        # from env_estimate_block() as env_estimate_next() gives sample by
+        # sample, to within the documented tolerance
+        n = 1000
+        np.random.seed(0)
+        x = np.random.randint(-10000, 10000, [n,]).astype(np.int32)
+        x[::100] *= 100
+
+        env = libtuna.env_estimate_init(self.Tc, self.sample_rate)
+        self.assertIsNotNone(env)
+        expected = np.array([libtuna.env_estimate_next(env, int(v)) for v in x],
+                dtype=np.float32)
+        libtuna.env_estimate_exit(env)
+
+        for level in range(libtuna.simd_detect() + 1):
+            self.assertSuccess(libtuna.simd_set_level(level))
+
+            env = libtuna.env_estimate_init(self.Tc, self.sample_rate)
+            self.assertIsNotNone(env)
+
+            out = np.zeros([n,], dtype=np.float32)
+            libtuna.env_estimate_block(env, x, out)
+            self.assertTrue(np.allclose(out, expected, rtol=1e-5, atol=0))
+
+            libtuna.env_estimate_exit(env)
+
+        self.assertSuccess(libtuna.simd_set_level(libtuna.simd_detect()))
+        self.assertNoErrors()
+
 if __name__ == '__main__':
     unittest.main(testRunner=tunaTestRunner())
@@ -143,5 +143,44 @@ class tunaMinimaTests(tunaTestCase):
         libtuna.onset_threshold_exit(onset)
         self.assertNoErrors()
 
+    def test_04_scan(self):
+        # Scanning a block must find the same crossings as feeding samples one
+        # at a time, with exactly the same thresholds and ages
+        Tw = 0.05
+        sample_rate = 1000
+        ratio = 2
+        siglen = 2000
+
+        np.random.seed(0)
+        signal = np.random.randint(1, 8, [siglen,]).astype(np.float32)
+        signal[np.random.randint(0, siglen, [20,])] = 100
+
+        onset = libtuna.onset_threshold_init(Tw, sample_rate, ratio)
+        self.assertIsNotNone(onset)
+        expected = []
+        threshold = 0
+        for i in range(siglen):
+            threshold = libtuna.onset_threshold_next(onset, signal[i], threshold)
+            if signal[i] > threshold:
+                expected.append((i, threshold, libtuna.onset_threshold_age(onset)))
+        libtuna.onset_threshold_exit(onset)
+
+        onset = libtuna.onset_threshold_init(Tw, sample_rate, ratio)
+        self.assertIsNotNone(onset)
+        found = []
+        threshold = 0
+        start = 0
+        while start < siglen:
+            i, threshold = libtuna.onset_threshold_scan(onset, signal[start:], threshold)
+            if start + i == siglen:
+                break
+            found.append((start + i, threshold, libtuna.onset_threshold_age(onset)))
+            start += i + 1
+        libtuna.onset_threshold_exit(onset)
+
+        self.assertTrue(len(expected) > 0)
+        self.assertEqual(found, expected)
+        self.assertNoErrors()
+
 if __name__ == '__main__':
     unittest.main(testRunner=tunaTestRunner())
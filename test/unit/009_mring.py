@@ -0,0 +1,111 @@
+#! /usr/bin/env python
+################################################################################
+#   009_mring.py: Tests for the mirrored ring buffer
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+
+from tuna_test import *
+import unittest
+import libtuna
+import numpy as np
+
+import tempfile
+import os
+
+class tunaMringTests(tunaTestCase):
+    def setUpLogging(self):
+        h, self.log_path = tempfile.mkstemp()
+        self.assertSuccess(libtuna.log_init(self.log_path, __file__))
+        self.log_f = os.fdopen(h)
+
+    def tearDownLogging(self):
+        if hasattr(self, 'log_f'):
+            libtuna.log_exit()
+            self.log_f.close()
+            os.unlink(self.log_path)
+
+    def assertNoErrors(self):
+        if hasattr(self, 'log_f'):
+            libtuna.log_sync()
+            self.log_f.seek(0)
+            for line in self.log_f:
+                self.assertNotIn('ERROR', line)
+                self.assertNotIn('FATAL', line)
+
+    def setUp(self):
+        self.setUpLogging()
+
+    def tearDown(self):
+        self.tearDownLogging()
+
+    def test_00_init(self):
+        r = libtuna.mring_init(1000)
+        self.assertIsNotNone(r)
+
+        # Capacity is rounded up to whole pages
+        self.assertGreaterEqual(libtuna.mring_capacity(r), 1000)
+        self.assertEqual(libtuna.mring_count(r), 0)
+        self.assertEqual(libtuna.mring_space(r), libtuna.mring_capacity(r))
+
+        libtuna.mring_exit(r)
+        self.assertNoErrors()
+
+    def test_01_write(self):
+        r = libtuna.mring_init(1000)
+        self.assertIsNotNone(r)
+        capacity = libtuna.mring_capacity(r)
+
+        x = np.arange(100, dtype=np.int32)
+        self.assertSuccess(libtuna.mring_write(r, x))
+        self.assertEqual(libtuna.mring_count(r), 100)
+        self.assertEqual(libtuna.mring_space(r), capacity - 100)
+        self.assertTrue(np.array_equal(libtuna.mring_data(r), x))
+
+        # Writing more than the free space must fail without changing the
+        # contents of the ring
+        y = np.zeros(capacity, dtype=np.int32)
+        self.assertLess(libtuna.mring_write(r, y), 0)
+        self.assertTrue(np.array_equal(libtuna.mring_data(r), x))
+
+        libtuna.mring_clear(r)
+        self.assertEqual(libtuna.mring_count(r), 0)
+
+        libtuna.mring_exit(r)
+
+    def test_02_wrap(self):
+        r = libtuna.mring_init(1000)
+        self.assertIsNotNone(r)
+        capacity = libtuna.mring_capacity(r)
+
+        # Step through the ring in blocks which don't divide its capacity so
+        # that the held data wraps around the end at many different points,
+        # checking that it is always presented contiguously and in order.
+        block = 300
+        held = np.zeros(0, dtype=np.int32)
+        for i in range(3 * capacity // block):
+            x = np.arange(i * block, (i + 1) * block, dtype=np.int32)
+            self.assertSuccess(libtuna.mring_write(r, x))
+            held = np.concatenate((held, x))
+            self.assertTrue(np.array_equal(libtuna.mring_data(r), held))
+
+            if libtuna.mring_space(r) < block:
+                libtuna.mring_advance(r, 2 * block)
+                held = held[2 * block:]
+                self.assertTrue(np.array_equal(libtuna.mring_data(r), held))
+
+        libtuna.mring_exit(r)
+        self.assertNoErrors()
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
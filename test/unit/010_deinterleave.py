@@ -0,0 +1,79 @@
+#! /usr/bin/env python
+################################################################################
+#   010_deinterleave.py: Tests for splitting interleaved samples
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+
+from tuna_test import *
+import unittest
+import libtuna
+import numpy as np
+
+import tempfile
+import os
+
+class tunaDeinterleaveTests(tunaTestCase):
+    def setUpLogging(self):
+        h, self.log_path = tempfile.mkstemp()
+        self.assertSuccess(libtuna.log_init(self.log_path, __file__))
+        self.log_f = os.fdopen(h)
+
+    def tearDownLogging(self):
+        if hasattr(self, 'log_f'):
+            libtuna.log_exit()
+            self.log_f.close()
+            os.unlink(self.log_path)
+
+    def assertNoErrors(self):
+        if hasattr(self, 'log_f'):
+            libtuna.log_sync()
+            self.log_f.seek(0)
+            for line in self.log_f:
+                self.assertNotIn('ERROR', line)
+                self.assertNotIn('FATAL', line)
+
+    def setUp(self):
+        self.setUpLogging()
+
+    def tearDown(self):
+        self.tearDownLogging()
+
+    def test_00_channels(self):
+        # Every SIMD level supported by this machine must give exactly the same
+        # result as numpy, for channel counts hitting each kernel and frame
+        # counts which leave a scalar tail
+        rng = np.random.RandomState(20)
+        for level in range(libtuna.simd_detect() + 1):
+            self.assertSuccess(libtuna.simd_set_level(level))
+
+            for channels in range(1, 17):
+                for frames in (1, 7, 8, 1001):
+                    x = rng.randint(-2**31, 2**31 - 1, channels * frames)
+                    x = x.astype(np.int32)
+                    y = np.zeros((channels, frames), dtype=np.int32)
+
+                    self.assertSuccess(libtuna.deinterleave(y, x))
+                    expected = x.reshape(frames, channels).T
+                    self.assertTrue(np.array_equal(y, expected))
+
+        self.assertSuccess(libtuna.simd_set_level(libtuna.simd_detect()))
+        self.assertNoErrors()
+
+    def test_01_bad_length(self):
+        x = np.zeros(10, dtype=np.int32)
+        y = np.zeros((3, 3), dtype=np.int32)
+        self.assertFailure(libtuna.deinterleave(y, x))
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
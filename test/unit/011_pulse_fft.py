@@ -0,0 +1,196 @@
+#! /usr/bin/env python
+################################################################################
+#   011_pulse_fft.py: Tests for the FFT lengths used for pulse third octave
+#   levels
+#
+#   Copyright (C) 2014 Paul Barker
+#
+#   This program is free software; you can redistribute it and/or modify it
+#   under the terms of the GNU General Public License as published by the
+#   Free Software Foundation; either version 2, or (at your option) any
+#   later version.
+#
+#   This program is distributed in the hope that it will be useful, but
+#   WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   General Public License for more details.
+################################################################################
+from tuna_test import *
+import unittest
+import libtuna
+import numpy as np
+
+import tempfile
+import os
+import re
+
+class tunaPulseFFTTests(tunaTestCase):
+    def setUpLogging(self):
+        h, self.log_path = tempfile.mkstemp()
+        self.assertSuccess(libtuna.log_init(self.log_path, __file__))
+        self.log_f = os.fdopen(h)
+
+    def tearDownLogging(self):
+        if hasattr(self, 'log_f'):
+            libtuna.log_exit()
+            self.log_f.close()
+            os.unlink(self.log_path)
+
+    def assertNoErrors(self):
+        if hasattr(self, 'log_f'):
+            libtuna.log_sync()
+            self.log_f.seek(0)
+            for line in self.log_f:
+                self.assertNotIn('ERROR', line)
+                self.assertNotIn('FATAL', line)
+
+    def setUp(self):
+        self.setUpLogging()
+
+        h, self.out_path = tempfile.mkstemp()
+        os.close(h)
+
+        # A 1 s maximum pulse duration at 48 kHz gives a 32768 point FFT in
+        # pulse_start(). Pulses of up to 2048 samples use a shorter FFT.
+        self.sample_rate = 48000
+        self.full_length = 32768
+        self.max_short = 2048
+
+    def tearDown(self):
+        os.unlink(self.out_path)
+        self.tearDownLogging()
+
+    def burst(self, length):
+        # Half a second of silence, then a burst of positive noise of the
+        # given length followed by silence up to one second. Being positive,
+        # the noise has plenty of energy in the lowest bands.
+        np.random.seed(0)
+        x = np.zeros([self.sample_rate,], dtype=np.int32)
+        start = self.sample_rate // 2
+        x[start:start + length] = np.random.uniform(0, 1000000,
+                [length,])
+        return x
+
+    def run_pulse(self, x):
+        # Pass the signal through the pulse consumer in blocks and return the
+        # onset, duration and third octave levels of each pulse found
+        params = libtuna.pulse_params()
+        params.Tw = 0.01
+        params.Tc = 0.001
+        params.pulse_max_duration = 1.0
+        params.threshold_ratio = 3.16
+        params.decay_threshold_ratio = 0.316
+        params.out_mode = libtuna.TUNA_OUT_MODE_CSV
+
+        c = libtuna.consumer_new()
+        self.assertIsNotNone(c)
+        self.assertSuccess(libtuna.pulse_init(c, self.out_path, params))
+        self.assertSuccess(libtuna.consumer_start(c, self.sample_rate))
+        for i in range(0, len(x), 4096):
+            self.assertSuccess(libtuna.consumer_write(c, x[i:i + 4096]))
+        libtuna.consumer_exit(c)
+
+        pulses = []
+        f = open(self.out_path, 'r')
+        for line in f:
+            if line.startswith('START'):
+                continue
+            fields = [float(v) for v in line.split(',') if v.strip()]
+            pulses.append((int(fields[0]), int(fields[1]),
+                np.array(fields[8:])))
+        f.close()
+
+        # Without ENABLE_PULSE_TOL each pulse only has its energy
+        if len(pulses) and len(pulses[0][2]) == 1:
+            self.skipTest("pulse third octave levels not enabled")
+
+        return pulses
+
+    def fft_lengths(self):
+        # Number of pulses analysed with each FFT length, as logged by
+        # pulse_exit()
+        libtuna.log_sync()
+        self.log_f.seek(0)
+        lengths = {}
+        for line in self.log_f:
+            m = re.search(r'pulse: (\d+) pulses analysed with (\d+) point FFTs',
+                    line)
+            if m:
+                lengths[int(m.group(2))] = int(m.group(1))
+
+        return lengths
+
+    def expected_length(self, duration):
+        # The shortest power of two of at least twice the duration and at
+        # least 256, or the full length for long pulses
+        if duration > self.max_short:
+            return self.full_length
+
+        length = 256
+        while length < 2 * duration:
+            length *= 2
+        return length
+
+    def levels(self, pulse):
+        # Pad the pulse to the full length and find its third octave levels
+        tol = libtuna.tol_init(self.sample_rate, self.full_length, 0.4, 3)
+        self.assertIsNotNone(tol)
+
+        n_tol = libtuna.tol_get_num_levels(tol)
+        spectrum = np.fft.rfft(pulse.astype(np.float64),
+                self.full_length).astype(np.complex64)
+        results = np.zeros([n_tol + 1,], dtype=np.float32)
+        libtuna.tol_calculate(tol, spectrum.view(np.float32), results)
+
+        libtuna.tol_exit(tol)
+        return results[:n_tol]
+
+    def check_pulses(self, x, pulses):
+        # Every pulse must give the levels found by padding to the full length
+        # and be counted against the FFT length expected for its duration
+        expected_lengths = {}
+        for onset, duration, levels in pulses:
+            length = self.expected_length(duration)
+            expected_lengths[length] = expected_lengths.get(length, 0) + 1
+
+            expected = self.levels(x[onset:onset + duration])
+            self.assertEqual(len(levels), len(expected))
+
+            total = sum(expected)
+            for i in range(len(expected)):
+                if expected[i] < 1e-6 * total:
+                    continue
+
+                self.assertAlmostEqual(levels[i] / expected[i], 1.0,
+                        places=3, msg="band %d" % i)
+
+        self.assertEqual(self.fft_lengths(), expected_lengths)
+
+    def test_00_short_pulse(self):
+        # A 200 sample burst is analysed with a short FFT, including the
+        # lowest bands which span under two bins of the full length FFT
+        x = self.burst(200)
+        pulses = self.run_pulse(x)
+        self.assertGreater(len(pulses), 0)
+
+        onset, duration, levels = pulses[0]
+        self.assertLessEqual(duration, self.max_short)
+        expected = self.levels(x[onset:onset + duration])
+        self.assertGreater(expected[0], 1e-6 * sum(expected))
+
+        self.check_pulses(x, pulses)
+        self.assertNotIn(self.full_length, self.fft_lengths())
+        self.assertNoErrors()
+
+    def test_01_long_pulse(self):
+        # A 0.2 s burst is too long for the short FFTs
+        x = self.burst(self.sample_rate // 5)
+        pulses = self.run_pulse(x)
+        self.assertGreater(len(pulses), 0)
+
+        self.check_pulses(x, pulses)
+        self.assertEqual(list(self.fft_lengths().keys()), [self.full_length])
+        self.assertNoErrors()
+
+if __name__ == '__main__':
+    unittest.main(testRunner=tunaTestRunner())
@@ -28,7 +28,10 @@ tests := $(d)/000_import.py \
 	$(d)/005_window.py \
 	$(d)/006_fft.py \
 	$(d)/007_env_estimate.py \
-	$(d)/008_onset_threshold.py
+	$(d)/008_onset_threshold.py \
+	$(d)/009_mring.py \
+	$(d)/010_deinterleave.py \
+	$(d)/011_pulse_fft.py
 
 run_tests := $(tests:$(d)/%.py=run-u%.py)
 